@@ -0,0 +1,124 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares the compression filters on synthetic 4D-STEM data (sparse
+//	counts around a bright central disk): time to save, file size and
+//	time to load. Filters whose plugin is missing fall back to deflate,
+//	which the report shows as the filter the file ended up with.
+//	Usage: bench_compression [output directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "Dataset.h"
+
+using namespace emd;
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char *compressionName(Dataset::Compression compression)
+{
+	switch(compression)
+	{
+	case Dataset::CompressionDeflate:
+		return "deflate";
+	case Dataset::CompressionBitshuffleLZ4:
+		return "bitshuffle/lz4";
+	case Dataset::CompressionZstd:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	QString directory = (argc > 1) ? QString(argv[1]) : QString("/tmp");
+	const int dims[4] = {32, 32, 128, 128};
+	const int64_t values = (int64_t) dims[0] * dims[1] * dims[2] * dims[3];
+	const int64_t bytes = values * sizeof(uint16_t);
+
+	uint16_t *data = (uint16_t*) allocateBuffer(bytes);
+	uint32_t random = 12345;
+	for(int64_t iii = 0; iii < values; ++iii)
+	{
+		int64_t pixel = iii % (dims[2] * dims[3]);
+		int row = pixel / dims[3] - dims[2] / 2;
+		int column = pixel % dims[3] - dims[3] / 2;
+		random = random * 1664525u + 1013904223u;
+		bool disk = row * row + column * column < 400;
+		data[iii] = disk ? (uint16_t) (200 + (random >> 24)) 
+			: (uint16_t) ((random >> 29) == 0 ? (random >> 26) & 3 : 0);
+	}
+	Dataset source(4, dims, DataTypeUInt16, (char*) data, AllocatedBuffer);
+	source.setName("data");
+
+	printf("%d x %d x %d x %d UInt16, %.1f MB\n", dims[0], dims[1], dims[2], 
+		dims[3], bytes / 1e6);
+	printf("%-16s %-16s %10s %10s %10s %10s\n", "requested", "written", 
+		"MB", "ratio", "save MB/s", "load MB/s");
+
+	const Dataset::Compression compressions[4] = {Dataset::CompressionNone, 
+		Dataset::CompressionDeflate, Dataset::CompressionBitshuffleLZ4, 
+		Dataset::CompressionZstd};
+	for(Dataset::Compression compression : compressions)
+	{
+		QByteArray path = (directory + QString("/bench_compression_%1.emd")
+			.arg((int) compression)).toLocal8Bit();
+		source.setCompression(compression);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		hsize_t fileSize;
+		{
+			H5::H5File file(path.constData(), H5F_ACC_TRUNC);
+			source.save(QString(""), &file);
+			file.flush(H5F_SCOPE_GLOBAL);
+			fileSize = file.getFileSize();
+		}
+		double saveTime = secondsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		Dataset loaded;
+		{
+			H5::H5File file(path.constData(), H5F_ACC_RDONLY);
+			loaded.loadData(file.openDataSet("data"));
+		}
+		double loadTime = secondsSince(start);
+
+		bool same = loaded.isLoaded() && loaded.memoryFootprint() == bytes 
+			&& memcmp(loaded.rawData(), data, bytes) == 0;
+		printf("%-16s %-16s %10.2f %10.2f %10.1f %10.1f%s\n", 
+			compressionName(compression), compressionName(loaded.compression()), 
+			fileSize / 1e6, (double) bytes / fileSize, bytes / 1e6 / saveTime, 
+			bytes / 1e6 / loadTime, same ? "" : "  (data differs)");
+	}
+
+	return 0;
+}
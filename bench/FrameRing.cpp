@@ -0,0 +1,146 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Frame rate through a FrameRing, from a producer thread to a consumer
+//	thread, against the 10k frames/s of a fast detector: the ring alone
+//	for each layout push accepts, then the ring drained by a FrameWriter
+//	into a file. The producer waits while the ring is full, so no frame
+//	is dropped and the rate is what the consumer sustains.
+//	Usage: bench_framering [output directory]
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <QString>
+
+#include "FrameRing.h"
+#include "FrameWriter.h"
+
+using namespace emd;
+
+const int ROWS = 256;
+const int COLUMNS = 256;
+const int FRAMES = 20000;
+const int SLOTS = 256;
+const double TARGET = 10000;
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void produce(FrameRing &ring, const Frame::Data<void> *frame, 
+	const uint16_t *packed)
+{
+	for(int iii = 0; iii < FRAMES; ++iii)
+	{
+		while(!(frame ? ring.push(*frame) : ring.push(packed)))
+			std::this_thread::yield();
+	}
+}
+
+static void report(const char *name, double seconds)
+{
+	double rate = FRAMES / seconds;
+	printf("%-28s %10.0f %10.1f %8s\n", name, rate, 
+		rate * ROWS * COLUMNS * sizeof(uint16_t) / 1e6, rate >= TARGET ? "yes" : "no");
+}
+
+// The consumer only takes the frames
+static double ringRate(const Frame::Data<void> *frame, const uint16_t *packed)
+{
+	FrameRing ring(ROWS, COLUMNS, DataTypeUInt16, SLOTS);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread producer(produce, std::ref(ring), frame, packed);
+	int64_t taken = 0;
+	while(taken < FRAMES)
+	{
+		int64_t count;
+		if(ring.readable(count))
+		{
+			ring.release(count);
+			taken += count;
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	return secondsSince(start);
+}
+
+static double writerRate(const QString &path, const uint16_t *packed)
+{
+	FrameRing ring(ROWS, COLUMNS, DataTypeUInt16, SLOTS);
+	FrameWriter writer;
+	if(!writer.open(path, QString("/data/bench"), ROWS, COLUMNS, DataTypeUInt16))
+		return -1;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread producer(produce, std::ref(ring), (const Frame::Data<void>*) 0, packed);
+	int64_t taken = 0;
+	while(taken < FRAMES)
+	{
+		int64_t count = writer.append(ring);
+		if(count < 0)
+			break;
+		if(count == 0)
+			std::this_thread::yield();
+		taken += count;
+	}
+	producer.join();
+	bool closed = writer.close();
+	double seconds = secondsSince(start);
+	return (closed && taken == FRAMES) ? seconds : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	QString directory = (argc > 1) ? QString(argv[1]) : QString("/tmp");
+	std::vector<uint16_t> packed(ROWS * COLUMNS);
+	for(int iii = 0; iii < ROWS * COLUMNS; ++iii)
+		packed[iii] = (uint16_t) iii;
+	std::vector<uint16_t> padded(ROWS * (COLUMNS + 16));
+	std::vector<uint16_t> transposed(ROWS * COLUMNS);
+
+	Frame::Data<void> paddedFrame(0, COLUMNS + 16, 1, ROWS, COLUMNS, padded.data(), 0);
+	Frame::Data<void> transposedFrame(0, 1, ROWS, ROWS, COLUMNS, transposed.data(), 0);
+
+	printf("%d frames of %d x %d UInt16, %u hardware threads\n", FRAMES, ROWS, 
+		COLUMNS, std::thread::hardware_concurrency());
+	printf("%-28s %10s %10s %8s\n", "path", "frames/s", "MB/s", "10k/s");
+	report("ring, packed", ringRate(0, packed.data()));
+	report("ring, padded rows", ringRate(&paddedFrame, 0));
+	report("ring, horizontal fastest", ringRate(&transposedFrame, 0));
+
+	double seconds = writerRate(directory + QString("/bench_framering.emd"), 
+		packed.data());
+	if(seconds > 0)
+		report("ring to FrameWriter", seconds);
+	else
+		printf("%-28s failed\n", "ring to FrameWriter");
+
+	return 0;
+}
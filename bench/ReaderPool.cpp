@@ -0,0 +1,146 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Read rate of a deflate compressed dataset through a ReaderPool against
+//	the number of helper processes, and in this process for reference.
+//	Every pool is started before anything is read, as the helpers are
+//	forked (see ReaderPool::start).
+//	Usage: bench_readerpool [output directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Dataset.h"
+#include "Parallel.h"
+#include "ReaderPool.h"
+
+using namespace emd;
+
+const hsize_t FRAMES = 64;
+const hsize_t ROWS = 512;
+const hsize_t COLUMNS = 512;
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Sparse counts around a bright disk, a chunk per frame
+static void writeFile(const QByteArray &path)
+{
+	std::vector<uint16_t> frames(FRAMES * ROWS * COLUMNS);
+	uint32_t random = 12345;
+	for(size_t iii = 0; iii < frames.size(); ++iii)
+	{
+		int64_t pixel = iii % (ROWS * COLUMNS);
+		int row = (int) (pixel / COLUMNS) - (int) ROWS / 2;
+		int column = (int) (pixel % COLUMNS) - (int) COLUMNS / 2;
+		random = random * 1664525u + 1013904223u;
+		bool disk = row * row + column * column < 1600;
+		frames[iii] = disk ? (uint16_t) (200 + (random >> 24)) 
+			: (uint16_t) ((random >> 29) == 0 ? (random >> 26) & 3 : 0);
+	}
+
+	H5::H5File file(path.constData(), H5F_ACC_TRUNC);
+	hsize_t dims[3] = {FRAMES, ROWS, COLUMNS};
+	hsize_t chunk[3] = {1, ROWS, COLUMNS};
+	H5::DSetCreatPropList plist;
+	plist.setChunk(3, chunk);
+	plist.setDeflate(4);
+	H5::DataSpace space(3, dims);
+	file.createDataSet("data", H5::PredType::NATIVE_UINT16, space, plist)
+		.write(frames.data(), H5::PredType::NATIVE_UINT16);
+}
+
+// Seconds to read the whole dataset, or a negative value on failure
+static double timeRead(ReaderPool &pool, uint16_t *destination)
+{
+	Dataset::Selection selection(3);
+	selection[0].start = 0;
+	selection[0].end = (int) FRAMES;
+	selection[1].start = 0;
+	selection[1].end = (int) ROWS;
+	selection[2].start = 0;
+	selection[2].end = (int) COLUMNS;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(!pool.read(QString("/data"), selection, destination))
+		return -1;
+	return secondsSince(start);
+}
+
+int main(int argc, char *argv[])
+{
+	QString directory = (argc > 1) ? QString(argv[1]) : QString("/tmp");
+	QString filePath = directory + QString("/bench_readerpool.emd");
+	writeFile(filePath.toLocal8Bit());
+
+	std::vector<int> counts;
+	for(int count = 1; count < threadCount(); count *= 2)
+		counts.push_back(count);
+	counts.push_back(threadCount());
+
+	std::vector<std::unique_ptr<ReaderPool> > pools;
+	for(int count : counts)
+	{
+		pools.push_back(std::unique_ptr<ReaderPool>(new ReaderPool(filePath, count)));
+		if(!pools.back()->start())
+			return 1;
+	}
+
+	const int64_t bytes = FRAMES * ROWS * COLUMNS * sizeof(uint16_t);
+	std::vector<uint16_t> reference(FRAMES * ROWS * COLUMNS);
+	std::vector<uint16_t> values(FRAMES * ROWS * COLUMNS);
+	ReaderPool here(filePath);
+	double hereTime = timeRead(here, reference.data());
+	if(hereTime < 0)
+		return 1;
+
+	printf("%llu x %llu x %llu UInt16, deflate, %.1f MB\n", 
+		(unsigned long long) FRAMES, (unsigned long long) ROWS, 
+		(unsigned long long) COLUMNS, bytes / 1e6);
+	printf("%-12s %10s %10s\n", "processes", "MB/s", "speedup");
+	printf("%-12s %10.1f %10.2f\n", "in process", bytes / 1e6 / hereTime, 1.0);
+	for(size_t iii = 0; iii < pools.size(); ++iii)
+	{
+		double seconds = timeRead(*pools[iii], values.data());
+		if(seconds < 0)
+		{
+			printf("%-12d %10s\n", pools[iii]->processCount(), "failed");
+			continue;
+		}
+
+		bool same = memcmp(values.data(), reference.data(), bytes) == 0;
+		printf("%-12d %10.1f %10.2f%s\n", pools[iii]->processCount(), 
+			bytes / 1e6 / seconds, hereTime / seconds, same ? "" : "  (data differs)");
+	}
+
+	pools.clear();
+	remove(filePath.toLocal8Bit().constData());
+	return 0;
+}
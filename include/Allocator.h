@@ -0,0 +1,69 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_ALLOCATOR_H
+#define EMD_ALLOCATOR_H
+
+#include "EmdLib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emd
+{
+
+// Data buffers of Datasets and owning Frames. Every buffer is 64 byte
+//	aligned. Blocks up to 8MB are rounded up to one of four size classes
+//	per power of two and pooled when freed, so frames created and 
+//	destroyed while scrubbing reuse memory instead of going back to the
+//	system; larger blocks are allocated as requested, and those at or above
+//	the huge page threshold are mapped with transparent huge pages where
+//	the platform has them. Throws std::bad_alloc like new.
+EMDLIB_API void *allocateBuffer(size_t size);
+EMDLIB_API void freeBuffer(void *buffer);
+
+// Selects the Dataset and Frame constructors that take ownership of a
+//	buffer from allocateBuffer; the others take buffers from new[].
+struct AllocatedBufferTag {};
+static const AllocatedBufferTag AllocatedBuffer = AllocatedBufferTag();
+
+struct AllocatorStatistics
+{
+	int64_t allocations;
+	int64_t frees;
+	int64_t poolHits;			// allocations served from the pool
+	int64_t bytesInUse;			// as requested, without the rounding
+	int64_t peakBytesInUse;
+	int64_t bytesPooled;		// freed blocks kept for reuse
+	int64_t hugePageBytes;		// in use, in huge page mappings
+};
+
+EMDLIB_API AllocatorStatistics allocatorStatistics();
+
+// Defaults to 1GB; 0 disables huge pages
+EMDLIB_API void setHugePageThreshold(size_t bytes);
+// Upper limit of bytesPooled (defaults to 256MB)
+EMDLIB_API void setBufferPoolLimit(size_t bytes);
+// Returns all pooled blocks to the system
+EMDLIB_API void trimBufferPool();
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_ASYNCLOAD_H
+#define EMD_ASYNCLOAD_H
+
+#include "EmdLib.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+#include <QString>
+
+#include "Dataset.h"
+
+namespace emd
+{
+
+class DataGroup;
+
+enum LoadError
+{
+	LoadErrorNone = 0,
+	LoadErrorCancelled,
+	LoadErrorInvalidGroup,
+	LoadErrorFile,
+	LoadErrorDataSet,
+	LoadErrorDataSpace,
+	LoadErrorAttribute,
+	LoadErrorFilter,		// compression filter plugin not found
+	LoadErrorMemory,
+	LoadErrorDirty,			// loaded data has unsaved changes
+	LoadErrorUnknown
+};
+
+// Runs job on the I/O thread after the jobs already queued, or ahead of
+//	them if urgent. Jobs still queued when the library shuts down are
+//	called with run false instead.
+typedef std::function<void(bool run)> IoJob;
+EMDLIB_API void queueIoJob(const IoJob &job, bool urgent = false);
+
+// HDF5 is not built thread safe, so every call into it is made holding
+//	this lock: the I/O thread holds it while it runs a job, and the 
+//	Model while it opens, saves, loads or refreshes. Code calling HDF5 
+//	directly (e.g. Dataset::read) from another thread must hold it too,
+//	and must not wait for the I/O thread while holding it.
+EMDLIB_API std::recursive_mutex &ioMutex();
+
+// Shared between a load and its observers. The reader adds to the byte
+//	counts as blocks are read, and stops before the next block once
+//	cancelled is set, leaving the data unloaded. Failures the reader
+//	detects itself (rather than HDF5 exceptions) are recorded in error.
+struct EMDLIB_API LoadProgress
+{
+	std::atomic<int64_t> bytesRead;
+	std::atomic<int64_t> bytesTotal;
+	std::atomic<bool> cancelled;
+	std::atomic<int> error;
+
+	LoadProgress()
+		: bytesRead(0),
+		bytesTotal(0),
+		cancelled(false),
+		error(LoadErrorNone)
+	{}
+
+	bool isCancelled() const {return cancelled.load();}
+};
+
+// Handle to a load queued on the I/O thread. Copies refer to the same
+//	load. The DataGroup must not be used until the load has finished.
+//	Other file operations may run meanwhile; they take turns with the
+//	load's reads through ioMutex.
+class EMDLIB_API LoadHandle
+{
+public:
+	// Called on the I/O thread once the load has finished, failed or
+	//	been cancelled.
+	typedef std::function<void(const LoadHandle &handle)> Callback;
+
+	LoadHandle();
+
+	// Queues a (re)load of the group from the file. A null group gives
+	//	a handle that has already failed.
+	static LoadHandle load(DataGroup *group, const QString &filePath, 
+		const Dataset::LoadOptions &options = Dataset::LoadOptions(), 
+		const Callback &finished = Callback());
+
+	bool isValid() const {return m_state != 0;}
+	DataGroup *dataGroup() const;
+
+	bool isFinished() const;
+	void wait() const;
+	bool waitFor(int milliseconds) const;
+	// Stops the load between blocks; a load that has not started yet
+	//	is skipped.
+	void cancel();
+
+	bool succeeded() const;
+	LoadError error() const;
+	QString errorMessage() const;
+
+	int64_t bytesRead() const;
+	int64_t bytesTotal() const;
+	// Fraction of the bytes read, and the time left at the rate so far
+	//	(negative until there is a rate).
+	double progress() const;
+	double secondsRemaining() const;
+
+private:
+	struct State;
+	friend class IoThread;
+
+	LoadHandle(const std::shared_ptr<State> &state);
+
+	std::shared_ptr<State> m_state;
+};
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_CENTEROFMASS_H
+#define EMD_CENTEROFMASS_H
+
+#include "EmdLib.h"
+
+#include <vector>
+
+namespace H5
+{
+class H5File;
+}
+
+namespace emd
+{
+
+class DataGroup;
+class Dataset;
+
+// Computes the center of mass of every diffraction pattern (the two
+//	fastest varying dims) of a DataGroup, for differential phase contrast
+//	(DPC) imaging. The data is either the loaded data or streamed from the
+//	file.
+class EMDLIB_API CenterOfMass
+{
+public:
+	enum Component
+	{
+		ComponentRow,			// shift along the frame rows (y)
+		ComponentColumn,		// shift along the frame columns (x)
+		ComponentMagnitude,
+		ComponentAngle,			// radians, atan2(row, column)
+		ComponentIntensity		// total intensity used for the center
+	};
+
+	CenterOfMass(DataGroup *dataGroup);
+
+	int frameRows() const {return m_frameRows;}
+	int frameColumns() const {return m_frameColumns;}
+
+	// Weight per detector pixel in frame order (0 excludes a pixel).
+	bool setMask(const std::vector<float> &mask);
+	// Pixels with values below the threshold are treated as background.
+	//	Sparse data has no background, so the threshold is not used.
+	void setThreshold(float threshold) {m_threshold = threshold;}
+	// Centers are reported relative to this position (default: the
+	//	center of the frame).
+	void setOrigin(double row, double column);
+
+	bool run(H5::H5File *file = 0);
+
+	// Creates a float Dataset over the scan dims; the caller takes
+	//	ownership.
+	Dataset *createImage(Component component) const;
+
+private:
+	bool runSparse(H5::H5File *file);
+
+	DataGroup *m_dataGroup;
+	int m_frameRows;
+	int m_frameColumns;
+	std::vector<int> m_scanDims;
+	std::vector<float> m_mask;
+	float m_threshold;
+	double m_originRow;
+	double m_originColumn;
+
+	std::vector<float> m_rows;
+	std::vector<float> m_columns;
+	std::vector<float> m_intensities;
+};
+
+} // namespace emd
+
+#endif
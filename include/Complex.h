@@ -0,0 +1,57 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef EMD_COMPLEX_H
+#define EMD_COMPLEX_H
+
+#include "EmdLib.h"
+
+namespace emd
+{
+
+class Dataset;
+class Frame;
+
+enum ComplexComponent
+{
+	ComplexReal,
+	ComplexImaginary,
+	ComplexMagnitude,
+	ComplexPhase			// radians, atan2(imaginary, real)
+};
+
+// Extracts one component of a complex frame into a new Float32 frame 
+//	(Float64 for double precision data) that owns its data. Frames of the
+//	native complex types (interleaved) and frames of data with a complex 
+//	dim (separate real and imaginary pointers) are both handled.
+EMDLIB_API Frame *complexFrame(const Frame *frame, ComplexComponent component);
+
+// Converts loaded Float32 / Float64 data with a complex dim (length 2: 
+//	real, imaginary) to Complex64 / Complex128 data without it. Returns 0
+//	if the data has no complex dim; the caller takes ownership.
+EMDLIB_API Dataset *interleaveComplex(const Dataset *data);
+// Converts loaded complex data to real data with a complex dim inserted
+//	at complexIndex.
+EMDLIB_API Dataset *splitComplex(const Dataset *data, int complexIndex = 0);
+
+} // namespace emd
+
+#endif
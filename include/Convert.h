@@ -0,0 +1,46 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef EMD_CONVERT_H
+#define EMD_CONVERT_H
+
+#include "EmdLib.h"
+#include "Util.h"
+
+#include <stdint.h>
+
+namespace emd
+{
+
+// Converts count values between any two numeric types (including the 16
+//	bit float types), applying value * scale + offset on the way. Integer
+//	results are rounded to nearest and saturated to the range of the type.
+//	Large blocks are split across threads. Returns false if either type is
+//	not numeric.
+EMDLIB_API bool convertValues(const void *source, DataType sourceType, 
+	void *destination, DataType destinationType, int64_t count, 
+	double scale = 1, double offset = 0);
+
+EMDLIB_API bool isNumericType(DataType type);
+
+} // namespace emd
+
+#endif
@@ -72,10 +72,26 @@ public:
 
 	Frame *getFrame();
 	bool load(H5::H5File *file);
+	// The options apply to the data; the dims only follow its binning
+	//	and strides. Returns false if the data could not be loaded.
+	bool load(H5::H5File *file, const Dataset::LoadOptions &options);
 	void unload();
+	// Reads a selection of the data into the caller's memory (see
+	//	Dataset::read), whether or not the group is loaded
+	bool read(H5::H5File *file, const Dataset::Selection &selection, 
+		void *destination, DataType type = DataTypeUnknown, 
+		const std::vector<int64_t> &strides = std::vector<int64_t>()) const;
     bool isLoaded() const;
+    // Picks up data and dims appended since they were read (see
+    //  Dataset::refresh). Returns true if any of them changed.
+    bool refresh(H5::H5File *file);
+    // Bytes held by the loaded data and dims
+    int64_t memoryFootprint() const;
+    bool isDirty() const;
 
 private:
+	bool loadData(H5::H5File *file, const Dataset::LoadOptions *options);
+
 	Dataset *m_data;
 	QList<Dataset*> m_dims;
     Model *m_model;
@@ -25,13 +25,18 @@
 
 #include "Node.h"
 
+#include <functional>
+#include <memory>
 #include <vector>
 
+#include "Allocator.h"
 #include "DataSpace.h"
 #include "Util.h"
 
 namespace H5
 {
+class DataSet;
+class DSetCreatPropList;
 class H5Object;
 }
 
@@ -39,11 +44,13 @@ namespace emd
 {
 
 class Frame;
+struct LoadProgress;
 
 class EMDLIB_API Dataset : public Node
 {
 public:
     typedef std::vector<int> Slice;
+    typedef std::function<void(char*)> BufferDeleter;
 
     static const int HorizontalDimension = -1;
     static const int VerticalDimension = -2;
@@ -63,17 +70,105 @@ public:
 	
 	typedef std::vector<Range> Selection;
 
+    // Compression applied to the data when it is saved. Filters other
+    //  than deflate are provided by HDF5 filter plugins (bitshuffle,
+    //  zstd), which must be available on the plugin path to read or
+    //  write them.
+    enum Compression
+    {
+        CompressionNone = 0,
+        CompressionDeflate,
+        CompressionBitshuffleLZ4,
+        CompressionZstd
+    };
+
+    // Copies share the loaded data; it is copied when a copy first
+    //  changes it through mutableData.
     Dataset(const Dataset &other);
+    Dataset(Dataset &&other);
 	Dataset(Node *parent = 0);
 	Dataset(const int &length, const emd::DataType &type, bool createDefault = false);
+	// Takes ownership of the data, allocated with new[].
 	Dataset(const int &nDims, int const *dimLengths, emd::DataType type, 
 		char *data, bool descendingData = true);
+	// Takes ownership of data from allocateBuffer.
+	Dataset(const int &nDims, int const *dimLengths, emd::DataType type, 
+		char *data, AllocatedBufferTag, bool descendingData = true);
+	// Adopts an external buffer without copying it (memory mapped,
+	//	pinned or owned by another library). The deleter is called once
+	//	the data is unloaded and no copy or frame refers to it; without a
+	//	deleter the dataset is a view and the caller keeps the buffer
+	//	alive for as long as the dataset uses it.
+	Dataset(const int &nDims, int const *dimLengths, emd::DataType type, 
+		char *data, const BufferDeleter &deleter, bool descendingData = true);
+	// Sparse event-list data: for every scan position (frame) the list
+	//	of detector pixel indexes that registered an electron, stored in
+	//	compressed row form (events of frame i are 
+	//	events[eventOffsets[i]] ... events[eventOffsets[i+1] - 1]).
+	Dataset(const int &nScanDims, int const *scanDimLengths, 
+		int const *frameDimLengths, std::vector<uint64_t> eventOffsets,
+		std::vector<uint32_t> events);
 	virtual ~Dataset();
 
+    // Conversion applied while loading: the values are converted to type
+    //  (DataTypeUnknown keeps the stored type) as value * scale + offset,
+    //  one block at a time, so the stored type is never held in full.
+    // For previews, the data can also be reduced per dim (in dim index
+    //  order, missing entries meaning 1): binning[d] consecutive values
+    //  are summed into one, and only every strides[d]-th bin is read.
+    //  Binned data is loaded as Float32 unless a type is given.
+    struct LoadOptions
+    {
+        DataType type;
+        double scale;
+        double offset;
+        std::vector<int> binning;
+        std::vector<int> strides;
+        // Optional: bytes read are reported here, and a cancelled load
+        //  stops between blocks
+        LoadProgress *progress;
+
+        LoadOptions()
+            : type(DataTypeUnknown),
+            scale(1),
+            offset(0),
+            progress(0)
+        {}
+
+        int binningFactor(int dim) const
+        {
+            return (dim < (int)binning.size() && binning[dim] > 1) ? binning[dim] : 1;
+        }
+        int strideFactor(int dim) const
+        {
+            return (dim < (int)strides.size() && strides[dim] > 1) ? strides[dim] : 1;
+        }
+        bool isBinned() const;
+        bool isDecimated() const;
+    };
+
 	// File operations
 	void loadData(const H5::DataSet &dataSet);
+	void loadData(const H5::DataSet &dataSet, const LoadOptions &options);
 	void unloadData();
+    // Reads a selection of the stored values straight into the caller's
+    //  memory, converted to type (the stored type when not numeric). The
+    //  strides give the distance between neighbours along each dim, in
+    //  elements of type; without them the destination is packed in C
+    //  order. Does not need or change the loaded data. Dense numeric data
+    //  only; returns false if the read fails.
+    bool read(const H5::DataSet &dataSet, const Selection &selection, 
+        void *destination, DataType type = DataTypeUnknown, 
+        const std::vector<int64_t> &strides = std::vector<int64_t>()) const;
     bool isLoaded() const;
+    // Takes the extent from the file again, for data that is still being
+    //  written (SWMR). Loaded data that grew along the slowest dim is
+    //  extended by reading only the new slices; other changes reload it.
+    //  Either way the options of the last load are kept. Returns true if
+    //  the extent changed.
+    bool refresh(const H5::DataSet &dataSet);
+    // Bytes held by the loaded data (zero when not loaded)
+    int64_t memoryFootprint() const;
 	virtual void save(const QString &path, H5::H5Object *group);
 
 	// Accessors
@@ -82,18 +177,54 @@ public:
 	QString units() const;
 	int dimCount() const;
 	int dimLength(const int &dimIndex) const;
-	void setDataOrder(bool descending) {m_descendingData = descending;}
+	void setDataOrder(bool descending) {if(!m_sparse) m_descendingData = descending;}
 	bool dataOrder() const {return m_descendingData;}
 	const DataSpace& dataSpace() const {return m_space;}
+	const char *rawData() const {return m_data;}
+	// Holds the data alive for as long as the pointer is kept, even if
+	//	this dataset is unloaded or deleted
+	std::shared_ptr<const char> sharedData() const {return m_buffer;}
+	char *mutableData();
+	bool isShared() const {return m_buffer && m_buffer.use_count() > 1;}
     Slice defaultSlice() const;
 	void setDataSpace(const DataSpace &space);
     void setDataType(DataType type);
+	// Frames are the two fastest varying dims (rows x columns, columns
+	//	fastest); the remaining dims are the scan dims, in data order.
+	void frameShape(int &rows, int &columns) const;
+	std::vector<int> scanDims() const;
 	int complexIndex() const;
 	void setComplexIndex(const int &index);
 	bool isComplexDim() const;
 	Selection selectAll() const;
     
     void setTrueLength(int length);
+    // Rescales a loaded dim vector to match data loaded with the given
+    //  binning and stride along this dim: each value becomes the mean
+    //  over its bin. The result is Float64.
+    void decimateDim(int binning, int stride);
+
+    // Sparse data is always in descending order, with the two detector
+    //  dims last. Frames are densified on demand.
+    bool isSparse() const {return m_sparse;}
+    void initSparse(const H5::DataSet &dataSet);
+    int64_t sparseFrameCount() const;
+    int sparseFrameSize() const;
+    const uint32_t *sparseEvents(int64_t frameIndex, int64_t &count) const;
+
+    // Float32 data can be saved as Float16 or BFloat16; other types are
+    //  saved as they are. The load type is the type loadData converts to
+    //  when no options are given.
+    void setStorageType(DataType type);
+    DataType storageType() const;
+    void setLoadType(DataType type);
+    DataType loadType() const {return m_loadType;}
+    // The options of the last load (without its progress)
+    const LoadOptions &loadOptions() const {return m_loadOptions;}
+
+    void setCompression(Compression compression, int level = 0);
+    Compression compression() const {return m_compression;}
+    int compressionLevel() const {return m_compressionLevel;}
 	
 	virtual QVariant variantRepresentation() const;
 	QVariant variantDataValue(const int &index) const;
@@ -101,6 +232,11 @@ public:
     QString valueString(const int &index) const;
 
 	Frame *frame(const Slice &slice) const;
+	// A frame whose writes (through Frame::mutableData) go to this 
+	//	dataset's data, which is first made private as by mutableData. The
+	//	dataset must not be copied while the frame is written. Not for 
+	//	sparse data.
+	Frame *mutableFrame(const Slice &slice);
 
 private:
     template <typename T>
@@ -117,8 +253,32 @@ private:
         return data[0] + index * (data[1] - data[0]);
     }
 
+    void loadSparseData(const H5::DataSet &dataSet);
+    H5::DataSet *saveSparseData(H5::H5Object *parentObject, const char *name);
+    Frame *sparseFrame(int hor, int ver, int hStep, int vStep, int offset) const;
+
+    // Both start at output slice first (along the slowest dim), which
+    //  lets refresh read only what was appended
+    void readBlocks(const H5::DataSet &dataSet, const H5::DataType &type, 
+        DataType fileType, const LoadOptions &options, int64_t first = 0);
+    void readDecimated(const H5::DataSet &dataSet, const H5::DataType &type, 
+        DataType fileType, const LoadOptions &options, int64_t first = 0);
+    bool extend(const H5::DataSet &dataSet, const DataSpace &space);
+    void writeFloat16(H5::DataSet &dataSet, const H5::DataType &type, 
+        DataType fileType) const;
+    bool writeExisting(H5::DataSet &dataSet) const;
+
+    void setBuffer(char *data);
+    void releaseBuffer();
+    void detach();
+
+    void readCompression(const H5::DataSet &dataSet);
+    static bool filtersAvailable(const H5::DataSet &dataSet);
+    void setFilter(H5::DSetCreatPropList &plist) const;
+
 private:
-	char *m_data;
+	char *m_data;					// m_buffer.get(), kept for the accessors
+	std::shared_ptr<char> m_buffer;
 	DataSpace m_space;
     DataType m_dataType;
     int m_dataTypeSize;
@@ -127,6 +287,18 @@ private:
 	int m_complexIndex;
     bool m_truncatedDim;
     int m_trueLength;
+    Compression m_compression;
+    int m_compressionLevel;
+    DataType m_storageType;
+    DataType m_loadType;
+    LoadOptions m_loadOptions;		// of the last load, without progress
+    DataSpace m_storedSpace;		// the file's extent at the last load
+    bool m_reducedInMemory;			// by decimateDim since the last load
+
+    bool m_sparse;
+    int m_frameDims[2];
+    std::vector<uint64_t> m_eventOffsets;
+    std::vector<uint32_t> m_events;
 };
 
 //template <typename T>
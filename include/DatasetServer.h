@@ -0,0 +1,113 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_DATASETSERVER_H
+#define EMD_DATASETSERVER_H
+
+#include "EmdLib.h"
+
+#include <memory>
+#include <stdint.h>
+#include <thread>
+
+#include <QString>
+
+#include "Dataset.h"
+
+namespace emd
+{
+
+// Shares loaded data between the processes on one machine, so that
+//	several viewers and scripts working on the same file hold a single 
+//	copy of it. Clients (see DatasetClient) connect through a Unix 
+//	domain socket and ask for a dataset, or a selection of it such as 
+//	the frames they page through, by file and path. The server reads it
+//	once into a shared memory segment and hands that segment to every
+//	client asking for the same data, which maps it instead of reading 
+//	the file. A file that changed on disk since (by size or modification
+//	time) is read again.
+//	Segments are counted as long as a client holds them. Segments no 
+//	client holds stay cached, and the least recently used are dropped 
+//	when a new one would exceed the memory cap; a request that does not
+//	fit under the cap even then is refused.
+//	Requests are served one at a time, on the thread running the server;
+//	a client that has sent part of a request does not hold up the others.
+//	POSIX only.
+class EMDLIB_API DatasetServer
+{
+public:
+	// No memory cap when it is 0
+	DatasetServer(const QString &socketPath, int64_t memoryCap = 0);
+	~DatasetServer();
+
+	// Listens on the socket and serves clients on a thread of its own.
+	//	Fails if another server is listening on it.
+	bool start();
+	// As start, but serves clients on the calling thread until stop is
+	//	called (from another thread), e.g. in a daemon's main.
+	bool run();
+	void stop();
+
+	QString socketPath() const;
+	int64_t memoryCap() const;
+	void setMemoryCap(int64_t bytes);
+	// Bytes held by the segments, whether clients hold them or not
+	int64_t memoryUsage() const;
+	int segmentCount() const;
+	int clientCount() const;
+
+private:
+	struct Shared;
+
+	std::shared_ptr<Shared> m_shared;
+	std::thread m_thread;
+};
+
+// A process's connection to a DatasetServer. Datasets attached through
+//	it keep their data after the connection is closed.
+class EMDLIB_API DatasetClient
+{
+public:
+	DatasetClient();
+	~DatasetClient();
+
+	bool connect(const QString &socketPath);
+	void disconnect();
+	bool isConnected() const;
+
+	// The data at the path in the file, converted to type (the stored 
+	//	type when not numeric). The selection is of the stored dims, and
+	//	all of the data is attached when it is empty. The dataset, deleted
+	//	by the caller, maps the server's segment; changes made to it stay
+	//	in this process. Returns 0 if the server cannot provide the data.
+	//	The file path is resolved (links, . and ..) before it is sent.
+	Dataset *attach(const QString &filePath, const QString &dataPath, 
+		const Dataset::Selection &selection = Dataset::Selection(), 
+		DataType type = DataTypeUnknown);
+
+private:
+	struct Connection;
+
+	std::shared_ptr<Connection> m_connection;
+};
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef EMD_FOURIERTRANSFORM_H
+#define EMD_FOURIERTRANSFORM_H
+
+#include "EmdLib.h"
+#include "Frame.h"
+
+namespace emd
+{
+
+// 2D discrete Fourier transforms of Frames, of any size (radix-2 for
+//	powers of two, Bluestein's algorithm otherwise). The twiddle factors
+//	of every transform length are computed once and cached per length and
+//	precision. Complex64 and Complex128 frames are transformed as they
+//	are, other frames as real data with an optional separate imaginary 
+//	part. Results are new interleaved complex Frames that own their data:
+//	Complex128 for Float64 and Complex128 input, Complex64 for everything
+//	else.
+class EMDLIB_API FourierTransform
+{
+public:
+	// Forward transform. With shift, the zero frequency is moved to 
+	//	(hSize / 2, vSize / 2) and the result is marked 
+	//	AttributeFourierTransformed, otherwise it stays at (0, 0) and the
+	//	result is marked AttributeFourierTransformedNoShift.
+	static Frame *transform(const Frame *frame, bool shift = true);
+	// Inverse transform, undoing the shift recorded in the frame 
+	//	attributes. The result is complex, scaled by 1 / (hSize * vSize).
+	static Frame *inverse(const Frame *frame);
+
+	// Transforms a stack of frames, one frame per thread. The caller 
+	//	takes ownership of the returned frames; frames that could not be
+	//	transformed are null.
+	static FrameList transform(const FrameList &frames, bool shift = true);
+	static FrameList inverse(const FrameList &frames);
+
+	// Releases the cached twiddle factors.
+	static void clearPlans();
+};
+
+} // namespace emd
+
+#endif
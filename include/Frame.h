@@ -22,8 +22,10 @@
 #define EMD_FRAME_H
 
 #include "EmdLib.h"
+#include "Allocator.h"
 
 #include <stdint.h>
+#include <memory>
 
 #include <QDebug>
 
@@ -70,7 +72,8 @@ public:
             : attributes(other.attributes),
             hStep(other.hStep), vStep(other.vStep),
             hSize(other.hSize), vSize(other.vSize),
-            real((T*)other.real), imaginary((T*)other.imaginary)
+            real(static_cast<T*>(other.real)), 
+            imaginary(static_cast<T*>(other.imaginary))
         {}
 		void setAttribute(Attribute attribute)
 		{
@@ -86,19 +89,37 @@ public:
         }
 	};
 
+	// Owned data must come from new[].
 	Frame(void *real, void *imaginary, 
 		int hStep, int vStep, 
 		int hSize, int vSize, 
 		DataType type = DataTypeUnknown,
         bool ownsData = true);
     Frame(const Data<void> &data, const DataType &type, bool ownsData = true);
+	// Take ownership of data from allocateBuffer.
+	Frame(void *real, void *imaginary, 
+		int hStep, int vStep, 
+		int hSize, int vSize, 
+		DataType type, AllocatedBufferTag);
+    Frame(const Data<void> &data, const DataType &type, AllocatedBufferTag);
     Frame(const Frame *other);
 	~Frame();
 
+    // Frames of a dataset point into its buffer, which copies of the
+    //  dataset and other frames share, so the data is read-only;
+    //  mutableData first copies shared data into a buffer of the frame.
+    //  Writes through a frame therefore do not change the dataset, except
+    //  for frames from Dataset::mutableFrame.
+    template <typename T>
+    Data<const T> data() const
+    {
+        return Data<const T>(m_data);
+    }
     template <typename T>
-    Data<T> data() const
+    Data<T> mutableData()
     {
-        return static_cast<Data<T> >(m_data);
+        detach();
+        return Data<T>(m_data);
     }
     
 	DataType dataType() const;
@@ -108,6 +129,10 @@ public:
     int64_t index() const;
     void setIndex(int64_t index);
 
+    // Keeps the buffer a non-owning frame points into alive, e.g. the
+    //  data of the dataset it came from.
+    void setOwner(const std::shared_ptr<const void> &owner) {m_owner = owner;}
+
     // Gets the data range if available.
     void checkDataRange(float &min, float &max) const;
 
@@ -117,13 +142,30 @@ public:
 
     void saveRawData(const QString &filePath) const;
 
+    // A compact Float32 copy of a Float16 or BFloat16 frame, for kernels
+    //  that take 16 bit floats as Float32; 0 for other types. The caller
+    //  takes ownership of the result.
+    Frame *toFloat32() const;
+
+    // 2D Fourier transforms (see FourierTransform); the caller takes
+    // ownership of the result.
+    Frame *fourierTransform(bool shift = true) const;
+    Frame *inverseFourierTransform() const;
+
 protected:
+    friend class Dataset;
+
+    void detach();
+
 	Data<void> m_data;
 	emd::DataType m_dataType;
     bool m_ownsData;
+    bool m_allocatedData;
+    bool m_writesThrough;		// see Dataset::mutableFrame
     int64_t m_index;
     float m_minValue;
     float m_maxValue;
+    std::shared_ptr<const void> m_owner;
 };
 
 typedef std::vector<Frame *> FrameList;
@@ -0,0 +1,76 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_FRAMEPREFETCHER_H
+#define EMD_FRAMEPREFETCHER_H
+
+#include "EmdLib.h"
+
+#include <memory>
+#include <stdint.h>
+
+#include <QString>
+
+#include "Dataset.h"
+
+namespace emd
+{
+
+class Frame;
+
+// Serves frames of a Dataset that is not loaded while the user scrubs
+//	along one of its free dims. Every request updates the active axis 
+//	(the dim that changed) and the velocity along it, and the frames
+//	expected next are read on the I/O thread into a bounded cache, so
+//	they are ready by the time they are asked for.
+//	Not to be used from I/O thread callbacks, as misses wait for it.
+class EMDLIB_API FramePrefetcher
+{
+public:
+	FramePrefetcher(const Dataset *data, const QString &filePath, 
+		int cacheFrames = 64, int lookahead = 8);
+	~FramePrefetcher();
+
+	// As Dataset::frame, and deleted by the caller likewise. Loaded data
+	//	is used as it is; otherwise the frame comes from the cache, or
+	//	is read (waiting for the read) on a miss.
+	Frame *frame(const Dataset::Slice &slice);
+
+	void clear();
+	int64_t hits() const;
+	int64_t misses() const;
+
+private:
+	struct Shared;
+
+	void predict(const Dataset::Slice &slice);
+
+	const Dataset *m_data;
+	std::shared_ptr<Shared> m_shared;
+	int m_lookahead;
+
+	Dataset::Slice m_lastSlice;
+	int m_axis;
+	double m_velocity;
+};
+
+} // namespace emd
+
+#endif
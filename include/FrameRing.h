@@ -0,0 +1,108 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_FRAMERING_H
+#define EMD_FRAMERING_H
+
+#include "EmdLib.h"
+
+#include <atomic>
+#include <stdint.h>
+
+#include "Frame.h"
+#include "Util.h"
+
+namespace emd
+{
+
+// Hands frames from one producer thread (e.g. the detector readout) to
+//	one consumer thread (e.g. a FrameWriter) without locks. The slots are
+//	allocated once, back to back, so consecutive frames can be taken as
+//	one block. A frame is rows x columns values, columns fastest. A
+//	Frame::Data frame is stored as hSize rows of vSize values, the layout
+//	of FramePrefetcher's hyperslab reads; frames whose horizontal index
+//	is the fast one are transposed into it.
+class EMDLIB_API FrameRing
+{
+public:
+	FrameRing(int rows, int columns, DataType type, int slotCount);
+	FrameRing(const Frame::Data<void> &shape, DataType type, int slotCount);
+	~FrameRing();
+
+	bool isValid() const {return m_slots != 0;}
+	int frameRows() const {return m_rows;}
+	int frameColumns() const {return m_columns;}
+	emd::DataType dataType() const {return m_type;}
+	int64_t frameBytes() const {return m_frameBytes;}
+	int slotCount() const {return m_slotCount;}
+	// Frames waiting; exact only on the producer or consumer thread
+	int64_t size() const;
+
+	// Producer. A frame is written into the slot from beginWrite (0 if
+	//	the ring is full) and published by endWrite. push copies a frame
+	//	and returns false, dropping it, if the ring is full.
+	void *beginWrite();
+	void endWrite();
+	bool push(const void *frame);
+	bool push(const Frame::Data<void> &frame);
+
+	// Consumer. readable gives the frames that can be read in one block
+	//	(up to the end of the slots), and release frees them.
+	const void *readable(int64_t &count);
+	void release(int64_t count);
+	bool pop(void *frame);
+
+	// Back pressure: frames dropped by push, times beginWrite found the
+	//	ring full, and the most frames ever waiting
+	int64_t framesPushed() const {return m_pushed;}
+	int64_t framesPopped() const {return m_popped;}
+	int64_t framesDropped() const {return m_dropped;}
+	int64_t fullEvents() const {return m_fullEvents;}
+	int64_t highWater() const {return m_highWater;}
+
+private:
+	FrameRing(const FrameRing &);
+	FrameRing &operator=(const FrameRing &);
+
+	void init(int rows, int columns, DataType type, int slotCount);
+
+	char *m_slots;
+	int m_rows;
+	int m_columns;
+	DataType m_type;
+	int64_t m_frameBytes;
+	int m_slotCount;
+
+	// Frames ever written and read; each is only changed by one side, 
+	//	and kept on its own cache line
+	alignas(64) std::atomic<int64_t> m_head;
+	alignas(64) std::atomic<int64_t> m_tail;
+
+	// Statistics, written by one side and read by either
+	alignas(64) std::atomic<int64_t> m_pushed;
+	std::atomic<int64_t> m_dropped;
+	std::atomic<int64_t> m_fullEvents;
+	std::atomic<int64_t> m_highWater;
+	alignas(64) std::atomic<int64_t> m_popped;
+};
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_FRAMESTREAM_H
+#define EMD_FRAMESTREAM_H
+
+#include "EmdLib.h"
+
+#include <stdint.h>
+#include <vector>
+
+#include "Convert.h"
+#include "Util.h"
+
+namespace H5
+{
+class DataSet;
+class H5File;
+}
+
+namespace emd
+{
+
+class Dataset;
+
+// Walks the frames (the two fastest varying dims) of a dense Dataset in
+//	blocks of consecutive frames, either from the loaded data or directly
+//	from the file without loading the whole Dataset. Blocks read from the
+//	file hold at most blockBytes, or a single frame if that is larger.
+class EMDLIB_API FrameStream
+{
+public:
+	static const int64_t DefaultBlockBytes = 64LL * 1024LL * 1024LL;
+
+	FrameStream(const Dataset *data, int64_t blockBytes = DefaultBlockBytes);
+	~FrameStream();
+
+	// Reads the blocks from the file. Without this the Dataset must be 
+	//	loaded.
+	bool open(H5::H5File *file);
+	void close();
+
+	bool isValid() const;
+	emd::DataType dataType() const;
+	int frameRows() const {return m_frameRows;}
+	int frameColumns() const {return m_frameColumns;}
+	int64_t frameSize() const {return (int64_t) m_frameRows * m_frameColumns;}
+	int64_t frameCount() const {return m_frameCount;}
+
+	// Gets the next block of frames. Returns false when all frames have
+	//	been delivered or a read fails; the arguments are only set for a
+	//	block that was read.
+	bool next(const char *&frames, int64_t &firstFrame, int64_t &blockFrames);
+	void rewind() {m_nextFrame = 0; m_error = false;}
+	// True if the stream stopped on a failed read
+	bool error() const {return m_error;}
+
+	// Passes every block to kernel(frames, firstFrame, blockFrames) with
+	//	the frames cast to their value type. 16 bit floats are expanded to
+	//	Float32 one block at a time. Returns false if the data type is not
+	//	numeric or a read fails.
+	template <typename Kernel>
+	bool forEachBlock(Kernel &kernel);
+
+private:
+	bool readBlock(int64_t firstFrame, int64_t blockFrames);
+
+	const Dataset *m_data;
+	H5::DataSet *m_dataSet;
+	char *m_buffer;
+	int64_t m_blockBytes;
+	int m_frameRows;
+	int m_frameColumns;
+	int64_t m_frameCount;
+	int64_t m_framesPerRow;
+	int64_t m_blockFrames;
+	// Blocks are whole rows of the slowest dim (descending data with 
+	//	scan dims), or else runs of the stored values
+	bool m_rowBlocks;
+	int64_t m_nextFrame;
+	bool m_error;
+};
+
+template <typename Kernel>
+bool FrameStream::forEachBlock(Kernel &kernel)
+{
+	DataType type = dataType();
+	if(!isNumericType(type))
+		return false;
+
+	const char *frames;
+	int64_t firstFrame, blockFrames;
+	std::vector<float> staging;
+	while(next(frames, firstFrame, blockFrames))
+	{
+		switch(type)
+		{
+		case DataTypeInt8:
+			kernel((const int8_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeInt16:
+			kernel((const int16_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeInt32:
+			kernel((const int32_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeInt64:
+			kernel((const int64_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeUInt8:
+			kernel((const uint8_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeUInt16:
+			kernel((const uint16_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeUInt32:
+			kernel((const uint32_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeUInt64:
+			kernel((const uint64_t*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeFloat32:
+			kernel((const float*) frames, firstFrame, blockFrames);
+			break;
+		case DataTypeFloat64:
+			kernel((const double*) frames, firstFrame, blockFrames);
+			break;
+		default:
+			// Float16 and BFloat16
+			staging.resize(blockFrames * frameSize());
+			convertValues(frames, type, staging.data(), DataTypeFloat32, 
+				(int64_t) staging.size());
+			kernel((const float*) staging.data(), firstFrame, blockFrames);
+			break;
+		}
+	}
+
+	return !m_error;
+}
+
+} // namespace emd
+
+#endif
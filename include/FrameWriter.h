@@ -0,0 +1,106 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_FRAMEWRITER_H
+#define EMD_FRAMEWRITER_H
+
+#include "EmdLib.h"
+
+#include <memory>
+#include <stdint.h>
+
+#include <QString>
+
+#include "Util.h"
+
+namespace emd
+{
+
+class FrameRing;
+
+// Appends frames to a new data group in a file while they arrive, e.g.
+//	during an acquisition. The data is frames x rows x columns, with an
+//	unlimited frame dim (dim1) whose vector grows with it. Frames are
+//	copied into batches of whole chunks, which are written on the I/O 
+//	thread, so the producer never waits for the file unless it gets 
+//	too far ahead. The file is valid after every flush.
+//	In SWMR mode (single writer, multiple readers) other processes can
+//	read the file while it is written (see Model::openSwmr); every batch
+//	is flushed as soon as it is written.
+//	One producer thread; not to be used from I/O thread callbacks.
+class EMDLIB_API FrameWriter
+{
+public:
+	static const int MaxPendingBatches = 4;
+
+	FrameWriter();
+	~FrameWriter();
+
+	// Creates the group (and any missing parents) in the file, which is
+	//	created if it does not exist. Fails if the file exists but is not 
+	//	an HDF5 file (which is left as it is), if the group already exists
+	//	or if the type is not numeric. No other group can be added to a file while it is
+	//	written in SWMR mode.
+	bool open(const QString &filePath, const QString &groupPath, 
+		int rows, int columns, DataType type, bool swmr = false);
+	bool isOpen() const {return m_shared != 0;}
+
+	// Copies count frames of rows x columns values. Returns false once a
+	//	write has failed, or if the writer is not open.
+	bool append(const void *frames, int64_t count = 1);
+	// Appends the frames waiting in the ring, as its consumer. Returns
+	//	the number of frames taken, or -1 on failure or if the ring's 
+	//	frames do not match.
+	int64_t append(FrameRing &ring);
+	// Writes the frames appended so far and flushes the file. 
+	bool flush();
+	bool close();
+
+	int frameRows() const {return m_rows;}
+	int frameColumns() const {return m_columns;}
+	emd::DataType dataType() const {return m_type;}
+	int64_t framesAppended() const {return m_framesAppended;}
+	int64_t framesWritten() const;
+	// Times append waited for the writes to catch up
+	int64_t stalls() const {return m_stalls;}
+
+private:
+	struct Shared;
+
+	void queueBatch(bool keep);
+
+	std::shared_ptr<Shared> m_shared;
+	int m_rows;
+	int m_columns;
+	DataType m_type;
+	int64_t m_frameBytes;
+
+	// The batch being filled starts at a chunk boundary
+	char *m_batch;
+	int64_t m_batchCapacity;
+	int64_t m_batchStart;
+	int64_t m_batchFrames;
+	int64_t m_framesAppended;
+	int64_t m_stalls;
+};
+
+} // namespace emd
+
+#endif
@@ -25,6 +25,10 @@
 
 #include <QtGui>
 
+#include <functional>
+#include <mutex>
+
+#include "AsyncLoad.h"
 #include "Util.h"
 #include "DataGroup.h"
 
@@ -43,6 +47,13 @@ class DimensionModel;
 class Dataset;
 class Frame;
 
+// Loaded data and metadata may be read from any number of threads at 
+//	once. File operations (open, save, loads, refresh) may also be called 
+//	from any thread; they are serialized with the I/O thread through 
+//	ioMutex. The QAbstractItemModel functions and the mutators belong to 
+//	the GUI thread. A group can be unloaded by the memory budget while 
+//	another thread reads it, so readers hold on to what they use through 
+//	Dataset::sharedData or a Frame rather than a bare data pointer.
 class EMDLIB_API Model : public QAbstractItemModel
 {
 	Q_OBJECT
@@ -81,10 +92,10 @@ class EMDLIB_API Model : public QAbstractItemModel
     QString filePath() const;
     void setFilePath(const QString &path);
 
-	H5::H5File *file() const {return m_file;}
+	// The file held open for SWMR reading, if any
+	H5::H5File *file() const {return m_swmrFile;}
 	Node *root() const {return m_root;}
 	Node *node(const QString &name, const Node *parent = 0) const;
-	Node *currentNode() const {return m_currentNode;}
 	Node *getPath(const QString &path) const;
     int dataGroupCount() const;
     DataGroup *dataGroupAtIndex(const int &index) const;
@@ -100,34 +111,98 @@ class EMDLIB_API Model : public QAbstractItemModel
 	// Mutators
 	Node *addNode(const QString &name, const int &type, Node *parent = 0);
 	Node *addPath(const char *path, const int &type);
-	void setCurrentNode(Node *node) {m_currentNode = node;}
 	void setAxisIndexes(const int &hindex, const int &vIndex);
 	void setDirty();
 
 	// File operations
 	bool open(const QString &filePath);
+	// Opens a file that another process is still writing in SWMR mode
+	//	(see FrameWriter). The file stays open for reading until it is
+	//	closed; loads read from it, and refresh picks up what has been
+	//	appended since. Asynchronous loads are not available meanwhile.
+	bool openSwmr(const QString &filePath);
+	void closeSwmr();
+	bool isSwmr() const {return m_swmrFile != 0;}
+	// Call periodically (e.g. from a timer) while reading in SWMR mode;
+	//	loaded groups that grew are extended, keeping their load options.
+	//	Returns the groups that changed.
+	QList<DataGroup*> refresh();
 	void save(const QString &filePath);
 	bool loadDataGroup(const int &groupIndex);
     bool loadDataGroup(DataGroup *dataGroup);
+    // Loads (or reloads) the data converted as the options request.
+    bool loadDataGroup(const int &groupIndex, const Dataset::LoadOptions &options);
+    // Progressive loads deliver the group coarse first: every pass but the
+    //  last reads only every 4^n-th value along each dim, and the callback
+    //  is invoked after each pass with the group holding that pass's data
+    //  (the last pass, passCount - 1, is full resolution). Returning false
+    //  from the callback stops the load at the current pass. Passes whose
+    //  stride would reach the longest dim are dropped, so the callback
+    //  may see fewer passes than requested. Dirty groups are not reloaded.
+    typedef std::function<bool(DataGroup *group, int pass, int passCount)> 
+        ProgressCallback;
+    bool loadDataGroupProgressive(const int &groupIndex, 
+        const ProgressCallback &callback, int passCount = 3, 
+        const Dataset::LoadOptions &options = Dataset::LoadOptions());
+    // Loads (or reloads) the group on the I/O thread and returns at once;
+    //  see LoadHandle.
+    LoadHandle loadDataGroupAsync(const int &groupIndex, 
+        const Dataset::LoadOptions &options = Dataset::LoadOptions(), 
+        const LoadHandle::Callback &finished = LoadHandle::Callback());
     void unloadDataGroups();
 	int indexOfDataGroup(DataGroup *group);
     bool anyLoaded();
 
+    // Loaded groups are kept within the memory budget (0 for no limit):
+    //  before a group is loaded, the least recently used groups are
+    //  unloaded until it fits. Groups with unsaved changes or with a
+    //  load in flight on any thread are never unloaded.
+    void setMemoryBudget(int64_t bytes);
+    int64_t memoryBudget() const {return m_memoryBudget;}
+    // Bytes held by loaded groups, counting loads in flight at their
+    //  expected size
+    int64_t memoryUsage();
+    // Marks the group as just used, e.g. when it is displayed
+    void touchDataGroup(DataGroup *dataGroup);
+
     void validateDataGroups();
 
 private:
+	bool insertNodes(int position, int rows, const QModelIndex &parent, 
+		int type);
+	bool loadGroup(const int &groupIndex, const Dataset::LoadOptions *options);
+	bool isLoading(DataGroup *group);
+	bool isSyncLoading(DataGroup *group) const;
+	void makeRoom(int64_t bytes, DataGroup *keep);
+
 	// Data
 	Node *m_root;
-	Node *m_currentNode;
 	QString m_fileName;
     QString m_fileDir;
     QString m_fileExtension;
-	H5::H5File *m_file;
-	// TODO: handle image setting more gracefully
-	int m_currentType;
+	H5::H5File *m_swmrFile;
 
 	QList<DataGroup*> m_dataGroups;
 
+	// Residency, most recently used group first; guarded by m_mutex
+	mutable std::recursive_mutex m_mutex;
+	int64_t m_memoryBudget;
+	QList<DataGroup*> m_recentGroups;
+	struct PendingLoad
+	{
+		LoadHandle handle;
+		int64_t bytes;
+	};
+	std::vector<PendingLoad> m_pendingLoads;
+	// Groups being read by loadGroup, which makeRoom leaves alone and 
+	//	memoryUsage counts at the size they are loaded at
+	struct SyncLoad
+	{
+		DataGroup *group;
+		int64_t bytes;
+	};
+	std::vector<SyncLoad> m_syncLoads;
+
 	bool m_chunking;
 	int m_nFrames;
 	char **m_chunks;
@@ -0,0 +1,58 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_PARALLEL_H
+#define EMD_PARALLEL_H
+
+#include "EmdLib.h"
+
+#include <functional>
+#include <stdint.h>
+
+namespace emd
+{
+
+// The parallel kernels share one pool of worker threads. Each worker
+//	has its own queue of tasks and takes work from the others when it
+//	runs out, and a thread waiting for its own tasks runs queued tasks
+//	meanwhile (and sleeps once there are none), so kernels that run at 
+//	the same time, or inside each other, never use more threads than 
+//	the pool has.
+
+// Number of threads used by the parallel kernels, counting the calling
+//	thread (defaults to the number of hardware threads).
+EMDLIB_API int threadCount();
+EMDLIB_API void setThreadCount(int count);
+// Pins worker thread n to processor n + 1 (where supported). Applies to
+//	workers started afterwards, so it should be set before first use.
+EMDLIB_API void setThreadAffinity(bool enabled);
+EMDLIB_API bool threadAffinity();
+
+// Splits [begin, end) into contiguous ranges of at least grain elements
+//	(at most one per thread) and calls body(rangeBegin, rangeEnd) for 
+//	each, in parallel. Returns when all ranges are done. Can be called
+//	from inside another parallelFor. If body throws, the first exception
+//	is rethrown once all ranges are done.
+EMDLIB_API void parallelFor(int64_t begin, int64_t end, int64_t grain,
+	const std::function<void(int64_t, int64_t)> &body);
+
+} // namespace emd
+
+#endif
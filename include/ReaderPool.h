@@ -0,0 +1,109 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_READERPOOL_H
+#define EMD_READERPOOL_H
+
+#include "EmdLib.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <QString>
+
+#include "Dataset.h"
+
+namespace emd
+{
+
+class DataGroup;
+
+// Reads selections of a file in several helper processes at once. HDF5
+//	serializes all calls within a process, so decoding (decompression
+//	and type conversion) in one process never uses more than one core;
+//	each helper opens the file read-only on its own and returns the 
+//	values it decoded through shared memory. A read is split along the
+//	slowest dim into pieces that the helpers decode in parallel, and 
+//	each piece is copied into the caller's buffer as it arrives.
+//	The helpers are forked, so the pool should be started before files
+//	are opened for writing, and the file must not be written while the 
+//	pool reads it. A helper that does not answer within the timeout is
+//	stopped and not used again; without helpers (not started, all lost,
+//	or not supported on the platform) reads are made in this process.
+//	Reads may be called from any thread; they run one at a time.
+class EMDLIB_API ReaderPool
+{
+public:
+	// Each helper's shared memory holds a piece of at most sharedBytes
+	ReaderPool(const QString &filePath, int processCount = 0, 
+		int64_t sharedBytes = 64LL * 1024LL * 1024LL);
+	~ReaderPool();
+
+	// Starts the helpers (as many as threadCount when processCount is
+	//	0). Returns false if none could be started. A forked helper only
+	//	has the calling thread, so a lock that another thread held at the
+	//	fork would never be released in it: the helpers are forked while
+	//	holding ioMutex, and the allocator's lock is taken around every
+	//	fork, which covers what the helpers use of emdlib. Locks of other
+	//	libraries (Qt's, the C++ runtime's) are not covered, so start is
+	//	safest called before other threads exist.
+	bool start();
+	void stop();
+	int processCount() const;
+
+	// Milliseconds a helper may take to answer (defaults to 30s)
+	void setTimeout(int milliseconds);
+	int timeout() const;
+	QString filePath() const {return m_filePath;}
+
+	// As Dataset::read and DataGroup::read, for the data at the path.
+	bool read(const QString &dataPath, const Dataset::Selection &selection, 
+		void *destination, DataType type = DataTypeUnknown, 
+		const std::vector<int64_t> &strides = std::vector<int64_t>());
+	bool read(const DataGroup *group, const Dataset::Selection &selection, 
+		void *destination, DataType type = DataTypeUnknown, 
+		const std::vector<int64_t> &strides = std::vector<int64_t>());
+
+private:
+	struct Helper
+	{
+		int pid;
+		int socket;
+		char *shared;
+	};
+
+	DataType storedType(const QString &dataPath);
+	bool readHere(const QString &dataPath, const Dataset::Selection &selection, 
+		void *destination, DataType type, const std::vector<int64_t> &strides);
+	void stopHelper(Helper &helper);
+	void dropHelper(int index);
+
+	QString m_filePath;
+	int m_processCount;
+	int64_t m_sharedBytes;
+	int m_timeout;
+	std::vector<Helper> m_helpers;
+	mutable std::mutex m_mutex;
+};
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_REDUCTION_H
+#define EMD_REDUCTION_H
+
+#include "EmdLib.h"
+#include "Util.h"
+
+#include <vector>
+
+namespace emd
+{
+
+class DataGroup;
+class Dataset;
+
+// Reduces loaded data along any subset of its dims (for example the mean
+//	diffraction pattern over the scan dims, or the total intensity image
+//	over the detector dims). Dims are indexed as in the Dataset, whatever
+//	its data order. Sums, means and variances are computed in double
+//	precision with pairwise summation and returned as Float64; minima and
+//	maxima keep the data type (Float32 for 16 bit floats, which are
+//	expanded first). Sparse data supports sums and means only.
+class EMDLIB_API Reduction
+{
+public:
+	enum Operation
+	{
+		OperationSum,
+		OperationMean,
+		OperationMin,
+		OperationMax,
+		OperationVariance		// population variance
+	};
+
+	static DataType resultType(DataType type, Operation operation);
+
+	// Returns 0 if the data is not loaded or the dims are invalid. The
+	//	caller takes ownership of the result.
+	static Dataset *reduce(const Dataset *data, Operation operation, 
+		const std::vector<int> &dims);
+	// Same, as a new DataGroup carrying copies of the remaining dim 
+	//	vectors.
+	static DataGroup *reduce(const DataGroup *dataGroup, Operation operation, 
+		const std::vector<int> &dims);
+};
+
+} // namespace emd
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_SIMD_H
+#define EMD_SIMD_H
+
+#include "EmdLib.h"
+
+#include <stdint.h>
+
+namespace emd
+{
+
+// Vectorized inner loops shared by the processing kernels. The best
+//	instruction set available on the running CPU is selected at runtime.
+namespace simd
+{
+
+EMDLIB_API float dot(const float *a, const float *b, int64_t length);
+EMDLIB_API double dot(const double *a, const float *b, int64_t length);
+
+// Sums the weighted values, and the weighted values times their
+//	coordinates, skipping values below the threshold.
+EMDLIB_API void moments(const float *values, const float *weights, 
+	const float *coordinates, int64_t length, float threshold, 
+	float &sum, float &moment);
+
+// Conversions between separate real and imaginary arrays and 
+//	interleaved (real, imaginary) pairs, and the magnitude of interleaved
+//	complex values.
+EMDLIB_API void interleave(const float *real, const float *imaginary, 
+	float *complex, int64_t length);
+EMDLIB_API void interleave(const double *real, const double *imaginary, 
+	double *complex, int64_t length);
+EMDLIB_API void deinterleave(const float *complex, float *real, 
+	float *imaginary, int64_t length);
+EMDLIB_API void deinterleave(const double *complex, double *real, 
+	double *imaginary, int64_t length);
+EMDLIB_API void magnitude(const float *complex, float *magnitude, int64_t length);
+EMDLIB_API void magnitude(const double *complex, double *magnitude, int64_t length);
+
+// IEEE half precision and bfloat16 conversions. Conversions to the 16 bit
+//	types round to the nearest even value; values too large for half 
+//	precision become infinities. F16C instructions are used for half 
+//	precision when the CPU has them.
+EMDLIB_API float halfToFloat(uint16_t half);
+EMDLIB_API uint16_t floatToHalf(float value);
+EMDLIB_API void halfToFloat(const uint16_t *half, float *values, int64_t length);
+EMDLIB_API void floatToHalf(const float *values, uint16_t *half, int64_t length);
+EMDLIB_API float bfloat16ToFloat(uint16_t bfloat16);
+EMDLIB_API uint16_t floatToBfloat16(float value);
+EMDLIB_API void bfloat16ToFloat(const uint16_t *bfloat16, float *values, int64_t length);
+EMDLIB_API void floatToBfloat16(const float *values, uint16_t *bfloat16, int64_t length);
+
+// Integer detector data to float, as value * scale + offset.
+EMDLIB_API void scale(const uint8_t *values, float *result, int64_t length, 
+	float scale, float offset);
+EMDLIB_API void scale(const uint16_t *values, float *result, int64_t length, 
+	float scale, float offset);
+EMDLIB_API void scale(const int16_t *values, float *result, int64_t length, 
+	float scale, float offset);
+EMDLIB_API void scale(const int32_t *values, float *result, int64_t length, 
+	float scale, float offset);
+EMDLIB_API void scale(const float *values, float *result, int64_t length, 
+	float scale, float offset);
+
+// Plain loop; the compiler vectorizes the conversion.
+template <typename T>
+inline void convert(const T *source, float *destination, int64_t length)
+{
+	for(int64_t iii = 0; iii < length; ++iii)
+		destination[iii] = (float) source[iii];
+}
+
+// Pairwise summation: blocks are summed with independent accumulators
+//	and the block sums are added in a tree, which keeps the rounding error
+//	growing with log(length) instead of length.
+template <typename T>
+inline double sum(const T *values, int64_t length)
+{
+	if(length > 256)
+	{
+		int64_t half = (length / 2) & ~int64_t(7);
+		return sum(values, half) + sum(values + half, length - half);
+	}
+
+	double sums[4] = {0, 0, 0, 0};
+	int64_t iii = 0;
+	for(; iii + 4 <= length; iii += 4)
+	{
+		sums[0] += (double) values[iii];
+		sums[1] += (double) values[iii + 1];
+		sums[2] += (double) values[iii + 2];
+		sums[3] += (double) values[iii + 3];
+	}
+	for(; iii < length; ++iii)
+		sums[0] += (double) values[iii];
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+// Pairwise sum of the squared deviations from center.
+template <typename T>
+inline double sumSquares(const T *values, int64_t length, double center)
+{
+	if(length > 256)
+	{
+		int64_t half = (length / 2) & ~int64_t(7);
+		return sumSquares(values, half, center) 
+			+ sumSquares(values + half, length - half, center);
+	}
+
+	double sums[4] = {0, 0, 0, 0};
+	int64_t iii = 0;
+	for(; iii + 4 <= length; iii += 4)
+	{
+		for(int jjj = 0; jjj < 4; ++jjj)
+		{
+			double deviation = (double) values[iii + jjj] - center;
+			sums[jjj] += deviation * deviation;
+		}
+	}
+	for(; iii < length; ++iii)
+	{
+		double deviation = (double) values[iii] - center;
+		sums[0] += deviation * deviation;
+	}
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+} // namespace simd
+
+} // namespace emd
+
+#endif
@@ -23,6 +23,7 @@
 
 #include "EmdLib.h"
 
+#include <complex>
 #include <limits>
 #include <stdint.h>
 #include <vector>
@@ -59,9 +60,19 @@ enum DataType
 	DataTypeFloat32	= 0x100,
 	DataTypeFloat64	= 0x200,
 
+	// Interleaved (real, imaginary) pairs of Float32 / Float64, stored as
+	//	HDF5 compound types with members "r" and "i"
+	DataTypeComplex64	= 0x400,
+	DataTypeComplex128	= 0x800,
+
 	DataTypeString	= 0x1000,
 	DataTypeBool	= 0x2000,
 
+	// 16 bit floats for derived data: IEEE half precision, and bfloat16
+	//	(the upper half of a Float32). Both are stored as uint16_t.
+	DataTypeFloat16		= 0x4000,
+	DataTypeBFloat16	= 0x8000,
+
 	DataTypeArray	= 0x10000
 };
 
@@ -72,6 +83,11 @@ EMDLIB_API int emdTypeDepth(const DataType &type);
 EMDLIB_API QString emdTypeString(const DataType &type);
 EMDLIB_API QVariant emdTypeFromString(const QString &string, const DataType &type);
 EMDLIB_API bool isFloatType(DataType type);
+EMDLIB_API bool isComplexType(DataType type);
+
+// Adds a directory to the search path for HDF5 filter plugins (e.g.
+//	bitshuffle and zstd), in addition to HDF5_PLUGIN_PATH.
+EMDLIB_API bool addFilterPluginPath(const QString &path);
 
 EMDLIB_API const std::vector<int> &randomIndexes(const int &length, const int &max);
 
@@ -141,6 +157,18 @@ struct TypeTraits<double>
     static DataType dataType() {return DataTypeFloat64;}
 };
 
+template<>
+struct TypeTraits<std::complex<float> >
+{
+    static DataType dataType() {return DataTypeComplex64;}
+};
+
+template<>
+struct TypeTraits<std::complex<double> >
+{
+    static DataType dataType() {return DataTypeComplex128;}
+};
+
 template<>
 struct TypeTraits<bool>
 {
@@ -0,0 +1,80 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_VIRTUALDETECTOR_H
+#define EMD_VIRTUALDETECTOR_H
+
+#include "EmdLib.h"
+
+#include <vector>
+
+namespace H5
+{
+class H5File;
+}
+
+namespace emd
+{
+
+class DataGroup;
+class Dataset;
+
+// Integrates every diffraction pattern (the two fastest varying dims) of
+//	a DataGroup against one or more detector masks, giving one image over
+//	the scan dims per mask. All masks are applied in a single pass over 
+//	the data, which is either the loaded data or streamed from the file.
+class EMDLIB_API VirtualDetector
+{
+public:
+	VirtualDetector(DataGroup *dataGroup);
+
+	int frameRows() const {return m_frameRows;}
+	int frameColumns() const {return m_frameColumns;}
+
+	// Masks have one weight per detector pixel, in frame order (rows x
+	//	columns, with the columns varying fastest).
+	int addMask(const std::vector<float> &mask);
+	int addAnnularMask(double centerRow, double centerColumn, 
+		double innerRadius, double outerRadius);
+	int maskCount() const {return (int) m_masks.size();}
+	void clearMasks();
+
+	// Computes the images of all masks. If a file is given, data that is
+	//	not loaded is read from it block by block.
+	bool run(H5::H5File *file = 0);
+
+	// Creates a float Dataset with the image of a mask over the scan dims;
+	//	the caller takes ownership.
+	Dataset *createImage(int maskIndex) const;
+
+private:
+	bool runSparse(H5::H5File *file);
+
+	DataGroup *m_dataGroup;
+	int m_frameRows;
+	int m_frameColumns;
+	std::vector<int> m_scanDims;
+	std::vector<std::vector<float> > m_masks;
+	std::vector<std::vector<float> > m_images;
+};
+
+} // namespace emd
+
+#endif
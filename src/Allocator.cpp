@@ -0,0 +1,328 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "Allocator.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+namespace emd
+{
+
+const size_t BUFFER_ALIGNMENT = 64;
+
+// Pooled size classes, four per power of two (a block is at most 25%
+//	larger than requested) from 4KB up to 8MB, which covers frames;
+//	larger buffers are allocated at the size asked for
+const int MIN_POOL_SHIFT = 12;
+const int MAX_POOL_SHIFT = 23;
+const int CLASSES_PER_SHIFT = 4;
+const int POOL_CLASSES = (MAX_POOL_SHIFT - MIN_POOL_SHIFT) * CLASSES_PER_SHIFT + 1;
+const size_t MAX_POOLED_SIZE = (size_t) 1 << MAX_POOL_SHIFT;
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+enum BlockKind
+{
+	BlockPooled,
+	BlockAligned,
+	BlockMapped
+};
+
+// Stored in the alignment padding in front of every buffer
+struct BlockHeader
+{
+	uint64_t size;			// usable bytes
+	uint64_t requested;		// bytes asked for, counted in bytesInUse
+	uint64_t mappedSize;
+	int32_t kind;
+	int32_t sizeClass;
+};
+
+static_assert(sizeof(BlockHeader) <= BUFFER_ALIGNMENT, "Block header too large");
+
+// Never destroyed, as buffers may still be freed during static 
+//	destruction
+struct Pool
+{
+	std::mutex mutex;
+	std::vector<void*> blocks[POOL_CLASSES];
+	size_t limit;
+
+	Pool()
+		: limit(256LL * 1024LL * 1024LL)
+	{}
+};
+
+static Pool &pool();
+
+#ifndef _WIN32
+// A process forked while another thread holds the pool's lock would 
+//	never see it released (see ReaderPool::start), so forks wait for it
+static void lockPoolForFork()
+{
+	pool().mutex.lock();
+}
+
+static void unlockPoolAfterFork()
+{
+	pool().mutex.unlock();
+}
+#endif
+
+static Pool *createPool()
+{
+	Pool *pool = new Pool;
+#ifndef _WIN32
+	pthread_atfork(lockPoolForFork, unlockPoolAfterFork, unlockPoolAfterFork);
+#endif
+	return pool;
+}
+
+static Pool &pool()
+{
+	static Pool *pool = createPool();
+	return *pool;
+}
+static std::atomic<size_t> s_hugePageThreshold(1024LL * 1024LL * 1024LL);
+
+static std::atomic<int64_t> s_allocations(0);
+static std::atomic<int64_t> s_frees(0);
+static std::atomic<int64_t> s_poolHits(0);
+static std::atomic<int64_t> s_bytesInUse(0);
+static std::atomic<int64_t> s_peakBytesInUse(0);
+static std::atomic<int64_t> s_bytesPooled(0);
+static std::atomic<int64_t> s_hugePageBytes(0);
+
+static void *alignedAllocate(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, BUFFER_ALIGNMENT);
+#else
+	void *block = 0;
+	if(posix_memalign(&block, BUFFER_ALIGNMENT, size) != 0)
+		return 0;
+	return block;
+#endif
+}
+
+static void alignedFree(void *block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+static size_t classSize(int sizeClass)
+{
+	size_t base = (size_t) 1 << (MIN_POOL_SHIFT + sizeClass / CLASSES_PER_SHIFT);
+	return base + base / CLASSES_PER_SHIFT * (sizeClass % CLASSES_PER_SHIFT);
+}
+
+static int sizeClass(size_t size)
+{
+	int sizeClass = 0;
+	while(classSize(sizeClass) < size)
+		++sizeClass;
+	return sizeClass;
+}
+
+static void countAllocation(size_t size)
+{
+	++s_allocations;
+	int64_t inUse = (s_bytesInUse += (int64_t) size);
+	int64_t peak = s_peakBytesInUse.load();
+	while(inUse > peak && !s_peakBytesInUse.compare_exchange_weak(peak, inUse))
+		;
+}
+
+// Huge page mappings, where the platform has them
+static BlockHeader *mapBlock(size_t size)
+{
+#if defined(_WIN32) || !defined(MAP_ANONYMOUS)
+	(void) size;
+	return 0;
+#else
+	size_t mappedSize = (size + BUFFER_ALIGNMENT + HUGE_PAGE_SIZE - 1) 
+		/ HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	void *block = mmap(0, mappedSize, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(block == MAP_FAILED)
+		return 0;
+#ifdef MADV_HUGEPAGE
+	madvise(block, mappedSize, MADV_HUGEPAGE);
+#endif
+	BlockHeader *header = (BlockHeader*) block;
+	header->mappedSize = mappedSize;
+	return header;
+#endif
+}
+
+void *allocateBuffer(size_t size)
+{
+	if(size == 0)
+		size = 1;
+
+	BlockHeader *header = 0;
+	size_t threshold = s_hugePageThreshold.load();
+	if(threshold > 0 && size >= threshold)
+	{
+		header = mapBlock(size);
+		if(header)
+		{
+			header->kind = BlockMapped;
+			header->sizeClass = 0;
+			header->size = size;
+			s_hugePageBytes += (int64_t) size;
+		}
+	}
+
+	if(!header && size <= MAX_POOLED_SIZE)
+	{
+		int poolClass = sizeClass(size);
+		{
+			std::lock_guard<std::mutex> lock(pool().mutex);
+			std::vector<void*> &blocks = pool().blocks[poolClass];
+			if(!blocks.empty())
+			{
+				header = (BlockHeader*) blocks.back();
+				blocks.pop_back();
+				s_bytesPooled -= (int64_t) header->size;
+				++s_poolHits;
+			}
+		}
+
+		if(!header)
+		{
+			size_t blockSize = classSize(poolClass);
+			header = (BlockHeader*) alignedAllocate(blockSize + BUFFER_ALIGNMENT);
+			if(!header)
+				throw std::bad_alloc();
+			header->kind = BlockPooled;
+			header->sizeClass = poolClass;
+			header->size = blockSize;
+			header->mappedSize = 0;
+		}
+	}
+
+	if(!header)
+	{
+		header = (BlockHeader*) alignedAllocate(size + BUFFER_ALIGNMENT);
+		if(!header)
+			throw std::bad_alloc();
+		header->kind = BlockAligned;
+		header->sizeClass = 0;
+		header->size = size;
+		header->mappedSize = 0;
+	}
+
+	header->requested = size;
+	countAllocation(size);
+	return (char*) header + BUFFER_ALIGNMENT;
+}
+
+void freeBuffer(void *buffer)
+{
+	if(!buffer)
+		return;
+
+	BlockHeader *header = (BlockHeader*) ((char*) buffer - BUFFER_ALIGNMENT);
+	++s_frees;
+	s_bytesInUse -= (int64_t) header->requested;
+
+	switch(header->kind)
+	{
+	case BlockPooled:
+		{
+			std::lock_guard<std::mutex> lock(pool().mutex);
+			if((size_t) s_bytesPooled.load() + header->size <= pool().limit)
+			{
+				pool().blocks[header->sizeClass].push_back(header);
+				s_bytesPooled += (int64_t) header->size;
+				return;
+			}
+		}
+		alignedFree(header);
+		break;
+	case BlockMapped:
+		s_hugePageBytes -= (int64_t) header->size;
+#if !defined(_WIN32) && defined(MAP_ANONYMOUS)
+		munmap(header, header->mappedSize);
+#endif
+		break;
+	default:
+		alignedFree(header);
+		break;
+	}
+}
+
+AllocatorStatistics allocatorStatistics()
+{
+	AllocatorStatistics statistics;
+	statistics.allocations = s_allocations.load();
+	statistics.frees = s_frees.load();
+	statistics.poolHits = s_poolHits.load();
+	statistics.bytesInUse = s_bytesInUse.load();
+	statistics.peakBytesInUse = s_peakBytesInUse.load();
+	statistics.bytesPooled = s_bytesPooled.load();
+	statistics.hugePageBytes = s_hugePageBytes.load();
+	return statistics;
+}
+
+void setHugePageThreshold(size_t bytes)
+{
+	s_hugePageThreshold.store(bytes);
+}
+
+void setBufferPoolLimit(size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool().mutex);
+		pool().limit = bytes;
+	}
+	if((size_t) s_bytesPooled.load() > bytes)
+		trimBufferPool();
+}
+
+void trimBufferPool()
+{
+	std::lock_guard<std::mutex> lock(pool().mutex);
+	for(std::vector<void*> &blocks : pool().blocks)
+	{
+		for(void *block : blocks)
+			alignedFree(block);
+		blocks.clear();
+	}
+	s_bytesPooled.store(0);
+}
+
+} // namespace emd
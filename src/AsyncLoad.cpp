@@ -0,0 +1,394 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "AsyncLoad.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "H5Cpp.h"
+
+#include <QDebug>
+
+#include "DataGroup.h"
+
+#ifndef H5_NO_NAMESPACE
+using namespace H5;
+#endif
+
+namespace emd
+{
+
+struct LoadHandle::State
+{
+	LoadProgress progress;
+
+	DataGroup *group;
+	QString filePath;
+	Dataset::LoadOptions options;
+	Callback finishedCallback;
+
+	mutable std::mutex mutex;
+	mutable std::condition_variable condition;
+	bool finished;
+	LoadError error;
+	QString message;
+	std::chrono::steady_clock::time_point startTime;
+	bool started;
+
+	State()
+		: group(0),
+		finished(false),
+		error(LoadErrorNone),
+		started(false)
+	{}
+};
+
+// All loads run one after another on a single thread, each holding the
+//	I/O lock, as the HDF5 library may only be used from one thread at a
+//	time.
+class IoThread
+{
+public:
+	static IoThread &instance()
+	{
+		static IoThread thread;
+		return thread;
+	}
+
+	~IoThread()
+	{
+		std::deque<IoJob> dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+			dropped.swap(m_queue);
+		}
+		m_condition.notify_all();
+		if(m_thread.joinable())
+			m_thread.join();
+
+		for(const IoJob &job : dropped)
+			job(false);
+	}
+
+	void queue(const IoJob &job, bool urgent)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(!m_thread.joinable())
+				m_thread = std::thread(&IoThread::run, this);
+			if(urgent)
+				m_queue.push_front(job);
+			else
+				m_queue.push_back(job);
+		}
+		m_condition.notify_one();
+	}
+
+	static void finish(const std::shared_ptr<LoadHandle::State> &state, 
+		LoadError error, const QString &message)
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->finished = true;
+			state->error = error;
+			state->message = message;
+		}
+		state->condition.notify_all();
+
+		if(state->finishedCallback)
+			state->finishedCallback(LoadHandle(state));
+	}
+
+	static void load(const std::shared_ptr<LoadHandle::State> &state, bool run)
+	{
+		if(!run || state->progress.isCancelled())
+		{
+			finish(state, LoadErrorCancelled, QString());
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->startTime = std::chrono::steady_clock::now();
+			state->started = true;
+		}
+
+		// Reloading would drop unsaved changes
+		DataGroup *group = state->group;
+		if(group->isDirty())
+		{
+			finish(state, LoadErrorDirty, QString("Data group has unsaved changes"));
+			return;
+		}
+
+		Dataset::LoadOptions options = state->options;
+		options.progress = &state->progress;
+
+		LoadError error = LoadErrorNone;
+		QString message;
+		H5File *file = 0;
+		try {
+			Exception::dontPrint();
+			QByteArray ba = state->filePath.toLocal8Bit();
+			file = new H5File(ba.constData(), H5F_ACC_RDONLY);
+
+			if(group->isLoaded())
+				group->unload();
+			if(!group->load(file, options))
+			{
+				error = (LoadError) state->progress.error.load();
+				if(error == LoadErrorNone)
+					error = LoadErrorUnknown;
+			}
+		}
+		catch(FileIException exception) {
+			error = LoadErrorFile;
+			message = exception.getCDetailMsg();
+		}
+		catch(GroupIException exception) {
+			error = LoadErrorFile;
+			message = exception.getCDetailMsg();
+		}
+		catch(DataSetIException exception) {
+			error = LoadErrorDataSet;
+			message = exception.getCDetailMsg();
+		}
+		catch(DataSpaceIException exception) {
+			error = LoadErrorDataSpace;
+			message = exception.getCDetailMsg();
+		}
+		catch(AttributeIException exception) {
+			error = LoadErrorAttribute;
+			message = exception.getCDetailMsg();
+		}
+		catch(Exception exception) {
+			error = LoadErrorUnknown;
+			message = exception.getCDetailMsg();
+		}
+		catch(std::bad_alloc) {
+			error = LoadErrorMemory;
+		}
+
+		if(file)
+		{
+			file->close();
+			delete file;
+		}
+
+		// Partly loaded data is not kept
+		if(error != LoadErrorNone && group->isLoaded())
+			group->unload();
+
+		if(error != LoadErrorNone && error != LoadErrorCancelled)
+			qDebug() << "Load failed: " << message;
+
+		finish(state, error, message);
+	}
+
+private:
+	IoThread()
+		: m_stop(false)
+	{}
+
+	void run()
+	{
+		while(true)
+		{
+			IoJob job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_condition.wait(lock, [this] {return m_stop || !m_queue.empty();});
+				if(m_stop)
+					return;
+
+				job = m_queue.front();
+				m_queue.pop_front();
+			}
+
+			std::lock_guard<std::recursive_mutex> lock(ioMutex());
+			job(true);
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::deque<IoJob> m_queue;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+std::recursive_mutex &ioMutex()
+{
+	static std::recursive_mutex *mutex = new std::recursive_mutex;
+	return *mutex;
+}
+
+void queueIoJob(const IoJob &job, bool urgent)
+{
+	IoThread::instance().queue(job, urgent);
+}
+
+LoadHandle::LoadHandle()
+{
+}
+
+LoadHandle::LoadHandle(const std::shared_ptr<State> &state)
+	: m_state(state)
+{
+}
+
+LoadHandle LoadHandle::load(DataGroup *group, const QString &filePath, 
+	const Dataset::LoadOptions &options, const Callback &finished)
+{
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->group = group;
+	state->filePath = filePath;
+	state->options = options;
+	state->options.progress = 0;
+	state->finishedCallback = finished;
+
+	if(!group)
+		IoThread::finish(state, LoadErrorInvalidGroup, QString());
+	else
+		queueIoJob([state](bool run) {IoThread::load(state, run);});
+
+	return LoadHandle(state);
+}
+
+DataGroup *LoadHandle::dataGroup() const
+{
+	return m_state ? m_state->group : 0;
+}
+
+bool LoadHandle::isFinished() const
+{
+	if(!m_state)
+		return true;
+
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->finished;
+}
+
+void LoadHandle::wait() const
+{
+	if(!m_state)
+		return;
+
+	std::unique_lock<std::mutex> lock(m_state->mutex);
+	m_state->condition.wait(lock, [this] {return m_state->finished;});
+}
+
+bool LoadHandle::waitFor(int milliseconds) const
+{
+	if(!m_state)
+		return true;
+
+	std::unique_lock<std::mutex> lock(m_state->mutex);
+	return m_state->condition.wait_for(lock, std::chrono::milliseconds(milliseconds), 
+		[this] {return m_state->finished;});
+}
+
+void LoadHandle::cancel()
+{
+	if(m_state)
+		m_state->progress.cancelled.store(true);
+}
+
+bool LoadHandle::succeeded() const
+{
+	if(!m_state)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->finished && m_state->error == LoadErrorNone;
+}
+
+LoadError LoadHandle::error() const
+{
+	if(!m_state)
+		return LoadErrorInvalidGroup;
+
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->error;
+}
+
+QString LoadHandle::errorMessage() const
+{
+	if(!m_state)
+		return QString();
+
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->message;
+}
+
+int64_t LoadHandle::bytesRead() const
+{
+	return m_state ? m_state->progress.bytesRead.load() : 0;
+}
+
+int64_t LoadHandle::bytesTotal() const
+{
+	return m_state ? m_state->progress.bytesTotal.load() : 0;
+}
+
+double LoadHandle::progress() const
+{
+	if(isFinished())
+		return 1;
+
+	int64_t total = bytesTotal();
+	if(total <= 0)
+		return 0;
+
+	return std::min(1.0, (double) bytesRead() / total);
+}
+
+double LoadHandle::secondsRemaining() const
+{
+	if(!m_state)
+		return 0;
+
+	std::chrono::steady_clock::time_point startTime;
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		if(m_state->finished)
+			return 0;
+		if(!m_state->started)
+			return -1;
+		startTime = m_state->startTime;
+	}
+
+	int64_t read = bytesRead();
+	int64_t total = bytesTotal();
+	if(read <= 0 || total <= 0)
+		return -1;
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	return elapsed.count() * std::max<int64_t>(0, total - read) / read;
+}
+
+} // namespace emd
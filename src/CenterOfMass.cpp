@@ -0,0 +1,275 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "CenterOfMass.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <H5Cpp.h>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Convert.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameStream.h"
+#include "Parallel.h"
+#include "Simd.h"
+
+namespace emd
+{
+
+// Frames handed to one thread at a time
+static const int64_t FRAME_GRAIN = 16;
+
+CenterOfMass::CenterOfMass(DataGroup *dataGroup)
+	: m_dataGroup(dataGroup),
+	m_frameRows(0),
+	m_frameColumns(0),
+	m_threshold(-std::numeric_limits<float>::max())
+{
+	const Dataset *data = m_dataGroup->data();
+	if(data)
+	{
+		data->frameShape(m_frameRows, m_frameColumns);
+		m_scanDims = data->scanDims();
+	}
+
+	if(m_scanDims.empty())
+		m_scanDims.push_back(1);
+
+	m_mask.assign((size_t) m_frameRows * m_frameColumns, 1.0f);
+	setOrigin(0.5 * (m_frameRows - 1), 0.5 * (m_frameColumns - 1));
+}
+
+bool CenterOfMass::setMask(const std::vector<float> &mask)
+{
+	if((int64_t) mask.size() != (int64_t) m_frameRows * m_frameColumns)
+		return false;
+
+	m_mask = mask;
+	return true;
+}
+
+void CenterOfMass::setOrigin(double row, double column)
+{
+	m_originRow = row;
+	m_originColumn = column;
+}
+
+struct FrameMoments
+{
+	const std::vector<float> *mask;
+	std::vector<float> columnCoordinates;
+	int rows;
+	int columns;
+	float threshold;
+	float originRow;
+	float originColumn;
+};
+
+template <typename T>
+static void frameMoments(const T *frames, int64_t firstFrame, int64_t frameCount,
+	const FrameMoments &params, std::vector<float> &rows, 
+	std::vector<float> &columns, std::vector<float> &intensities)
+{
+	int64_t frameSize = (int64_t) params.rows * params.columns;
+	parallelFor(0, frameCount, FRAME_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		std::vector<float> scratch(params.columns);
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			const T *data = frames + frame * frameSize;
+			double sum = 0, rowMoment = 0, columnMoment = 0;
+
+			// The column moment is accumulated along each row; the row
+			//	moment follows from the row sums.
+			for(int row = 0; row < params.rows; ++row)
+			{
+				int64_t offset = (int64_t) row * params.columns;
+				simd::convert(data + offset, scratch.data(), params.columns);
+
+				float rowSum, rowColumnMoment;
+				simd::moments(scratch.data(), params.mask->data() + offset,
+					params.columnCoordinates.data(), params.columns, 
+					params.threshold, rowSum, rowColumnMoment);
+
+				sum += rowSum;
+				rowMoment += (double) rowSum * (row - params.originRow);
+				columnMoment += rowColumnMoment;
+			}
+
+			int64_t index = firstFrame + frame;
+			intensities[index] = (float) sum;
+			rows[index] = (sum != 0 ? (float) (rowMoment / sum) : 0.0f);
+			columns[index] = (sum != 0 ? (float) (columnMoment / sum) : 0.0f);
+		}
+	});
+}
+
+// Takes the moments of the blocks of a FrameStream
+struct BlockMoments
+{
+	const FrameMoments *params;
+	std::vector<float> *rows;
+	std::vector<float> *columns;
+	std::vector<float> *intensities;
+
+	template <typename T>
+	void operator()(const T *frames, int64_t firstFrame, int64_t frameCount)
+	{
+		frameMoments(frames, firstFrame, frameCount, *params, *rows, *columns, *intensities);
+	}
+};
+
+bool CenterOfMass::run(H5::H5File *file)
+{
+	const Dataset *data = m_dataGroup->data();
+	if(!data)
+		return false;
+
+	if(data->isSparse())
+		return runSparse(file);
+
+	FrameStream stream(data);
+	if(!stream.isValid())
+		return false;
+
+	if(!isNumericType(stream.dataType()))
+	{
+		qWarning() << "Unsupported data type for center of mass";
+		return false;
+	}
+
+	if(!data->isLoaded())
+	{
+		if(!file || !stream.open(file))
+			return false;
+	}
+
+	int64_t count = stream.frameCount();
+	m_rows.assign(count, 0.0f);
+	m_columns.assign(count, 0.0f);
+	m_intensities.assign(count, 0.0f);
+
+	FrameMoments params;
+	params.mask = &m_mask;
+	params.rows = m_frameRows;
+	params.columns = m_frameColumns;
+	params.threshold = m_threshold;
+	params.originRow = (float) m_originRow;
+	params.originColumn = (float) m_originColumn;
+	for(int column = 0; column < m_frameColumns; ++column)
+		params.columnCoordinates.push_back((float) (column - m_originColumn));
+
+	BlockMoments moments = {&params, &m_rows, &m_columns, &m_intensities};
+	if(!stream.forEachBlock(moments))
+	{
+		m_intensities.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool CenterOfMass::runSparse(H5::H5File *file)
+{
+	bool wasLoaded = m_dataGroup->isLoaded();
+	if(!wasLoaded && (!file || !m_dataGroup->load(file)))
+		return false;
+
+	const Dataset *data = m_dataGroup->data();
+	int64_t count = data->sparseFrameCount();
+	m_rows.assign(count, 0.0f);
+	m_columns.assign(count, 0.0f);
+	m_intensities.assign(count, 0.0f);
+
+	uint32_t frameSize = (uint32_t) m_mask.size();
+	parallelFor(0, count, FRAME_GRAIN * 16, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			int64_t eventCount;
+			const uint32_t *events = data->sparseEvents(frame, eventCount);
+			double sum = 0, rowMoment = 0, columnMoment = 0;
+			for(int64_t iii = 0; iii < eventCount; ++iii)
+			{
+				uint32_t pixel = events[iii];
+				if(pixel >= frameSize)
+					continue;
+
+				double weight = m_mask[pixel];
+				sum += weight;
+				rowMoment += weight * (pixel / m_frameColumns - m_originRow);
+				columnMoment += weight * (pixel % m_frameColumns - m_originColumn);
+			}
+
+			m_intensities[frame] = (float) sum;
+			m_rows[frame] = (sum != 0 ? (float) (rowMoment / sum) : 0.0f);
+			m_columns[frame] = (sum != 0 ? (float) (columnMoment / sum) : 0.0f);
+		}
+	});
+
+	if(!wasLoaded)
+		m_dataGroup->unload();
+
+	return true;
+}
+
+Dataset *CenterOfMass::createImage(Component component) const
+{
+	if(m_intensities.empty())
+		return 0;
+
+	size_t count = m_intensities.size();
+	float *image = (float*) allocateBuffer(count * sizeof(float));
+	for(size_t iii = 0; iii < count; ++iii)
+	{
+		switch(component)
+		{
+		case ComponentRow:
+			image[iii] = m_rows[iii];
+			break;
+		case ComponentColumn:
+			image[iii] = m_columns[iii];
+			break;
+		case ComponentMagnitude:
+			image[iii] = std::sqrt(m_rows[iii] * m_rows[iii] + m_columns[iii] * m_columns[iii]);
+			break;
+		case ComponentAngle:
+			image[iii] = std::atan2(m_rows[iii], m_columns[iii]);
+			break;
+		case ComponentIntensity:
+			image[iii] = m_intensities[iii];
+			break;
+		}
+	}
+
+	Dataset *dataset = new Dataset((int) m_scanDims.size(), m_scanDims.data(), 
+		DataTypeFloat32, (char*) image, AllocatedBuffer, m_dataGroup->dataOrder());
+	dataset->setName("data");
+
+	return dataset;
+}
+
+} // namespace emd
@@ -0,0 +1,344 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Complex.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Dataset.h"
+#include "Frame.h"
+#include "Parallel.h"
+#include "Simd.h"
+
+namespace emd
+{
+
+// Rows handed to one thread at a time
+static const int64_t ROW_GRAIN = 64;
+
+// One row of interleaved complex values
+template <typename R>
+static void componentRow(const R *complex, int64_t length, 
+	ComplexComponent component, R *result)
+{
+	switch(component)
+	{
+	case ComplexReal:
+		for(int64_t iii = 0; iii < length; ++iii)
+			result[iii] = complex[2 * iii];
+		break;
+	case ComplexImaginary:
+		for(int64_t iii = 0; iii < length; ++iii)
+			result[iii] = complex[2 * iii + 1];
+		break;
+	case ComplexMagnitude:
+		simd::magnitude(complex, result, length);
+		break;
+	case ComplexPhase:
+		for(int64_t iii = 0; iii < length; ++iii)
+			result[iii] = std::atan2(complex[2 * iii + 1], complex[2 * iii]);
+		break;
+	}
+}
+
+template <typename R>
+static void interleavedComponent(const Frame *frame, ComplexComponent component, R *result)
+{
+	Frame::Data<const R> data = frame->data<R>();
+	int columns = data.hSize;
+
+	parallelFor(0, data.vSize, ROW_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		std::vector<R> line;
+		for(int64_t row = begin; row < end; ++row)
+		{
+			const R *values = data.real + 2 * row * data.vStep;
+			if(data.hStep != 1)
+			{
+				line.resize(2 * columns);
+				for(int column = 0; column < columns; ++column)
+				{
+					line[2 * column] = values[2 * column * data.hStep];
+					line[2 * column + 1] = values[2 * column * data.hStep + 1];
+				}
+				values = line.data();
+			}
+			componentRow(values, columns, component, result + row * columns);
+		}
+	});
+}
+
+// Separate real and imaginary pointers (data with a complex dim); real
+//	frames are treated as having a zero imaginary part
+template <typename R, typename S>
+static void splitComponent(const Frame *frame, ComplexComponent component, R *result)
+{
+	Frame::Data<const S> data = frame->data<S>();
+	int columns = data.hSize;
+
+	parallelFor(0, data.vSize, ROW_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t row = begin; row < end; ++row)
+		{
+			R *line = result + row * columns;
+			for(int column = 0; column < columns; ++column)
+			{
+				int64_t index = row * data.vStep + column * data.hStep;
+				R re = (R) data.real[index];
+				R im = data.imaginary ? (R) data.imaginary[index] : 0;
+				switch(component)
+				{
+				case ComplexReal:
+					line[column] = re;
+					break;
+				case ComplexImaginary:
+					line[column] = im;
+					break;
+				case ComplexMagnitude:
+					line[column] = std::sqrt(re * re + im * im);
+					break;
+				case ComplexPhase:
+					line[column] = std::atan2(im, re);
+					break;
+				}
+			}
+		}
+	});
+}
+
+template <typename R>
+static bool splitComponent(const Frame *frame, ComplexComponent component, R *result)
+{
+	switch(frame->dataType())
+	{
+	case DataTypeInt8:
+		splitComponent<R, int8_t>(frame, component, result);
+		break;
+	case DataTypeInt16:
+		splitComponent<R, int16_t>(frame, component, result);
+		break;
+	case DataTypeInt32:
+		splitComponent<R, int32_t>(frame, component, result);
+		break;
+	case DataTypeInt64:
+		splitComponent<R, int64_t>(frame, component, result);
+		break;
+	case DataTypeUInt8:
+		splitComponent<R, uint8_t>(frame, component, result);
+		break;
+	case DataTypeUInt16:
+		splitComponent<R, uint16_t>(frame, component, result);
+		break;
+	case DataTypeUInt32:
+		splitComponent<R, uint32_t>(frame, component, result);
+		break;
+	case DataTypeUInt64:
+		splitComponent<R, uint64_t>(frame, component, result);
+		break;
+	case DataTypeFloat32:
+		splitComponent<R, float>(frame, component, result);
+		break;
+	case DataTypeFloat64:
+		splitComponent<R, double>(frame, component, result);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+Frame *complexFrame(const Frame *frame, ComplexComponent component)
+{
+	if(!frame)
+		return NULL;
+
+	Frame::Data<const void> data = frame->data<void>();
+	if(!data.real)
+		return NULL;
+
+	// 16 bit floats are taken as Float32
+	std::unique_ptr<Frame> expanded(frame->toFloat32());
+	if(expanded)
+		frame = expanded.get();
+
+	int64_t size = (int64_t) data.hSize * data.vSize;
+	DataType type = frame->dataType();
+	bool isDouble = (type == DataTypeComplex128 || type == DataTypeFloat64);
+	DataType resultType = isDouble ? DataTypeFloat64 : DataTypeFloat32;
+	char *result = (char*) allocateBuffer(size * emdTypeDepth(resultType));
+
+	bool converted = true;
+	if(type == DataTypeComplex64)
+		interleavedComponent(frame, component, (float*) result);
+	else if(type == DataTypeComplex128)
+		interleavedComponent(frame, component, (double*) result);
+	else if(isDouble)
+		converted = splitComponent(frame, component, (double*) result);
+	else
+		converted = splitComponent(frame, component, (float*) result);
+
+	if(!converted)
+	{
+		qWarning() << "Unsupported data type for complex frame";
+		freeBuffer(result);
+		return NULL;
+	}
+
+	// Components of a spectrum are still displayed as a spectrum
+	int64_t attributes = data.attributes & (Frame::AttributeFourierTransformed 
+		| Frame::AttributeFourierTransformedNoShift);
+	Frame::Data<void> resultData(attributes, 1, data.hSize, data.hSize, data.vSize, 
+		result, NULL);
+
+	Frame *resultFrame = new Frame(resultData, resultType, AllocatedBuffer);
+	resultFrame->setIndex(frame->index());
+
+	return resultFrame;
+}
+
+// Number of elements of the dims that vary faster than dim, skipping it
+static int64_t fasterCount(const std::vector<int> &lengths, int dim, bool descending)
+{
+	int64_t count = 1;
+	for(int iii = 0; iii < (int) lengths.size(); ++iii)
+	{
+		if(descending ? iii > dim : iii < dim)
+			count *= lengths[iii];
+	}
+
+	return count;
+}
+
+Dataset *interleaveComplex(const Dataset *data)
+{
+	if(!data || !data->rawData() || data->isSparse())
+		return 0;
+
+	int complexIndex = data->complexIndex();
+	if(complexIndex < 0 || data->dataSpace().dimLength(complexIndex) != 2)
+		return 0;
+
+	DataType type = data->dataType();
+	if(type != DataTypeFloat32 && type != DataTypeFloat64)
+	{
+		qWarning() << "Complex dims must be Float32 or Float64 to interleave";
+		return 0;
+	}
+
+	std::vector<int> lengths;
+	int64_t size = 1;
+	for(int iii = 0; iii < data->dimCount(); ++iii)
+	{
+		int length = data->dataSpace().dimLength(iii);
+		size *= length;
+		if(iii != complexIndex)
+			lengths.push_back(length);
+	}
+
+	// Every block of inner real values is followed by its imaginary block
+	std::vector<int> allLengths = lengths;
+	allLengths.insert(allLengths.begin() + complexIndex, 2);
+	int64_t inner = fasterCount(allLengths, complexIndex, data->dataOrder());
+	int64_t outer = size / (2 * inner);
+
+	int depth = emdTypeDepth(type);
+	char *result = (char*) allocateBuffer(size * depth);
+	parallelFor(0, outer, 1, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t block = begin; block < end; ++block)
+		{
+			int64_t offset = block * 2 * inner;
+			if(type == DataTypeFloat32)
+			{
+				const float *values = (const float*) data->rawData() + offset;
+				simd::interleave(values, values + inner, (float*) result + offset, inner);
+			}
+			else
+			{
+				const double *values = (const double*) data->rawData() + offset;
+				simd::interleave(values, values + inner, (double*) result + offset, inner);
+			}
+		}
+	});
+
+	DataType complexType = (type == DataTypeFloat32 ? DataTypeComplex64 : DataTypeComplex128);
+	Dataset *dataset = new Dataset((int) lengths.size(), lengths.data(), complexType, 
+		result, AllocatedBuffer, data->dataOrder());
+	dataset->setName(data->name());
+
+	return dataset;
+}
+
+Dataset *splitComplex(const Dataset *data, int complexIndex)
+{
+	if(!data || !data->rawData() || !isComplexType(data->dataType()))
+		return 0;
+
+	if(complexIndex < 0 || complexIndex > data->dimCount())
+		return 0;
+
+	std::vector<int> lengths;
+	int64_t size = 1;
+	for(int iii = 0; iii < data->dimCount(); ++iii)
+	{
+		lengths.push_back(data->dataSpace().dimLength(iii));
+		size *= lengths.back();
+	}
+	lengths.insert(lengths.begin() + complexIndex, 2);
+
+	int64_t inner = fasterCount(lengths, complexIndex, data->dataOrder());
+	int64_t outer = size / inner;
+
+	DataType type = (data->dataType() == DataTypeComplex64 ? DataTypeFloat32 : DataTypeFloat64);
+	char *result = (char*) allocateBuffer(2 * size * emdTypeDepth(type));
+	parallelFor(0, outer, 1, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t block = begin; block < end; ++block)
+		{
+			int64_t offset = block * 2 * inner;
+			if(type == DataTypeFloat32)
+			{
+				float *values = (float*) result + offset;
+				simd::deinterleave((const float*) data->rawData() + offset, values, values + inner, inner);
+			}
+			else
+			{
+				double *values = (double*) result + offset;
+				simd::deinterleave((const double*) data->rawData() + offset, values, values + inner, inner);
+			}
+		}
+	});
+
+	Dataset *dataset = new Dataset((int) lengths.size(), lengths.data(), type, 
+		result, AllocatedBuffer, data->dataOrder());
+	dataset->setName(data->name());
+	dataset->setComplexIndex(complexIndex);
+
+	return dataset;
+}
+
+} // namespace emd
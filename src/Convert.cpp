@@ -0,0 +1,258 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Parallel.h"
+#include "Simd.h"
+
+namespace emd
+{
+
+// Values handed to one thread at a time
+static const int64_t CONVERT_GRAIN = 256 * 1024;
+
+// 16 bit floats go through a float buffer of this many values
+static const int64_t STAGING_LENGTH = 4096;
+
+template <typename D>
+static inline D saturate(double value)
+{
+	if(!std::numeric_limits<D>::is_integer)
+		return (D) value;
+
+	if(value != value)
+		return 0;
+	if(value <= (double) std::numeric_limits<D>::lowest())
+		return std::numeric_limits<D>::lowest();
+	if(value >= (double) std::numeric_limits<D>::max())
+		return std::numeric_limits<D>::max();
+
+	return (D) std::nearbyint(value);
+}
+
+template <typename S, typename D>
+static void convertRange(const S *source, D *destination, int64_t count, 
+	double scale, double offset)
+{
+	if(scale == 1 && offset == 0)
+	{
+		for(int64_t iii = 0; iii < count; ++iii)
+			destination[iii] = saturate<D>((double) source[iii]);
+	}
+	else
+	{
+		for(int64_t iii = 0; iii < count; ++iii)
+			destination[iii] = saturate<D>(source[iii] * scale + offset);
+	}
+}
+
+// The usual detector types have vectorized kernels
+template <>
+void convertRange(const uint8_t *source, float *destination, int64_t count, 
+	double scale, double offset)
+{
+	simd::scale(source, destination, count, (float) scale, (float) offset);
+}
+
+template <>
+void convertRange(const uint16_t *source, float *destination, int64_t count, 
+	double scale, double offset)
+{
+	simd::scale(source, destination, count, (float) scale, (float) offset);
+}
+
+template <>
+void convertRange(const int16_t *source, float *destination, int64_t count, 
+	double scale, double offset)
+{
+	simd::scale(source, destination, count, (float) scale, (float) offset);
+}
+
+template <>
+void convertRange(const int32_t *source, float *destination, int64_t count, 
+	double scale, double offset)
+{
+	simd::scale(source, destination, count, (float) scale, (float) offset);
+}
+
+template <>
+void convertRange(const float *source, float *destination, int64_t count, 
+	double scale, double offset)
+{
+	simd::scale(source, destination, count, (float) scale, (float) offset);
+}
+
+template <typename S>
+static bool convertFrom(const S *source, void *destination, DataType type, 
+	int64_t count, double scale, double offset)
+{
+	switch(type)
+	{
+	case DataTypeInt8:
+		convertRange(source, (int8_t*) destination, count, scale, offset);
+		break;
+	case DataTypeInt16:
+		convertRange(source, (int16_t*) destination, count, scale, offset);
+		break;
+	case DataTypeInt32:
+		convertRange(source, (int32_t*) destination, count, scale, offset);
+		break;
+	case DataTypeInt64:
+		convertRange(source, (int64_t*) destination, count, scale, offset);
+		break;
+	case DataTypeUInt8:
+		convertRange(source, (uint8_t*) destination, count, scale, offset);
+		break;
+	case DataTypeUInt16:
+		convertRange(source, (uint16_t*) destination, count, scale, offset);
+		break;
+	case DataTypeUInt32:
+		convertRange(source, (uint32_t*) destination, count, scale, offset);
+		break;
+	case DataTypeUInt64:
+		convertRange(source, (uint64_t*) destination, count, scale, offset);
+		break;
+	case DataTypeFloat32:
+		convertRange(source, (float*) destination, count, scale, offset);
+		break;
+	case DataTypeFloat64:
+		convertRange(source, (double*) destination, count, scale, offset);
+		break;
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
+		{
+			float staging[STAGING_LENGTH];
+			uint16_t *result = (uint16_t*) destination;
+			for(int64_t start = 0; start < count; start += STAGING_LENGTH)
+			{
+				int64_t length = std::min(STAGING_LENGTH, count - start);
+				convertRange(source + start, staging, length, scale, offset);
+				if(type == DataTypeFloat16)
+					simd::floatToHalf(staging, result + start, length);
+				else
+					simd::floatToBfloat16(staging, result + start, length);
+			}
+		}
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+static bool convertRange(const char *source, DataType sourceType, 
+	char *destination, DataType destinationType, int64_t count, 
+	double scale, double offset)
+{
+	switch(sourceType)
+	{
+	case DataTypeInt8:
+		return convertFrom((const int8_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeInt16:
+		return convertFrom((const int16_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeInt32:
+		return convertFrom((const int32_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeInt64:
+		return convertFrom((const int64_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeUInt8:
+		return convertFrom((const uint8_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeUInt16:
+		return convertFrom((const uint16_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeUInt32:
+		return convertFrom((const uint32_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeUInt64:
+		return convertFrom((const uint64_t*) source, destination, destinationType, count, scale, offset);
+	case DataTypeFloat32:
+		return convertFrom((const float*) source, destination, destinationType, count, scale, offset);
+	case DataTypeFloat64:
+		return convertFrom((const double*) source, destination, destinationType, count, scale, offset);
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
+		{
+			float staging[STAGING_LENGTH];
+			const uint16_t *values = (const uint16_t*) source;
+			int depth = emdTypeDepth(destinationType);
+			for(int64_t start = 0; start < count; start += STAGING_LENGTH)
+			{
+				int64_t length = std::min(STAGING_LENGTH, count - start);
+				if(sourceType == DataTypeFloat16)
+					simd::halfToFloat(values + start, staging, length);
+				else
+					simd::bfloat16ToFloat(values + start, staging, length);
+				if(!convertFrom(staging, destination + start * depth, destinationType, 
+						length, scale, offset))
+					return false;
+			}
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool isNumericType(DataType type)
+{
+	switch(type)
+	{
+	case DataTypeInt8:
+	case DataTypeInt16:
+	case DataTypeInt32:
+	case DataTypeInt64:
+	case DataTypeUInt8:
+	case DataTypeUInt16:
+	case DataTypeUInt32:
+	case DataTypeUInt64:
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
+	case DataTypeFloat32:
+	case DataTypeFloat64:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool convertValues(const void *source, DataType sourceType, 
+	void *destination, DataType destinationType, int64_t count, 
+	double scale, double offset)
+{
+	if(!isNumericType(sourceType) || !isNumericType(destinationType))
+		return false;
+
+	int sourceDepth = emdTypeDepth(sourceType);
+	int destinationDepth = emdTypeDepth(destinationType);
+	parallelFor(0, count, CONVERT_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		convertRange((const char*) source + begin * sourceDepth, sourceType, 
+			(char*) destination + begin * destinationDepth, destinationType, 
+			end - begin, scale, offset);
+	});
+
+	return true;
+}
+
+} // namespace emd
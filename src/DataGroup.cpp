@@ -25,7 +25,9 @@
 #include <QDebug>
 
 #include "Attribute.h"
+#include "Convert.h"
 #include "Dataset.h"
+#include "Util.h"
 
 namespace emd
 {
@@ -71,12 +73,7 @@ Dataset *DataGroup::dimData(const int &index) const
 bool DataGroup::isIntType() const
 {
 	emd::DataType type = m_data->dataType();
-	if(type == DataTypeUnknown
-		|| type == DataTypeFloat32
-		|| type == DataTypeFloat64)
-		return false;
-
-	return true;
+	return isNumericType(type) && !isFloatType(type) && !isComplexType(type);
 }
 
 bool DataGroup::hasComplexDim() const
@@ -180,6 +177,16 @@ Frame *DataGroup::getFrame()
 }
 
 bool DataGroup::load(H5::H5File *file)
+{
+	return loadData(file, NULL);
+}
+
+bool DataGroup::load(H5::H5File *file, const Dataset::LoadOptions &options)
+{
+	return loadData(file, &options);
+}
+
+bool DataGroup::loadData(H5::H5File *file, const Dataset::LoadOptions *options)
 {
 	if(!m_data)
 		return false;
@@ -188,8 +195,16 @@ bool DataGroup::load(H5::H5File *file)
 	QByteArray ba = path.toLocal8Bit();
 	const char *cPath = ba.data();
 	hid_t objID = H5Oopen(file->getId(), cPath, H5P_DEFAULT);
+	// The wrappers take references of their own, which are all that
+	//	should keep the file open
 	H5::DataSet dataSet(objID);
-	m_data->loadData(dataSet);
+	H5Oclose(objID);
+	if(options)
+		m_data->loadData(dataSet, *options);
+	else
+		m_data->loadData(dataSet);
+	if(!m_data->isLoaded())
+		return false;
 
 	// Load dims
 	for(Dataset *dim : m_dims)
@@ -199,11 +214,71 @@ bool DataGroup::load(H5::H5File *file)
 		cPath = ba.data();
 		hid_t objID = H5Oopen(file->getId(), cPath, H5P_DEFAULT);
 		dataSet = H5::DataSet(objID);
+		H5Oclose(objID);
+		dim->unloadData();
 		dim->loadData(dataSet);
 	}
+
+	// Calibrations follow a reduced load
+	if(options && options->isDecimated())
+	{
+		for(int iii = 0; iii < (int)m_dims.size(); ++iii)
+			m_dims[iii]->decimateDim(options->binningFactor(iii), options->strideFactor(iii));
+	}
+	checkDimLengths();
 	return true;
 }
 
+bool DataGroup::read(H5::H5File *file, const Dataset::Selection &selection, 
+	void *destination, DataType type, const std::vector<int64_t> &strides) const
+{
+	if(!m_data)
+		return false;
+
+	QByteArray ba = m_data->path().toLocal8Bit();
+	hid_t objID = H5Oopen(file->getId(), ba.data(), H5P_DEFAULT);
+	if(objID < 0)
+		return false;
+	H5::DataSet dataSet(objID);
+	H5Oclose(objID);
+	return m_data->read(dataSet, selection, destination, type, strides);
+}
+
+bool DataGroup::refresh(H5::H5File *file)
+{
+	if(!m_data)
+		return false;
+
+	QList<Dataset*> datasets;
+	datasets.append(m_data);
+	datasets.append(m_dims);
+
+	// Calibrations that are reloaded follow a reduced load again
+	const Dataset::LoadOptions &options = m_data->loadOptions();
+	bool changed = false;
+	for(int iii = 0; iii < datasets.count(); ++iii)
+	{
+		Dataset *dataset = datasets[iii];
+		QByteArray ba = dataset->path().toLocal8Bit();
+		hid_t objID = H5Oopen(file->getId(), ba.data(), H5P_DEFAULT);
+		if(objID < 0)
+			continue;
+		H5::DataSet dataSet(objID);
+		H5Oclose(objID);
+		if(!dataset->refresh(dataSet))
+			continue;
+
+		changed = true;
+		if(iii > 0 && m_data->isLoaded() && options.isDecimated())
+			dataset->decimateDim(options.binningFactor(iii - 1), 
+				options.strideFactor(iii - 1));
+	}
+
+	if(changed)
+		checkDimLengths();
+	return changed;
+}
+
 void DataGroup::unload()
 {
 	m_data->unloadData();
@@ -217,4 +292,32 @@ bool DataGroup::isLoaded() const
     return m_data->isLoaded();
 }
 
+int64_t DataGroup::memoryFootprint() const
+{
+    if(!m_data)
+        return 0;
+
+    int64_t size = m_data->memoryFootprint();
+    for(const Dataset *dim : m_dims)
+        size += dim->memoryFootprint();
+    return size;
+}
+
+bool DataGroup::isDirty() const
+{
+    if(m_status & Node::DIRTY)
+        return true;
+
+    if(m_data && (m_data->status() & Node::DIRTY))
+        return true;
+
+    // Edited calibrations would be replaced by a reload as well
+    for(const Dataset *dim : m_dims)
+    {
+        if(dim->status() & Node::DIRTY)
+            return true;
+    }
+    return false;
+}
+
 } // namespace emd
@@ -20,6 +20,9 @@
 
 #include "Dataset.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stack>
 
 #include "H5Cpp.h"
@@ -27,8 +30,12 @@
 #include <QDebug>
 #include <QString>
 
+#include "Allocator.h"
+#include "AsyncLoad.h"
 #include "Attribute.h"
+#include "Convert.h"
 #include "Frame.h"
+#include "Simd.h"
 
 #ifndef H5_NO_NAMESPACE
 using namespace H5;
@@ -39,10 +46,122 @@ namespace emd
 
 const uint64_t MEMORY_LIMIT = 2048LL * 1024LL * 1024LL * 1024LL;	// 2TB
 
+// Chunks of compressed datasets are grown frame by frame until they
+//	reach roughly this size.
+const uint64_t TARGET_CHUNK_SIZE = 1024LL * 1024LL;					// 1MB
+
+// 16 bit float data is converted to and from Float32 in blocks of about
+//	this size, so the whole dataset is never held in both types.
+const uint64_t CONVERSION_BLOCK_SIZE = 16LL * 1024LL * 1024LL;		// 16MB
+
+// Sparse data is stored as one variable length list of detector pixel
+//	indexes per scan position, with the detector dims in this attribute.
+static const char *const SPARSE_FRAME_DIMS = "sparse_frame_dims";
+
+// Registered ids of the HDF5 filter plugins we write.
+const H5Z_filter_t FILTER_BITSHUFFLE = 32008;
+const H5Z_filter_t FILTER_ZSTD = 32015;
+
+// Bitshuffle filter parameters: cd_values[0-2] are filled in by the 
+//	filter, cd_values[3] is the block size (0 lets the filter choose) and
+//	cd_values[4] selects the compressor (BSHUF_H5_COMPRESS_LZ4).
+const unsigned int BITSHUFFLE_LZ4 = 2;
+
+static std::vector<hsize_t> chunkDims(const DataSpace &space, bool descending, int typeSize)
+{
+	// A chunk always holds whole frames (the two fastest varying dims),
+	//	and is extended along the slower dims while it is small.
+	int rank = space.rank();
+	std::vector<hsize_t> dims(rank, 1);
+
+	uint64_t bytes = (typeSize > 0 ? typeSize : 1);
+	for(int count = 0; count < rank; ++count)
+	{
+		int iii = descending ? rank - 1 - count : count;
+		hsize_t length = (hsize_t) space.dimLength(iii);
+		if(count < 2)
+		{
+			dims[iii] = std::max<hsize_t>(1, length);
+		}
+		else
+		{
+			if(bytes >= TARGET_CHUNK_SIZE)
+				break;
+			hsize_t fit = (hsize_t) (TARGET_CHUNK_SIZE / bytes);
+			dims[iii] = std::max<hsize_t>(1, std::min(fit, length));
+		}
+		bytes *= dims[iii];
+	}
+
+	return dims;
+}
+
+// Interleaved complex value as "re+imi"
+template <typename T>
+static QString complexString(const char *data, int index)
+{
+	const T *values = (const T*) data + 2 * index;
+	QString sign = (values[1] < 0 ? "-" : "+");
+	return QString::number(values[0]) + sign + QString::number(std::abs(values[1])) + "i";
+}
+
+// Copies share the data until one of them changes it (see detach). The
+//	copy has no parent; the sparse event lists are copied.
 Dataset::Dataset(const Dataset &other)
-    : m_space(other.m_space)
+    : Node(0),
+    m_data(other.m_data),
+    m_buffer(other.m_buffer),
+    m_space(other.m_space),
+    m_dataType(other.m_dataType),
+    m_dataTypeSize(other.m_dataTypeSize),
+    m_descendingData(other.m_descendingData),
+    m_complexIndex(other.m_complexIndex),
+    m_truncatedDim(other.m_truncatedDim),
+    m_trueLength(other.m_trueLength),
+    m_compression(other.m_compression),
+    m_compressionLevel(other.m_compressionLevel),
+    m_storageType(other.m_storageType),
+    m_loadType(other.m_loadType),
+    m_loadOptions(other.m_loadOptions),
+    m_storedSpace(other.m_storedSpace),
+    m_reducedInMemory(other.m_reducedInMemory),
+    m_sparse(other.m_sparse),
+    m_eventOffsets(other.m_eventOffsets),
+    m_events(other.m_events)
 {
+    m_name = other.m_name;
+    m_status = other.m_status;
+    m_frameDims[0] = other.m_frameDims[0];
+    m_frameDims[1] = other.m_frameDims[1];
+}
 
+Dataset::Dataset(Dataset &&other)
+    : Node(0),
+    m_data(other.m_data),
+    m_buffer(std::move(other.m_buffer)),
+    m_space(other.m_space),
+    m_dataType(other.m_dataType),
+    m_dataTypeSize(other.m_dataTypeSize),
+    m_descendingData(other.m_descendingData),
+    m_complexIndex(other.m_complexIndex),
+    m_truncatedDim(other.m_truncatedDim),
+    m_trueLength(other.m_trueLength),
+    m_compression(other.m_compression),
+    m_compressionLevel(other.m_compressionLevel),
+    m_storageType(other.m_storageType),
+    m_loadType(other.m_loadType),
+    m_loadOptions(other.m_loadOptions),
+    m_storedSpace(other.m_storedSpace),
+    m_reducedInMemory(other.m_reducedInMemory),
+    m_sparse(other.m_sparse),
+    m_eventOffsets(std::move(other.m_eventOffsets)),
+    m_events(std::move(other.m_events))
+{
+    m_name = other.m_name;
+    m_status = other.m_status;
+    m_frameDims[0] = other.m_frameDims[0];
+    m_frameDims[1] = other.m_frameDims[1];
+    other.m_data = 0;
 }
 
 Dataset::Dataset(Node *p)
@@ -51,7 +170,14 @@ Dataset::Dataset(Node *p)
     m_dataType(DataTypeUnknown),
     m_dataTypeSize(0),
 	m_complexIndex(-1),
-    m_truncatedDim(false)
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(false)
 {
 	m_data = 0;
 	m_descendingData = true;
@@ -61,7 +187,14 @@ Dataset::Dataset(const int &length, const emd::DataType &type, bool createDefaul
 	: m_space(1, &length),
     m_dataType(type),
 	m_complexIndex(-1),
-    m_truncatedDim(false)
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(false)
 {
 	m_data = NULL;
 	m_descendingData = false;	// Doesn't matter for 1D data
@@ -69,7 +202,7 @@ Dataset::Dataset(const int &length, const emd::DataType &type, bool createDefaul
 
 	if(createDefault)
 	{
-		m_data = new char[length * m_dataTypeSize];
+		setBuffer((char*) allocateBuffer(length * m_dataTypeSize));
 
 		// TODO: temp
 		if(type == DataTypeInt32)
@@ -86,25 +219,214 @@ Dataset::Dataset(const int &rank, int const *dimLengths, DataType type,
 	: m_space(rank, dimLengths),
     m_dataType(type),
 	m_complexIndex(-1),
-    m_truncatedDim(false)
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(false)
+{
+	if(data)
+		m_buffer.reset(data, [](char *buffer) { delete[] buffer; });
+	m_data = data;
+	m_descendingData = descendingData;
+    m_dataTypeSize = emdTypeDepth(m_dataType);
+}
+
+Dataset::Dataset(const int &rank, int const *dimLengths, DataType type, 
+		char *data, AllocatedBufferTag, bool descendingData)
+	: m_space(rank, dimLengths),
+    m_dataType(type),
+	m_complexIndex(-1),
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(false)
 {
+	setBuffer(data);
+	m_descendingData = descendingData;
+    m_dataTypeSize = emdTypeDepth(m_dataType);
+}
+
+Dataset::Dataset(const int &rank, int const *dimLengths, DataType type, 
+		char *data, const BufferDeleter &deleter, bool descendingData)
+	: m_space(rank, dimLengths),
+    m_dataType(type),
+	m_complexIndex(-1),
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(false)
+{
+	if(deleter)
+		m_buffer.reset(data, deleter);
+	else
+		m_buffer.reset(data, [](char*) {});
 	m_data = data;
 	m_descendingData = descendingData;
     m_dataTypeSize = emdTypeDepth(m_dataType);
 }
 
+Dataset::Dataset(const int &nScanDims, int const *scanDimLengths, 
+		int const *frameDimLengths, std::vector<uint64_t> eventOffsets,
+		std::vector<uint32_t> events)
+	: m_space(0),
+    m_dataType(DataTypeUInt32),
+	m_complexIndex(-1),
+    m_truncatedDim(false),
+    m_compression(CompressionNone),
+    m_compressionLevel(0),
+    m_storageType(DataTypeUnknown),
+    m_loadType(DataTypeUnknown),
+    m_storedSpace(0),
+    m_reducedInMemory(false),
+    m_sparse(true),
+    m_eventOffsets(std::move(eventOffsets)),
+    m_events(std::move(events))
+{
+	m_data = NULL;
+	m_descendingData = true;
+    m_dataTypeSize = emdTypeDepth(m_dataType);
+    m_frameDims[0] = frameDimLengths[0];
+    m_frameDims[1] = frameDimLengths[1];
+
+    std::vector<int> dimLengths(scanDimLengths, scanDimLengths + nScanDims);
+    dimLengths.push_back(m_frameDims[0]);
+    dimLengths.push_back(m_frameDims[1]);
+    m_space = DataSpace((int) dimLengths.size(), dimLengths.data());
+}
+
 Dataset::~Dataset()
 {
 	//qDebug() << "Deleting data " << m_name;
-	if(m_data)
-		delete[] m_data;
+}
+
+// The buffer is freed once no Dataset copy or Frame refers to it
+void Dataset::setBuffer(char *data)
+{
+	if(data)
+		m_buffer.reset(data, freeBuffer);
+	else
+		m_buffer.reset();
+	m_data = data;
+}
+
+void Dataset::releaseBuffer()
+{
+	m_buffer.reset();
+	m_data = 0;
+}
+
+void Dataset::detach()
+{
+	if(!m_buffer || m_buffer.use_count() == 1)
+		return;
+
+	int64_t size = memoryFootprint();
+	char *data = (char*) allocateBuffer(size);
+	memcpy(data, m_data, size);
+	setBuffer(data);
+}
+
+char *Dataset::mutableData()
+{
+	detach();
+	return m_data;
 }
 
 /***************************** File Operations **************************/
+// Number of bins that are kept along a dim; the bin is clipped to short
+//	dims, and a trailing partial bin is dropped.
+static int decimatedLength(int length, int &binning, int stride)
+{
+	if(length <= 0)
+		return 0;
+
+	binning = std::min(binning, length);
+	return (length - binning) / (binning * stride) + 1;
+}
+
+// Loads with progress report failures there, and check for
+//	cancellation between blocks
+static void setLoadError(const Dataset::LoadOptions &options, LoadError error)
+{
+	if(options.progress)
+		options.progress->error.store(error);
+}
+
+static bool loadCancelled(const Dataset::LoadOptions &options)
+{
+	if(!options.progress || !options.progress->isCancelled())
+		return false;
+
+	setLoadError(options, LoadErrorCancelled);
+	return true;
+}
+
+static void addBytesRead(const Dataset::LoadOptions &options, int64_t bytes)
+{
+	if(options.progress)
+		options.progress->bytesRead += bytes;
+}
+
+bool Dataset::LoadOptions::isBinned() const
+{
+	for(int factor : binning)
+	{
+		if(factor > 1)
+			return true;
+	}
+	return false;
+}
+
+bool Dataset::LoadOptions::isDecimated() const
+{
+	if(isBinned())
+		return true;
+
+	for(int factor : strides)
+	{
+		if(factor > 1)
+			return true;
+	}
+	return false;
+}
+
 void Dataset::loadData(const DataSet &dataSet)
+{
+	LoadOptions options;
+	options.type = m_loadType;
+	loadData(dataSet, options);
+}
+
+void Dataset::loadData(const DataSet &dataSet, const LoadOptions &options)
 {
     //H5PLset_loading_state(1);
     
+	if(loadCancelled(options))
+		return;
+
+	m_loadOptions = options;
+	m_loadOptions.progress = 0;
+	m_reducedInMemory = false;
+
+	// Event lists are variable length lists, always stored uncompressed
+	if(m_sparse)
+	{
+		loadSparseData(dataSet);
+		return;
+	}
+
 	H5::DataSpace space = dataSet.getSpace();
 	// Data element size
 	H5T_class_t dataClass = dataSet.getTypeClass();
@@ -125,7 +447,75 @@ void Dataset::loadData(const DataSet &dataSet)
 			m_dataTypeSize = (int)type.getSize();
 		}
 	}
+	else if(H5T_COMPOUND == dataClass)
+	{
+		// Complex numbers, read with the member names used in the file
+		hid_t nativeType = H5Tget_native_type(dataSet.getCompType().getId(), H5T_DIR_ASCEND);
+		type = H5::DataType(nativeType);
+		H5Tclose(nativeType);
+	}
 	
+	// The stored type is loaded as it is, unless another type or a scale
+	//	is requested, in which case the values are converted block by block
+	//	as they are read
+	DataType fileType = hdfToEmdType(type);
+	bool convert = false;
+	if(isNumericType(fileType))
+	{
+		// Read in the native byte order, whatever the file's
+		type = emdToHdfType(fileType);
+		DataType loadType = isNumericType(options.type) ? options.type : fileType;
+		convert = (loadType != fileType || options.scale != 1 || options.offset != 0);
+		setDataType(loadType);
+	}
+	else if(isComplexType(fileType))
+	{
+		setDataType(fileType);
+	}
+
+	// Compressed data is decoded by HDF5 during the read, but only if
+	//	the filter (which may be a plugin) can be found.
+	readCompression(dataSet);
+	if(!filtersAvailable(dataSet))
+	{
+		qWarning() << "Compression filter not available for " << m_name
+			<< "; check HDF5_PLUGIN_PATH";
+		setLoadError(options, LoadErrorFilter);
+		return;
+	}
+
+	// Reduced loads change the shape, so it is taken from the file each
+	//	time to let a later full load restore it
+	m_space = DataSpace::fromHdfDataSet(dataSet);
+	m_storedSpace = m_space;
+	int64_t readCount = 1;
+	for(int iii = 0; iii < m_space.rank(); ++iii)
+		readCount *= m_space.dimLength(iii);
+
+	bool decimate = options.isDecimated() && isNumericType(fileType) 
+		&& m_space.rank() > 0;
+	if(decimate)
+	{
+		if(options.isBinned() && !isNumericType(options.type))
+			setDataType(DataTypeFloat32);
+
+		std::vector<int> lengths(m_space.rank());
+		readCount = 1;
+		for(int iii = 0; iii < m_space.rank(); ++iii)
+		{
+			int binning = options.binningFactor(iii);
+			lengths[iii] = decimatedLength(m_space.dimLength(iii), binning, 
+				options.strideFactor(iii));
+			readCount *= (int64_t) lengths[iii] * binning;
+		}
+		m_space = DataSpace(m_space.rank(), lengths.data());
+	}
+
+	int64_t readBytes = readCount 
+		* (isNumericType(fileType) ? emdTypeDepth(fileType) : m_dataTypeSize);
+	if(options.progress)
+		options.progress->bytesTotal += readBytes;
+
 	unsigned long long size = m_dataTypeSize;
 	for(int iii = 0; iii < m_space.rank(); ++iii)
 		size *= m_space.dimLength(iii);
@@ -134,31 +524,189 @@ void Dataset::loadData(const DataSet &dataSet)
 	{
 		// Init data
 		// TODO: catch memory allocation exception
-		m_data = new char[size];
+		setBuffer((char*) allocateBuffer(size));
 		// Copy data
-		dataSet.read(m_data, type, space, space);
+		if(decimate)
+			readDecimated(dataSet, type, fileType, options);
+		else if(convert || (options.progress && isNumericType(fileType)))
+			readBlocks(dataSet, type, fileType, options);
+		else
+		{
+			dataSet.read(m_data, type, space, space);
+			addBytesRead(options, readBytes);
+		}
 	}
 	else
 	{
 		qWarning() << "Data size exceeds memory limit";
+		setLoadError(options, LoadErrorMemory);
 	}
 }
 
+void Dataset::loadSparseData(const DataSet &dataSet)
+{
+	H5::DataSpace space = dataSet.getSpace();
+	hssize_t frameCount = space.getSimpleExtentNpoints();
+
+	std::vector<hvl_t> lists(frameCount);
+	hid_t listType = H5Tvlen_create(H5T_NATIVE_UINT32);
+	herr_t status = H5Dread(dataSet.getId(), listType, H5S_ALL, H5S_ALL, 
+		H5P_DEFAULT, lists.data());
+	if(status < 0)
+	{
+		qWarning() << "Failed to read sparse data " << m_name;
+		H5Tclose(listType);
+		return;
+	}
+
+	// Pack the lists into one contiguous event array
+	m_eventOffsets.assign(frameCount + 1, 0);
+	for(hssize_t iii = 0; iii < frameCount; ++iii)
+		m_eventOffsets[iii + 1] = m_eventOffsets[iii] + lists[iii].len;
+
+	if(m_eventOffsets.back() * sizeof(uint32_t) < MEMORY_LIMIT)
+	{
+		m_events.resize(m_eventOffsets.back());
+		for(hssize_t iii = 0; iii < frameCount; ++iii)
+		{
+			if(lists[iii].len > 0)
+				memcpy(&m_events[m_eventOffsets[iii]], lists[iii].p, 
+					lists[iii].len * sizeof(uint32_t));
+		}
+	}
+	else
+	{
+		qWarning() << "Data size exceeds memory limit";
+		m_eventOffsets.clear();
+	}
+
+	H5Dvlen_reclaim(listType, space.getId(), H5P_DEFAULT, lists.data());
+	H5Tclose(listType);
+}
+
 void Dataset::unloadData()
 {
     // Disallow unloading of unsaved data
-    if(m_data && !(m_status & Node::DIRTY))
+    if(m_status & Node::DIRTY)
+        return;
+
+    releaseBuffer();
+
+    if(m_sparse)
     {
-	    delete[] m_data;
-	    m_data = 0;
+        std::vector<uint64_t>().swap(m_eventOffsets);
+        std::vector<uint32_t>().swap(m_events);
     }
 }
 
+bool Dataset::refresh(const DataSet &dataSet)
+{
+	// Unsaved changes are kept
+	if(m_sparse || (m_status & Node::DIRTY) || H5Drefresh(dataSet.getId()) < 0)
+		return false;
+
+	// Loaded data may be reduced, so it is compared with the extent it 
+	//	was read from
+	DataSpace space = DataSpace::fromHdfDataSet(dataSet);
+	const DataSpace &current = isLoaded() ? m_storedSpace : m_space;
+	bool changed = (space.rank() != current.rank());
+	for(int iii = 0; iii < space.rank() && !changed; ++iii)
+		changed = (space.dimLength(iii) != current.dimLength(iii));
+	if(!changed)
+		return false;
+
+	if(!isLoaded())
+	{
+		m_truncatedDim = false;
+		m_space = space;
+		return true;
+	}
+
+	// Slices appended along the slowest dim are read on their own; 
+	//	anything else, or data reduced after it was read, is reloaded
+	bool appended = !m_reducedInMemory && !m_truncatedDim 
+		&& isNumericType(m_dataType) && space.rank() > 0 
+		&& space.rank() == m_storedSpace.rank() 
+		&& space.dimLength(0) > m_storedSpace.dimLength(0)
+		&& m_storedSpace.dimLength(0) >= m_loadOptions.binningFactor(0);
+	for(int iii = 1; iii < space.rank() && appended; ++iii)
+		appended = (space.dimLength(iii) == m_storedSpace.dimLength(iii));
+	if(!appended || !extend(dataSet, space))
+	{
+		// A dim that was stored as start and step may not be any more
+		m_truncatedDim = false;
+		loadData(dataSet, m_loadOptions);
+	}
+	return true;
+}
+
+// Grows the buffer to the new extent, keeping the loaded slices, and
+//	reads the rest with the options of the last load
+bool Dataset::extend(const H5::DataSet &dataSet, const DataSpace &space)
+{
+	DataType fileType = dataTypeFromHdfDataSet(dataSet);
+	if(!isNumericType(fileType))
+		return false;
+
+	bool decimate = m_loadOptions.isDecimated();
+	std::vector<int> lengths(space.rank());
+	unsigned long long size = m_dataTypeSize;
+	for(int iii = 0; iii < space.rank(); ++iii)
+	{
+		int binning = m_loadOptions.binningFactor(iii);
+		lengths[iii] = decimate ? decimatedLength(space.dimLength(iii), binning, 
+			m_loadOptions.strideFactor(iii)) : space.dimLength(iii);
+		size *= lengths[iii];
+	}
+	if(size >= MEMORY_LIMIT)
+		return false;
+
+	int64_t first = m_space.dimLength(0);
+	char *buffer = (char*) allocateBuffer(size);
+	memcpy(buffer, m_data, memoryFootprint());
+	setBuffer(buffer);
+	m_space = DataSpace(space.rank(), lengths.data());
+	m_storedSpace = space;
+
+	H5::DataType type = emdToHdfType(fileType);
+	try
+	{
+		if(decimate)
+			readDecimated(dataSet, type, fileType, m_loadOptions, first);
+		else
+			readBlocks(dataSet, type, fileType, m_loadOptions, first);
+	}
+	catch(H5::Exception error)
+	{
+		qWarning() << "Failed to read the data appended to " << m_name;
+		return false;
+	}
+	return true;
+}
+
 bool Dataset::isLoaded() const
 {
+    if(m_sparse)
+        return !m_eventOffsets.empty();
+
     return (m_data != NULL);
 }
 
+int64_t Dataset::memoryFootprint() const
+{
+    if(m_sparse)
+        return (int64_t) (m_eventOffsets.size() * sizeof(uint64_t) 
+            + m_events.size() * sizeof(uint32_t));
+
+    if(!m_data)
+        return 0;
+
+    int64_t size = m_dataTypeSize;
+    for(int iii = 0; iii < m_space.rank(); ++iii)
+        size *= m_space.dimLength(iii);
+    return size;
+}
+
 void Dataset::save(const QString & path, H5Object *parentObject)
 {
 	if(!parentObject)
@@ -166,7 +714,7 @@ void Dataset::save(const QString & path, H5Object *parentObject)
 	
 	DataSet *dataset = 0;
 
-	if(m_data) try
+	if(isLoaded()) try
 	{
 		QByteArray ba = m_name.toUtf8();
 		const char *name = ba.constData();
@@ -175,12 +723,19 @@ void Dataset::save(const QString & path, H5Object *parentObject)
 		if(exists < 0)
 			return;
 
-		if(exists == 0)
+		if(exists == 0 && m_sparse)
+		{
+			dataset = saveSparseData(parentObject, name);
+			if(!dataset)
+				return;
+		}
+		else if(exists == 0)
 		{
 			// Create property list for a dataset and set up fill values.
-			uint64_t fillvalue = 0; 
+			uint64_t fillvalue[2] = {0, 0};
 			DSetCreatPropList plist;
-			plist.setFillValue(emd::emdToHdfType(m_dataType), &fillvalue);
+			DataType fileType = storageType();
+			plist.setFillValue(emd::emdToHdfType(fileType), fillvalue);
  
 			// Create dataspaces for the dataset in the file and memory.
 			hsize_t *fdim = new hsize_t[m_space.rank()];
@@ -188,44 +743,629 @@ void Dataset::save(const QString & path, H5Object *parentObject)
 				fdim[iii] = m_space.dimLength(iii);
 			H5::DataSpace fspace(m_space.rank(), fdim);
 
-			H5::DataType dataType(emd::emdToHdfType(m_dataType));
+			H5::DataType dataType(emd::emdToHdfType(fileType));
+
+			// Compression requires a chunked layout. Fixed-length strings
+			//	are left contiguous.
+			hid_t createPlist = H5P_DEFAULT;
+			if(m_compression != CompressionNone && m_dataType != DataTypeString)
+			{
+				std::vector<hsize_t> chunk = chunkDims(m_space, m_descendingData, emdTypeDepth(fileType));
+				plist.setChunk(m_space.rank(), chunk.data());
+				setFilter(plist);
+				createPlist = plist.getId();
+			}
 		
 			// Create the dataset
-			dataset = new DataSet(H5Dcreate(parentObject->getId(),
+			hid_t datasetID = H5Dcreate(parentObject->getId(),
 				name, dataType.getId(), fspace.getId(), 
-				H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
-			
-			// For now, write the dataset iff it didn't already exist
-			//	This will have to be changed later if we want to allow
-			//	the modification of existing data sets.
-			if(dataset)
+				H5P_DEFAULT, createPlist, H5P_DEFAULT);
+			if(datasetID < 0)
 			{
-				dataset->write(m_data, dataType, fspace, fspace);
+				qWarning() << "Failed to create dataset " << m_name;
+				delete[] fdim;
+				return;
 			}
-
+			// The wrapper takes a reference of its own, which is all that
+			//	keeps the file open once it is closed
+			dataset = new DataSet(datasetID);
+			H5Dclose(datasetID);
 			delete[] fdim;
+			if(fileType != m_dataType)
+				writeFloat16(*dataset, dataType, fileType);
+			else
+				dataset->write(m_data, dataType, fspace, fspace);
 		}
 		else
 		{
-			dataset = new DataSet(H5Dopen(parentObject->getId(), name, (hid_t)NULL));
+			hid_t datasetID = H5Dopen(parentObject->getId(), name, (hid_t)NULL);
+			if(datasetID < 0)
+				return;
+			dataset = new DataSet(datasetID);
+			H5Dclose(datasetID);
+			// Changes are written over the stored values, which must have
+			//	the same shape
+			if((m_status & DIRTY) && !writeExisting(*dataset))
+			{
+				delete dataset;
+				return;
+			}
 		}
 
-		if(dataset)
-		{
-			foreach(Node *node, m_children)
-				node->save(path + "/" + m_name, dataset);
+		foreach(Node *node, m_children)
+			node->save(path + "/" + m_name, dataset);
 
-			dataset->close();
-			delete dataset;
-		}
+		dataset->close();
+		delete dataset;
 
+		// Only reached once the data has been written; a failed write 
+		//	leaves it marked as unsaved
 		removeStatus(DIRTY);
 	}
 	catch(FileIException error) {
 		qDebug() << "Data save failed (FileIException): " << m_name;
+		delete dataset;
 	}
 	catch(PropListIException error) {
 		qDebug() << "Data save failed (PropListIException): " << m_name;
+		delete dataset;
+	}
+	catch(DataSetIException error) {
+		qDebug() << "Data save failed (DataSetIException): " << m_name;
+		delete dataset;
+	}
+	catch(DataSpaceIException error) {
+		qDebug() << "Data save failed (DataSpaceIException): " << m_name;
+		delete dataset;
+	}
+}
+
+bool Dataset::writeExisting(H5::DataSet &dataSet) const
+{
+	if(m_sparse)
+	{
+		qWarning() << "Changed sparse data cannot be written over " << m_name;
+		return false;
+	}
+
+	DataSpace stored = DataSpace::fromHdfDataSet(dataSet);
+	bool sameShape = (stored.rank() == m_space.rank());
+	for(int iii = 0; sameShape && iii < m_space.rank(); ++iii)
+		sameShape = (stored.dimLength(iii) == m_space.dimLength(iii));
+	if(!sameShape)
+	{
+		qWarning() << "Stored data has another shape, not overwritten: " << m_name;
+		return false;
+	}
+
+	DataType fileType = dataTypeFromHdfDataSet(dataSet);
+	if(m_dataType == DataTypeFloat32 
+		&& (fileType == DataTypeFloat16 || fileType == DataTypeBFloat16))
+	{
+		writeFloat16(dataSet, H5::DataType(emdToHdfType(fileType)), fileType);
+		return true;
+	}
+
+	dataSet.write(m_data, emdToHdfType(m_dataType));
+	return true;
+}
+
+// Blocks of whole slices along the slowest dim of the file
+static hsize_t conversionSlices(const DataSpace &space, int typeSize, hsize_t &sliceSize)
+{
+	sliceSize = 1;
+	for(int iii = 1; iii < space.rank(); ++iii)
+		sliceSize *= space.dimLength(iii);
+
+	return std::max<hsize_t>(1, CONVERSION_BLOCK_SIZE / (sliceSize * typeSize));
+}
+
+// Blocks are read straight into the data when the type is kept, so a
+//	load can still report progress and be cancelled.
+void Dataset::readBlocks(const H5::DataSet &dataSet, const H5::DataType &type, 
+	DataType fileType, const LoadOptions &options, int64_t first)
+{
+	bool convert = (m_dataType != fileType || options.scale != 1 || options.offset != 0);
+	int rank = m_space.rank();
+	int fileTypeSize = emdTypeDepth(fileType);
+	if(rank == 0)
+	{
+		// A scalar is a single read
+		std::vector<char> value(fileTypeSize);
+		dataSet.read(convert ? value.data() : m_data, type);
+		if(convert)
+			convertValues(value.data(), fileType, m_data, m_dataType, 1, 
+				options.scale, options.offset);
+		addBytesRead(options, fileTypeSize);
+		return;
+	}
+
+	H5::DataSpace fileSpace = dataSet.getSpace();
+	std::vector<hsize_t> offset(rank, 0), count(rank);
+	for(int iii = 1; iii < rank; ++iii)
+		count[iii] = m_space.dimLength(iii);
+
+	hsize_t sliceSize;
+	hsize_t slices = conversionSlices(m_space, fileTypeSize, sliceSize);
+	hsize_t length = m_space.dimLength(0);
+	std::vector<char> block;
+
+	for(hsize_t start = first; start < length; start += slices)
+	{
+		if(loadCancelled(options))
+		{
+			releaseBuffer();
+			return;
+		}
+
+		offset[0] = start;
+		count[0] = std::min(slices, length - start);
+		hsize_t blockSize = count[0] * sliceSize;
+		char *target = m_data + start * sliceSize * m_dataTypeSize;
+
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+		H5::DataSpace memorySpace(1, &blockSize);
+		if(convert)
+		{
+			block.resize(blockSize * fileTypeSize);
+			dataSet.read(block.data(), type, memorySpace, fileSpace);
+			convertValues(block.data(), fileType, target, m_dataType, 
+				blockSize, options.scale, options.offset);
+		}
+		else
+		{
+			dataSet.read(target, type, memorySpace, fileSpace);
+		}
+		addBytesRead(options, blockSize * fileTypeSize);
+	}
+}
+
+// Sums consecutive groups of bin values along one dim of a block in C
+//	order, in place: the dim is length long, with outer values before
+//	and inner values after it.
+static void binDim(double *values, int64_t outer, int64_t length, int64_t bin, 
+	int64_t inner, std::vector<double> &sums)
+{
+	int64_t bins = length / bin;
+	for(int64_t iii = 0; iii < outer; ++iii)
+	{
+		for(int64_t jjj = 0; jjj < bins; ++jjj)
+		{
+			const double *source = values + (iii * length + jjj * bin) * inner;
+			double *target = values + (iii * bins + jjj) * inner;
+			if(inner == 1)
+			{
+				*target = simd::sum(source, bin);
+				continue;
+			}
+
+			sums.assign(source, source + inner);
+			for(int64_t kkk = 1; kkk < bin; ++kkk)
+			{
+				const double *row = source + kkk * inner;
+				for(int64_t lll = 0; lll < inner; ++lll)
+					sums[lll] += row[lll];
+			}
+			std::copy(sums.begin(), sums.end(), target);
+		}
+	}
+}
+
+// Reads blocks of whole output slices along the slowest dim. Each block
+//	is one strided hyperslab whose HDF5 blocks are the bins, so only the
+//	values that are kept are read; the bins are then summed dim by dim.
+void Dataset::readDecimated(const H5::DataSet &dataSet, const H5::DataType &type, 
+	DataType fileType, const LoadOptions &options, int64_t first)
+{
+	H5::DataSpace fileSpace = dataSet.getSpace();
+	int rank = m_space.rank();
+	std::vector<hsize_t> offset(rank, 0), count(rank), stride(rank), bin(rank);
+	DataSpace storedSpace = DataSpace::fromHdfDataSet(dataSet);
+	hsize_t sliceSize = 1;
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		int binning = options.binningFactor(iii);
+		decimatedLength(storedSpace.dimLength(iii), binning, options.strideFactor(iii));
+		bin[iii] = binning;
+		stride[iii] = bin[iii] * options.strideFactor(iii);
+		count[iii] = m_space.dimLength(iii);
+		if(iii > 0)
+			sliceSize *= count[iii] * bin[iii];
+	}
+
+	// The binned values are summed as Float64
+	bool binned = options.isBinned();
+	int valueSize = binned ? (int)sizeof(double) : emdTypeDepth(fileType);
+	hsize_t slices = std::max<hsize_t>(1, 
+		CONVERSION_BLOCK_SIZE / (sliceSize * bin[0] * valueSize));
+	hsize_t length = m_space.dimLength(0);
+	hsize_t outputSliceSize = 1;
+	for(int iii = 1; iii < rank; ++iii)
+		outputSliceSize *= count[iii];
+
+	std::vector<char> block;
+	std::vector<double> values, sums;
+	for(hsize_t start = first; start < length; start += slices)
+	{
+		if(loadCancelled(options))
+		{
+			releaseBuffer();
+			return;
+		}
+
+		offset[0] = start * stride[0];
+		count[0] = std::min(slices, length - start);
+		hsize_t blockSize = count[0] * bin[0] * sliceSize;
+		block.resize(blockSize * emdTypeDepth(fileType));
+
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data(), 
+			stride.data(), bin.data());
+		H5::DataSpace memorySpace(1, &blockSize);
+		dataSet.read(block.data(), type, memorySpace, fileSpace);
+		addBytesRead(options, block.size());
+
+		char *target = m_data + start * outputSliceSize * m_dataTypeSize;
+		if(!binned)
+		{
+			convertValues(block.data(), fileType, target, m_dataType, 
+				count[0] * outputSliceSize, options.scale, options.offset);
+			continue;
+		}
+
+		values.resize(blockSize);
+		convertValues(block.data(), fileType, values.data(), DataTypeFloat64, blockSize);
+
+		// Fastest dim first, so every pass works on already reduced data
+		std::vector<int64_t> extents(rank);
+		for(int iii = 0; iii < rank; ++iii)
+			extents[iii] = count[iii] * bin[iii];
+		for(int iii = rank - 1; iii >= 0; --iii)
+		{
+			if(bin[iii] == 1)
+				continue;
+
+			int64_t outer = 1, inner = 1;
+			for(int jjj = 0; jjj < iii; ++jjj)
+				outer *= extents[jjj];
+			for(int jjj = iii + 1; jjj < rank; ++jjj)
+				inner *= extents[jjj];
+			binDim(values.data(), outer, extents[iii], bin[iii], inner, sums);
+			extents[iii] = count[iii];
+		}
+
+		convertValues(values.data(), DataTypeFloat64, target, m_dataType, 
+			count[0] * outputSliceSize, options.scale, options.offset);
+	}
+}
+
+// Reads blocks of whole selected slices along the slowest dim. Packed
+//	destinations are filled block by block, straight from HDF5 when the
+//	type is kept; strided ones are filled row by row from the block.
+bool Dataset::read(const H5::DataSet &dataSet, const Selection &selection, 
+	void *destination, DataType type, const std::vector<int64_t> &strides) const
+{
+	H5T_class_t dataClass = dataSet.getTypeClass();
+	H5::DataType fileHdfType;
+	if(H5T_FLOAT == dataClass)
+		fileHdfType = dataSet.getFloatType();
+	else if(H5T_INTEGER == dataClass)
+		fileHdfType = dataSet.getIntType();
+	DataType fileType = (H5T_FLOAT == dataClass || H5T_INTEGER == dataClass) 
+		? hdfToEmdType(fileHdfType) : DataTypeUnknown;
+	// Read in the native byte order, whatever the file's
+	if(isNumericType(fileType))
+		fileHdfType = emdToHdfType(fileType);
+	if(m_sparse || !isNumericType(fileType))
+	{
+		qWarning() << "Only dense numeric data can be read into a buffer: " << m_name;
+		return false;
+	}
+
+	DataSpace fileSpace = DataSpace::fromHdfDataSet(dataSet);
+	int rank = fileSpace.rank();
+	if(rank == 0 || (int)selection.size() != rank 
+		|| (!strides.empty() && (int)strides.size() != rank))
+	{
+		qWarning() << "Selection does not match data " << m_name;
+		return false;
+	}
+
+	std::vector<hsize_t> offset(rank), count(rank);
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		const Range &range = selection[iii];
+		if(range.start < 0 || range.end > fileSpace.dimLength(iii) 
+			|| range.start >= range.end)
+		{
+			qWarning() << "Selection out of range for " << m_name;
+			return false;
+		}
+		offset[iii] = range.start;
+		count[iii] = range.end - range.start;
+	}
+
+	if(!isNumericType(type))
+		type = fileType;
+	int typeSize = emdTypeDepth(type);
+	int fileTypeSize = emdTypeDepth(fileType);
+
+	// Strides in elements; a packed destination is in C order
+	std::vector<int64_t> packed(rank);
+	packed[rank - 1] = 1;
+	for(int iii = rank - 2; iii >= 0; --iii)
+		packed[iii] = packed[iii + 1] * count[iii + 1];
+	const std::vector<int64_t> &step = strides.empty() ? packed : strides;
+	bool contiguous = (step == packed);
+
+	hsize_t sliceSize = packed[0];
+	hsize_t slices = std::max<hsize_t>(1, CONVERSION_BLOCK_SIZE / (sliceSize * fileTypeSize));
+	hsize_t length = count[0];
+	H5::DataSpace hdfSpace = dataSet.getSpace();
+	std::vector<char> block, row;
+	std::vector<hsize_t> index(rank);
+	char *target = (char*) destination;
+
+	try
+	{
+		for(hsize_t start = 0; start < length; start += slices)
+		{
+			std::vector<hsize_t> blockOffset(offset), blockCount(count);
+			blockOffset[0] += start;
+			blockCount[0] = std::min(slices, length - start);
+			hsize_t blockSize = blockCount[0] * sliceSize;
+
+			hdfSpace.selectHyperslab(H5S_SELECT_SET, blockCount.data(), blockOffset.data());
+			H5::DataSpace memorySpace(1, &blockSize);
+			if(contiguous && type == fileType)
+			{
+				dataSet.read(target + start * sliceSize * typeSize, fileHdfType, 
+					memorySpace, hdfSpace);
+				continue;
+			}
+
+			block.resize(blockSize * fileTypeSize);
+			dataSet.read(block.data(), fileHdfType, memorySpace, hdfSpace);
+			if(contiguous)
+			{
+				convertValues(block.data(), fileType, 
+					target + start * sliceSize * typeSize, type, blockSize);
+				continue;
+			}
+
+			// Rows along the fastest dim, with the index of the other dims
+			//	counted in C order; with one dim the block is a single row
+			hsize_t rowLength = (rank == 1) ? blockSize : count[rank - 1];
+			std::fill(index.begin(), index.end(), 0);
+			index[0] = start;
+			for(hsize_t source = 0; source < blockSize; source += rowLength)
+			{
+				int64_t rowOffset = (rank == 1) ? (int64_t) start * step[0] : 0;
+				for(int iii = 0; iii < rank - 1; ++iii)
+					rowOffset += (int64_t) index[iii] * step[iii];
+				char *rowTarget = target + rowOffset * typeSize;
+				const char *rowSource = block.data() + source * fileTypeSize;
+				if(step[rank - 1] == 1)
+				{
+					convertValues(rowSource, fileType, rowTarget, type, rowLength);
+				}
+				else
+				{
+					row.resize(rowLength * typeSize);
+					convertValues(rowSource, fileType, row.data(), type, rowLength);
+					for(hsize_t iii = 0; iii < rowLength; ++iii)
+						memcpy(rowTarget + iii * step[rank - 1] * typeSize, 
+							row.data() + iii * typeSize, typeSize);
+				}
+
+				for(int iii = rank - 2; iii >= 0; --iii)
+				{
+					if(++index[iii] < count[iii] || iii == 0)
+						break;
+					index[iii] = 0;
+				}
+			}
+		}
+	}
+	catch(H5::Exception error)
+	{
+		qWarning() << "Failed to read " << m_name;
+		return false;
+	}
+
+	return true;
+}
+
+void Dataset::writeFloat16(H5::DataSet &dataSet, const H5::DataType &type, 
+	DataType fileType) const
+{
+	H5::DataSpace fileSpace = dataSet.getSpace();
+	int rank = m_space.rank();
+	std::vector<hsize_t> offset(rank, 0), count(rank);
+	for(int iii = 1; iii < rank; ++iii)
+		count[iii] = m_space.dimLength(iii);
+
+	hsize_t sliceSize;
+	hsize_t slices = conversionSlices(m_space, sizeof(uint16_t), sliceSize);
+	hsize_t length = m_space.dimLength(0);
+	std::vector<uint16_t> block;
+	const float *values = (const float*) m_data;
+
+	for(hsize_t start = 0; start < length; start += slices)
+	{
+		offset[0] = start;
+		count[0] = std::min(slices, length - start);
+		hsize_t blockSize = count[0] * sliceSize;
+		block.resize(blockSize);
+
+		if(fileType == DataTypeFloat16)
+			simd::floatToHalf(values + start * sliceSize, block.data(), blockSize);
+		else
+			simd::floatToBfloat16(values + start * sliceSize, block.data(), blockSize);
+
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+		H5::DataSpace memorySpace(1, &blockSize);
+		dataSet.write(block.data(), type, memorySpace, fileSpace);
+	}
+}
+
+DataSet *Dataset::saveSparseData(H5Object *parentObject, const char *name)
+{
+	// The file dataset only has the scan dims; a single frame is stored
+	//	as a list of length one.
+	int scanRank = m_space.rank() - 2;
+	std::vector<hsize_t> fdim;
+	for(int iii = 0; iii < scanRank; ++iii)
+		fdim.push_back(m_space.dimLength(iii));
+	if(fdim.empty())
+		fdim.push_back(1);
+	H5::DataSpace fspace((int) fdim.size(), fdim.data());
+
+	// Filters would only compress the references to the lists, so the
+	//	data is always written uncompressed.
+	hid_t listType = H5Tvlen_create(H5T_NATIVE_UINT32);
+	hid_t id = H5Dcreate(parentObject->getId(), name, listType, 
+		fspace.getId(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	if(id < 0)
+	{
+		H5Tclose(listType);
+		return 0;
+	}
+
+	int64_t frameCount = sparseFrameCount();
+	std::vector<hvl_t> lists(frameCount);
+	for(int64_t iii = 0; iii < frameCount; ++iii)
+	{
+		int64_t count;
+		lists[iii].p = (void*) sparseEvents(iii, count);
+		lists[iii].len = (size_t) count;
+	}
+	herr_t written = H5Dwrite(id, listType, H5S_ALL, H5S_ALL, H5P_DEFAULT, lists.data());
+	H5Tclose(listType);
+	if(written < 0)
+	{
+		qWarning() << "Failed to write the events of " << m_name;
+		H5Dclose(id);
+		return 0;
+	}
+
+	hsize_t length = 2;
+	H5::DataSpace attrSpace(1, &length);
+	hid_t attr = H5Acreate(id, SPARSE_FRAME_DIMS, H5T_NATIVE_INT32, 
+		attrSpace.getId(), H5P_DEFAULT, H5P_DEFAULT);
+	if(attr < 0)
+	{
+		qWarning() << "Failed to create the frame dims of " << m_name;
+		H5Dclose(id);
+		return 0;
+	}
+	written = H5Awrite(attr, H5T_NATIVE_INT32, m_frameDims);
+	H5Aclose(attr);
+	if(written < 0)
+	{
+		qWarning() << "Failed to write the frame dims of " << m_name;
+		H5Dclose(id);
+		return 0;
+	}
+
+	// The wrapper takes a reference of its own
+	DataSet *dataset = new DataSet(id);
+	H5Dclose(id);
+	return dataset;
+}
+
+void Dataset::readCompression(const DataSet &dataSet)
+{
+	m_compression = CompressionNone;
+	m_compressionLevel = 0;
+
+	DSetCreatPropList plist = dataSet.getCreatePlist();
+	int nFilters = plist.getNfilters();
+	for(int iii = 0; iii < nFilters; ++iii)
+	{
+		unsigned int flags;
+		size_t nValues = 8;
+		unsigned int values[8];
+		unsigned int config;
+		H5Z_filter_t filter = H5Pget_filter2(plist.getId(), iii, &flags, 
+			&nValues, values, 0, NULL, &config);
+
+		if(filter == H5Z_FILTER_DEFLATE)
+		{
+			m_compression = CompressionDeflate;
+			m_compressionLevel = nValues > 0 ? (int) values[0] : 0;
+		}
+		else if(filter == FILTER_BITSHUFFLE)
+		{
+			m_compression = CompressionBitshuffleLZ4;
+		}
+		else if(filter == FILTER_ZSTD)
+		{
+			m_compression = CompressionZstd;
+			m_compressionLevel = nValues > 0 ? (int) values[0] : 0;
+		}
+	}
+}
+
+bool Dataset::filtersAvailable(const DataSet &dataSet)
+{
+	DSetCreatPropList plist = dataSet.getCreatePlist();
+	int nFilters = plist.getNfilters();
+	for(int iii = 0; iii < nFilters; ++iii)
+	{
+		unsigned int flags;
+		size_t nValues = 0;
+		unsigned int config;
+		H5Z_filter_t filter = H5Pget_filter2(plist.getId(), iii, &flags, 
+			&nValues, NULL, 0, NULL, &config);
+
+		// Querying availability also loads the plugin if needed.
+		if(filter < 0 || H5Zfilter_avail(filter) <= 0)
+			return false;
+	}
+
+	return true;
+}
+
+void Dataset::setFilter(DSetCreatPropList &plist) const
+{
+	Compression compression = m_compression;
+	if(compression == CompressionBitshuffleLZ4 && H5Zfilter_avail(FILTER_BITSHUFFLE) <= 0)
+	{
+		qWarning() << "Bitshuffle filter not available, using deflate for " << m_name;
+		compression = CompressionDeflate;
+	}
+	else if(compression == CompressionZstd && H5Zfilter_avail(FILTER_ZSTD) <= 0)
+	{
+		qWarning() << "Zstd filter not available, using deflate for " << m_name;
+		compression = CompressionDeflate;
+	}
+
+	switch(compression)
+	{
+	case CompressionDeflate:
+		{
+			// Byte shuffling groups the (mostly zero) high bytes of
+			//	multi-byte integers, which helps deflate a lot.
+			if(m_dataTypeSize > 1)
+				plist.setShuffle();
+			plist.setDeflate(m_compressionLevel > 0 ? m_compressionLevel : 4);
+		}
+		break;
+	case CompressionBitshuffleLZ4:
+		{
+			const unsigned int values[5] = {0, 0, 0, 0, BITSHUFFLE_LZ4};
+			H5Pset_filter(plist.getId(), FILTER_BITSHUFFLE, H5Z_FLAG_MANDATORY, 5, values);
+		}
+		break;
+	case CompressionZstd:
+		{
+			const unsigned int values[1] = 
+				{(unsigned int) (m_compressionLevel > 0 ? m_compressionLevel : 3)};
+			H5Pset_filter(plist.getId(), FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, values);
+		}
+		break;
+	default:
+		break;
 	}
 }
 
@@ -289,6 +1429,54 @@ void Dataset::setDataType(DataType type)
     m_dataTypeSize = emdTypeDepth(type);
 }
 
+void Dataset::setStorageType(DataType type)
+{
+    m_storageType = type;
+}
+
+DataType Dataset::storageType() const
+{
+    if(m_dataType == DataTypeFloat32 
+        && (m_storageType == DataTypeFloat16 || m_storageType == DataTypeBFloat16))
+        return m_storageType;
+
+    return m_dataType;
+}
+
+void Dataset::setLoadType(DataType type)
+{
+    m_loadType = type;
+}
+
+void Dataset::frameShape(int &rows, int &columns) const
+{
+	rows = columns = 0;
+	int rank = m_space.rank();
+	if(rank < 2)
+		return;
+
+	if(m_descendingData)
+	{
+		rows = m_space.dimLength(rank - 2);
+		columns = m_space.dimLength(rank - 1);
+	}
+	else
+	{
+		columns = m_space.dimLength(0);
+		rows = m_space.dimLength(1);
+	}
+}
+
+std::vector<int> Dataset::scanDims() const
+{
+	std::vector<int> dims;
+	int rank = m_space.rank();
+	for(int iii = 0; iii < rank - 2; ++iii)
+		dims.push_back(m_space.dimLength(m_descendingData ? iii : iii + 2));
+
+	return dims;
+}
+
 int Dataset::complexIndex() const
 {
 	return m_complexIndex;
@@ -328,18 +1516,120 @@ Dataset::Selection Dataset::selectAll() const
 	return selection;
 }
 
+void Dataset::initSparse(const DataSet &dataSet)
+{
+	if(H5Aexists(dataSet.getId(), SPARSE_FRAME_DIMS) <= 0)
+		return;
+
+	H5::Attribute attr = dataSet.openAttribute(SPARSE_FRAME_DIMS);
+	if(attr.getSpace().getSimpleExtentNpoints() != 2)
+		return;
+	attr.read(PredType::NATIVE_INT32, m_frameDims);
+
+	// The logical (dense) dataspace has the detector dims appended to
+	//	the scan dims of the file dataset.
+	std::vector<int> dimLengths;
+	H5::DataSpace space = dataSet.getSpace();
+	int rank = space.getSimpleExtentNdims();
+	std::vector<hsize_t> dims(rank);
+	space.getSimpleExtentDims(dims.data(), NULL);
+	for(int iii = 0; iii < rank; ++iii)
+		dimLengths.push_back((int) dims[iii]);
+	dimLengths.push_back(m_frameDims[0]);
+	dimLengths.push_back(m_frameDims[1]);
+
+	m_sparse = true;
+	m_descendingData = true;
+	m_space = DataSpace((int) dimLengths.size(), dimLengths.data());
+	setDataType(DataTypeUInt32);
+}
+
+int64_t Dataset::sparseFrameCount() const
+{
+	if(m_eventOffsets.empty())
+		return 0;
+
+	return (int64_t) m_eventOffsets.size() - 1;
+}
+
+int Dataset::sparseFrameSize() const
+{
+	return m_frameDims[0] * m_frameDims[1];
+}
+
+const uint32_t *Dataset::sparseEvents(int64_t frameIndex, int64_t &count) const
+{
+	count = 0;
+	if(frameIndex < 0 || frameIndex >= sparseFrameCount())
+		return NULL;
+
+	uint64_t start = m_eventOffsets[frameIndex];
+	count = (int64_t) (m_eventOffsets[frameIndex + 1] - start);
+	if(count == 0)
+		return NULL;
+
+	return &m_events[start];
+}
+
+void Dataset::setCompression(Compression compression, int level)
+{
+	m_compression = compression;
+	m_compressionLevel = level;
+}
+
 void Dataset::setTrueLength(int length)
 {
-    if(this->dimCount() != 1)
+    if(m_space.rank() != 1)
         return;
 
-    if(this->dimLength(0) != 2)
+    // The stored length, not an earlier true length
+    if(m_space.dimLength(0) != 2)
         return;
 
     m_trueLength = length;
     m_truncatedDim = true;
 }
 
+void Dataset::decimateDim(int binning, int stride)
+{
+    if(!m_data || m_sparse || m_space.rank() != 1 || !isNumericType(m_dataType))
+        return;
+
+    int length = dimLength(0);
+    int binnedLength = decimatedLength(length, binning, stride);
+    if(binning == 1 && stride == 1)
+        return;
+
+    int storedLength = m_space.dimLength(0);
+    std::vector<double> values(storedLength);
+    convertValues(m_data, m_dataType, values.data(), DataTypeFloat64, storedLength);
+
+    std::vector<double> result;
+    if(m_truncatedDim)
+    {
+        // Still a start and a step, describing the new length
+        double step = values[1] - values[0];
+        result.push_back(values[0] + 0.5 * (binning - 1) * step);
+        result.push_back(result[0] + step * binning * stride);
+        m_trueLength = binnedLength;
+    }
+    else
+    {
+        for(int iii = 0; iii < binnedLength; ++iii)
+        {
+            const double *bin = &values[iii * binning * stride];
+            result.push_back(simd::sum(bin, binning) / binning);
+        }
+    }
+
+    setDataType(DataTypeFloat64);
+    int resultLength = (int)result.size();
+    m_space = DataSpace(1, &resultLength);
+    setBuffer((char*) allocateBuffer(resultLength * sizeof(double)));
+    std::copy(result.begin(), result.end(), (double*)m_data);
+    m_reducedInMemory = true;
+}
+
 QVariant Dataset::variantRepresentation() const
 {
 	return QVariant(m_space.stringRepresentation());
@@ -347,6 +1637,21 @@ QVariant Dataset::variantRepresentation() const
 
 QVariant Dataset::variantDataValue(const int &index) const
 {
+	if(m_sparse)
+	{
+		int frameSize = sparseFrameSize();
+		int64_t count;
+		const uint32_t *events = sparseEvents(index / frameSize, count);
+		uint32_t pixel = (uint32_t) (index % frameSize);
+		uint32_t value = 0;
+		for(int64_t iii = 0; iii < count; ++iii)
+		{
+			if(events[iii] == pixel)
+				++value;
+		}
+		return QVariant(value);
+	}
+
 	// If this is a dummy data node (created when a dim node does not
 	//	exist) then we just return the index value itself (shifted).
 	if(!m_data)
@@ -434,6 +1739,14 @@ QVariant Dataset::variantDataValue(const int &index) const
             return value<double>(index);
 		}
 		break;
+	case DataTypeFloat16:
+		return QVariant(simd::halfToFloat(((const uint16_t*) m_data)[index]));
+	case DataTypeBFloat16:
+		return QVariant(simd::bfloat16ToFloat(((const uint16_t*) m_data)[index]));
+	case DataTypeComplex64:
+		return QVariant(complexString<float>(m_data, index));
+	case DataTypeComplex128:
+		return QVariant(complexString<double>(m_data, index));
 	case DataTypeString:
 		{
             if(m_truncatedDim && index > 1)
@@ -579,6 +1892,14 @@ QString Dataset::valueString(const int &index) const
             return QString::number(value<double>(index));
 		}
 		break;
+	case DataTypeFloat16:
+		return QString::number(simd::halfToFloat(((const uint16_t*) m_data)[index]));
+	case DataTypeBFloat16:
+		return QString::number(simd::bfloat16ToFloat(((const uint16_t*) m_data)[index]));
+	case DataTypeComplex64:
+		return complexString<float>(m_data, index);
+	case DataTypeComplex128:
+		return complexString<double>(m_data, index);
 	case DataTypeString:
 		{
             if(m_truncatedDim && index > 1)
@@ -656,18 +1977,98 @@ Frame *Dataset::frame(const Slice &slice) const
         hStep = temp;
     }
 
+	if(m_sparse)
+	{
+		Frame *frame = sparseFrame(hor, ver, hStep, vStep, offset);
+		if(frame)
+			frame->setIndex(offset);
+		return frame;
+	}
+
 	void *real, *imaginary = NULL;
 	real = (void*) (m_data + offset * m_dataTypeSize);
 	if(m_complexIndex >= 0)
 		imaginary = (void*) (m_data + (offset + complexStep) * m_dataTypeSize); 
 
 	Frame *frame = new Frame(real, imaginary, hStep, vStep, m_space.dimLength(hor), m_space.dimLength(ver), this->dataType(), false);
+	frame->setOwner(m_buffer);
 
     frame->setIndex(offset);
 
 	return frame;
 }
 
+Frame *Dataset::mutableFrame(const Slice &slice)
+{
+	if(m_sparse)
+		return 0;
+
+	detach();
+	Frame *frame = this->frame(slice);
+	if(frame)
+		frame->m_writesThrough = true;
+	return frame;
+}
+
+Frame *Dataset::sparseFrame(int hor, int ver, int hStep, int vStep, int offset) const
+{
+	if(!isLoaded())
+		return 0;
+
+	int rank = m_space.rank();
+	int frameSize = sparseFrameSize();
+	int hSize = m_space.dimLength(hor);
+	int vSize = m_space.dimLength(ver);
+
+	uint32_t *dense = (uint32_t*) allocateBuffer((size_t) hSize * vSize * sizeof(uint32_t));
+	memset(dense, 0, (size_t) hSize * vSize * sizeof(uint32_t));
+
+	if(hor == rank - 2 && ver == rank - 1)
+	{
+		// Diffraction pattern of one scan position. The detector dims
+		//	are the fastest varying, so the steps are the same in the
+		//	densified frame as in the full dense dataset.
+		int64_t count;
+		const uint32_t *events = sparseEvents(offset / frameSize, count);
+		for(int64_t iii = 0; iii < count; ++iii)
+		{
+			if(events[iii] < (uint32_t) frameSize)
+				++dense[events[iii]];
+		}
+
+		return new Frame(dense, NULL, hStep, vStep, hSize, vSize, m_dataType, AllocatedBuffer);
+	}
+	else if(hor < rank - 2 && ver < rank - 2)
+	{
+		// Real space image of a single detector pixel
+		uint32_t pixel = (uint32_t) (offset % frameSize);
+		int64_t base = offset / frameSize;
+		int64_t hScanStep = hStep / frameSize;
+		int64_t vScanStep = vStep / frameSize;
+		for(int v = 0; v < vSize; ++v)
+		{
+			for(int h = 0; h < hSize; ++h)
+			{
+				int64_t count;
+				const uint32_t *events = sparseEvents(base + h * hScanStep + v * vScanStep, count);
+				uint32_t value = 0;
+				for(int64_t iii = 0; iii < count; ++iii)
+				{
+					if(events[iii] == pixel)
+						++value;
+				}
+				dense[v * hSize + h] = value;
+			}
+		}
+
+		return new Frame(dense, NULL, 1, hSize, hSize, vSize, m_dataType, AllocatedBuffer);
+	}
+
+	// Mixed scan/detector frames are not supported
+	freeBuffer(dense);
+	return 0;
+}
+
 } // namespace emd
 
 
@@ -0,0 +1,948 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DatasetServer.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "H5Cpp.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+#include "AsyncLoad.h"
+#include "Convert.h"
+#include "DataSpace.h"
+
+namespace emd
+{
+
+const int SERVER_MAX_RANK = 32;
+const int SERVER_MAX_PATH = 4096;
+
+// Sent by a client, followed by the file and data paths for attach
+struct ServerRequest
+{
+	enum Operation
+	{
+		Attach = 1,
+		Release
+	};
+
+	int32_t operation;
+	int32_t type;
+	// 0 for all of the data
+	int32_t rank;
+	int32_t filePathLength;
+	int32_t dataPathLength;
+	int32_t start[SERVER_MAX_RANK];
+	int32_t end[SERVER_MAX_RANK];
+	int64_t segment;
+};
+
+// Sent with the segment's file descriptor when successful
+struct ServerReply
+{
+	int32_t success;
+	int32_t type;
+	int32_t rank;
+	int32_t dims[SERVER_MAX_RANK];
+	int64_t segment;
+	int64_t bytes;
+};
+
+#ifndef _WIN32
+
+#ifdef MSG_NOSIGNAL
+const int SERVER_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SERVER_SEND_FLAGS = 0;
+#endif
+
+static bool sendAll(int socket, const void *data, size_t size)
+{
+	const char *next = (const char*) data;
+	while(size > 0)
+	{
+		ssize_t sent = send(socket, next, size, SERVER_SEND_FLAGS);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return false;
+		next += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(int socket, void *data, size_t size)
+{
+	char *next = (char*) data;
+	while(size > 0)
+	{
+		ssize_t received = recv(socket, next, size, 0);
+		if(received < 0 && errno == EINTR)
+			continue;
+		if(received <= 0)
+			return false;
+		next += received;
+		size -= received;
+	}
+	return true;
+}
+
+static void noSignalOnClose(int socket)
+{
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	int noSignal = 1;
+	setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#else
+	(void) socket;
+#endif
+}
+
+static bool socketAddress(const QString &path, sockaddr_un &address)
+{
+	QByteArray ba = path.toLocal8Bit();
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(ba.size() == 0 || ba.size() >= (int) sizeof(address.sun_path))
+	{
+		qWarning() << "Bad socket path: " << path;
+		return false;
+	}
+	memcpy(address.sun_path, ba.constData(), ba.size());
+	return true;
+}
+
+static bool sendReply(int socket, const ServerReply &reply, int fd)
+{
+	iovec io = {(void*) &reply, sizeof(reply)};
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &io;
+	message.msg_iovlen = 1;
+
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		cmsghdr align;
+	} control;
+	if(fd >= 0)
+	{
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &fd, sizeof(int));
+	}
+
+	ssize_t sent;
+	do
+		sent = sendmsg(socket, &message, SERVER_SEND_FLAGS);
+	while(sent < 0 && errno == EINTR);
+	if(sent <= 0)
+		return false;
+
+	// The descriptor went with the first part
+	return sendAll(socket, (const char*) &reply + sent, sizeof(reply) - sent);
+}
+
+static bool receiveReply(int socket, ServerReply &reply, int &fd)
+{
+	fd = -1;
+	iovec io = {&reply, sizeof(reply)};
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &io;
+	message.msg_iovlen = 1;
+
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		cmsghdr align;
+	} control;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	ssize_t received;
+	do
+		received = recvmsg(socket, &message, 0);
+	while(received < 0 && errno == EINTR);
+	if(received <= 0)
+		return false;
+
+	for(cmsghdr *header = CMSG_FIRSTHDR(&message); header; 
+		header = CMSG_NXTHDR(&message, header))
+	{
+		if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(header), sizeof(int));
+	}
+
+	if(!receiveAll(socket, (char*) &reply + received, sizeof(reply) - received))
+	{
+		if(fd >= 0)
+			close(fd);
+		fd = -1;
+		return false;
+	}
+	return true;
+}
+
+// In nanoseconds where the platform has them, so that a file rewritten
+//	within a second is not taken for the old one
+static int64_t modificationTime(const struct stat &status)
+{
+#if defined(__APPLE__)
+	return status.st_mtimespec.tv_sec * 1000000000LL + status.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+	return status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+#else
+	return status.st_mtime * 1000000000LL;
+#endif
+}
+
+// Clients are given the descriptor itself, so the name is unlinked at
+//	once, and nothing is left behind if the server dies.
+static int createSegment(int64_t bytes)
+{
+	static std::atomic<int> counter(0);
+	char name[64];
+	snprintf(name, sizeof(name), "/emd-%d-%d", (int) getpid(), counter++);
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0)
+		return -1;
+	shm_unlink(name);
+
+	if(ftruncate(fd, bytes) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+#endif
+
+struct DatasetServer::Shared
+{
+	struct Segment
+	{
+		std::string key;
+		int fd;
+		int64_t bytes;
+		DataType type;
+		std::vector<int32_t> dims;
+		int references;
+		uint64_t lastUse;
+	};
+
+	struct Client
+	{
+		int socket;
+		// Received bytes of requests that are not complete yet
+		std::vector<char> input;
+		// References held, by segment
+		std::map<int64_t, int> references;
+	};
+
+	QString socketPath;
+	std::atomic<int64_t> memoryCap;
+	std::atomic<int64_t> memoryUsage;
+	std::atomic<int> segmentCount;
+	std::atomic<int> clientCount;
+	std::atomic<bool> stopping;
+	int listener;
+	int wake[2];
+
+	// Only used on the serving thread
+	std::map<int64_t, Segment> segments;
+	std::map<std::string, int64_t> keys;
+	std::vector<Client> clients;
+	int64_t nextSegment;
+	uint64_t clock;
+
+	Shared(const QString &path, int64_t cap)
+		: socketPath(path),
+		memoryCap(cap),
+		memoryUsage(0),
+		segmentCount(0),
+		clientCount(0),
+		stopping(false),
+		listener(-1),
+		nextSegment(1),
+		clock(0)
+	{
+		wake[0] = wake[1] = -1;
+	}
+
+	~Shared()
+	{
+#ifndef _WIN32
+		if(wake[0] >= 0)
+		{
+			close(wake[0]);
+			close(wake[1]);
+		}
+#endif
+	}
+
+#ifndef _WIN32
+	bool listen()
+	{
+		if(listener >= 0)
+			return false;
+
+		sockaddr_un address;
+		if(!socketAddress(socketPath, address))
+			return false;
+
+		// A socket left behind by a server that is gone is replaced
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(probe >= 0)
+		{
+			bool inUse = (::connect(probe, (sockaddr*) &address, sizeof(address)) == 0);
+			close(probe);
+			if(inUse)
+			{
+				qWarning() << "A dataset server is already listening on " << socketPath;
+				return false;
+			}
+		}
+		struct stat status;
+		if(stat(address.sun_path, &status) == 0 && S_ISSOCK(status.st_mode))
+			unlink(address.sun_path);
+
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listener < 0 
+			|| bind(listener, (sockaddr*) &address, sizeof(address)) != 0 
+			|| ::listen(listener, 16) != 0
+			|| (wake[0] < 0 && pipe(wake) != 0))
+		{
+			qWarning() << "Failed to listen on " << socketPath;
+			if(listener >= 0)
+				close(listener);
+			listener = -1;
+			return false;
+		}
+
+		stopping = false;
+		return true;
+	}
+
+	void serve()
+	{
+		std::vector<pollfd> waiting;
+		while(!stopping)
+		{
+			waiting.clear();
+			pollfd wakeEntry = {wake[0], POLLIN, 0};
+			pollfd listenerEntry = {listener, POLLIN, 0};
+			waiting.push_back(wakeEntry);
+			waiting.push_back(listenerEntry);
+			for(const Client &client : clients)
+			{
+				pollfd entry = {client.socket, POLLIN, 0};
+				waiting.push_back(entry);
+			}
+
+			if(poll(waiting.data(), waiting.size(), -1) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				qWarning() << "Dataset server failed to wait for clients";
+				break;
+			}
+
+			if(waiting[0].revents)
+			{
+				char byte;
+				if(read(wake[0], &byte, 1) < 0)
+					qDebug() << "Failed to clear the wake pipe";
+				break;
+			}
+
+			// Last to first, so that clients that are gone can be removed
+			for(int iii = (int) waiting.size() - 3; iii >= 0; --iii)
+			{
+				if(!waiting[iii + 2].revents || handle(clients[iii]))
+					continue;
+
+				for(const auto &held : clients[iii].references)
+				{
+					auto segment = segments.find(held.first);
+					if(segment != segments.end())
+						segment->second.references -= held.second;
+				}
+				close(clients[iii].socket);
+				clients.erase(clients.begin() + iii);
+			}
+
+			if(waiting[1].revents & POLLIN)
+			{
+				int socket = accept(listener, 0, 0);
+				if(socket >= 0)
+				{
+					// A client that stops reading its replies cannot hold up
+					//	the others for long
+					timeval timeout = {5, 0};
+					setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+					noSignalOnClose(socket);
+					Client client;
+					client.socket = socket;
+					clients.push_back(client);
+				}
+			}
+			clientCount = clients.size();
+		}
+
+		shutdown();
+	}
+
+	void shutdown()
+	{
+		for(const Client &client : clients)
+			close(client.socket);
+		clients.clear();
+		for(const auto &segment : segments)
+			close(segment.second.fd);
+		segments.clear();
+		keys.clear();
+
+		memoryUsage = 0;
+		segmentCount = 0;
+		clientCount = 0;
+
+		close(listener);
+		listener = -1;
+		QByteArray path = socketPath.toLocal8Bit();
+		unlink(path.constData());
+	}
+
+	// Takes what the client has sent without waiting for the rest, and
+	//	serves the requests that are complete. Returns false once the 
+	//	client is gone, or if it breaks the protocol.
+	bool handle(Client &client)
+	{
+		char buffer[4096];
+		ssize_t received;
+		do
+			received = recv(client.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+		while(received < 0 && errno == EINTR);
+		if(received == 0)
+			return false;
+		if(received < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		client.input.insert(client.input.end(), buffer, buffer + received);
+
+		while(client.input.size() >= sizeof(ServerRequest))
+		{
+			ServerRequest request;
+			memcpy(&request, client.input.data(), sizeof(request));
+			if(request.operation == ServerRequest::Release)
+			{
+				client.input.erase(client.input.begin(), 
+					client.input.begin() + sizeof(request));
+				release(client, request.segment);
+				continue;
+			}
+
+			if(request.operation != ServerRequest::Attach 
+				|| request.rank < 0 || request.rank > SERVER_MAX_RANK 
+				|| request.filePathLength < 0 || request.filePathLength > SERVER_MAX_PATH 
+				|| request.dataPathLength < 0 || request.dataPathLength > SERVER_MAX_PATH)
+				return false;
+
+			size_t length = sizeof(request) + request.filePathLength 
+				+ request.dataPathLength;
+			if(client.input.size() < length)
+				break;
+
+			const char *paths = client.input.data() + sizeof(request);
+			std::string filePath(paths, request.filePathLength);
+			std::string dataPath(paths + request.filePathLength, 
+				request.dataPathLength);
+			client.input.erase(client.input.begin(), client.input.begin() + length);
+
+			ServerReply reply;
+			memset(&reply, 0, sizeof(reply));
+			int fd = -1;
+			if(attach(client, request, filePath, dataPath, reply))
+				fd = segments[reply.segment].fd;
+			if(!sendReply(client.socket, reply, fd))
+				return false;
+		}
+		return true;
+	}
+
+	bool attach(Client &client, const ServerRequest &request, 
+		const std::string &filePath, const std::string &dataPath, 
+		ServerReply &reply)
+	{
+		// Requests for the same values of the same version of the file
+		//	share a segment
+		struct stat status;
+		if(stat(filePath.c_str(), &status) != 0)
+		{
+			qWarning() << "Cannot share data from " << filePath.c_str();
+			return false;
+		}
+
+		std::string key = filePath + '\n' + std::to_string((int64_t) status.st_size) 
+			+ ' ' + std::to_string(modificationTime(status)) + '\n' + dataPath 
+			+ '\n' + std::to_string(request.type);
+		for(int iii = 0; iii < request.rank; ++iii)
+			key += ' ' + std::to_string(request.start[iii]) + ':' 
+				+ std::to_string(request.end[iii]);
+
+		int64_t id;
+		auto known = keys.find(key);
+		if(known != keys.end())
+			id = known->second;
+		else
+			id = load(key, request, filePath, dataPath);
+		if(id < 0)
+			return false;
+
+		Segment &segment = segments[id];
+		++segment.references;
+		++client.references[id];
+		segment.lastUse = ++clock;
+
+		reply.success = 1;
+		reply.type = segment.type;
+		reply.rank = segment.dims.size();
+		for(int iii = 0; iii < reply.rank; ++iii)
+			reply.dims[iii] = segment.dims[iii];
+		reply.segment = id;
+		reply.bytes = segment.bytes;
+		return true;
+	}
+
+	// Returns the new segment, or -1
+	int64_t load(const std::string &key, const ServerRequest &request, 
+		const std::string &filePath, const std::string &dataPath)
+	{
+		std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+		int fd = -1;
+		try {
+			H5::Exception::dontPrint();
+			H5::H5File file(filePath.c_str(), H5F_ACC_RDONLY);
+			H5::DataSet dataSet = file.openDataSet(dataPath.c_str());
+
+			DataSpace space = DataSpace::fromHdfDataSet(dataSet);
+			int rank = space.rank();
+			if(rank == 0 || (request.rank != 0 && request.rank != rank))
+			{
+				qWarning() << "Selection does not match data " << dataPath.c_str();
+				return -1;
+			}
+
+			Dataset::Selection selection(rank);
+			std::vector<int32_t> dims(rank);
+			int64_t values = 1;
+			for(int iii = 0; iii < rank; ++iii)
+			{
+				selection[iii].start = request.rank ? request.start[iii] : 0;
+				selection[iii].end = request.rank ? request.end[iii] : space.dimLength(iii);
+				dims[iii] = selection[iii].end - selection[iii].start;
+				values *= std::max(dims[iii], 0);
+			}
+
+			DataType type = (DataType) request.type;
+			if(!isNumericType(type))
+				type = dataTypeFromHdfDataSet(dataSet);
+			if(!isNumericType(type) || values <= 0)
+			{
+				qWarning() << "Cannot share " << dataPath.c_str();
+				return -1;
+			}
+
+			int64_t bytes = values * emdTypeDepth(type);
+			if(!makeRoom(bytes))
+			{
+				qWarning() << "Dataset server memory cap reached; refused " << dataPath.c_str();
+				return -1;
+			}
+
+			fd = createSegment(bytes);
+			if(fd < 0)
+			{
+				qWarning() << "Failed to create a shared memory segment for " << dataPath.c_str();
+				return -1;
+			}
+
+			void *data = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			Dataset reader;
+			bool success = (data != MAP_FAILED) 
+				&& reader.read(dataSet, selection, data, type);
+			if(data != MAP_FAILED)
+				munmap(data, bytes);
+			if(!success)
+			{
+				close(fd);
+				return -1;
+			}
+
+			Segment segment = {key, fd, bytes, type, dims, 0, 0};
+			int64_t id = nextSegment++;
+			segments[id] = segment;
+			keys[key] = id;
+			memoryUsage += bytes;
+			segmentCount = segments.size();
+			return id;
+		}
+		catch(H5::Exception error) {
+			qWarning() << "Failed to read " << dataPath.c_str() << " from " << filePath.c_str();
+			if(fd >= 0)
+				close(fd);
+			return -1;
+		}
+	}
+
+	void release(Client &client, int64_t id)
+	{
+		auto held = client.references.find(id);
+		if(held == client.references.end())
+			return;
+		if(--held->second == 0)
+			client.references.erase(held);
+
+		auto segment = segments.find(id);
+		if(segment != segments.end())
+			--segment->second.references;
+	}
+
+	// Drops the least recently used segments no client holds until the
+	//	bytes fit under the cap. Returns false if they do not.
+	bool makeRoom(int64_t bytes)
+	{
+		int64_t cap = memoryCap;
+		if(cap <= 0)
+			return true;
+
+		while(memoryUsage + bytes > cap)
+		{
+			auto oldest = segments.end();
+			for(auto segment = segments.begin(); segment != segments.end(); ++segment)
+			{
+				if(segment->second.references == 0 && (oldest == segments.end() 
+					|| segment->second.lastUse < oldest->second.lastUse))
+					oldest = segment;
+			}
+			if(oldest == segments.end())
+				return false;
+
+			keys.erase(oldest->second.key);
+			close(oldest->second.fd);
+			memoryUsage -= oldest->second.bytes;
+			segments.erase(oldest);
+		}
+
+		segmentCount = segments.size();
+		return true;
+	}
+#endif
+};
+
+DatasetServer::DatasetServer(const QString &socketPath, int64_t memoryCap)
+	: m_shared(new Shared(socketPath, memoryCap))
+{
+}
+
+DatasetServer::~DatasetServer()
+{
+	stop();
+}
+
+bool DatasetServer::start()
+{
+#ifdef _WIN32
+	qWarning() << "The dataset server is not supported on this platform";
+	return false;
+#else
+	if(m_thread.joinable() || !m_shared->listen())
+		return false;
+
+	std::shared_ptr<Shared> shared = m_shared;
+	m_thread = std::thread([shared]() {shared->serve();});
+	return true;
+#endif
+}
+
+bool DatasetServer::run()
+{
+#ifdef _WIN32
+	qWarning() << "The dataset server is not supported on this platform";
+	return false;
+#else
+	if(m_thread.joinable() || !m_shared->listen())
+		return false;
+
+	m_shared->serve();
+	return true;
+#endif
+}
+
+void DatasetServer::stop()
+{
+#ifndef _WIN32
+	if(!m_shared->stopping.exchange(true) && m_shared->wake[1] >= 0)
+	{
+		char byte = 0;
+		if(write(m_shared->wake[1], &byte, 1) < 0)
+			qDebug() << "Failed to wake the dataset server";
+	}
+#endif
+
+	if(m_thread.joinable())
+		m_thread.join();
+}
+
+QString DatasetServer::socketPath() const
+{
+	return m_shared->socketPath;
+}
+
+int64_t DatasetServer::memoryCap() const
+{
+	return m_shared->memoryCap;
+}
+
+void DatasetServer::setMemoryCap(int64_t bytes)
+{
+	m_shared->memoryCap = std::max<int64_t>(0, bytes);
+}
+
+int64_t DatasetServer::memoryUsage() const
+{
+	return m_shared->memoryUsage;
+}
+
+int DatasetServer::segmentCount() const
+{
+	return m_shared->segmentCount;
+}
+
+int DatasetServer::clientCount() const
+{
+	return m_shared->clientCount;
+}
+
+/**************************** DatasetClient ***************************/
+
+// Shared with the deleters of the attached datasets, which tell the 
+//	server that the process no longer holds the segment
+struct DatasetClient::Connection
+{
+	std::mutex mutex;
+	int socket;
+
+	Connection()
+		: socket(-1)
+	{}
+
+	void release(int64_t segment)
+	{
+#ifndef _WIN32
+		std::lock_guard<std::mutex> lock(mutex);
+		if(socket < 0)
+			return;
+
+		ServerRequest request;
+		memset(&request, 0, sizeof(request));
+		request.operation = ServerRequest::Release;
+		request.segment = segment;
+		sendAll(socket, &request, sizeof(request));
+#else
+		(void) segment;
+#endif
+	}
+};
+
+DatasetClient::DatasetClient()
+	: m_connection(new Connection)
+{
+}
+
+DatasetClient::~DatasetClient()
+{
+	disconnect();
+}
+
+bool DatasetClient::connect(const QString &socketPath)
+{
+	disconnect();
+
+#ifdef _WIN32
+	qWarning() << "The dataset server is not supported on this platform";
+	return false;
+#else
+	sockaddr_un address;
+	if(!socketAddress(socketPath, address))
+		return false;
+
+	int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(socket < 0 || ::connect(socket, (sockaddr*) &address, sizeof(address)) != 0)
+	{
+		qWarning() << "Failed to connect to the dataset server at " << socketPath;
+		if(socket >= 0)
+			close(socket);
+		return false;
+	}
+	noSignalOnClose(socket);
+
+	// A new connection, so that releases from datasets attached through
+	//	the last one do not reach this one
+	m_connection = std::make_shared<Connection>();
+	m_connection->socket = socket;
+	return true;
+#endif
+}
+
+void DatasetClient::disconnect()
+{
+#ifndef _WIN32
+	std::lock_guard<std::mutex> lock(m_connection->mutex);
+	if(m_connection->socket >= 0)
+		close(m_connection->socket);
+	m_connection->socket = -1;
+#endif
+}
+
+bool DatasetClient::isConnected() const
+{
+	std::lock_guard<std::mutex> lock(m_connection->mutex);
+	return m_connection->socket >= 0;
+}
+
+Dataset *DatasetClient::attach(const QString &filePath, 
+	const QString &dataPath, const Dataset::Selection &selection, DataType type)
+{
+#ifdef _WIN32
+	return 0;
+#else
+	// The server shares data by file path, so each file is asked for by
+	//	the same one
+	QString canonicalPath = QFileInfo(filePath).canonicalFilePath();
+	if(canonicalPath.isEmpty())
+	{
+		qWarning() << "No such file: " << filePath;
+		return 0;
+	}
+
+	QByteArray file = canonicalPath.toLocal8Bit();
+	QByteArray data = dataPath.toLocal8Bit();
+	if(selection.size() > (size_t) SERVER_MAX_RANK 
+		|| file.size() > SERVER_MAX_PATH || data.size() > SERVER_MAX_PATH)
+	{
+		qWarning() << "Cannot request " << dataPath << " from the dataset server";
+		return 0;
+	}
+
+	ServerRequest request;
+	memset(&request, 0, sizeof(request));
+	request.operation = ServerRequest::Attach;
+	request.type = type;
+	request.rank = selection.size();
+	request.filePathLength = file.size();
+	request.dataPathLength = data.size();
+	for(int iii = 0; iii < request.rank; ++iii)
+	{
+		request.start[iii] = selection[iii].start;
+		request.end[iii] = selection[iii].end;
+	}
+
+	ServerReply reply;
+	int fd = -1;
+	{
+		std::lock_guard<std::mutex> lock(m_connection->mutex);
+		int socket = m_connection->socket;
+		if(socket < 0)
+		{
+			qWarning() << "Not connected to a dataset server";
+			return 0;
+		}
+
+		if(!sendAll(socket, &request, sizeof(request)) 
+			|| !sendAll(socket, file.constData(), file.size()) 
+			|| !sendAll(socket, data.constData(), data.size()) 
+			|| !receiveReply(socket, reply, fd))
+		{
+			qWarning() << "Lost the connection to the dataset server";
+			close(socket);
+			m_connection->socket = -1;
+			return 0;
+		}
+	}
+
+	if(!reply.success || fd < 0 || reply.rank < 1 || reply.rank > SERVER_MAX_RANK)
+	{
+		if(fd >= 0)
+			close(fd);
+		qWarning() << "The dataset server could not provide " << dataPath;
+		return 0;
+	}
+
+	// Private, so that changes to the data stay in this process
+	void *mapped = mmap(0, reply.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(mapped == MAP_FAILED)
+	{
+		qWarning() << "Failed to map the shared data of " << dataPath;
+		m_connection->release(reply.segment);
+		return 0;
+	}
+
+	std::shared_ptr<Connection> connection = m_connection;
+	int64_t segment = reply.segment;
+	int64_t bytes = reply.bytes;
+	return new Dataset(reply.rank, reply.dims, (DataType) reply.type, 
+		(char*) mapped, [connection, segment, bytes](char *data)
+		{
+			munmap(data, bytes);
+			connection->release(segment);
+		});
+#endif
+}
+
+} // namespace emd
@@ -24,6 +24,7 @@
 #include <stack>
 #include <stdint.h>
 
+#include "Allocator.h"
 #include "Attribute.h"
 #include "Model.h"
 
@@ -262,7 +263,7 @@ FileManager::Error FileManager::loadSer(const char *filePath, Model *model)
 			    emdDataType = serToEmdType(serDataType);
                 elementSize = dataSizeX * dataSizeY * emd::emdTypeDepth(emdDataType);
                 int32_t dataSize = serHeader.validElementCount * elementSize;
-                data = new char[dataSize];
+                data = (char*) allocateBuffer(dataSize);
             }
 
             if(dataSizeX == xSize && dataSizeY == ySize)
@@ -277,8 +278,7 @@ FileManager::Error FileManager::loadSer(const char *filePath, Model *model)
                 delete[] dataOffsetArray;
                 delete[] tagOffsetArray;
 
-                if(data)
-                    delete[] data;
+                freeBuffer(data);
 
                 return ErrorInvalidDataFormat;
             }
@@ -308,7 +308,7 @@ FileManager::Error FileManager::loadSer(const char *filePath, Model *model)
             dimSizes[0] = dataSizeX;
             dimSizes[1] = dataSizeY;
 
-            Dataset *dataNode = new Dataset(dimCount, dimSizes, emdDataType, data, false);
+            Dataset *dataNode = new Dataset(dimCount, dimSizes, emdDataType, data, AllocatedBuffer, false);
 
 			dataNode->setName("data");
 
@@ -755,13 +755,13 @@ FileManager::Error FileManager::loadDm3(const char *filePath, Model *emdModel)
 				int dataDepth = emd::emdTypeDepth(dataTypeList.at(imgIndex));
 
 				// Init the data
-				char *data = new char[dataLength * dataDepth];
+				char *data = (char*) allocateBuffer(dataLength * dataDepth);
 
 				// Store the data
 				char *rawData = dataList.at(imgIndex);
 				memcpy(data, rawData, dataDepth * dataLength);
 				Dataset *dataNode = new Dataset(dimList.count(),
-					dimSizes, dataTypeList.at(imgIndex), data, false);
+					dimSizes, dataTypeList.at(imgIndex), data, AllocatedBuffer, false);
 				dataNode->setName("data");
                 dataNode->setStatus(Node::DIRTY);
 
@@ -835,7 +835,7 @@ FileManager::Error FileManager::loadTiff(const char *filePath, Model *emdModel)
     }
 	// Initialize the image data
 	const int dims[2] = {rawImage.width(), rawImage.height()};
-	char *data = new char[dims[0] * dims[1]];
+	char *data = (char*) allocateBuffer(dims[0] * dims[1]);
 
 	// Store the data
 	int index = 0;
@@ -867,7 +867,7 @@ FileManager::Error FileManager::loadTiff(const char *filePath, Model *emdModel)
 	dataGroup->addChild(groupType);
 
 	// Create the dataset
-	Dataset *dataSet = new Dataset(2, dims, DataTypeUInt8, data);
+	Dataset *dataSet = new Dataset(2, dims, DataTypeUInt8, data, AllocatedBuffer);
 	dataSet->setName("data");
 	dataGroup->setData(dataSet);
 
@@ -937,6 +937,12 @@ DataType FileManager::serToEmdType(const int &serType)
     case 8:
         emdType = DataTypeFloat64;
         break;
+    case 9:
+        emdType = DataTypeComplex64;
+        break;
+    case 10:
+        emdType = DataTypeComplex128;
+        break;
     default:
         emdType = DataTypeUnknown;
         break;
@@ -0,0 +1,444 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "FourierTransform.h"
+
+#include <cmath>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Parallel.h"
+
+namespace emd
+{
+
+// Rows or columns handed to one thread at a time
+static const int64_t LINE_GRAIN = 16;
+
+static const double PI = 3.14159265358979323846;
+
+// Twiddle factors of one transform length. Powers of two use an 
+//	iterative radix-2 transform; other lengths are computed as a 
+//	convolution with a chirp (Bluestein), itself done with a power-of-two
+//	transform.
+template <typename R>
+struct FftPlan
+{
+	int length;
+	std::vector<int> bitReverse;
+	std::vector<std::complex<R> > twiddles;
+
+	std::vector<std::complex<R> > chirp;
+	std::vector<std::complex<R> > filter;
+	std::shared_ptr<const FftPlan<R> > padded;
+};
+
+// Spelled out; std::complex multiplication checks for infinities
+template <typename R>
+static inline std::complex<R> multiply(const std::complex<R> &a, const std::complex<R> &b)
+{
+	return std::complex<R>(a.real() * b.real() - a.imag() * b.imag(), 
+		a.real() * b.imag() + a.imag() * b.real());
+}
+
+static bool isPowerOfTwo(int length)
+{
+	return length > 0 && (length & (length - 1)) == 0;
+}
+
+static std::mutex planMutex;
+
+template <typename R>
+static std::map<int, std::shared_ptr<const FftPlan<R> > > &planCache()
+{
+	static std::map<int, std::shared_ptr<const FftPlan<R> > > cache;
+	return cache;
+}
+
+template <typename R>
+static void radix2(const FftPlan<R> &plan, std::complex<R> *values);
+
+template <typename R>
+static std::shared_ptr<const FftPlan<R> > createPlan(int length);
+
+template <typename R>
+static std::shared_ptr<const FftPlan<R> > plan(int length)
+{
+	{
+		std::lock_guard<std::mutex> lock(planMutex);
+		auto found = planCache<R>().find(length);
+		if(found != planCache<R>().end())
+			return found->second;
+	}
+
+	// Created outside the lock, as Bluestein plans need a second plan
+	std::shared_ptr<const FftPlan<R> > created = createPlan<R>(length);
+
+	std::lock_guard<std::mutex> lock(planMutex);
+	auto inserted = planCache<R>().insert(std::make_pair(length, created));
+	return inserted.first->second;
+}
+
+template <typename R>
+static std::shared_ptr<const FftPlan<R> > createPlan(int length)
+{
+	std::shared_ptr<FftPlan<R> > result = std::make_shared<FftPlan<R> >();
+	result->length = length;
+
+	if(isPowerOfTwo(length))
+	{
+		int bits = 0;
+		while((1 << bits) < length)
+			++bits;
+
+		result->bitReverse.resize(length);
+		for(int iii = 0; iii < length; ++iii)
+		{
+			int reversed = 0;
+			for(int bit = 0; bit < bits; ++bit)
+			{
+				if(iii & (1 << bit))
+					reversed |= 1 << (bits - 1 - bit);
+			}
+			result->bitReverse[iii] = reversed;
+		}
+
+		result->twiddles.resize(length / 2);
+		for(int iii = 0; iii < length / 2; ++iii)
+		{
+			double angle = -2 * PI * iii / length;
+			result->twiddles[iii] = std::complex<R>((R) std::cos(angle), (R) std::sin(angle));
+		}
+
+		return result;
+	}
+
+	int paddedLength = 1;
+	while(paddedLength < 2 * length - 1)
+		paddedLength *= 2;
+	result->padded = plan<R>(paddedLength);
+
+	// k^2 is reduced modulo 2 * length to keep the angle accurate
+	result->chirp.resize(length);
+	for(int64_t iii = 0; iii < length; ++iii)
+	{
+		double angle = -PI * (double) ((iii * iii) % (2 * (int64_t) length)) / length;
+		result->chirp[iii] = std::complex<R>((R) std::cos(angle), (R) std::sin(angle));
+	}
+
+	result->filter.assign(paddedLength, std::complex<R>(0, 0));
+	result->filter[0] = std::conj(result->chirp[0]);
+	for(int iii = 1; iii < length; ++iii)
+	{
+		result->filter[iii] = std::conj(result->chirp[iii]);
+		result->filter[paddedLength - iii] = std::conj(result->chirp[iii]);
+	}
+	radix2(*result->padded, result->filter.data());
+
+	return result;
+}
+
+template <typename R>
+static void radix2(const FftPlan<R> &plan, std::complex<R> *values)
+{
+	int length = plan.length;
+	for(int iii = 0; iii < length; ++iii)
+	{
+		int swapped = plan.bitReverse[iii];
+		if(iii < swapped)
+			std::swap(values[iii], values[swapped]);
+	}
+
+	for(int size = 2; size <= length; size *= 2)
+	{
+		int half = size / 2;
+		int step = length / size;
+		for(int start = 0; start < length; start += size)
+		{
+			std::complex<R> *lower = values + start;
+			std::complex<R> *upper = lower + half;
+			for(int iii = 0; iii < half; ++iii)
+			{
+				std::complex<R> product = multiply(plan.twiddles[iii * step], upper[iii]);
+				upper[iii] = lower[iii] - product;
+				lower[iii] += product;
+			}
+		}
+	}
+}
+
+// Forward transform of a contiguous line, in place. The scratch buffer
+//	is only used by Bluestein plans.
+template <typename R>
+static void transformLine(const FftPlan<R> &plan, std::complex<R> *values, 
+	std::vector<std::complex<R> > &scratch)
+{
+	if(!plan.padded)
+	{
+		radix2(plan, values);
+		return;
+	}
+
+	int length = plan.length;
+	int paddedLength = plan.padded->length;
+	scratch.assign(paddedLength, std::complex<R>(0, 0));
+	for(int iii = 0; iii < length; ++iii)
+		scratch[iii] = multiply(values[iii], plan.chirp[iii]);
+
+	// Convolution with the chirp; the inverse transform is done by 
+	//	conjugating around a forward transform
+	radix2(*plan.padded, scratch.data());
+	for(int iii = 0; iii < paddedLength; ++iii)
+		scratch[iii] = std::conj(multiply(scratch[iii], plan.filter[iii]));
+	radix2(*plan.padded, scratch.data());
+
+	R scale = (R) 1 / paddedLength;
+	for(int iii = 0; iii < length; ++iii)
+		values[iii] = multiply(std::conj(scratch[iii]) * scale, plan.chirp[iii]);
+}
+
+// Copies the frame into a contiguous complex buffer. Shifted spectra are
+//	moved back so that the zero frequency is at (0, 0). Frames of the
+//	native complex types are interleaved, with steps counted in complex
+//	values; other frames may have a separate imaginary part.
+template <typename R, typename S>
+static void loadFrame(const Frame *frame, bool unshift, std::complex<R> *values)
+{
+	Frame::Data<const S> data = frame->data<S>();
+	bool interleaved = isComplexType(frame->dataType());
+	int rows = data.vSize;
+	int columns = data.hSize;
+	int rowShift = unshift ? rows / 2 : 0;
+	int columnShift = unshift ? columns / 2 : 0;
+
+	for(int row = 0; row < rows; ++row)
+	{
+		int64_t rowOffset = ((row + rowShift) % rows) * data.vStep;
+		std::complex<R> *line = values + (int64_t) row * columns;
+		for(int column = 0; column < columns; ++column)
+		{
+			int64_t index = rowOffset + ((column + columnShift) % columns) * data.hStep;
+			if(interleaved)
+			{
+				line[column] = std::complex<R>((R) data.real[2 * index], 
+					(R) data.real[2 * index + 1]);
+				continue;
+			}
+			R imaginary = data.imaginary ? (R) data.imaginary[index] : 0;
+			line[column] = std::complex<R>((R) data.real[index], imaginary);
+		}
+	}
+}
+
+template <typename R>
+static void transformValues(std::complex<R> *values, int rows, int columns, bool parallel)
+{
+	std::shared_ptr<const FftPlan<R> > rowPlan = plan<R>(columns);
+	std::shared_ptr<const FftPlan<R> > columnPlan = plan<R>(rows);
+
+	auto transformRows = [&](int64_t begin, int64_t end)
+	{
+		std::vector<std::complex<R> > scratch;
+		for(int64_t row = begin; row < end; ++row)
+			transformLine(*rowPlan, values + row * columns, scratch);
+	};
+
+	auto transformColumns = [&](int64_t begin, int64_t end)
+	{
+		std::vector<std::complex<R> > scratch;
+		std::vector<std::complex<R> > line(rows);
+		for(int64_t column = begin; column < end; ++column)
+		{
+			for(int row = 0; row < rows; ++row)
+				line[row] = values[(int64_t) row * columns + column];
+			transformLine(*columnPlan, line.data(), scratch);
+			for(int row = 0; row < rows; ++row)
+				values[(int64_t) row * columns + column] = line[row];
+		}
+	};
+
+	if(parallel)
+	{
+		parallelFor(0, rows, LINE_GRAIN, transformRows);
+		parallelFor(0, columns, LINE_GRAIN, transformColumns);
+	}
+	else
+	{
+		transformRows(0, rows);
+		transformColumns(0, columns);
+	}
+}
+
+template <typename R, typename S>
+static Frame *transformFrame(const Frame *frame, bool shift, bool inverse, 
+	DataType resultType, bool parallel)
+{
+	Frame::Data<const S> data = frame->data<S>();
+	int rows = data.vSize;
+	int columns = data.hSize;
+	int64_t size = (int64_t) rows * columns;
+
+	bool unshift = inverse && (data.attributes & Frame::AttributeFourierTransformed);
+	std::vector<std::complex<R> > values(size);
+	loadFrame<R, S>(frame, unshift, values.data());
+
+	// The inverse is the conjugate of the forward transform of the
+	//	conjugate
+	if(inverse)
+	{
+		for(int64_t iii = 0; iii < size; ++iii)
+			values[iii] = std::conj(values[iii]);
+	}
+
+	transformValues(values.data(), rows, columns, parallel);
+
+	R *result = (R*) allocateBuffer(2 * size * sizeof(R));
+	int rowShift = shift ? rows / 2 : 0;
+	int columnShift = shift ? columns / 2 : 0;
+	R scale = inverse ? (R) 1 / size : 1;
+	R sign = inverse ? -1 : 1;
+
+	for(int row = 0; row < rows; ++row)
+	{
+		const std::complex<R> *line = values.data() + (int64_t) row * columns;
+		int64_t rowOffset = (int64_t) ((row + rowShift) % rows) * columns;
+		for(int column = 0; column < columns; ++column)
+		{
+			int64_t index = rowOffset + (column + columnShift) % columns;
+			result[2 * index] = line[column].real() * scale;
+			result[2 * index + 1] = sign * line[column].imag() * scale;
+		}
+	}
+
+	int64_t attributes = Frame::AttributeComplex;
+	if(!inverse)
+	{
+		attributes |= shift ? Frame::AttributeFourierTransformed 
+			: Frame::AttributeFourierTransformedNoShift;
+	}
+
+	Frame::Data<void> resultData(attributes, 1, columns, columns, rows, result, NULL);
+
+	return new Frame(resultData, resultType, AllocatedBuffer);
+}
+
+template <typename R>
+static Frame *transformFrame(const Frame *frame, bool shift, bool inverse, 
+	DataType resultType, bool parallel)
+{
+	switch(frame->dataType())
+	{
+	case DataTypeInt8:
+		return transformFrame<R, int8_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeInt16:
+		return transformFrame<R, int16_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeInt32:
+		return transformFrame<R, int32_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeInt64:
+		return transformFrame<R, int64_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeUInt8:
+		return transformFrame<R, uint8_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeUInt16:
+		return transformFrame<R, uint16_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeUInt32:
+		return transformFrame<R, uint32_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeUInt64:
+		return transformFrame<R, uint64_t>(frame, shift, inverse, resultType, parallel);
+	case DataTypeFloat32:
+		return transformFrame<R, float>(frame, shift, inverse, resultType, parallel);
+	case DataTypeFloat64:
+	case DataTypeComplex128:
+		return transformFrame<R, double>(frame, shift, inverse, resultType, parallel);
+	case DataTypeComplex64:
+		return transformFrame<R, float>(frame, shift, inverse, resultType, parallel);
+	default:
+		qWarning() << "Unsupported data type for Fourier transform";
+		return NULL;
+	}
+}
+
+static Frame *transformFrame(const Frame *frame, bool shift, bool inverse, bool parallel)
+{
+	if(!frame)
+		return NULL;
+
+	Frame::Data<const void> data = frame->data<void>();
+	if(!data.real || data.hSize <= 0 || data.vSize <= 0)
+		return NULL;
+
+	// 16 bit floats are transformed as Float32
+	std::unique_ptr<Frame> expanded(frame->toFloat32());
+	if(expanded)
+		frame = expanded.get();
+
+	DataType type = frame->dataType();
+	if(type == DataTypeFloat64 || type == DataTypeComplex128)
+		return transformFrame<double>(frame, shift, inverse, DataTypeComplex128, parallel);
+
+	return transformFrame<float>(frame, shift, inverse, DataTypeComplex64, parallel);
+}
+
+static FrameList transformFrames(const FrameList &frames, bool shift, bool inverse)
+{
+	FrameList result(frames.size(), NULL);
+	parallelFor(0, (int64_t) frames.size(), 1, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t iii = begin; iii < end; ++iii)
+			result[iii] = transformFrame(frames[iii], shift, inverse, false);
+	});
+
+	return result;
+}
+
+Frame *FourierTransform::transform(const Frame *frame, bool shift)
+{
+	return transformFrame(frame, shift, false, true);
+}
+
+Frame *FourierTransform::inverse(const Frame *frame)
+{
+	return transformFrame(frame, false, true, true);
+}
+
+FrameList FourierTransform::transform(const FrameList &frames, bool shift)
+{
+	return transformFrames(frames, shift, false);
+}
+
+FrameList FourierTransform::inverse(const FrameList &frames)
+{
+	return transformFrames(frames, false, true);
+}
+
+void FourierTransform::clearPlans()
+{
+	std::lock_guard<std::mutex> lock(planMutex);
+	planCache<float>().clear();
+	planCache<double>().clear();
+}
+
+} // namespace emd
@@ -23,11 +23,16 @@
 #include <limits>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 
 #include <qdatastream.h>
 #include <QDebug>
 #include <qfile.h>
 
+#include "Allocator.h"
+#include "Convert.h"
+#include "FourierTransform.h"
+#include "Simd.h"
 #include "Util.h"
 
 namespace emd
@@ -40,6 +45,8 @@ Frame::Frame(void *real, void *imaginary, int hStep, int vStep, int hSize, int v
 	: m_data(0, hStep, vStep, hSize, vSize, real, imaginary),
 	m_dataType(type),
     m_ownsData(ownsData),
+    m_allocatedData(false),
+    m_writesThrough(false),
     m_minValue(kInvalidFloatValue),
     m_maxValue(kInvalidFloatValue)
 {
@@ -51,29 +58,105 @@ Frame::Frame(const Data<void> &data, const DataType &type, bool ownsData)
     : m_data(data),
     m_dataType(type),
     m_ownsData(ownsData),
+    m_allocatedData(false),
+    m_writesThrough(false),
+    m_minValue(kInvalidFloatValue),
+    m_maxValue(kInvalidFloatValue)
+{
+}
+
+Frame::Frame(void *real, void *imaginary, int hStep, int vStep, int hSize, int vSize, emd::DataType type, AllocatedBufferTag)
+	: m_data(0, hStep, vStep, hSize, vSize, real, imaginary),
+	m_dataType(type),
+    m_ownsData(true),
+    m_allocatedData(true),
+    m_writesThrough(false),
+    m_minValue(kInvalidFloatValue),
+    m_maxValue(kInvalidFloatValue)
+{
+	if(imaginary)
+		m_data.setAttribute(Frame::AttributeComplex);
+}
+
+Frame::Frame(const Data<void> &data, const DataType &type, AllocatedBufferTag)
+    : m_data(data),
+    m_dataType(type),
+    m_ownsData(true),
+    m_allocatedData(true),
+    m_writesThrough(false),
     m_minValue(kInvalidFloatValue),
     m_maxValue(kInvalidFloatValue)
 {
 }
 
 Frame::Frame(const Frame *other)
-    : m_data(other->data<void>()),
+    : m_data(other->m_data),
     m_dataType(other->dataType()),
     m_index(other->index()),
-    m_ownsData(false)
+    m_ownsData(false),
+    m_allocatedData(false),
+    m_writesThrough(false)
 {
     other->checkDataRange(m_minValue, m_maxValue);
+    m_owner = other->m_owner;
 }
 
 Frame::~Frame()
 {
-	if(m_ownsData)
+	if(m_ownsData && m_allocatedData)
     {
-        if(m_data.real)
-            delete[] m_data.real;
-        if(m_data.imaginary)
-            delete[] m_data.imaginary;
+        freeBuffer(m_data.real);
+        freeBuffer(m_data.imaginary);
     }
+	else if(m_ownsData)
+    {
+        delete[] (char*) m_data.real;
+        delete[] (char*) m_data.imaginary;
+    }
+}
+
+// Contiguous copy of one plane
+static void *copyPlane(const Frame::Data<void> &data, const void *plane, int depth)
+{
+	if(!plane)
+		return NULL;
+
+	const char *values = (const char*) plane;
+	char *result = (char*) allocateBuffer((size_t) data.hSize * data.vSize * depth);
+	char *target = result;
+	for(int vvv = 0; vvv < data.vSize; ++vvv)
+	{
+		const char *row = values + vvv * data.vStep * depth;
+		if(data.hStep == 1)
+		{
+			memcpy(target, row, (size_t) data.hSize * depth);
+			target += (size_t) data.hSize * depth;
+			continue;
+		}
+
+		for(int hhh = 0; hhh < data.hSize; ++hhh, target += depth)
+			memcpy(target, row + hhh * data.hStep * depth, depth);
+	}
+
+	return result;
+}
+
+void Frame::detach()
+{
+	if(m_ownsData || m_writesThrough || !m_owner || m_owner.use_count() == 1)
+		return;
+
+	int depth = emdTypeDepth(m_dataType);
+	if(depth <= 0)
+		return;
+
+	m_data.real = copyPlane(m_data, m_data.real, depth);
+	m_data.imaginary = copyPlane(m_data, m_data.imaginary, depth);
+	m_data.hStep = 1;
+	m_data.vStep = m_data.hSize;
+	m_ownsData = true;
+	m_allocatedData = true;
+	m_owner.reset();
 }
 
 DataType Frame::dataType() const
@@ -83,7 +166,7 @@ DataType Frame::dataType() const
 
 bool Frame::isComplex() const
 {
-    return (m_data.imaginary != NULL);
+    return (m_data.imaginary != NULL || isComplexType(m_dataType));
 }
 
 int64_t Frame::index() const
@@ -102,14 +185,61 @@ void Frame::checkDataRange(float &min, float &max) const
     max = m_maxValue;
 }
 
+// Range of a random sample of the values (in the type V the values are
+//	compared in), ignoring the SAMPLE_CUTOFF - 1 most extreme ones at 
+//	either end.
+template <typename V, typename Value>
+static void sampleRange(const Frame::Data<void> &data, Value value, 
+	float &minValue, float &maxValue)
+{
+	const std::vector<int> &randomIndexes = emd::randomIndexes(RANDOM_SAMPLE_SIZE, data.hSize * data.vSize);
+
+	std::vector<V> mins( SAMPLE_CUTOFF, std::numeric_limits<V>::max() );
+	std::vector<V> maxes( SAMPLE_CUTOFF, std::numeric_limits<V>::lowest() );
+	V val, newVal, oldVal;
+	int div, rem, index;
+	for(int iii = 0; iii < RANDOM_SAMPLE_SIZE; ++iii)
+	{
+		index = randomIndexes[iii];
+		div = index / data.hSize;
+		rem = index % data.hSize;
+		index = div * data.vStep + rem * data.hStep;
+		val = value(index);
+
+		index = -1;
+		while(index+1 < SAMPLE_CUTOFF && mins.at(index+1) > val)
+			++index;
+		newVal = val;
+		while(index >= 0)
+		{
+			oldVal = mins[index];
+			mins[index] = newVal;
+			newVal = oldVal;
+			--index;
+		}
+
+		while(index+1 < SAMPLE_CUTOFF && maxes.at(index+1) < val)
+			++index;
+		newVal = val;
+		while(index >= 0)
+		{
+			oldVal = maxes[index];
+			maxes[index] = newVal;
+			newVal = oldVal;
+			--index;
+		}
+	}
+
+	minValue = (float) mins.at(0);
+	maxValue = (float) maxes.at(0);
+}
+
 template <typename T>
 void Frame::getDataRange(T &min, T &max)
 {
     if(m_minValue == kInvalidFloatValue || m_maxValue == kInvalidFloatValue)
     {
-	    Frame::Data<T> data = this->data<T>();
-
-        const std::vector<int> &randomIndexes = emd::randomIndexes(RANDOM_SAMPLE_SIZE, data.hSize * data.vSize);
+	    Frame::Data<const T> data = this->data<T>();
 
 	    if( data.attributes & (Frame::AttributeFourierTransformed | Frame::AttributeFourierTransformedNoShift) )
 	    {
@@ -123,51 +253,38 @@ void Frame::getDataRange(T &min, T &max)
 			    hOffset = data.hSize / 2;
 			    vOffset = data.vSize / 2;
 		    }
+		    // Interleaved complex spectra are scaled by the real part
+		    int64_t peak = vOffset * data.hSize + hOffset;
+		    if(isComplexType(m_dataType))
+			    peak *= 2;
 		    static const float ffac = 0.005f;
-		    m_maxValue = data.real[vOffset * data.hSize + hOffset] * ffac;
+		    m_maxValue = data.real[peak] * ffac;
 		    m_minValue = 0;
 	    }
+	    else if(m_dataType == DataTypeFloat16 || m_dataType == DataTypeBFloat16)
+	    {
+		    // 16 bit floats are held as uint16_t, whatever T is asked for
+		    const uint16_t *values = (const uint16_t*) m_data.real;
+		    if(m_dataType == DataTypeFloat16)
+			    sampleRange<float>(m_data, [values](int index)
+				    {return simd::halfToFloat(values[index]);}, m_minValue, m_maxValue);
+		    else
+			    sampleRange<float>(m_data, [values](int index)
+				    {return simd::bfloat16ToFloat(values[index]);}, m_minValue, m_maxValue);
+	    }
+	    else if(isComplexType(m_dataType))
+	    {
+		    // The range of the real parts of interleaved complex values
+		    const T *values = data.real;
+		    sampleRange<T>(m_data, [values](int index) {return values[2 * index];}, 
+			    m_minValue, m_maxValue);
+	    }
 	    else
 	    {
 		    // Determine the range of the Frame
-		    std::vector<T> mins( SAMPLE_CUTOFF, std::numeric_limits<T>::max() );
-		    std::vector<T> maxes( SAMPLE_CUTOFF, std::numeric_limits<T>::lowest() );
-		    T val, newVal, oldVal;
-		    int div, rem, index;
-		    for(int iii = 0; iii < RANDOM_SAMPLE_SIZE; ++iii)
-		    {
-			    index = randomIndexes[iii];
-			    div = index / data.hSize;
-			    rem = index % data.hSize;
-			    index = div * data.vStep + rem * data.hStep;
-			    val = data.real[index];
-
-			    index = -1;
-			    while(index+1 < SAMPLE_CUTOFF && mins.at(index+1) > val)
-				    ++index;
-			    newVal = val;
-			    while(index >= 0)
-			    {
-				    oldVal = mins[index];
-				    mins[index] = newVal;
-				    newVal = oldVal;
-				    --index;
-			    }
-
-			    while(index+1 < SAMPLE_CUTOFF && maxes.at(index+1) < val)
-				    ++index;
-			    newVal = val;
-			    while(index >= 0)
-			    {
-				    oldVal = maxes[index];
-				    maxes[index] = newVal;
-				    newVal = oldVal;
-				    --index;
-			    }
-		    }
-
-		    m_minValue = (float) mins.at(0);
-		    m_maxValue = (float) maxes.at(0);
+		    const T *values = data.real;
+		    sampleRange<T>(m_data, [values](int index) {return values[index];}, 
+			    m_minValue, m_maxValue);
 	    }
     }
 
@@ -202,6 +319,60 @@ void Frame::saveRawData(const QString &filePath) const
     stream.writeRawData(outputData, dataLength);
 }
 
+// One plane of a 16 bit float frame, hSize values per row
+static float *expandPlane(const Frame::Data<void> &data, const void *plane, 
+	DataType type)
+{
+	if(!plane)
+		return NULL;
+
+	const uint16_t *values = (const uint16_t*) plane;
+	float *result = (float*) allocateBuffer((size_t) data.hSize * data.vSize * sizeof(float));
+	for(int vvv = 0; vvv < data.vSize; ++vvv)
+	{
+		const uint16_t *row = values + vvv * data.vStep;
+		float *target = result + (int64_t) vvv * data.hSize;
+		if(data.hStep == 1)
+		{
+			convertValues(row, type, target, DataTypeFloat32, data.hSize);
+			continue;
+		}
+
+		for(int hhh = 0; hhh < data.hSize; ++hhh)
+		{
+			uint16_t value = row[hhh * data.hStep];
+			target[hhh] = (type == DataTypeFloat16) ? simd::halfToFloat(value) 
+				: simd::bfloat16ToFloat(value);
+		}
+	}
+
+	return result;
+}
+
+Frame *Frame::toFloat32() const
+{
+	if(m_dataType != DataTypeFloat16 && m_dataType != DataTypeBFloat16)
+		return 0;
+
+	Data<void> data(m_data.attributes, 1, m_data.hSize, m_data.hSize, m_data.vSize, 
+		expandPlane(m_data, m_data.real, m_dataType), 
+		expandPlane(m_data, m_data.imaginary, m_dataType));
+	Frame *frame = new Frame(data, DataTypeFloat32, AllocatedBuffer);
+	frame->setIndex(m_index);
+
+	return frame;
+}
+
+Frame *Frame::fourierTransform(bool shift) const
+{
+    return FourierTransform::transform(this, shift);
+}
+
+Frame *Frame::inverseFourierTransform() const
+{
+    return FourierTransform::inverse(this);
+}
+
 template EMDLIB_API void Frame::getDataRange<uint8_t>(uint8_t &, uint8_t &);
 template EMDLIB_API void Frame::getDataRange<uint16_t>(uint16_t &, uint16_t &);
 template EMDLIB_API void Frame::getDataRange<uint32_t>(uint32_t &, uint32_t &);
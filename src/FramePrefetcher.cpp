@@ -0,0 +1,532 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FramePrefetcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "AsyncLoad.h"
+#include "Frame.h"
+
+#ifndef H5_NO_NAMESPACE
+using namespace H5;
+#endif
+
+namespace emd
+{
+
+// Where a frame lies in the data, as worked out by Dataset::frame
+struct FrameGeometry
+{
+	int hor;
+	int ver;
+	int hSize;
+	int vSize;
+	int64_t hStep;
+	int64_t vStep;
+	int64_t complexStep;
+	int64_t offset;
+};
+
+struct FrameKey
+{
+	int64_t offset;
+	int hor;
+	int ver;
+
+	bool operator<(const FrameKey &other) const
+	{
+		if(offset != other.offset)
+			return offset < other.offset;
+		if(hor != other.hor)
+			return hor < other.hor;
+		return ver < other.ver;
+	}
+};
+
+// A frame as read from the file, in its own compact layout
+struct FrameData
+{
+	int64_t hStep;
+	int64_t vStep;
+	int hSize;
+	int vSize;
+	int64_t offset;
+	std::vector<char> real;
+	std::vector<char> imaginary;
+};
+
+typedef std::shared_ptr<FrameData> FrameDataPtr;
+
+struct FramePrefetcher::Shared
+{
+	// Copied from the Dataset, so the I/O thread never touches it
+	QString filePath;
+	QString path;
+	std::vector<int> extents;
+	bool descending;
+	int complexIndex;
+	DataType type;
+
+	// Only used on the I/O thread
+	H5File *file;
+	H5::DataSet *dataSet;
+
+	// Cache, most recently used first
+	std::mutex mutex;
+	int capacity;
+	std::map<FrameKey, std::pair<FrameDataPtr, std::list<FrameKey>::iterator> > cache;
+	std::list<FrameKey> recent;
+	std::set<FrameKey> pending;
+	std::set<FrameKey> wanted;
+	int64_t hits;
+	int64_t misses;
+
+	Shared()
+		: descending(true),
+		complexIndex(-1),
+		type(DataTypeUnknown),
+		file(0),
+		dataSet(0),
+		capacity(0),
+		hits(0),
+		misses(0)
+	{}
+
+	bool geometry(const Dataset::Slice &slice, FrameGeometry &frame) const;
+	FrameDataPtr read(const Dataset::Slice &slice, const FrameGeometry &frame);
+	void store(const FrameKey &key, const FrameDataPtr &data);
+	void close();
+};
+
+bool FramePrefetcher::Shared::geometry(const Dataset::Slice &slice, FrameGeometry &frame) const
+{
+	int rank = (int) extents.size();
+	if((int) slice.size() != rank)
+		return false;
+
+	frame.hor = -1;
+	frame.ver = -1;
+	frame.complexStep = 0;
+	frame.offset = 0;
+	int64_t step = 1;
+	for(int jjj = 0; jjj < rank; ++jjj)
+	{
+		int iii = descending ? rank - 1 - jjj : jjj;
+		if(slice[iii] == Dataset::HorizontalDimension)
+		{
+			frame.hor = iii;
+			frame.hStep = step;
+		}
+		else if(slice[iii] == Dataset::VerticalDimension)
+		{
+			frame.ver = iii;
+			frame.vStep = step;
+		}
+		else if(iii == complexIndex)
+		{
+			frame.complexStep = step;
+		}
+		else
+		{
+			frame.offset += slice[iii] * step;
+		}
+
+		step *= extents[iii];
+	}
+
+	if(frame.hor < 0 || frame.ver < 0)
+		return false;
+
+	if(frame.hor > frame.ver)
+	{
+		std::swap(frame.hor, frame.ver);
+		std::swap(frame.hStep, frame.vStep);
+	}
+	frame.hSize = extents[frame.hor];
+	frame.vSize = extents[frame.ver];
+
+	return true;
+}
+
+// Descending data is read as one hyperslab. In ascending data the frame
+//	is not a box of the file's dims, so its points are selected instead.
+FrameDataPtr FramePrefetcher::Shared::read(const Dataset::Slice &slice, 
+	const FrameGeometry &frame)
+{
+	int rank = (int) extents.size();
+	hsize_t frameSize = (hsize_t) frame.hSize * frame.vSize;
+	int typeSize = emdTypeDepth(type);
+
+	FrameDataPtr data = std::make_shared<FrameData>();
+	data->hSize = frame.hSize;
+	data->vSize = frame.vSize;
+	data->offset = frame.offset;
+
+	try {
+		Exception::dontPrint();
+		if(!dataSet)
+		{
+			QByteArray ba = filePath.toLocal8Bit();
+			file = new H5File(ba.constData(), H5F_ACC_RDONLY);
+			ba = path.toLocal8Bit();
+			dataSet = new H5::DataSet(file->openDataSet(ba.constData()));
+		}
+
+		H5::DataType memoryType = emdToHdfType(type);
+		int planes = (complexIndex >= 0 ? 2 : 1);
+		for(int plane = 0; plane < planes; ++plane)
+		{
+			std::vector<char> &buffer = (plane == 0 ? data->real : data->imaginary);
+			buffer.resize(frameSize * typeSize);
+			H5::DataSpace fileSpace = dataSet->getSpace();
+
+			if(descending)
+			{
+				std::vector<hsize_t> start(rank), count(rank, 1);
+				for(int iii = 0; iii < rank; ++iii)
+				{
+					if(iii == frame.hor || iii == frame.ver)
+					{
+						start[iii] = 0;
+						count[iii] = extents[iii];
+					}
+					else
+					{
+						start[iii] = (iii == complexIndex ? plane : slice[iii]);
+					}
+				}
+				fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), start.data());
+
+				// The vertical dim is the faster of the two
+				data->hStep = frame.vSize;
+				data->vStep = 1;
+			}
+			else
+			{
+				std::vector<hsize_t> coordinates(frameSize * rank);
+				hsize_t *point = coordinates.data();
+				for(int vvv = 0; vvv < frame.vSize; ++vvv)
+				{
+					for(int hhh = 0; hhh < frame.hSize; ++hhh)
+					{
+						int64_t index = frame.offset + plane * frame.complexStep 
+							+ hhh * frame.hStep + vvv * frame.vStep;
+						for(int iii = rank - 1; iii >= 0; --iii)
+						{
+							point[iii] = index % extents[iii];
+							index /= extents[iii];
+						}
+						point += rank;
+					}
+				}
+				fileSpace.selectElements(H5S_SELECT_SET, frameSize, coordinates.data());
+
+				data->hStep = 1;
+				data->vStep = frame.hSize;
+			}
+
+			H5::DataSpace memorySpace(1, &frameSize);
+			dataSet->read(buffer.data(), memoryType, memorySpace, fileSpace);
+		}
+	}
+	catch(Exception error) {
+		qDebug() << "Frame read failed: " << error.getCDetailMsg();
+		return FrameDataPtr();
+	}
+
+	return data;
+}
+
+void FramePrefetcher::Shared::store(const FrameKey &key, const FrameDataPtr &data)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(cache.count(key))
+		return;
+
+	recent.push_front(key);
+	cache[key] = std::make_pair(data, recent.begin());
+	while((int) recent.size() > capacity)
+	{
+		cache.erase(recent.back());
+		recent.pop_back();
+	}
+}
+
+void FramePrefetcher::Shared::close()
+{
+	if(dataSet)
+	{
+		dataSet->close();
+		delete dataSet;
+		dataSet = 0;
+	}
+
+	if(file)
+	{
+		file->close();
+		delete file;
+		file = 0;
+	}
+}
+
+// Owned copy, so cached frames can be evicted at any time
+static Frame *copyFrame(const FrameData &data, DataType type)
+{
+	char *real = (char*) allocateBuffer(data.real.size());
+	memcpy(real, data.real.data(), data.real.size());
+	char *imaginary = 0;
+	if(!data.imaginary.empty())
+	{
+		imaginary = (char*) allocateBuffer(data.imaginary.size());
+		memcpy(imaginary, data.imaginary.data(), data.imaginary.size());
+	}
+
+	Frame *frame = new Frame(real, imaginary, (int) data.hStep, (int) data.vStep, 
+		data.hSize, data.vSize, type, AllocatedBuffer);
+	frame->setIndex(data.offset);
+	return frame;
+}
+
+static FrameKey frameKey(const FrameGeometry &frame)
+{
+	FrameKey key;
+	key.offset = frame.offset;
+	key.hor = frame.hor;
+	key.ver = frame.ver;
+	return key;
+}
+
+FramePrefetcher::FramePrefetcher(const Dataset *data, const QString &filePath, 
+	int cacheFrames, int lookahead)
+	: m_data(data),
+	m_shared(std::make_shared<Shared>()),
+	m_lookahead(lookahead),
+	m_axis(-1),
+	m_velocity(0)
+{
+	m_shared->filePath = filePath;
+	m_shared->path = data->path();
+	const DataSpace &space = data->dataSpace();
+	for(int iii = 0; iii < space.rank(); ++iii)
+		m_shared->extents.push_back(space.dimLength(iii));
+	m_shared->descending = data->dataOrder();
+	m_shared->complexIndex = data->complexIndex();
+	m_shared->type = data->dataType();
+	m_shared->capacity = std::max(1, cacheFrames);
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+	std::shared_ptr<Shared> shared = m_shared;
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		shared->wanted.clear();
+	}
+
+	// Queued reads keep the shared state alive; the file is closed
+	//	after them
+	queueIoJob([shared](bool) {shared->close();});
+}
+
+Frame *FramePrefetcher::frame(const Dataset::Slice &slice)
+{
+	if(m_data->isLoaded() || m_data->isSparse())
+		return m_data->frame(slice);
+
+	FrameGeometry geometry;
+	if(!m_shared->geometry(slice, geometry))
+		return 0;
+	FrameKey key = frameKey(geometry);
+
+	FrameDataPtr data;
+	{
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+		auto entry = m_shared->cache.find(key);
+		if(entry != m_shared->cache.end())
+		{
+			data = entry->second.first;
+			m_shared->recent.splice(m_shared->recent.begin(), m_shared->recent, 
+				entry->second.second);
+			++m_shared->hits;
+		}
+		else
+		{
+			++m_shared->misses;
+		}
+	}
+
+	if(!data)
+	{
+		// Read ahead of any queued prefetches
+		std::shared_ptr<Shared> shared = m_shared;
+		std::shared_ptr<std::promise<FrameDataPtr> > promise = 
+			std::make_shared<std::promise<FrameDataPtr> >();
+		std::future<FrameDataPtr> result = promise->get_future();
+		queueIoJob([shared, slice, geometry, key, promise](bool run)
+		{
+			FrameDataPtr read;
+			if(run)
+				read = shared->read(slice, geometry);
+			if(read)
+				shared->store(key, read);
+			promise->set_value(read);
+		}, true);
+		data = result.get();
+	}
+
+	predict(slice);
+
+	return data ? copyFrame(*data, m_shared->type) : 0;
+}
+
+// The active axis is the free dim that changed most since the last
+//	request; the velocity is smoothed while the direction holds.
+void FramePrefetcher::predict(const Dataset::Slice &slice)
+{
+	int rank = (int) slice.size();
+	if((int) m_lastSlice.size() == rank)
+	{
+		int axis = -1, delta = 0;
+		for(int iii = 0; iii < rank; ++iii)
+		{
+			if(slice[iii] < 0 || m_lastSlice[iii] < 0 || iii == m_shared->complexIndex)
+				continue;
+
+			int change = slice[iii] - m_lastSlice[iii];
+			if(std::abs(change) > std::abs(delta))
+			{
+				axis = iii;
+				delta = change;
+			}
+		}
+
+		if(axis >= 0)
+		{
+			if(axis == m_axis && (delta > 0) == (m_velocity > 0))
+				m_velocity = 0.5 * (m_velocity + delta);
+			else
+				m_velocity = delta;
+			m_axis = axis;
+		}
+	}
+	m_lastSlice = slice;
+
+	if(m_axis < 0 || m_axis >= rank || slice[m_axis] < 0 || m_velocity == 0)
+		return;
+
+	std::vector<Dataset::Slice> slices;
+	std::vector<FrameGeometry> geometries;
+	std::set<FrameKey> wanted;
+	int length = m_shared->extents[m_axis];
+	int last = slice[m_axis];
+	for(int iii = 1; iii <= m_lookahead; ++iii)
+	{
+		int value = slice[m_axis] + (int) std::lround(iii * m_velocity);
+		if(value < 0 || value >= length)
+			break;
+		if(value == last)
+			continue;
+		last = value;
+
+		Dataset::Slice next = slice;
+		next[m_axis] = value;
+		FrameGeometry geometry;
+		if(!m_shared->geometry(next, geometry))
+			break;
+
+		slices.push_back(next);
+		geometries.push_back(geometry);
+		wanted.insert(frameKey(geometry));
+	}
+
+	std::vector<int> queued;
+	{
+		std::lock_guard<std::mutex> lock(m_shared->mutex);
+		m_shared->wanted = wanted;
+		for(int iii = 0; iii < (int) slices.size(); ++iii)
+		{
+			FrameKey key = frameKey(geometries[iii]);
+			if(m_shared->cache.count(key) || m_shared->pending.count(key))
+				continue;
+
+			m_shared->pending.insert(key);
+			queued.push_back(iii);
+		}
+	}
+
+	// Reads no longer wanted by the time they run are skipped
+	std::shared_ptr<Shared> shared = m_shared;
+	for(int index : queued)
+	{
+		Dataset::Slice next = slices[index];
+		FrameGeometry geometry = geometries[index];
+		FrameKey key = frameKey(geometry);
+		queueIoJob([shared, next, geometry, key](bool run)
+		{
+			{
+				std::lock_guard<std::mutex> lock(shared->mutex);
+				shared->pending.erase(key);
+				if(!run || shared->cache.count(key) || !shared->wanted.count(key))
+					return;
+			}
+
+			FrameDataPtr data = shared->read(next, geometry);
+			if(data)
+				shared->store(key, data);
+		});
+	}
+}
+
+void FramePrefetcher::clear()
+{
+	std::lock_guard<std::mutex> lock(m_shared->mutex);
+	m_shared->cache.clear();
+	m_shared->recent.clear();
+	m_shared->wanted.clear();
+}
+
+int64_t FramePrefetcher::hits() const
+{
+	std::lock_guard<std::mutex> lock(m_shared->mutex);
+	return m_shared->hits;
+}
+
+int64_t FramePrefetcher::misses() const
+{
+	std::lock_guard<std::mutex> lock(m_shared->mutex);
+	return m_shared->misses;
+}
+
+} // namespace emd
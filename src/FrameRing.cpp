@@ -0,0 +1,258 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FrameRing.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDebug>
+
+#include "Allocator.h"
+
+namespace emd
+{
+
+FrameRing::FrameRing(int rows, int columns, DataType type, int slotCount)
+{
+	init(rows, columns, type, slotCount);
+}
+
+FrameRing::FrameRing(const Frame::Data<void> &shape, DataType type, int slotCount)
+{
+	init(shape.hSize, shape.vSize, type, slotCount);
+}
+
+void FrameRing::init(int rows, int columns, DataType type, int slotCount)
+{
+	m_slots = 0;
+	m_rows = rows;
+	m_columns = columns;
+	m_type = type;
+	m_frameBytes = (int64_t) rows * columns * emdTypeDepth(type);
+	m_slotCount = slotCount;
+	m_head = 0;
+	m_tail = 0;
+	m_pushed = 0;
+	m_dropped = 0;
+	m_fullEvents = 0;
+	m_highWater = 0;
+	m_popped = 0;
+
+	if(m_frameBytes <= 0 || slotCount <= 0)
+	{
+		qWarning() << "Invalid frame ring shape";
+		return;
+	}
+
+	m_slots = (char*) allocateBuffer(m_frameBytes * slotCount);
+}
+
+FrameRing::~FrameRing()
+{
+	freeBuffer(m_slots);
+}
+
+int64_t FrameRing::size() const
+{
+	return m_head.load(std::memory_order_acquire) 
+		- m_tail.load(std::memory_order_acquire);
+}
+
+// The head is only written here, so it is read relaxed; the tail is 
+//	read with acquire so the consumer is done with a slot before it is
+//	reused.
+void *FrameRing::beginWrite()
+{
+	if(!m_slots)
+		return 0;
+
+	int64_t head = m_head.load(std::memory_order_relaxed);
+	if(head - m_tail.load(std::memory_order_acquire) >= m_slotCount)
+	{
+		m_fullEvents.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	return m_slots + (head % m_slotCount) * m_frameBytes;
+}
+
+void FrameRing::endWrite()
+{
+	int64_t head = m_head.load(std::memory_order_relaxed) + 1;
+	m_head.store(head, std::memory_order_release);
+	m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+	int64_t waiting = head - m_tail.load(std::memory_order_relaxed);
+	if(waiting > m_highWater.load(std::memory_order_relaxed))
+		m_highWater.store(waiting, std::memory_order_relaxed);
+}
+
+bool FrameRing::push(const void *frame)
+{
+	void *slot = beginWrite();
+	if(!slot)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	memcpy(slot, frame, m_frameBytes);
+	endWrite();
+	return true;
+}
+
+// Element by element, in tiles so that both the source and the slot 
+//	are walked a few cache lines at a time
+template <typename T>
+static void copyTiled(T *slot, const T *source, int rows, int columns, 
+	int64_t hStep, int64_t vStep)
+{
+	const int TILE = 32;
+	for(int rowStart = 0; rowStart < rows; rowStart += TILE)
+	{
+		int rowEnd = std::min(rows, rowStart + TILE);
+		for(int columnStart = 0; columnStart < columns; columnStart += TILE)
+		{
+			int columnEnd = std::min(columns, columnStart + TILE);
+			for(int hhh = rowStart; hhh < rowEnd; ++hhh)
+			{
+				T *target = slot + (int64_t) hhh * columns;
+				const T *row = source + hhh * hStep;
+				for(int vvv = columnStart; vvv < columnEnd; ++vvv)
+					target[vvv] = row[vvv * vStep];
+			}
+		}
+	}
+}
+
+struct Value128
+{
+	uint64_t values[2];
+};
+
+// Rows that are contiguous in the frame (vStep == 1) are copied whole.
+//	Other layouts, such as the prefetcher's point selections where the
+//	horizontal index is the fast one, are transposed into the slot.
+bool FrameRing::push(const Frame::Data<void> &frame)
+{
+	if(frame.hSize != m_rows || frame.vSize != m_columns || !frame.real)
+		return false;
+
+	char *slot = (char*) beginWrite();
+	if(!slot)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	int typeSize = emdTypeDepth(m_type);
+	const char *source = (const char*) frame.real;
+	int64_t rowBytes = (int64_t) m_columns * typeSize;
+	if(frame.vStep == 1 && frame.hStep == m_columns)
+	{
+		memcpy(slot, source, m_frameBytes);
+	}
+	else if(frame.vStep == 1)
+	{
+		for(int hhh = 0; hhh < m_rows; ++hhh)
+			memcpy(slot + hhh * rowBytes, source + hhh * frame.hStep * typeSize, rowBytes);
+	}
+	else
+	{
+		switch(typeSize)
+		{
+		case 1:
+			copyTiled((uint8_t*) slot, (const uint8_t*) source, m_rows, m_columns, 
+				frame.hStep, frame.vStep);
+			break;
+		case 2:
+			copyTiled((uint16_t*) slot, (const uint16_t*) source, m_rows, m_columns, 
+				frame.hStep, frame.vStep);
+			break;
+		case 4:
+			copyTiled((uint32_t*) slot, (const uint32_t*) source, m_rows, m_columns, 
+				frame.hStep, frame.vStep);
+			break;
+		case 8:
+			copyTiled((uint64_t*) slot, (const uint64_t*) source, m_rows, m_columns, 
+				frame.hStep, frame.vStep);
+			break;
+		case 16:
+			copyTiled((Value128*) slot, (const Value128*) source, m_rows, m_columns, 
+				frame.hStep, frame.vStep);
+			break;
+		default:
+			for(int hhh = 0; hhh < m_rows; ++hhh)
+			{
+				for(int vvv = 0; vvv < m_columns; ++vvv)
+				{
+					memcpy(slot + ((int64_t) hhh * m_columns + vvv) * typeSize, 
+						source + (hhh * frame.hStep + vvv * frame.vStep) * typeSize, 
+						typeSize);
+				}
+			}
+			break;
+		}
+	}
+
+	endWrite();
+	return true;
+}
+
+const void *FrameRing::readable(int64_t &count)
+{
+	count = 0;
+	if(!m_slots)
+		return 0;
+
+	int64_t tail = m_tail.load(std::memory_order_relaxed);
+	int64_t waiting = m_head.load(std::memory_order_acquire) - tail;
+	if(waiting <= 0)
+		return 0;
+
+	int64_t slot = tail % m_slotCount;
+	count = std::min(waiting, m_slotCount - slot);
+	return m_slots + slot * m_frameBytes;
+}
+
+void FrameRing::release(int64_t count)
+{
+	if(count <= 0)
+		return;
+
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + count, 
+		std::memory_order_release);
+	m_popped.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool FrameRing::pop(void *frame)
+{
+	int64_t count;
+	const void *slot = readable(count);
+	if(!slot)
+		return false;
+
+	memcpy(frame, slot, m_frameBytes);
+	release(1);
+	return true;
+}
+
+} // namespace emd
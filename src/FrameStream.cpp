@@ -0,0 +1,275 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FrameStream.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <H5Cpp.h>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Dataset.h"
+
+#ifndef H5_NO_NAMESPACE
+using namespace H5;
+#endif
+
+namespace emd
+{
+
+// Selects values [begin, end) of the stored data, in C order: whole rows
+//	of the trailing dims where the run is aligned to them, and partial
+//	rows at its ends, so at most two hyperslabs per dim.
+static void selectRun(H5::DataSpace &space, const std::vector<hsize_t> &dims, 
+	hsize_t begin, hsize_t end)
+{
+	int rank = dims.size();
+	std::vector<hsize_t> offset(rank);
+	std::vector<hsize_t> count(rank);
+	H5S_seloper_t operation = H5S_SELECT_SET;
+	while(begin < end)
+	{
+		// Blocks of the trailing dims after dim, taken along dim
+		hsize_t block = 1;
+		int dim = rank - 1;
+		while(dim > 0 && begin % (block * dims[dim]) == 0 
+			&& begin + block * dims[dim] <= end)
+		{
+			block *= dims[dim];
+			--dim;
+		}
+
+		hsize_t rest = begin;
+		for(int iii = rank - 1; iii >= 0; --iii)
+		{
+			offset[iii] = rest % dims[iii];
+			rest /= dims[iii];
+		}
+		for(int iii = 0; iii < rank; ++iii)
+			count[iii] = (iii < dim) ? 1 : dims[iii];
+		count[dim] = std::min((end - begin) / block, dims[dim] - offset[dim]);
+
+		space.selectHyperslab(operation, count.data(), offset.data());
+		operation = H5S_SELECT_OR;
+		begin += count[dim] * block;
+	}
+}
+
+FrameStream::FrameStream(const Dataset *data, int64_t blockBytes)
+	: m_data(data),
+	m_dataSet(0),
+	m_buffer(0),
+	m_blockBytes(blockBytes),
+	m_frameRows(0),
+	m_frameColumns(0),
+	m_frameCount(0),
+	m_framesPerRow(1),
+	m_blockFrames(0),
+	m_rowBlocks(false),
+	m_nextFrame(0),
+	m_error(false)
+{
+	if(m_data->isSparse())
+		return;
+
+	m_data->frameShape(m_frameRows, m_frameColumns);
+
+	m_frameCount = 1;
+	for(int length : m_data->scanDims())
+		m_frameCount *= length;
+}
+
+FrameStream::~FrameStream()
+{
+	close();
+}
+
+bool FrameStream::open(H5File *file)
+{
+	close();
+	if(!isValid())
+		return false;
+
+	QByteArray ba = m_data->path().toLocal8Bit();
+	hid_t objID = H5Oopen(file->getId(), ba.constData(), H5P_DEFAULT);
+	if(objID < 0)
+		return false;
+	m_dataSet = new DataSet(objID);
+	H5Oclose(objID);
+
+	// Descending data with scan dims is read a few rows of the slowest
+	//	dim at a time, aligned to the chunks if there are any. In other 
+	//	data the frames are still consecutive runs of the stored values
+	//	(ascending data has the first dim fastest in memory, but is 
+	//	stored in the same order), so a block is read as a run of whole
+	//	frames.
+	const DataSpace &space = m_data->dataSpace();
+	int rank = space.rank();
+	m_rowBlocks = m_data->dataOrder() && rank > 2;
+	if(m_rowBlocks)
+	{
+		m_framesPerRow = m_frameCount / std::max(1, space.dimLength(0));
+		int64_t rowBytes = m_framesPerRow * frameSize() * emdTypeDepth(dataType());
+		int64_t rows = std::max<int64_t>(1, m_blockBytes / std::max<int64_t>(1, rowBytes));
+
+		DSetCreatPropList plist = m_dataSet->getCreatePlist();
+		if(plist.getLayout() == H5D_CHUNKED)
+		{
+			std::vector<hsize_t> chunk(rank);
+			plist.getChunk(rank, chunk.data());
+			if((int64_t) chunk[0] <= rows)
+				rows -= rows % (int64_t) chunk[0];
+		}
+
+		m_blockFrames = std::min<int64_t>(rows, space.dimLength(0)) * m_framesPerRow;
+	}
+	else
+	{
+		int64_t frameBytes = frameSize() * emdTypeDepth(dataType());
+		m_framesPerRow = 1;
+		m_blockFrames = std::min<int64_t>(m_frameCount, std::max<int64_t>(1, 
+			m_blockBytes / std::max<int64_t>(1, frameBytes)));
+	}
+
+	uint64_t bufferSize = (uint64_t) m_blockFrames * frameSize() * emdTypeDepth(dataType());
+	m_buffer = (char*) allocateBuffer(bufferSize);
+	rewind();
+
+	return true;
+}
+
+void FrameStream::close()
+{
+	if(m_dataSet)
+	{
+		m_dataSet->close();
+		delete m_dataSet;
+		m_dataSet = 0;
+	}
+
+	if(m_buffer)
+	{
+		freeBuffer(m_buffer);
+		m_buffer = 0;
+	}
+}
+
+bool FrameStream::isValid() const
+{
+	return (m_frameCount > 0 && m_frameRows > 0 && m_frameColumns > 0);
+}
+
+DataType FrameStream::dataType() const
+{
+	return m_data->dataType();
+}
+
+bool FrameStream::next(const char *&frames, int64_t &firstFrame, int64_t &blockFrames)
+{
+	if(!isValid() || m_error || m_nextFrame >= m_frameCount)
+		return false;
+
+	if(!m_dataSet)
+	{
+		// Loaded data is delivered in one block.
+		if(!m_data->isLoaded())
+		{
+			m_error = true;
+			return false;
+		}
+
+		frames = m_data->rawData();
+		firstFrame = 0;
+		blockFrames = m_frameCount;
+		m_nextFrame = m_frameCount;
+		return true;
+	}
+
+	int64_t count = std::min(m_blockFrames, m_frameCount - m_nextFrame);
+	if(!readBlock(m_nextFrame, count))
+	{
+		m_error = true;
+		return false;
+	}
+
+	frames = m_buffer;
+	firstFrame = m_nextFrame;
+	blockFrames = count;
+	m_nextFrame += count;
+	return true;
+}
+
+bool FrameStream::readBlock(int64_t firstFrame, int64_t blockFrames)
+{
+	H5::DataType memType = emdToHdfType(dataType());
+
+	try
+	{
+		H5::DataSpace fileSpace = m_dataSet->getSpace();
+		if(m_blockFrames == m_frameCount)
+		{
+			m_dataSet->read(m_buffer, memType, fileSpace, fileSpace);
+			return true;
+		}
+
+		const DataSpace &space = m_data->dataSpace();
+		int rank = space.rank();
+		if(!m_rowBlocks)
+		{
+			std::vector<hsize_t> dims(rank);
+			for(int iii = 0; iii < rank; ++iii)
+				dims[iii] = space.dimLength(iii);
+			hsize_t values = blockFrames * frameSize();
+			selectRun(fileSpace, dims, firstFrame * frameSize(), 
+				firstFrame * frameSize() + values);
+			H5::DataSpace memSpace(1, &values);
+			m_dataSet->read(m_buffer, memType, memSpace, fileSpace);
+			return true;
+		}
+
+		std::vector<hsize_t> offset(rank, 0);
+		std::vector<hsize_t> count(rank);
+		for(int iii = 0; iii < rank; ++iii)
+			count[iii] = space.dimLength(iii);
+		offset[0] = firstFrame / m_framesPerRow;
+		count[0] = blockFrames / m_framesPerRow;
+
+		fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+		H5::DataSpace memSpace(rank, count.data());
+		m_dataSet->read(m_buffer, memType, memSpace, fileSpace);
+	}
+	catch(DataSetIException error)
+	{
+		qDebug() << "Bad dataset operation: " << error.getCDetailMsg();
+		return false;
+	}
+	catch(DataSpaceIException error)
+	{
+		qDebug() << "Bad dataspace operation.";
+		return false;
+	}
+
+	return true;
+}
+
+} // namespace emd
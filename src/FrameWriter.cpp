@@ -0,0 +1,498 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FrameWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+#include "Allocator.h"
+#include "AsyncLoad.h"
+#include "Attribute.h"
+#include "Convert.h"
+#include "FrameRing.h"
+
+#ifndef H5_NO_NAMESPACE
+using namespace H5;
+#endif
+
+namespace emd
+{
+
+const uint64_t WRITER_CHUNK_SIZE = 1024LL * 1024LL;				// 1MB
+const uint64_t WRITER_BATCH_SIZE = 16LL * 1024LL * 1024LL;		// 16MB
+const hsize_t DIM_CHUNK_LENGTH = 4096;
+
+struct FrameWriter::Shared
+{
+	QString filePath;
+	QString groupPath;
+	int rows;
+	int columns;
+	DataType type;
+	bool swmr;
+
+	// Only used on the I/O thread
+	H5File *file;
+	H5::DataSet *data;
+	H5::DataSet *dim;
+	hsize_t extent;
+
+	std::atomic<int64_t> framesWritten;
+	std::atomic<bool> failed;
+
+	std::mutex mutex;
+	std::condition_variable written;
+	int pendingBatches;
+
+	Shared()
+		: rows(0),
+		columns(0),
+		type(DataTypeUnknown),
+		swmr(false),
+		file(0),
+		data(0),
+		dim(0),
+		extent(0),
+		framesWritten(0),
+		failed(false),
+		pendingBatches(0)
+	{}
+
+	bool create(hsize_t chunkFrames);
+	void write(const char *frames, int64_t first, int64_t count);
+	bool flush();
+	void close();
+};
+
+// Runs job on the I/O thread and waits for its result
+static bool runIoJob(const std::function<bool()> &job)
+{
+	std::shared_ptr<std::promise<bool> > promise = 
+		std::make_shared<std::promise<bool> >();
+	std::future<bool> result = promise->get_future();
+	queueIoJob([job, promise](bool run)
+	{
+		promise->set_value(run && job());
+	});
+	return result.get();
+}
+
+static void addAttribute(H5Object *object, const char *name, 
+	const QVariant &value, DataType type)
+{
+	Attribute attribute;
+	attribute.setName(name);
+	attribute.setValue(value);
+	attribute.setType(type);
+	attribute.save(QString(), object);
+}
+
+// A dim vector of 1-based indexes, as for the default dims
+static H5::DataSet *createDim(H5::Group &group, int index, hsize_t length, 
+	bool unlimited, const char *units)
+{
+	QString name = QString("dim%1").arg(index);
+	QByteArray ba = name.toLocal8Bit();
+
+	hsize_t maxLength = unlimited ? H5S_UNLIMITED : length;
+	H5::DataSpace space(1, &length, &maxLength);
+	DSetCreatPropList plist;
+	if(unlimited)
+		plist.setChunk(1, &DIM_CHUNK_LENGTH);
+	H5::DataSet *dim = new H5::DataSet(group.createDataSet(ba.constData(), 
+		PredType::NATIVE_INT32, space, plist));
+
+	if(length > 0)
+	{
+		std::vector<int32_t> values(length);
+		for(hsize_t iii = 0; iii < length; ++iii)
+			values[iii] = (int32_t) iii + 1;
+		dim->write(values.data(), PredType::NATIVE_INT32);
+	}
+
+	addAttribute(dim, "name", QVariant(name), DataTypeString);
+	addAttribute(dim, "units", QVariant(units), DataTypeString);
+	return dim;
+}
+
+bool FrameWriter::Shared::create(hsize_t chunkFrames)
+{
+	try {
+		Exception::dontPrint();
+
+		// SWMR needs the latest file format
+		FileAccPropList accessPlist;
+		if(swmr)
+			accessPlist.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+
+		// The group is added to an existing file, which is never replaced
+		QByteArray ba = filePath.toLocal8Bit();
+		if(QFileInfo::exists(filePath))
+		{
+			if(H5Fis_hdf5(ba.constData()) <= 0)
+			{
+				qWarning() << "Not an HDF5 file: " << filePath;
+				return false;
+			}
+			file = new H5File(ba.constData(), H5F_ACC_RDWR, 
+				FileCreatPropList::DEFAULT, accessPlist);
+		}
+		else
+		{
+			file = new H5File(ba.constData(), H5F_ACC_EXCL, 
+				FileCreatPropList::DEFAULT, accessPlist);
+		}
+
+		ba = groupPath.toLocal8Bit();
+		if(H5Lexists(file->getId(), ba.constData(), H5P_DEFAULT) > 0)
+		{
+			qWarning() << "Group already exists: " << groupPath;
+			close();
+			return false;
+		}
+
+		hid_t linkPlist = H5Pcreate(H5P_LINK_CREATE);
+		H5Pset_create_intermediate_group(linkPlist, 1);
+		hid_t groupID = H5Gcreate(file->getId(), ba.constData(), linkPlist, 
+			H5P_DEFAULT, H5P_DEFAULT);
+		H5Pclose(linkPlist);
+		if(groupID < 0)
+		{
+			qWarning() << "Failed to create group " << groupPath;
+			close();
+			return false;
+		}
+		// The new objects are closed before SWMR writing starts, as HDF5
+		//	cannot refresh objects that are open
+		{
+			H5::Group group(groupID);
+			H5Gclose(groupID);
+			addAttribute(&group, "emd_group_type", QVariant(1), DataTypeInt32);
+
+			// Chunks hold whole frames
+			hsize_t dims[3] = {0, (hsize_t) rows, (hsize_t) columns};
+			hsize_t maxDims[3] = {H5S_UNLIMITED, (hsize_t) rows, (hsize_t) columns};
+			hsize_t chunk[3] = {chunkFrames, (hsize_t) rows, (hsize_t) columns};
+			H5::DataSpace space(3, dims, maxDims);
+			DSetCreatPropList plist;
+			plist.setChunk(3, chunk);
+			group.createDataSet("data", emdToHdfType(type), space, plist);
+
+			delete createDim(group, 1, 0, true, "[frame]");
+			delete createDim(group, 2, rows, false, "[px]");
+			delete createDim(group, 3, columns, false, "[px]");
+		}
+
+		// Readers may open the file from here on
+		if(swmr && H5Fstart_swmr_write(file->getId()) < 0)
+		{
+			qWarning() << "Failed to start SWMR writing to " << filePath;
+			close();
+			return false;
+		}
+
+		ba = (groupPath + "/data").toLocal8Bit();
+		// Batches are written in whole chunks, which go straight to the
+		//	file without a chunk cache (saving a copy of every frame)
+		DSetAccPropList dataPlist;
+		dataPlist.setChunkCache(0, 0, 1.0);
+		data = new H5::DataSet(file->openDataSet(ba.constData(), dataPlist));
+		ba = (groupPath + "/dim1").toLocal8Bit();
+		dim = new H5::DataSet(file->openDataSet(ba.constData()));
+		extent = 0;
+	}
+	catch(Exception error) {
+		qWarning() << "Failed to create frame data in " << filePath;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+// The data and dim1 are extended together, so a flush never leaves
+//	them with different lengths. The frames are written before dim1
+//	grows, so SWMR readers see whole frames for the length of dim1.
+void FrameWriter::Shared::write(const char *frames, int64_t first, int64_t count)
+{
+	if(failed || !data)
+		return;
+
+	try {
+		hsize_t end = first + count;
+		if(end > extent)
+		{
+			hsize_t size[3] = {end, (hsize_t) rows, (hsize_t) columns};
+			data->extend(size);
+		}
+
+		hsize_t offset[3] = {(hsize_t) first, 0, 0};
+		hsize_t blockCount[3] = {(hsize_t) count, (hsize_t) rows, (hsize_t) columns};
+		H5::DataSpace fileSpace = data->getSpace();
+		fileSpace.selectHyperslab(H5S_SELECT_SET, blockCount, offset);
+		H5::DataSpace memorySpace(3, blockCount);
+		data->write(frames, emdToHdfType(type), memorySpace, fileSpace);
+
+		if(end > extent)
+		{
+			dim->extend(&end);
+
+			hsize_t start = extent;
+			hsize_t added = end - extent;
+			std::vector<int32_t> values(added);
+			for(hsize_t iii = 0; iii < added; ++iii)
+				values[iii] = (int32_t) (start + iii + 1);
+			H5::DataSpace dimSpace = dim->getSpace();
+			dimSpace.selectHyperslab(H5S_SELECT_SET, &added, &start);
+			H5::DataSpace valueSpace(1, &added);
+			dim->write(values.data(), PredType::NATIVE_INT32, valueSpace, dimSpace);
+			extent = end;
+		}
+
+		if(swmr)
+		{
+			H5Dflush(data->getId());
+			H5Dflush(dim->getId());
+		}
+
+		int64_t written = framesWritten;
+		if((int64_t) end > written)
+			framesWritten = end;
+	}
+	catch(Exception error) {
+		qWarning() << "Failed to write frames to " << filePath;
+		failed = true;
+	}
+}
+
+bool FrameWriter::Shared::flush()
+{
+	if(!file)
+		return false;
+	return H5Fflush(file->getId(), H5F_SCOPE_LOCAL) >= 0 && !failed;
+}
+
+void FrameWriter::Shared::close()
+{
+	delete data;
+	data = 0;
+	delete dim;
+	dim = 0;
+	if(file)
+	{
+		file->close();
+		delete file;
+		file = 0;
+	}
+}
+
+FrameWriter::FrameWriter()
+	: m_rows(0),
+	m_columns(0),
+	m_type(DataTypeUnknown),
+	m_frameBytes(0),
+	m_batch(0),
+	m_batchCapacity(0),
+	m_batchStart(0),
+	m_batchFrames(0),
+	m_framesAppended(0),
+	m_stalls(0)
+{
+}
+
+FrameWriter::~FrameWriter()
+{
+	close();
+}
+
+bool FrameWriter::open(const QString &filePath, const QString &groupPath, 
+	int rows, int columns, DataType type, bool swmr)
+{
+	close();
+	if(rows <= 0 || columns <= 0 || !isNumericType(type))
+		return false;
+
+	std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+	shared->filePath = filePath;
+	shared->groupPath = groupPath;
+	shared->rows = rows;
+	shared->columns = columns;
+	shared->type = type;
+	shared->swmr = swmr;
+
+	m_frameBytes = (int64_t) rows * columns * emdTypeDepth(type);
+	int64_t chunkFrames = std::max<int64_t>(1, WRITER_CHUNK_SIZE / m_frameBytes);
+	int64_t chunkBytes = chunkFrames * m_frameBytes;
+	m_batchCapacity = chunkFrames * std::max<int64_t>(1, WRITER_BATCH_SIZE / chunkBytes);
+
+	if(!runIoJob([shared, chunkFrames]() {return shared->create(chunkFrames);}))
+		return false;
+
+	m_shared = shared;
+	m_rows = rows;
+	m_columns = columns;
+	m_type = type;
+	m_batch = (char*) allocateBuffer(m_batchCapacity * m_frameBytes);
+	m_batchStart = 0;
+	m_batchFrames = 0;
+	m_framesAppended = 0;
+	m_stalls = 0;
+	return true;
+}
+
+bool FrameWriter::append(const void *frames, int64_t count)
+{
+	if(!m_shared || m_shared->failed)
+		return false;
+
+	const char *source = (const char*) frames;
+	while(count > 0)
+	{
+		int64_t copied = std::min(count, m_batchCapacity - m_batchFrames);
+		memcpy(m_batch + m_batchFrames * m_frameBytes, source, copied * m_frameBytes);
+		m_batchFrames += copied;
+		m_framesAppended += copied;
+		source += copied * m_frameBytes;
+		count -= copied;
+
+		if(m_batchFrames == m_batchCapacity)
+			queueBatch(false);
+	}
+
+	return true;
+}
+
+int64_t FrameWriter::append(FrameRing &ring)
+{
+	if(!m_shared || ring.frameRows() != m_rows || ring.frameColumns() != m_columns 
+		|| ring.dataType() != m_type)
+		return -1;
+
+	// A block stops at the end of the slots
+	int64_t taken = 0;
+	int64_t count;
+	while(const void *frames = ring.readable(count))
+	{
+		if(!append(frames, count))
+			return -1;
+		ring.release(count);
+		taken += count;
+	}
+
+	return taken;
+}
+
+// Hands the batch to the I/O thread. A kept batch is written as a copy
+//	and goes on filling, so the next write still starts on a chunk.
+void FrameWriter::queueBatch(bool keep)
+{
+	if(m_batchFrames == 0)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(m_shared->mutex);
+		if(m_shared->pendingBatches >= MaxPendingBatches)
+		{
+			++m_stalls;
+			m_shared->written.wait(lock, [this]() 
+			{
+				return m_shared->pendingBatches < MaxPendingBatches;
+			});
+		}
+		++m_shared->pendingBatches;
+	}
+
+	char *batch = m_batch;
+	int64_t first = m_batchStart;
+	int64_t count = m_batchFrames;
+	if(keep)
+	{
+		batch = (char*) allocateBuffer(count * m_frameBytes);
+		memcpy(batch, m_batch, count * m_frameBytes);
+	}
+	else
+	{
+		m_batch = (char*) allocateBuffer(m_batchCapacity * m_frameBytes);
+		m_batchStart += m_batchFrames;
+		m_batchFrames = 0;
+	}
+
+	std::shared_ptr<Shared> shared = m_shared;
+	queueIoJob([shared, batch, first, count](bool run)
+	{
+		if(run)
+			shared->write(batch, first, count);
+		else
+			shared->failed = true;
+		freeBuffer(batch);
+
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		--shared->pendingBatches;
+		shared->written.notify_all();
+	});
+}
+
+bool FrameWriter::flush()
+{
+	if(!m_shared)
+		return false;
+
+	queueBatch(true);
+	std::shared_ptr<Shared> shared = m_shared;
+	return runIoJob([shared]() {return shared->flush();});
+}
+
+bool FrameWriter::close()
+{
+	if(!m_shared)
+		return false;
+
+	queueBatch(false);
+	std::shared_ptr<Shared> shared = m_shared;
+	bool flushed = runIoJob([shared]() 
+	{
+		bool flushed = shared->flush();
+		shared->close();
+		return flushed;
+	});
+
+	freeBuffer(m_batch);
+	m_batch = 0;
+	m_shared.reset();
+	return flushed;
+}
+
+int64_t FrameWriter::framesWritten() const
+{
+	return m_shared ? m_shared->framesWritten.load() : 0;
+}
+
+} // namespace emd
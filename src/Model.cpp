@@ -20,6 +20,7 @@
 
 #include "Model.h"
 
+#include <algorithm>
 #include <stdint.h>
 #include <string.h>
 
@@ -29,6 +30,7 @@
 #include "Group.h"
 #include "DataGroup.h"
 #include "Attribute.h"
+#include "Convert.h"
 #include "Dataset.h"
 #include "DataSpace.h"
 #include "Frame.h"
@@ -59,6 +61,9 @@ Model::Model(QObject *parent)
 	addNode("sample",		Node::GROUP);
 	addNode("comments",		Node::GROUP);
 
+	m_memoryBudget = 0;
+	m_swmrFile = 0;
+
 	// Init data
 	m_chunks = 0;
 	m_chunkDims = 0;
@@ -68,6 +73,7 @@ Model::Model(QObject *parent)
 
 Model::~Model()
 {
+	closeSwmr();
 	if(m_chunkCount)
 		delete [] m_chunkCount;
 	if(m_FrameSpaceDims)
@@ -255,15 +261,22 @@ Qt::ItemFlags Model::flags(const QModelIndex &index) const
 	return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsEditable;
 }
 
+// Rows inserted through the item model interface are groups
 bool Model::insertRows(int position, int rows, 
 					const QModelIndex &parent)
+{
+	return insertNodes(position, rows, parent, Node::GROUP);
+}
+
+bool Model::insertNodes(int position, int rows, const QModelIndex &parent, 
+	int type)
 {
 	Node *parentNode = getNode(parent);
 	if(!parentNode)
 		parentNode = m_root;
 
 	beginInsertRows(parent, position, position + rows - 1);
-	bool success = parentNode->addChildren(position, rows, m_currentType);
+	bool success = parentNode->addChildren(position, rows, type);
 	endInsertRows();
 
 	return success;
@@ -287,6 +300,7 @@ bool Model::removeRows(int position, int rows,
 
 void Model::validateDataGroups()
 {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
     m_dataGroups.clear();
 
     QList<Node*> nodes;
@@ -308,6 +322,14 @@ void Model::validateDataGroups()
             }
         }
     }
+
+    QList<DataGroup*> recentGroups;
+    foreach(DataGroup *dataGroup, m_recentGroups)
+    {
+        if(m_dataGroups.contains(dataGroup))
+            recentGroups.append(dataGroup);
+    }
+    m_recentGroups = recentGroups;
 }
 
 Node *Model::getNode(const QModelIndex &index) const
@@ -470,8 +492,7 @@ Node *Model::addNode(const QString &name, const int &type, Node *parent)
 		parent = m_root;
 
 	// Create the new node
-	m_currentType = type;
-	insertRows(parent->childCount(), 1, modelIndex);
+	insertNodes(parent->childCount(), 1, modelIndex, type);
 
 	// Set the node data
 	Node *node = parent->child(parent->childCount() - 1);
@@ -693,13 +714,24 @@ int Model::getChunkIndex(const int * /*indexes*/)
 
 /*************************** File operations *************************/
 
+// The node that parseAttribute adds attributes to. Passed along with
+//	the iteration rather than kept in the Model, so files can be parsed
+//	by several Models at once.
+struct AttributeParent
+{
+	Model *model;
+	Node *node;
+};
+
 herr_t parseAttribute(hid_t objID, const char *name, 
 			const H5A_info_t * /*ainfo*/, void *opData)
 {
-	Model *model = (Model*) opData;
+	AttributeParent *parent = (AttributeParent*) opData;
+	Model *model = parent->model;
 
 	hid_t attrID = H5Aopen(objID, name, H5P_DEFAULT);
 	H5::Attribute atr(attrID);
+	H5Aclose(attrID);
 	H5T_class_t typeClass = atr.getTypeClass();
 	hid_t ftype = H5Aget_type(atr.getId());  
 	size_t byteSize = H5Tget_size(ftype);
@@ -708,7 +740,7 @@ herr_t parseAttribute(hid_t objID, const char *name,
 	uint64_t length = totalSize / byteSize;
 
 	Attribute *node = dynamic_cast<Attribute*>( model->addNode(name, 
-							Node::ATTRIBUTE, model->currentNode()) );
+							Node::ATTRIBUTE, parent->node) );
 
 	if(H5T_INTEGER == typeClass)	// TODO: replace cascading ifs with switches
 	{
@@ -872,6 +904,7 @@ herr_t checkDataGroup(hid_t objID, const char *name,
 
 	hid_t attrID = H5Aopen(objID, name, H5P_DEFAULT);
 	H5::Attribute atr(attrID);
+	H5Aclose(attrID);
 
 	H5T_class_t typeClass = atr.getTypeClass();
 
@@ -997,9 +1030,9 @@ herr_t parseFileNode(hid_t fileID, const char *name, const H5O_info_t *info,
 
         if(node)
         {
-		    model->setCurrentNode(node);
+		    AttributeParent parent = {model, node};
 		    H5Aiterate(objID, H5_INDEX_NAME, H5_ITER_NATIVE, 0,
-			    parseAttribute, model);
+			    parseAttribute, &parent);
         }
         else
         {
@@ -1010,15 +1043,19 @@ herr_t parseFileNode(hid_t fileID, const char *name, const H5O_info_t *info,
     }
     case H5O_TYPE_DATASET:
         node = model->addPath(name, Node::DATASET);
-		model->setCurrentNode(node);
-		H5Aiterate(objID, H5_INDEX_NAME, H5_ITER_NATIVE, 0,
-			parseAttribute, model);
+		{
+			AttributeParent parent = {model, node};
+			H5Aiterate(objID, H5_INDEX_NAME, H5_ITER_NATIVE, 0,
+				parseAttribute, &parent);
+		}
 		{
 			DataSet dataSet(objID);
 			(dynamic_cast<Dataset*>(node))
 				->setDataSpace(DataSpace::fromHdfDataSet(dataSet));
 			(dynamic_cast<Dataset*>(node))
 				->setDataType(dataTypeFromHdfDataSet(dataSet));
+			if(H5T_VLEN == dataSet.getTypeClass())
+				(dynamic_cast<Dataset*>(node))->initSparse(dataSet);
 		}
         break;
     case H5O_TYPE_NAMED_DATATYPE:
@@ -1039,38 +1076,39 @@ bool Model::open(const QString &filePath)
 
     qDebug() << (m_fileDir + m_fileName + "." + m_fileExtension);
 
-	m_file = 0;
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	H5File *file = 0;
 	try {
 		// Open the file in read-write mode.
 		Exception::dontPrint();
 		QByteArray ba = filePath.toLocal8Bit();
 		const char *path = ba.constData();
-		m_file = new H5File(path, H5F_ACC_RDWR);
+		file = new H5File(path, H5F_ACC_RDWR);
 	
 		// Go through all of the objects in the root group and process them
 		//	appropriately. A recursive parsing function is called on each
 		//	group that is found. We pass in a pointer to this Model which
 		//	is required to create and manipulate nodes.
-		H5Ovisit(m_file->getId(), H5_INDEX_NAME, H5_ITER_NATIVE, 
+		H5Ovisit(file->getId(), H5_INDEX_NAME, H5_ITER_NATIVE, 
 			parseFileNode, (void*)this);
 
 		validateDataGroups();
 
 		// Clean up
-		if(m_file)
+		if(file)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 		}
 	}
 	// catch failure caused by the H5File operations
 	catch(FileIException error) {
 		qDebug() << "Bad file operation.";
 		// Clean up
-		if(m_file)
+		if(file)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 		}
 		return false;
 	}
@@ -1078,10 +1116,10 @@ bool Model::open(const QString &filePath)
 	catch(DataSetIException error) {
 		qDebug() << "Bad dataset operation.";
 		// Clean up
-		if(m_file)
+		if(file)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 		}
 		return false;
 	}
@@ -1089,10 +1127,10 @@ bool Model::open(const QString &filePath)
 	catch(DataSpaceIException error) {
 		qDebug() << "Bad dataspace operation.";
 		// Clean up
-		if(m_file)
+		if(file)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 		}
 		return false;
 	}
@@ -1100,18 +1138,81 @@ bool Model::open(const QString &filePath)
 	catch(AttributeIException error){
 		qDebug() << "Bad attribute operation.";
 		// Clean up
-		if(m_file)
+		if(file)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 		}
 		return false;
 	}
 	return true;
 }
 
+bool Model::openSwmr(const QString &filePath)
+{
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	closeSwmr();
+	this->setFilePath(filePath);
+
+	try {
+		Exception::dontPrint();
+		QByteArray ba = filePath.toLocal8Bit();
+		m_swmrFile = new H5File(ba.constData(), 
+			H5F_ACC_RDONLY | H5F_ACC_SWMR_READ);
+
+		H5Ovisit(m_swmrFile->getId(), H5_INDEX_NAME, H5_ITER_NATIVE, 
+			parseFileNode, (void*)this);
+
+		validateDataGroups();
+	}
+	catch(Exception error) {
+		qDebug() << "Failed to open for SWMR reading: " << filePath;
+		closeSwmr();
+		return false;
+	}
+
+	return true;
+}
+
+void Model::closeSwmr()
+{
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	if(!m_swmrFile)
+		return;
+
+	m_swmrFile->close();
+	delete m_swmrFile;
+	m_swmrFile = 0;
+}
+
+QList<DataGroup*> Model::refresh()
+{
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	QList<DataGroup*> changed;
+	if(!m_swmrFile)
+		return changed;
+
+	// Refreshing grows loaded groups, which memoryUsage reads under m_mutex
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+	try {
+		Exception::dontPrint();
+		foreach(DataGroup *dataGroup, m_dataGroups)
+		{
+			if(dataGroup->refresh(m_swmrFile))
+				changed.append(dataGroup);
+		}
+	}
+	catch(Exception error) {
+		qDebug() << "Failed to refresh " << filePath();
+	}
+
+	return changed;
+}
+
 void Model::save(const QString &filePath)
 {
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
 	// Update the file name (it might not have changed).
 	this->setFilePath(filePath);
 
@@ -1187,83 +1288,368 @@ void Model::save(const QString &filePath)
 	}
 }
 
+// Size of the group once loaded with the options, from the shape in the
+//	file; binning and strides are only estimated.
+static int64_t expectedSize(const DataGroup *group, const Dataset::LoadOptions *options)
+{
+	const Dataset *data = group->data();
+	if(!data)
+		return 0;
+
+	DataType type = data->dataType();
+	if(options && isNumericType(options->type))
+		type = options->type;
+	else if(options && options->isBinned())
+		type = DataTypeFloat32;
+
+	int64_t size = emdTypeDepth(type);
+	const DataSpace &space = data->dataSpace();
+	for(int iii = 0; iii < space.rank(); ++iii)
+	{
+		int64_t length = space.dimLength(iii);
+		if(options)
+			length /= options->binningFactor(iii) * options->strideFactor(iii);
+		size *= std::max<int64_t>(1, length);
+	}
+	return size;
+}
+
 bool Model::loadDataGroup(const int &groupIndex)
+{
+	return loadGroup(groupIndex, NULL);
+}
+
+bool Model::loadDataGroup(const int &groupIndex, const Dataset::LoadOptions &options)
+{
+	return loadGroup(groupIndex, &options);
+}
+
+bool Model::loadDataGroupProgressive(const int &groupIndex, 
+	const ProgressCallback &callback, int passCount, const Dataset::LoadOptions &options)
 {
 	if(groupIndex < 0 || groupIndex >= m_dataGroups.count())
 		return false;
 
+	DataGroup *group = m_dataGroups.at(groupIndex);
+	int rank = 0;
+	int longest = 1;
+	{
+		// An asynchronous load may be changing the dataspace
+		std::lock_guard<std::recursive_mutex> lock(m_mutex);
+		if(isLoading(group))
+		{
+			qWarning() << "Data group is being loaded asynchronously";
+			return false;
+		}
+
+		// No more passes than there are strides shorter than the longest dim
+		rank = group->data()->dimCount();
+		for(int iii = 0; iii < rank; ++iii)
+			longest = std::max(longest, group->data()->dimLength(iii));
+	}
+	int usefulPasses = 1;
+	for(int64_t stride = 4; stride < longest; stride *= 4)
+		++usefulPasses;
+	passCount = std::min(std::max(1, passCount), usefulPasses);
+	for(int pass = 0; pass < passCount; ++pass)
+	{
+		// Strides of 4^n, down to 1 for the last pass
+		Dataset::LoadOptions passOptions = options;
+		int stride = 1 << (2 * (passCount - 1 - pass));
+		if(stride > 1)
+		{
+			passOptions.strides.resize(rank);
+			for(int iii = 0; iii < rank; ++iii)
+				passOptions.strides[iii] = options.strideFactor(iii) * stride;
+		}
+
+		if(!loadGroup(groupIndex, &passOptions))
+			return false;
+
+		if(callback && !callback(group, pass, passCount))
+			break;
+	}
+
+	return true;
+}
+
+bool Model::loadGroup(const int &groupIndex, const Dataset::LoadOptions *options)
+{
+	if(groupIndex < 0 || groupIndex >= m_dataGroups.count())
+		return false;
+
+	// Held throughout, so that two threads loading the same group take 
+	//	turns rather than both reading it
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
 	DataGroup *newGroup = m_dataGroups.at(groupIndex);
 
+	// Other threads making room hold only m_mutex, so the group is marked
+	//	until it has been read. It is counted at its current footprint 
+	//	until the size it is loaded at is known.
+	struct SyncLoadGuard
+	{
+		Model *model;
+		DataGroup *group;
+		~SyncLoadGuard()
+		{
+			std::lock_guard<std::recursive_mutex> lock(model->m_mutex);
+			for(auto load = model->m_syncLoads.begin(); 
+				load != model->m_syncLoads.end(); ++load)
+			{
+				if(load->group == group)
+				{
+					model->m_syncLoads.erase(load);
+					break;
+				}
+			}
+		}
+	} syncLoadGuard = {this, newGroup};
+	{
+		std::lock_guard<std::recursive_mutex> lock(m_mutex);
+		if(isLoading(newGroup))
+		{
+			syncLoadGuard.group = 0;
+			qWarning() << "Data group is being loaded asynchronously";
+			return false;
+		}
+
+		SyncLoad syncLoad = {newGroup, newGroup->memoryFootprint()};
+		m_syncLoads.push_back(syncLoad);
+	}
+
     if(newGroup->isLoaded())
     {
-        return true;
+        touchDataGroup(newGroup);
+        if(!options)
+            return true;
+
+        // Reloaded with the requested conversion, which would lose 
+        //  unsaved changes
+        if(newGroup->isDirty())
+        {
+            qWarning() << "Data group has unsaved changes and is not reloaded";
+            return false;
+        }
+        newGroup->unload();
     }
 
+    // The group's own size is already counted through m_syncLoads
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        int64_t bytes = expectedSize(newGroup, options);
+        for(SyncLoad &load : m_syncLoads)
+        {
+            if(load.group == newGroup)
+                load.bytes = bytes;
+        }
+        makeRoom(0, newGroup);
+    }
+    touchDataGroup(newGroup);
+
+    // The file is already open
+    if(m_swmrFile)
+    {
+        try {
+            Exception::dontPrint();
+            return (options ? newGroup->load(m_swmrFile, *options) 
+                : newGroup->load(m_swmrFile));
+        }
+        catch(Exception error) {
+            qDebug() << "Bad file operation: " << error.getCDetailMsg();
+            return false;
+        }
+    }
+
+	H5File *file = 0;
 	try {
 		// Open the file in read-write mode.
 		Exception::dontPrint();
         QString filePath = m_fileDir + m_fileName + "." + m_fileExtension;
 		QByteArray ba = filePath.toLocal8Bit();
-		m_file = new H5File(ba.constData(), H5F_ACC_RDONLY);
+		file = new H5File(ba.constData(), H5F_ACC_RDONLY);
 		// TODO: verify file integrity
 		
-		bool success = newGroup->load(m_file);
+		bool success = (options ? newGroup->load(file, *options) 
+			: newGroup->load(file));
 		if(!success)
 		{
-			m_file->close();
-			delete m_file;
+			file->close();
+			delete file;
 			return false;
 		}
 
 		// Clean up
-		m_file->close();
-		delete m_file;
+		file->close();
+		delete file;
 	}
 	// catch failure caused by the H5File operations
 	catch(FileIException error) {
 		qDebug() << "Bad file operation.";
 		// Clean up
-		m_file->close();
-		delete m_file;
+		file->close();
+		delete file;
 		return false;
 	}
 	// catch failure caused by the DataSet operations
 	catch(DataSetIException error) {
 		qDebug() << "Bad dataset operation: " << error.getCDetailMsg();
 		// Clean up
-		m_file->close();
-		delete m_file;
+		file->close();
+		delete file;
 		return false;
 	}
 	// catch failure caused by the DataSpace operations
 	catch(DataSpaceIException error) {
 		qDebug() << "Bad dataspace operation.";
 		// Clean up
-		m_file->close();
-		delete m_file;
+		file->close();
+		delete file;
 		return false;
 	}
 	// catch failure caused by the Attribute operations
 	catch(AttributeIException error){
 		qDebug() << "Bad attribute operation.";
 		// Clean up
-		m_file->close();
-		delete m_file;
+		file->close();
+		delete file;
 		return false;
 	}
 
 	return true;
 }
 
+LoadHandle Model::loadDataGroupAsync(const int &groupIndex, 
+	const Dataset::LoadOptions &options, const LoadHandle::Callback &finished)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	DataGroup *group = 0;
+	if(groupIndex >= 0 && groupIndex < m_dataGroups.count())
+		group = m_dataGroups.at(groupIndex);
+	if(!group || isLoading(group) || isSyncLoading(group) || m_swmrFile)
+		return LoadHandle::load(0, filePath());
+
+	PendingLoad pending;
+	pending.bytes = expectedSize(group, &options);
+	makeRoom(pending.bytes, group);
+	touchDataGroup(group);
+
+	pending.handle = LoadHandle::load(group, filePath(), options, finished);
+	m_pendingLoads.push_back(pending);
+	return pending.handle;
+}
+
 bool Model::loadDataGroup(DataGroup *dataGroup)
 {
     return this->loadDataGroup(indexOfDataGroup(dataGroup));
 }
 
+// Groups that are being loaded stay loaded
 void Model::unloadDataGroups()
 {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
     foreach(DataGroup *dataGroup, m_dataGroups)
-        dataGroup->unload();
+    {
+        if(!isLoading(dataGroup) && !isSyncLoading(dataGroup))
+            dataGroup->unload();
+    }
+}
+
+void Model::setMemoryBudget(int64_t bytes)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	m_memoryBudget = std::max<int64_t>(0, bytes);
+	makeRoom(0, 0);
+}
+
+int64_t Model::memoryUsage()
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	int64_t usage = 0;
+	foreach(DataGroup *dataGroup, m_dataGroups)
+	{
+		if(!isLoading(dataGroup) && !isSyncLoading(dataGroup))
+			usage += dataGroup->memoryFootprint();
+	}
+
+	for(const PendingLoad &pending : m_pendingLoads)
+		usage += pending.bytes;
+	for(const SyncLoad &load : m_syncLoads)
+		usage += load.bytes;
+	return usage;
+}
+
+void Model::touchDataGroup(DataGroup *dataGroup)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	m_recentGroups.removeAll(dataGroup);
+	m_recentGroups.prepend(dataGroup);
+}
+
+// Finished loads are forgotten here
+bool Model::isLoading(DataGroup *group)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	bool loading = false;
+	for(auto pending = m_pendingLoads.begin(); pending != m_pendingLoads.end(); )
+	{
+		if(pending->handle.isFinished())
+		{
+			pending = m_pendingLoads.erase(pending);
+			continue;
+		}
+
+		if(pending->handle.dataGroup() == group)
+			loading = true;
+		++pending;
+	}
+	return loading;
+}
+
+bool Model::isSyncLoading(DataGroup *group) const
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	for(const SyncLoad &load : m_syncLoads)
+	{
+		if(load.group == group)
+			return true;
+	}
+	return false;
+}
+
+void Model::makeRoom(int64_t bytes, DataGroup *keep)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	if(m_memoryBudget <= 0)
+		return;
+
+	int64_t usage = memoryUsage();
+	if(usage + bytes <= m_memoryBudget)
+		return;
+
+	// Groups loaded without the model are the oldest
+	QList<DataGroup*> candidates;
+	foreach(DataGroup *dataGroup, m_dataGroups)
+	{
+		if(!m_recentGroups.contains(dataGroup))
+			candidates.append(dataGroup);
+	}
+	for(int iii = m_recentGroups.count() - 1; iii >= 0; --iii)
+		candidates.append(m_recentGroups.at(iii));
+
+	foreach(DataGroup *dataGroup, candidates)
+	{
+		if(usage + bytes <= m_memoryBudget)
+			break;
+		if(dataGroup == keep || isLoading(dataGroup) 
+			|| isSyncLoading(dataGroup) || dataGroup->isDirty() 
+			|| !dataGroup->isLoaded())
+			continue;
+
+		// The dim vectors stay loaded
+		int64_t footprint = dataGroup->memoryFootprint();
+		dataGroup->unload();
+		usage -= footprint - dataGroup->memoryFootprint();
+	}
 }
 
 int Model::indexOfDataGroup(DataGroup *group)
@@ -0,0 +1,346 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace emd
+{
+
+static std::atomic<int> s_threadCount(0);
+static std::atomic<bool> s_threadAffinity(false);
+
+int threadCount()
+{
+	int count = s_threadCount.load();
+	if(count > 0)
+		return count;
+
+	count = (int) std::thread::hardware_concurrency();
+	return (count > 0 ? count : 1);
+}
+
+void setThreadCount(int count)
+{
+	s_threadCount.store(count > 0 ? count : 0);
+}
+
+void setThreadAffinity(bool enabled)
+{
+	s_threadAffinity.store(enabled);
+}
+
+bool threadAffinity()
+{
+	return s_threadAffinity.load();
+}
+
+namespace
+{
+
+typedef std::function<void()> Task;
+
+// A queue of tasks: its owner works at the back, other threads take 
+//	from the front, the oldest and usually largest tasks.
+class TaskQueue
+{
+public:
+	void push(const Task &task)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(task);
+	}
+
+	bool popBack(Task &task)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_tasks.empty())
+			return false;
+		task = std::move(m_tasks.back());
+		m_tasks.pop_back();
+		return true;
+	}
+
+	bool popFront(Task &task)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_tasks.empty())
+			return false;
+		task = std::move(m_tasks.front());
+		m_tasks.pop_front();
+		return true;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::deque<Task> m_tasks;
+};
+
+// Workers are started as the thread count asks for them and are never
+//	stopped; workers beyond the current count sleep. The pool is never
+//	destroyed, so workers can still be asleep in it at exit.
+class ThreadPool
+{
+public:
+	static const int MaxWorkers = 256;
+
+	static ThreadPool &instance()
+	{
+		static ThreadPool *pool = new ThreadPool;
+		return *pool;
+	}
+
+	// The calling thread counts as one of the threads
+	void ensureWorkers(int threads)
+	{
+		int workers = std::min(threads - 1, (int) MaxWorkers);
+		m_active.store(std::max(workers, 0));
+		if(workers <= m_started.load())
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_wake.notify_all();
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_startMutex);
+		for(int index = m_started.load(); index < workers; ++index)
+		{
+			std::thread thread(&ThreadPool::run, this, index);
+			pin(thread, index);
+			thread.detach();
+			m_started.store(index + 1);
+		}
+	}
+
+	void push(const Task &task)
+	{
+		if(s_worker >= 0)
+			m_queues[s_worker].push(task);
+		else
+			m_injected.push(task);
+
+		// All are woken, as a sleeping worker beyond the active count 
+		//	could otherwise take the only notification
+		m_queued.fetch_add(1);
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_wake.notify_all();
+	}
+
+	// Runs one queued task: the thread's own newest, or else the oldest
+	//	of another queue. Returns false if none was found.
+	bool runOne()
+	{
+		Task task;
+		if(!take(task))
+			return false;
+
+		m_queued.fetch_sub(1);
+		task();
+		return true;
+	}
+
+private:
+	ThreadPool()
+		: m_started(0),
+		m_active(0),
+		m_queued(0)
+	{}
+
+	bool take(Task &task)
+	{
+		int self = s_worker;
+		if(self >= 0 && m_queues[self].popBack(task))
+			return true;
+		if(m_injected.popFront(task))
+			return true;
+
+		int started = m_started.load();
+		int first = (self >= 0 ? self + 1 : 0);
+		for(int count = 0; count < started; ++count)
+		{
+			int index = (first + count) % started;
+			if(index != self && m_queues[index].popFront(task))
+				return true;
+		}
+		return false;
+	}
+
+	void run(int index)
+	{
+		s_worker = index;
+		while(true)
+		{
+			if(index < m_active.load() && runOne())
+				continue;
+
+			std::unique_lock<std::mutex> lock(m_sleepMutex);
+			m_wake.wait(lock, [this, index]()
+			{
+				return index < m_active.load() && m_queued.load() > 0;
+			});
+		}
+	}
+
+	static void pin(std::thread &thread, int index)
+	{
+#ifdef __linux__
+		if(!s_threadAffinity.load())
+			return;
+
+		int processors = (int) std::thread::hardware_concurrency();
+		if(processors <= 0)
+			return;
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET((index + 1) % processors, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+		(void) thread;
+		(void) index;
+#endif
+	}
+
+	TaskQueue m_queues[MaxWorkers];
+	TaskQueue m_injected;
+	std::atomic<int> m_started;
+	std::atomic<int> m_active;
+	std::atomic<int64_t> m_queued;
+
+	std::mutex m_startMutex;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+
+	static thread_local int s_worker;
+};
+
+thread_local int ThreadPool::s_worker = -1;
+
+// The ranges of one parallelFor still to finish, and the first exception
+//	thrown by any of them
+struct Completion
+{
+	Completion(int64_t count)
+		: pending(count)
+	{}
+
+	void finish(std::exception_ptr thrown)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(thrown && !error)
+			error = thrown;
+		if(--pending == 0)
+			done.notify_all();
+	}
+
+	std::mutex mutex;
+	std::condition_variable done;
+	int64_t pending;
+	std::exception_ptr error;
+};
+
+} // namespace
+
+void parallelFor(int64_t begin, int64_t end, int64_t grain,
+	const std::function<void(int64_t, int64_t)> &body)
+{
+	if(end <= begin)
+		return;
+
+	grain = std::max<int64_t>(grain, 1);
+	int64_t length = end - begin;
+	int threads = threadCount();
+	int64_t rangeCount = std::min<int64_t>(threads, (length + grain - 1) / grain);
+
+	if(rangeCount <= 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	ThreadPool &pool = ThreadPool::instance();
+	pool.ensureWorkers(threads);
+
+	// The calling thread processes the first range itself, and then
+	//	helps with queued tasks until none are left, and waits for the
+	//	other ranges to be done. The tasks refer to the caller's frame,
+	//	so it is not left until they are, even if a range throws.
+	int64_t rangeLength = (length + rangeCount - 1) / rangeCount;
+	Completion completion((length - 1) / rangeLength);
+	for(int64_t start = begin + rangeLength; start < end; start += rangeLength)
+	{
+		int64_t stop = std::min(start + rangeLength, end);
+		pool.push([&body, &completion, start, stop]()
+		{
+			std::exception_ptr thrown;
+			try {
+				body(start, stop);
+			}
+			catch(...) {
+				thrown = std::current_exception();
+			}
+			completion.finish(thrown);
+		});
+	}
+
+	std::exception_ptr thrown;
+	try {
+		body(begin, std::min(begin + rangeLength, end));
+	}
+	catch(...) {
+		thrown = std::current_exception();
+	}
+
+	std::unique_lock<std::mutex> lock(completion.mutex);
+	while(completion.pending > 0)
+	{
+		lock.unlock();
+		bool ran = pool.runOne();
+		lock.lock();
+		if(!ran)
+		{
+			completion.done.wait(lock, [&completion]()
+			{
+				return completion.pending == 0;
+			});
+		}
+	}
+
+	if(!thrown)
+		thrown = completion.error;
+	lock.unlock();
+	if(thrown)
+		std::rethrow_exception(thrown);
+}
+
+} // namespace emd
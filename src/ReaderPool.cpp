@@ -0,0 +1,610 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ReaderPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "H5Cpp.h"
+
+#include <QDebug>
+
+#include "AsyncLoad.h"
+#include "Convert.h"
+#include "DataGroup.h"
+#include "Parallel.h"
+
+#ifndef H5_NO_NAMESPACE
+using namespace H5;
+#endif
+
+namespace emd
+{
+
+#ifndef _WIN32
+
+const int POOL_MAX_RANK = 32;
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// Sent to a helper, followed by the data path. The selection is of the
+//	stored dims; the values are decoded into the helper's shared memory,
+//	packed in C order.
+struct PoolRequest
+{
+	enum Operation
+	{
+		StoredType = 1,
+		Read
+	};
+
+	int32_t operation;
+	int32_t type;
+	int32_t rank;
+	int32_t pathLength;
+	int32_t start[POOL_MAX_RANK];
+	int32_t end[POOL_MAX_RANK];
+};
+
+struct PoolReply
+{
+	int32_t success;
+	int32_t type;
+};
+
+static bool sendAll(int socket, const void *data, size_t size)
+{
+	const char *next = (const char*) data;
+	while(size > 0)
+	{
+		ssize_t sent = send(socket, next, size, SEND_FLAGS);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return false;
+		next += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool receiveAll(int socket, void *data, size_t size)
+{
+	char *next = (char*) data;
+	while(size > 0)
+	{
+		ssize_t received = recv(socket, next, size, 0);
+		if(received < 0 && errno == EINTR)
+			continue;
+		if(received <= 0)
+			return false;
+		next += received;
+		size -= received;
+	}
+	return true;
+}
+
+// The helper process: answers requests until the pool closes its end
+//	of the socket.
+static void serve(int socket, char *shared, int64_t sharedBytes, 
+	const char *filePath)
+{
+	// Only the forking thread exists in the helper, so the parallel
+	//	kernels must not wait for the pool's workers
+	setThreadCount(1);
+	Exception::dontPrint();
+
+	H5File *file = 0;
+	try {
+		file = new H5File(filePath, H5F_ACC_RDONLY);
+	}
+	catch(Exception error) {
+		qWarning() << "Reader process failed to open " << filePath;
+	}
+
+	Dataset reader;
+	PoolRequest request;
+	std::vector<char> path;
+	while(receiveAll(socket, &request, sizeof(request)))
+	{
+		path.assign(std::max(request.pathLength, 0) + 1, 0);
+		if(!receiveAll(socket, path.data(), path.size() - 1))
+			break;
+
+		PoolReply reply = {0, DataTypeUnknown};
+		try {
+			if(file)
+			{
+				DataSet dataSet = file->openDataSet(path.data());
+				DataType type = (DataType) request.type;
+				if(request.operation == PoolRequest::StoredType)
+				{
+					reply.type = dataTypeFromHdfDataSet(dataSet);
+					reply.success = isNumericType((DataType) reply.type);
+				}
+				else if(request.rank > 0 && request.rank <= POOL_MAX_RANK 
+					&& isNumericType(type))
+				{
+					Dataset::Selection selection(request.rank);
+					int64_t bytes = emdTypeDepth(type);
+					for(int iii = 0; iii < request.rank; ++iii)
+					{
+						selection[iii].start = request.start[iii];
+						selection[iii].end = request.end[iii];
+						bytes *= std::max(request.end[iii] - request.start[iii], 0);
+					}
+
+					reply.type = type;
+					reply.success = bytes <= sharedBytes 
+						&& reader.read(dataSet, selection, shared, type);
+				}
+			}
+		}
+		catch(Exception error) {
+			reply.success = 0;
+		}
+
+		if(!sendAll(socket, &reply, sizeof(reply)))
+			break;
+	}
+
+	if(file)
+	{
+		file->close();
+		delete file;
+	}
+}
+
+static bool sendRequest(int socket, PoolRequest &request, 
+	const QByteArray &path)
+{
+	request.pathLength = path.size();
+	return sendAll(socket, &request, sizeof(request)) 
+		&& sendAll(socket, path.constData(), path.size());
+}
+
+// Fails if the helper has not answered within timeout milliseconds
+static bool receiveReply(int socket, PoolReply &reply, int timeout)
+{
+	pollfd entry = {socket, POLLIN, 0};
+	int ready;
+	do {
+		ready = poll(&entry, 1, timeout);
+	} while(ready < 0 && errno == EINTR);
+	return ready > 0 && receiveAll(socket, &reply, sizeof(reply));
+}
+
+#endif
+
+// Copies slices [first, first + slices) of a selection, packed in C 
+//	order at source, into the destination laid out with the given 
+//	strides (in elements).
+static void copySlices(const char *source, int64_t first, int64_t slices, 
+	const std::vector<int64_t> &count, const std::vector<int64_t> &packed, 
+	const std::vector<int64_t> &step, int typeSize, char *destination)
+{
+	int rank = count.size();
+	int64_t values = slices * packed[0];
+	if(step == packed)
+	{
+		memcpy(destination + first * packed[0] * typeSize, source, 
+			values * typeSize);
+		return;
+	}
+
+	int64_t rowLength = count[rank - 1];
+	std::vector<int64_t> index(rank, 0);
+	index[0] = first;
+	for(int64_t value = 0; value < values; value += rowLength)
+	{
+		int64_t rowOffset = 0;
+		for(int iii = 0; iii < rank - 1; ++iii)
+			rowOffset += index[iii] * step[iii];
+		char *rowTarget = destination + rowOffset * typeSize;
+		const char *rowSource = source + value * typeSize;
+		if(step[rank - 1] == 1)
+		{
+			memcpy(rowTarget, rowSource, rowLength * typeSize);
+		}
+		else
+		{
+			for(int64_t iii = 0; iii < rowLength; ++iii)
+				memcpy(rowTarget + iii * step[rank - 1] * typeSize, 
+					rowSource + iii * typeSize, typeSize);
+		}
+
+		for(int iii = rank - 2; iii >= 0; --iii)
+		{
+			if(++index[iii] < count[iii] || iii == 0)
+				break;
+			index[iii] = 0;
+		}
+	}
+}
+
+ReaderPool::ReaderPool(const QString &filePath, int processCount, 
+	int64_t sharedBytes)
+	: m_filePath(filePath),
+	m_processCount(processCount),
+	m_sharedBytes(std::max<int64_t>(sharedBytes, 4096)),
+	m_timeout(30000)
+{
+}
+
+ReaderPool::~ReaderPool()
+{
+	stop();
+}
+
+bool ReaderPool::start()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_helpers.empty())
+		return true;
+
+#ifdef _WIN32
+	qWarning() << "Reader processes are not supported on this platform";
+	return false;
+#else
+	int count = (m_processCount > 0) ? m_processCount : threadCount();
+	QByteArray path = m_filePath.toLocal8Bit();
+
+	// No HDF5 call is half done in another thread when the helpers are
+	//	forked
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	for(int iii = 0; iii < count; ++iii)
+	{
+		int sockets[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+			break;
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+		int noSignal = 1;
+		setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+
+		void *shared = mmap(0, m_sharedBytes, PROT_READ | PROT_WRITE, 
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		pid_t pid = (shared == MAP_FAILED) ? -1 : fork();
+		if(pid < 0)
+		{
+			if(shared != MAP_FAILED)
+				munmap(shared, m_sharedBytes);
+			close(sockets[0]);
+			close(sockets[1]);
+			break;
+		}
+
+		if(pid == 0)
+		{
+			close(sockets[0]);
+			for(const Helper &helper : m_helpers)
+				close(helper.socket);
+			serve(sockets[1], (char*) shared, m_sharedBytes, path.constData());
+			// Exits without running the parent's destructors
+			_exit(0);
+		}
+
+		close(sockets[1]);
+		Helper helper = {pid, sockets[0], (char*) shared};
+		m_helpers.push_back(helper);
+	}
+
+	if(m_helpers.empty())
+	{
+		qWarning() << "Failed to start reader processes for " << m_filePath;
+		return false;
+	}
+	return true;
+#endif
+}
+
+void ReaderPool::stop()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(Helper &helper : m_helpers)
+		stopHelper(helper);
+	m_helpers.clear();
+}
+
+int ReaderPool::processCount() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_helpers.size();
+}
+
+void ReaderPool::setTimeout(int milliseconds)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_timeout = std::max(milliseconds, 1);
+}
+
+int ReaderPool::timeout() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_timeout;
+}
+
+bool ReaderPool::read(const DataGroup *group, 
+	const Dataset::Selection &selection, void *destination, DataType type, 
+	const std::vector<int64_t> &strides)
+{
+	if(!group || !group->data())
+		return false;
+
+	return read(group->data()->path(), selection, destination, type, strides);
+}
+
+bool ReaderPool::read(const QString &dataPath, 
+	const Dataset::Selection &selection, void *destination, DataType type, 
+	const std::vector<int64_t> &strides)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_helpers.empty())
+		return readHere(dataPath, selection, destination, type, strides);
+
+#ifdef _WIN32
+	return false;
+#else
+	int rank = selection.size();
+	if(rank == 0 || rank > POOL_MAX_RANK 
+		|| (!strides.empty() && (int)strides.size() != rank))
+	{
+		qWarning() << "Selection does not match data " << dataPath;
+		return false;
+	}
+
+	std::vector<int64_t> count(rank);
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		count[iii] = selection[iii].end - selection[iii].start;
+		if(selection[iii].start < 0 || count[iii] <= 0)
+		{
+			qWarning() << "Selection out of range for " << dataPath;
+			return false;
+		}
+	}
+
+	if(!isNumericType(type))
+		type = storedType(dataPath);
+	if(m_helpers.empty())
+		return readHere(dataPath, selection, destination, type, strides);
+	if(!isNumericType(type))
+	{
+		qWarning() << "Only dense numeric data can be read into a buffer: " << dataPath;
+		return false;
+	}
+	int typeSize = emdTypeDepth(type);
+
+	std::vector<int64_t> packed(rank);
+	packed[rank - 1] = 1;
+	for(int iii = rank - 2; iii >= 0; --iii)
+		packed[iii] = packed[iii + 1] * count[iii + 1];
+	const std::vector<int64_t> &step = strides.empty() ? packed : strides;
+
+	int64_t sliceBytes = packed[0] * typeSize;
+	if(sliceBytes > m_sharedBytes)
+	{
+		qWarning() << "Slices of " << dataPath << " do not fit in the reader processes' memory";
+		return false;
+	}
+
+	// Pieces of whole slices, at least one per helper
+	int64_t length = count[0];
+	int64_t helperCount = m_helpers.size();
+	int64_t pieceLength = std::min(m_sharedBytes / sliceBytes, 
+		(length + helperCount - 1) / helperCount);
+
+	QByteArray path = dataPath.toLocal8Bit();
+	PoolRequest request;
+	memset(&request, 0, sizeof(request));
+	request.operation = PoolRequest::Read;
+	request.type = type;
+	request.rank = rank;
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		request.start[iii] = selection[iii].start;
+		request.end[iii] = selection[iii].end;
+	}
+
+	// The first slice of the piece each helper is reading, or -1, and 
+	//	when it is lost if it has not answered
+	typedef std::chrono::steady_clock Clock;
+	std::vector<int64_t> pieces(helperCount, -1);
+	std::vector<Clock::time_point> deadlines(helperCount);
+	std::vector<bool> lost(helperCount, false);
+	std::vector<pollfd> waiting;
+	int64_t next = 0;
+	bool success = true;
+	char *target = (char*) destination;
+	for(;;)
+	{
+		for(int64_t helper = 0; helper < helperCount; ++helper)
+		{
+			if(!success || next >= length)
+				break;
+			if(pieces[helper] >= 0 || lost[helper])
+				continue;
+
+			int64_t slices = std::min(pieceLength, length - next);
+			request.start[0] = selection[0].start + next;
+			request.end[0] = request.start[0] + slices;
+			if(!sendRequest(m_helpers[helper].socket, request, path))
+			{
+				lost[helper] = true;
+				success = false;
+				break;
+			}
+			pieces[helper] = next;
+			deadlines[helper] = Clock::now() + std::chrono::milliseconds(m_timeout);
+			next += slices;
+		}
+
+		waiting.clear();
+		Clock::time_point deadline = Clock::time_point::max();
+		for(int64_t helper = 0; helper < helperCount; ++helper)
+		{
+			if(pieces[helper] >= 0)
+			{
+				pollfd entry = {m_helpers[helper].socket, POLLIN, 0};
+				waiting.push_back(entry);
+				deadline = std::min(deadline, deadlines[helper]);
+			}
+		}
+		if(waiting.empty())
+			break;
+
+		int64_t wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - Clock::now()).count() + 1;
+		if(poll(waiting.data(), waiting.size(), (int) std::max<int64_t>(wait, 0)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			success = false;
+			break;
+		}
+
+		Clock::time_point now = Clock::now();
+		for(int64_t helper = 0, entry = 0; helper < helperCount; ++helper)
+		{
+			if(pieces[helper] < 0)
+				continue;
+			if(!waiting[entry++].revents)
+			{
+				if(now >= deadlines[helper])
+				{
+					lost[helper] = true;
+					success = false;
+					pieces[helper] = -1;
+				}
+				continue;
+			}
+
+			PoolReply reply;
+			if(!receiveAll(m_helpers[helper].socket, &reply, sizeof(reply)))
+			{
+				lost[helper] = true;
+				success = false;
+			}
+			else if(!reply.success)
+			{
+				qWarning() << "Failed to read " << dataPath;
+				success = false;
+			}
+			else
+			{
+				int64_t first = pieces[helper];
+				int64_t slices = std::min(pieceLength, length - first);
+				copySlices(m_helpers[helper].shared, first, slices, count, 
+					packed, step, typeSize, target);
+			}
+			pieces[helper] = -1;
+		}
+	}
+
+	// Helpers that stopped answering are not used again
+	for(int64_t helper = helperCount - 1; helper >= 0; --helper)
+	{
+		if(lost[helper])
+			dropHelper(helper);
+	}
+
+	return success;
+#endif
+}
+
+DataType ReaderPool::storedType(const QString &dataPath)
+{
+#ifdef _WIN32
+	return DataTypeUnknown;
+#else
+	PoolRequest request;
+	memset(&request, 0, sizeof(request));
+	request.operation = PoolRequest::StoredType;
+
+	PoolReply reply = {0, DataTypeUnknown};
+	int socket = m_helpers.front().socket;
+	if(!sendRequest(socket, request, dataPath.toLocal8Bit()) 
+		|| !receiveReply(socket, reply, m_timeout))
+	{
+		dropHelper(0);
+		return DataTypeUnknown;
+	}
+	return reply.success ? (DataType) reply.type : DataTypeUnknown;
+#endif
+}
+
+bool ReaderPool::readHere(const QString &dataPath, 
+	const Dataset::Selection &selection, void *destination, DataType type, 
+	const std::vector<int64_t> &strides)
+{
+	std::lock_guard<std::recursive_mutex> ioLock(ioMutex());
+	try {
+		Exception::dontPrint();
+		QByteArray filePath = m_filePath.toLocal8Bit();
+		H5File file(filePath.constData(), H5F_ACC_RDONLY);
+		QByteArray path = dataPath.toLocal8Bit();
+		DataSet dataSet = file.openDataSet(path.constData());
+		Dataset reader;
+		return reader.read(dataSet, selection, destination, type, strides);
+	}
+	catch(Exception error) {
+		qWarning() << "Failed to read " << dataPath;
+		return false;
+	}
+}
+
+// A helper that stopped answering may be stuck, so it is killed
+void ReaderPool::dropHelper(int index)
+{
+#ifndef _WIN32
+	qWarning() << "Reader process stopped";
+	kill(m_helpers[index].pid, SIGKILL);
+	stopHelper(m_helpers[index]);
+	m_helpers.erase(m_helpers.begin() + index);
+#endif
+}
+
+void ReaderPool::stopHelper(Helper &helper)
+{
+#ifndef _WIN32
+	// The helper exits once its socket is closed
+	close(helper.socket);
+	waitpid(helper.pid, 0, 0);
+	munmap(helper.shared, m_sharedBytes);
+#endif
+}
+
+} // namespace emd
@@ -0,0 +1,704 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "Reduction.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Attribute.h"
+#include "Convert.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "DataSpace.h"
+#include "Parallel.h"
+#include "Simd.h"
+
+namespace emd
+{
+
+// Elements handed to one thread at a time when only one dim is left
+static const int64_t ELEMENT_GRAIN = 64 * 1024;
+
+// Reductions whose partial results would take more than this per thread
+//	run on a single thread instead of giving every thread its own copy
+static const int64_t MAX_PARTIAL_BYTES = 256 * 1024 * 1024;
+
+// The dims in memory order (fastest first), with neighbouring dims that
+//	are both kept or both reduced merged into one
+struct ReductionLayout
+{
+	std::vector<int64_t> lengths;
+	std::vector<int64_t> inStrides;
+	std::vector<int64_t> outStrides;	// 0 along reduced dims
+	int64_t outCount;
+	int64_t reducedCount;
+};
+
+static void buildLayout(const DataSpace &space, bool descending, 
+	const std::vector<bool> &reduced, ReductionLayout &layout)
+{
+	int rank = space.rank();
+	int64_t inStride = 1;
+	int64_t outStride = 1;
+	layout.outCount = 1;
+	layout.reducedCount = 1;
+
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		int dim = descending ? rank - 1 - iii : iii;
+		int64_t length = space.dimLength(dim);
+		if(reduced[dim])
+			layout.reducedCount *= length;
+		else
+			layout.outCount *= length;
+
+		if(length == 1)
+			continue;
+
+		if(!layout.lengths.empty() && (layout.outStrides.back() == 0) == reduced[dim])
+		{
+			layout.lengths.back() *= length;
+		}
+		else
+		{
+			layout.lengths.push_back(length);
+			layout.inStrides.push_back(inStride);
+			layout.outStrides.push_back(reduced[dim] ? 0 : outStride);
+		}
+
+		inStride *= length;
+		if(!reduced[dim])
+			outStride *= length;
+	}
+
+	// A single element
+	if(layout.lengths.empty())
+	{
+		layout.lengths.push_back(1);
+		layout.inStrides.push_back(1);
+		layout.outStrides.push_back(1);
+	}
+}
+
+static inline void addCompensated(double &sum, double &compensation, double value)
+{
+	double corrected = value - compensation;
+	double total = sum + corrected;
+	compensation = (total - sum) - corrected;
+	sum = total;
+}
+
+// Accumulators for every output: compensated (Kahan) sums for the sum,
+//	mean and variance, extremes for the min and max
+template <typename T>
+struct Partial
+{
+	std::vector<double> sums;
+	std::vector<double> compensations;
+	std::vector<T> extremes;
+};
+
+template <typename T>
+class Reducer
+{
+public:
+	Reducer(const T *data, const ReductionLayout &layout, 
+		Reduction::Operation operation, const double *centers)
+		: m_data(data),
+		m_layout(layout),
+		m_operation(operation),
+		m_centers(centers)
+	{
+	}
+
+	void init(Partial<T> &partial) const
+	{
+		if(m_operation == Reduction::OperationMin)
+			partial.extremes.assign(m_layout.outCount, std::numeric_limits<T>::max());
+		else if(m_operation == Reduction::OperationMax)
+			partial.extremes.assign(m_layout.outCount, std::numeric_limits<T>::lowest());
+		else
+		{
+			partial.sums.assign(m_layout.outCount, 0);
+			partial.compensations.assign(m_layout.outCount, 0);
+		}
+	}
+
+	void merge(Partial<T> &result, const Partial<T> &partial) const
+	{
+		for(int64_t iii = 0; iii < m_layout.outCount; ++iii)
+		{
+			switch(m_operation)
+			{
+			case Reduction::OperationMin:
+				result.extremes[iii] = std::min(result.extremes[iii], partial.extremes[iii]);
+				break;
+			case Reduction::OperationMax:
+				result.extremes[iii] = std::max(result.extremes[iii], partial.extremes[iii]);
+				break;
+			default:
+				addCompensated(result.sums[iii], result.compensations[iii], partial.sums[iii]);
+				addCompensated(result.sums[iii], result.compensations[iii], -partial.compensations[iii]);
+				break;
+			}
+		}
+	}
+
+	// The slowest dim is split between the threads. When it is kept the 
+	//	threads write to separate outputs, otherwise every thread 
+	//	accumulates into its own copy and the copies are merged.
+	void run(Partial<T> &result) const
+	{
+		init(result);
+
+		int slowest = (int) m_layout.lengths.size() - 1;
+		int64_t length = m_layout.lengths[slowest];
+		int64_t grain = slowest == 0 ? ELEMENT_GRAIN : 1;
+
+		if(m_layout.outStrides[slowest] != 0)
+		{
+			parallelFor(0, length, grain, [&](int64_t begin, int64_t end)
+			{
+				reduceRange(begin, end, result);
+			});
+			return;
+		}
+
+		int64_t partialBytes = m_layout.outCount * (int64_t) std::max(2 * sizeof(double), sizeof(T));
+		if(partialBytes > MAX_PARTIAL_BYTES)
+		{
+			reduceRange(0, length, result);
+			return;
+		}
+
+		std::mutex mutex;
+		parallelFor(0, length, grain, [&](int64_t begin, int64_t end)
+		{
+			Partial<T> partial;
+			init(partial);
+			reduceRange(begin, end, partial);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			merge(result, partial);
+		});
+	}
+
+private:
+	void reduceRange(int64_t begin, int64_t end, Partial<T> &partial) const
+	{
+		int slowest = (int) m_layout.lengths.size() - 1;
+		if(slowest == 0)
+		{
+			reduceRun(m_data + begin, begin * m_layout.outStrides[0], end - begin, partial);
+			return;
+		}
+
+		std::vector<int64_t> counters(slowest, 0);
+		for(int64_t outer = begin; outer < end; ++outer)
+		{
+			while(true)
+			{
+				int64_t in = outer * m_layout.inStrides[slowest];
+				int64_t out = outer * m_layout.outStrides[slowest];
+				for(int iii = 1; iii < slowest; ++iii)
+				{
+					in += counters[iii] * m_layout.inStrides[iii];
+					out += counters[iii] * m_layout.outStrides[iii];
+				}
+
+				reduceRun(m_data + in, out, m_layout.lengths[0], partial);
+
+				int dim = 1;
+				for(; dim < slowest; ++dim)
+				{
+					if(++counters[dim] < m_layout.lengths[dim])
+						break;
+					counters[dim] = 0;
+				}
+				if(dim == slowest)
+					break;
+			}
+		}
+	}
+
+	// A contiguous run along the fastest dim, either reduced into one 
+	//	output or added element by element to consecutive outputs
+	void reduceRun(const T *values, int64_t out, int64_t length, Partial<T> &partial) const
+	{
+		if(m_layout.outStrides[0] == 0)
+		{
+			switch(m_operation)
+			{
+			case Reduction::OperationMin:
+			{
+				T extreme = partial.extremes[out];
+				for(int64_t iii = 0; iii < length; ++iii)
+				{
+					if(values[iii] < extreme)
+						extreme = values[iii];
+				}
+				partial.extremes[out] = extreme;
+				break;
+			}
+			case Reduction::OperationMax:
+			{
+				T extreme = partial.extremes[out];
+				for(int64_t iii = 0; iii < length; ++iii)
+				{
+					if(values[iii] > extreme)
+						extreme = values[iii];
+				}
+				partial.extremes[out] = extreme;
+				break;
+			}
+			case Reduction::OperationVariance:
+				addCompensated(partial.sums[out], partial.compensations[out], 
+					simd::sumSquares(values, length, m_centers[out]));
+				break;
+			default:
+				addCompensated(partial.sums[out], partial.compensations[out], 
+					simd::sum(values, length));
+				break;
+			}
+			return;
+		}
+
+		double *sums = partial.sums.data() + out;
+		double *compensations = partial.compensations.data() + out;
+		switch(m_operation)
+		{
+		case Reduction::OperationMin:
+		{
+			T *extremes = partial.extremes.data() + out;
+			for(int64_t iii = 0; iii < length; ++iii)
+				extremes[iii] = std::min(extremes[iii], values[iii]);
+			break;
+		}
+		case Reduction::OperationMax:
+		{
+			T *extremes = partial.extremes.data() + out;
+			for(int64_t iii = 0; iii < length; ++iii)
+				extremes[iii] = std::max(extremes[iii], values[iii]);
+			break;
+		}
+		case Reduction::OperationVariance:
+		{
+			const double *centers = m_centers + out;
+			for(int64_t iii = 0; iii < length; ++iii)
+			{
+				double deviation = (double) values[iii] - centers[iii];
+				addCompensated(sums[iii], compensations[iii], deviation * deviation);
+			}
+			break;
+		}
+		default:
+			for(int64_t iii = 0; iii < length; ++iii)
+				addCompensated(sums[iii], compensations[iii], (double) values[iii]);
+			break;
+		}
+	}
+
+	const T *m_data;
+	const ReductionLayout &m_layout;
+	Reduction::Operation m_operation;
+	const double *m_centers;
+};
+
+template <typename T>
+static char *reduceData(const T *data, const ReductionLayout &layout, 
+	Reduction::Operation operation)
+{
+	Partial<T> partial;
+	int64_t count = layout.outCount;
+
+	if(operation == Reduction::OperationMin || operation == Reduction::OperationMax)
+	{
+		Reducer<T>(data, layout, operation, NULL).run(partial);
+		char *result = (char*) allocateBuffer(count * sizeof(T));
+		std::memcpy(result, partial.extremes.data(), count * sizeof(T));
+		return result;
+	}
+
+	// The variance is a second pass over the deviations from the mean,
+	//	which does not lose precision to cancellation like the sum of
+	//	squares does
+	Reduction::Operation firstPass = operation == Reduction::OperationSum 
+		? Reduction::OperationSum : Reduction::OperationMean;
+	Reducer<T>(data, layout, firstPass, NULL).run(partial);
+
+	double *result = (double*) allocateBuffer(count * sizeof(double));
+	double scale = operation == Reduction::OperationSum ? 1.0 : 1.0 / layout.reducedCount;
+	for(int64_t iii = 0; iii < count; ++iii)
+		result[iii] = (partial.sums[iii] - partial.compensations[iii]) * scale;
+
+	if(operation == Reduction::OperationVariance)
+	{
+		Reducer<T>(data, layout, operation, result).run(partial);
+		for(int64_t iii = 0; iii < count; ++iii)
+			result[iii] = (partial.sums[iii] - partial.compensations[iii]) * scale;
+	}
+
+	return (char*) result;
+}
+
+// Event counts of the sparse data, accumulated straight into the output
+static char *reduceSparse(const Dataset *data, const std::vector<bool> &reduced, 
+	Reduction::Operation operation, const ReductionLayout &layout)
+{
+	const DataSpace &space = data->dataSpace();
+	int rank = space.rank();
+
+	// Output strides of the original dims; sparse data is descending
+	std::vector<int64_t> outStrides(rank, 0);
+	int64_t outStride = 1;
+	for(int dim = rank - 1; dim >= 0; --dim)
+	{
+		if(!reduced[dim])
+		{
+			outStrides[dim] = outStride;
+			outStride *= space.dimLength(dim);
+		}
+	}
+
+	int columns = space.dimLength(rank - 1);
+	std::vector<int64_t> pixelOffsets(data->sparseFrameSize());
+	for(size_t iii = 0; iii < pixelOffsets.size(); ++iii)
+	{
+		pixelOffsets[iii] = (iii / columns) * outStrides[rank - 2]
+			+ (iii % columns) * outStrides[rank - 1];
+	}
+
+	bool scanKept = true;
+	for(int dim = 0; dim < rank - 2; ++dim)
+		scanKept = scanKept && !reduced[dim];
+
+	int64_t count = layout.outCount;
+	std::vector<double> result(count, 0);
+	std::mutex mutex;
+
+	auto accumulate = [&](int64_t begin, int64_t end, double *sums)
+	{
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			int64_t frameOffset = 0;
+			int64_t index = frame;
+			for(int dim = rank - 3; dim >= 0; --dim)
+			{
+				frameOffset += (index % space.dimLength(dim)) * outStrides[dim];
+				index /= space.dimLength(dim);
+			}
+
+			int64_t eventCount;
+			const uint32_t *events = data->sparseEvents(frame, eventCount);
+			for(int64_t iii = 0; iii < eventCount; ++iii)
+			{
+				if(events[iii] < pixelOffsets.size())
+					sums[frameOffset + pixelOffsets[events[iii]]] += 1;
+			}
+		}
+	};
+
+	if(scanKept)
+	{
+		parallelFor(0, data->sparseFrameCount(), ELEMENT_GRAIN / 64, 
+			[&](int64_t begin, int64_t end)
+		{
+			accumulate(begin, end, result.data());
+		});
+	}
+	else if(count * (int64_t) sizeof(double) > MAX_PARTIAL_BYTES)
+	{
+		accumulate(0, data->sparseFrameCount(), result.data());
+	}
+	else
+	{
+		parallelFor(0, data->sparseFrameCount(), ELEMENT_GRAIN / 64, 
+			[&](int64_t begin, int64_t end)
+		{
+			std::vector<double> partial(count, 0);
+			accumulate(begin, end, partial.data());
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for(int64_t iii = 0; iii < count; ++iii)
+				result[iii] += partial[iii];
+		});
+	}
+
+	double *output = (double*) allocateBuffer(count * sizeof(double));
+	double scale = operation == Reduction::OperationMean ? 1.0 / layout.reducedCount : 1.0;
+	for(int64_t iii = 0; iii < count; ++iii)
+		output[iii] = result[iii] * scale;
+
+	return (char*) output;
+}
+
+DataType Reduction::resultType(DataType type, Operation operation)
+{
+	// 16 bit floats are reduced as Float32
+	if((operation == OperationMin || operation == OperationMax) 
+		&& (type == DataTypeFloat16 || type == DataTypeBFloat16))
+		return DataTypeFloat32;
+	if(operation == OperationMin || operation == OperationMax)
+		return type;
+
+	return DataTypeFloat64;
+}
+
+Dataset *Reduction::reduce(const Dataset *data, Operation operation, 
+	const std::vector<int> &dims)
+{
+	if(!data || !data->isLoaded())
+	{
+		qWarning() << "Reduction requires loaded data";
+		return 0;
+	}
+
+	const DataSpace &space = data->dataSpace();
+	int rank = space.rank();
+	std::vector<bool> reduced(rank, false);
+	for(size_t iii = 0; iii < dims.size(); ++iii)
+	{
+		if(dims[iii] < 0 || dims[iii] >= rank)
+		{
+			qWarning() << "Invalid reduction dim" << dims[iii];
+			return 0;
+		}
+		reduced[dims[iii]] = true;
+	}
+
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		if(space.dimLength(iii) <= 0)
+			return 0;
+	}
+
+	ReductionLayout layout;
+	buildLayout(space, data->dataOrder(), reduced, layout);
+
+	char *result = 0;
+	DataType type = resultType(data->dataType(), operation);
+	if(data->isSparse())
+	{
+		if(operation != OperationSum && operation != OperationMean)
+		{
+			qWarning() << "Sparse data supports only sum and mean reductions";
+			return 0;
+		}
+		result = reduceSparse(data, reduced, operation, layout);
+	}
+	else
+	{
+		const char *values = data->rawData();
+		switch(data->dataType())
+		{
+		case DataTypeInt8:
+			result = reduceData((const int8_t*) values, layout, operation);
+			break;
+		case DataTypeInt16:
+			result = reduceData((const int16_t*) values, layout, operation);
+			break;
+		case DataTypeInt32:
+			result = reduceData((const int32_t*) values, layout, operation);
+			break;
+		case DataTypeInt64:
+			result = reduceData((const int64_t*) values, layout, operation);
+			break;
+		case DataTypeUInt8:
+			result = reduceData((const uint8_t*) values, layout, operation);
+			break;
+		case DataTypeUInt16:
+			result = reduceData((const uint16_t*) values, layout, operation);
+			break;
+		case DataTypeUInt32:
+			result = reduceData((const uint32_t*) values, layout, operation);
+			break;
+		case DataTypeUInt64:
+			result = reduceData((const uint64_t*) values, layout, operation);
+			break;
+		case DataTypeFloat32:
+			result = reduceData((const float*) values, layout, operation);
+			break;
+		case DataTypeFloat64:
+			result = reduceData((const double*) values, layout, operation);
+			break;
+		case DataTypeFloat16:
+		case DataTypeBFloat16:
+			{
+				// Expanded to Float32 first
+				int64_t count = 1;
+				for(int iii = 0; iii < rank; ++iii)
+					count *= space.dimLength(iii);
+				std::vector<float> staging(count);
+				convertValues(values, data->dataType(), staging.data(), 
+					DataTypeFloat32, count);
+				result = reduceData(staging.data(), layout, operation);
+			}
+			break;
+		default:
+			qWarning() << "Unsupported data type for reduction";
+			return 0;
+		}
+	}
+
+	std::vector<int> lengths;
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		if(!reduced[iii])
+			lengths.push_back(space.dimLength(iii));
+	}
+	if(lengths.empty())
+		lengths.push_back(1);
+
+	Dataset *dataset = new Dataset((int) lengths.size(), lengths.data(), type, 
+		result, AllocatedBuffer, data->dataOrder());
+	dataset->setName("data");
+
+	return dataset;
+}
+
+static void copyAttribute(const Node *source, Dataset *dim, const QString &name)
+{
+	Node *value = source->child(name);
+	if(!value)
+		return;
+
+	Attribute *attribute = new Attribute(dim);
+	attribute->setName(name);
+	attribute->setValue(value->variantRepresentation());
+	attribute->setType(DataTypeString);
+	dim->addChild(attribute);
+}
+
+// Copies the values of a dim vector; string dims and dims that are not 
+//	loaded become default index dims
+static Dataset *copyDim(const Dataset *dim, const QString &name)
+{
+	int length = dim->dataSpace().dimLength(0);
+	int depth = emdTypeDepth(dim->dataType());
+
+	Dataset *copy;
+	if(dim->isLoaded() && dim->dimCount() == 1 && depth > 0)
+	{
+		char *values = (char*) allocateBuffer(length * depth);
+		std::memcpy(values, dim->rawData(), length * depth);
+		copy = new Dataset(1, &length, dim->dataType(), values, AllocatedBuffer);
+		if(dim->dimLength(0) != length)
+			copy->setTrueLength(dim->dimLength(0));
+	}
+	else
+	{
+		copy = new Dataset(dim->dimLength(0), DataTypeInt32, true);
+	}
+
+	copy->setName(name);
+	copyAttribute(dim, copy, "units");
+	copyAttribute(dim, copy, "name");
+
+	return copy;
+}
+
+static const char *operationName(Reduction::Operation operation)
+{
+	switch(operation)
+	{
+	case Reduction::OperationSum:
+		return "sum";
+	case Reduction::OperationMean:
+		return "mean";
+	case Reduction::OperationMin:
+		return "min";
+	case Reduction::OperationMax:
+		return "max";
+	case Reduction::OperationVariance:
+		return "variance";
+	}
+
+	return "";
+}
+
+DataGroup *Reduction::reduce(const DataGroup *dataGroup, Operation operation, 
+	const std::vector<int> &dims)
+{
+	if(!dataGroup)
+		return 0;
+
+	Dataset *data = reduce(dataGroup->data(), operation, dims);
+	if(!data)
+		return 0;
+
+	DataGroup *result = new DataGroup();
+	result->setName(dataGroup->name() + "_" + operationName(operation));
+	result->setData(data);
+	data->setParentNode(result);
+
+	Attribute *groupType = new Attribute(result);
+	groupType->setName("emd_group_type");
+	groupType->setValue(QVariant(1));
+	groupType->setType(DataTypeInt32);
+	result->addChild(groupType);
+
+	if(!data->dataOrder())
+	{
+		Attribute *dataOrder = new Attribute(result);
+		dataOrder->setName("data_order");
+		dataOrder->setValue(QVariant(0));
+		dataOrder->setType(DataTypeInt32);
+		result->addChild(dataOrder);
+	}
+
+	QString nameStem = "dim%1";
+	int keptDims = 0;
+	int dimCount = dataGroup->data()->dimCount();
+	for(int iii = 0; iii < dimCount; ++iii)
+	{
+		if(std::find(dims.begin(), dims.end(), iii) != dims.end())
+			continue;
+
+		Dataset *dim = dataGroup->dimData(iii);
+		if(!dim)
+			continue;
+
+		Dataset *copy = copyDim(dim, nameStem.arg(++keptDims));
+		result->addDim(copy);
+		copy->setParentNode(result);
+	}
+
+	// Everything was reduced to one value
+	if(keptDims == 0)
+	{
+		Dataset *dim = new Dataset(1, DataTypeInt32, true);
+		dim->setName(nameStem.arg(1));
+		result->addDim(dim);
+		dim->setParentNode(result);
+	}
+
+	result->setStatus(Node::DIRTY, true);
+
+	return result;
+}
+
+} // namespace emd
@@ -0,0 +1,583 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "Simd.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define EMD_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(EMD_SIMD_SSE2) && defined(__GNUC__)
+#define EMD_SIMD_AVX
+#include <immintrin.h>
+#endif
+
+namespace emd
+{
+
+namespace simd
+{
+
+static float dotScalar(const float *a, const float *b, int64_t length)
+{
+	// Four partial sums keep the additions independent.
+	float sums[4] = {0, 0, 0, 0};
+	int64_t iii = 0;
+	for(; iii + 4 <= length; iii += 4)
+	{
+		sums[0] += a[iii] * b[iii];
+		sums[1] += a[iii + 1] * b[iii + 1];
+		sums[2] += a[iii + 2] * b[iii + 2];
+		sums[3] += a[iii + 3] * b[iii + 3];
+	}
+	for(; iii < length; ++iii)
+		sums[0] += a[iii] * b[iii];
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+#ifdef EMD_SIMD_SSE2
+static float dotSse2(const float *a, const float *b, int64_t length)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	int64_t iii = 0;
+	for(; iii + 8 <= length; iii += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + iii), _mm_loadu_ps(b + iii)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + iii + 4), _mm_loadu_ps(b + iii + 4)));
+	}
+
+	float partial[4];
+	_mm_storeu_ps(partial, _mm_add_ps(sum0, sum1));
+
+	return (partial[0] + partial[1]) + (partial[2] + partial[3]) 
+		+ dotScalar(a + iii, b + iii, length - iii);
+}
+#endif
+
+#ifdef EMD_SIMD_AVX
+__attribute__((target("avx")))
+static float dotAvx(const float *a, const float *b, int64_t length)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	int64_t iii = 0;
+	for(; iii + 16 <= length; iii += 16)
+	{
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + iii), _mm256_loadu_ps(b + iii)));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + iii + 8), _mm256_loadu_ps(b + iii + 8)));
+	}
+
+	float partial[8];
+	_mm256_storeu_ps(partial, _mm256_add_ps(sum0, sum1));
+
+	float sum = 0;
+	for(int jjj = 0; jjj < 8; ++jjj)
+		sum += partial[jjj];
+
+	return sum + dotScalar(a + iii, b + iii, length - iii);
+}
+
+static bool hasAvx()
+{
+	static const bool s_hasAvx = __builtin_cpu_supports("avx");
+	return s_hasAvx;
+}
+#endif
+
+float dot(const float *a, const float *b, int64_t length)
+{
+#ifdef EMD_SIMD_AVX
+	if(hasAvx())
+		return dotAvx(a, b, length);
+#endif
+#ifdef EMD_SIMD_SSE2
+	return dotSse2(a, b, length);
+#else
+	return dotScalar(a, b, length);
+#endif
+}
+
+double dot(const double *a, const float *b, int64_t length)
+{
+	double sums[4] = {0, 0, 0, 0};
+	int64_t iii = 0;
+	for(; iii + 4 <= length; iii += 4)
+	{
+		sums[0] += a[iii] * b[iii];
+		sums[1] += a[iii + 1] * b[iii + 1];
+		sums[2] += a[iii + 2] * b[iii + 2];
+		sums[3] += a[iii + 3] * b[iii + 3];
+	}
+	for(; iii < length; ++iii)
+		sums[0] += a[iii] * b[iii];
+
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+static void momentsScalar(const float *values, const float *weights, 
+	const float *coordinates, int64_t length, float threshold, 
+	float &sum, float &moment)
+{
+	for(int64_t iii = 0; iii < length; ++iii)
+	{
+		float value = (values[iii] >= threshold ? values[iii] * weights[iii] : 0.0f);
+		sum += value;
+		moment += value * coordinates[iii];
+	}
+}
+
+void moments(const float *values, const float *weights, 
+	const float *coordinates, int64_t length, float threshold, 
+	float &sum, float &moment)
+{
+	sum = 0;
+	moment = 0;
+	int64_t iii = 0;
+
+#ifdef EMD_SIMD_SSE2
+	__m128 limit = _mm_set1_ps(threshold);
+	__m128 sums = _mm_setzero_ps();
+	__m128 moments = _mm_setzero_ps();
+	for(; iii + 4 <= length; iii += 4)
+	{
+		// Values below the threshold are masked to zero
+		__m128 value = _mm_loadu_ps(values + iii);
+		value = _mm_and_ps(_mm_cmpge_ps(value, limit), value);
+		value = _mm_mul_ps(value, _mm_loadu_ps(weights + iii));
+		sums = _mm_add_ps(sums, value);
+		moments = _mm_add_ps(moments, _mm_mul_ps(value, _mm_loadu_ps(coordinates + iii)));
+	}
+
+	float partial[4];
+	_mm_storeu_ps(partial, sums);
+	sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+	_mm_storeu_ps(partial, moments);
+	moment = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+
+	float tailSum = 0, tailMoment = 0;
+	momentsScalar(values + iii, weights + iii, coordinates + iii, length - iii, 
+		threshold, tailSum, tailMoment);
+	sum += tailSum;
+	moment += tailMoment;
+}
+
+void interleave(const float *real, const float *imaginary, 
+	float *complex, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 4 <= length; iii += 4)
+	{
+		__m128 re = _mm_loadu_ps(real + iii);
+		__m128 im = _mm_loadu_ps(imaginary + iii);
+		_mm_storeu_ps(complex + 2 * iii, _mm_unpacklo_ps(re, im));
+		_mm_storeu_ps(complex + 2 * iii + 4, _mm_unpackhi_ps(re, im));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		complex[2 * iii] = real[iii];
+		complex[2 * iii + 1] = imaginary[iii];
+	}
+}
+
+void interleave(const double *real, const double *imaginary, 
+	double *complex, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 2 <= length; iii += 2)
+	{
+		__m128d re = _mm_loadu_pd(real + iii);
+		__m128d im = _mm_loadu_pd(imaginary + iii);
+		_mm_storeu_pd(complex + 2 * iii, _mm_unpacklo_pd(re, im));
+		_mm_storeu_pd(complex + 2 * iii + 2, _mm_unpackhi_pd(re, im));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		complex[2 * iii] = real[iii];
+		complex[2 * iii + 1] = imaginary[iii];
+	}
+}
+
+void deinterleave(const float *complex, float *real, 
+	float *imaginary, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 4 <= length; iii += 4)
+	{
+		__m128 low = _mm_loadu_ps(complex + 2 * iii);
+		__m128 high = _mm_loadu_ps(complex + 2 * iii + 4);
+		_mm_storeu_ps(real + iii, _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(imaginary + iii, _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		real[iii] = complex[2 * iii];
+		imaginary[iii] = complex[2 * iii + 1];
+	}
+}
+
+void deinterleave(const double *complex, double *real, 
+	double *imaginary, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 2 <= length; iii += 2)
+	{
+		__m128d low = _mm_loadu_pd(complex + 2 * iii);
+		__m128d high = _mm_loadu_pd(complex + 2 * iii + 2);
+		_mm_storeu_pd(real + iii, _mm_unpacklo_pd(low, high));
+		_mm_storeu_pd(imaginary + iii, _mm_unpackhi_pd(low, high));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		real[iii] = complex[2 * iii];
+		imaginary[iii] = complex[2 * iii + 1];
+	}
+}
+
+void magnitude(const float *complex, float *magnitude, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 4 <= length; iii += 4)
+	{
+		__m128 low = _mm_loadu_ps(complex + 2 * iii);
+		__m128 high = _mm_loadu_ps(complex + 2 * iii + 4);
+		low = _mm_mul_ps(low, low);
+		high = _mm_mul_ps(high, high);
+		__m128 sum = _mm_add_ps(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)),
+			_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm_storeu_ps(magnitude + iii, _mm_sqrt_ps(sum));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		float re = complex[2 * iii];
+		float im = complex[2 * iii + 1];
+		magnitude[iii] = std::sqrt(re * re + im * im);
+	}
+}
+
+void magnitude(const double *complex, double *magnitude, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 2 <= length; iii += 2)
+	{
+		__m128d low = _mm_loadu_pd(complex + 2 * iii);
+		__m128d high = _mm_loadu_pd(complex + 2 * iii + 2);
+		low = _mm_mul_pd(low, low);
+		high = _mm_mul_pd(high, high);
+		__m128d sum = _mm_add_pd(_mm_unpacklo_pd(low, high), _mm_unpackhi_pd(low, high));
+		_mm_storeu_pd(magnitude + iii, _mm_sqrt_pd(sum));
+	}
+#endif
+	for(; iii < length; ++iii)
+	{
+		double re = complex[2 * iii];
+		double im = complex[2 * iii + 1];
+		magnitude[iii] = std::sqrt(re * re + im * im);
+	}
+}
+
+float halfToFloat(uint16_t half)
+{
+	uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+
+	// Subnormals are mantissa * 2^-24
+	if(exponent == 0)
+	{
+		float value = mantissa * (1.0f / 16777216.0f);
+		return sign ? -value : value;
+	}
+
+	uint32_t bits;
+	if(exponent == 31)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	// Infinity and NaN (kept quiet)
+	if(magnitude >= 0x7f800000)
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+
+	// Rounds to infinity (65520 and above)
+	if(magnitude >= 0x477ff000)
+		return sign | 0x7c00;
+
+	// Subnormal or zero; the float rounding mode rounds to nearest even
+	if(magnitude < 0x38800000)
+		return sign | (uint16_t) std::nearbyint(std::fabs(value) * 16777216.0f);
+
+	magnitude += 0xfff + ((magnitude >> 13) & 1);
+	magnitude -= (uint32_t) (127 - 15) << 23;
+	return sign | (uint16_t) (magnitude >> 13);
+}
+
+#ifdef EMD_SIMD_AVX
+__attribute__((target("avx,f16c")))
+static int64_t halfToFloatF16c(const uint16_t *half, float *values, int64_t length)
+{
+	int64_t iii = 0;
+	for(; iii + 8 <= length; iii += 8)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*) (half + iii));
+		_mm256_storeu_ps(values + iii, _mm256_cvtph_ps(packed));
+	}
+	return iii;
+}
+
+__attribute__((target("avx,f16c")))
+static int64_t floatToHalfF16c(const float *values, uint16_t *half, int64_t length)
+{
+	int64_t iii = 0;
+	for(; iii + 8 <= length; iii += 8)
+	{
+		__m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(values + iii), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*) (half + iii), packed);
+	}
+	return iii;
+}
+
+static bool hasF16c()
+{
+	static const bool s_hasF16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+	return s_hasF16c;
+}
+#endif
+
+void halfToFloat(const uint16_t *half, float *values, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_AVX
+	if(hasF16c())
+		iii = halfToFloatF16c(half, values, length);
+#endif
+	for(; iii < length; ++iii)
+		values[iii] = halfToFloat(half[iii]);
+}
+
+void floatToHalf(const float *values, uint16_t *half, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_AVX
+	if(hasF16c())
+		iii = floatToHalfF16c(values, half, length);
+#endif
+	for(; iii < length; ++iii)
+		half[iii] = floatToHalf(values[iii]);
+}
+
+float bfloat16ToFloat(uint16_t bfloat16)
+{
+	uint32_t bits = (uint32_t) bfloat16 << 16;
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint16_t floatToBfloat16(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	if((bits & 0x7fffffff) > 0x7f800000)
+		return (uint16_t) ((bits >> 16) | 0x40);
+
+	bits += 0x7fff + ((bits >> 16) & 1);
+	return (uint16_t) (bits >> 16);
+}
+
+void bfloat16ToFloat(const uint16_t *bfloat16, float *values, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for(; iii + 8 <= length; iii += 8)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*) (bfloat16 + iii));
+		_mm_storeu_si128((__m128i*) (values + iii), _mm_unpacklo_epi16(zero, packed));
+		_mm_storeu_si128((__m128i*) (values + iii + 4), _mm_unpackhi_epi16(zero, packed));
+	}
+#endif
+	for(; iii < length; ++iii)
+		values[iii] = bfloat16ToFloat(bfloat16[iii]);
+}
+
+#ifdef EMD_SIMD_SSE2
+// Four floats rounded to bfloat16, in the low 16 bits of each lane
+//	(sign extended, so that they can be packed with signed saturation)
+static inline __m128i roundBfloat16(__m128 values)
+{
+	__m128i bits = _mm_castps_si128(values);
+	__m128i odd = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(1));
+	__m128i rounded = _mm_add_epi32(bits, _mm_add_epi32(odd, _mm_set1_epi32(0x7fff)));
+	__m128i quiet = _mm_or_si128(bits, _mm_set1_epi32(0x400000));
+
+	__m128i nan = _mm_castps_si128(_mm_cmpunord_ps(values, values));
+	rounded = _mm_or_si128(_mm_and_si128(nan, quiet), _mm_andnot_si128(nan, rounded));
+
+	return _mm_srai_epi32(rounded, 16);
+}
+#endif
+
+void floatToBfloat16(const float *values, uint16_t *bfloat16, int64_t length)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	for(; iii + 8 <= length; iii += 8)
+	{
+		__m128i low = roundBfloat16(_mm_loadu_ps(values + iii));
+		__m128i high = roundBfloat16(_mm_loadu_ps(values + iii + 4));
+		_mm_storeu_si128((__m128i*) (bfloat16 + iii), _mm_packs_epi32(low, high));
+	}
+#endif
+	for(; iii < length; ++iii)
+		bfloat16[iii] = floatToBfloat16(values[iii]);
+}
+
+#ifdef EMD_SIMD_SSE2
+static inline void storeScaled(float *result, __m128i values, __m128 factor, __m128 shift)
+{
+	_mm_storeu_ps(result, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(values), factor), shift));
+}
+#endif
+
+void scale(const uint8_t *values, float *result, int64_t length, 
+	float scale, float offset)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128 factor = _mm_set1_ps(scale);
+	__m128 shift = _mm_set1_ps(offset);
+	__m128i zero = _mm_setzero_si128();
+	for(; iii + 16 <= length; iii += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*) (values + iii));
+		__m128i low = _mm_unpacklo_epi8(bytes, zero);
+		__m128i high = _mm_unpackhi_epi8(bytes, zero);
+		storeScaled(result + iii, _mm_unpacklo_epi16(low, zero), factor, shift);
+		storeScaled(result + iii + 4, _mm_unpackhi_epi16(low, zero), factor, shift);
+		storeScaled(result + iii + 8, _mm_unpacklo_epi16(high, zero), factor, shift);
+		storeScaled(result + iii + 12, _mm_unpackhi_epi16(high, zero), factor, shift);
+	}
+#endif
+	for(; iii < length; ++iii)
+		result[iii] = values[iii] * scale + offset;
+}
+
+void scale(const uint16_t *values, float *result, int64_t length, 
+	float scale, float offset)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128 factor = _mm_set1_ps(scale);
+	__m128 shift = _mm_set1_ps(offset);
+	__m128i zero = _mm_setzero_si128();
+	for(; iii + 8 <= length; iii += 8)
+	{
+		__m128i words = _mm_loadu_si128((const __m128i*) (values + iii));
+		storeScaled(result + iii, _mm_unpacklo_epi16(words, zero), factor, shift);
+		storeScaled(result + iii + 4, _mm_unpackhi_epi16(words, zero), factor, shift);
+	}
+#endif
+	for(; iii < length; ++iii)
+		result[iii] = values[iii] * scale + offset;
+}
+
+void scale(const int16_t *values, float *result, int64_t length, 
+	float scale, float offset)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128 factor = _mm_set1_ps(scale);
+	__m128 shift = _mm_set1_ps(offset);
+	for(; iii + 8 <= length; iii += 8)
+	{
+		// Sign extended by unpacking into the high half and shifting back
+		__m128i words = _mm_loadu_si128((const __m128i*) (values + iii));
+		storeScaled(result + iii, _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16), factor, shift);
+		storeScaled(result + iii + 4, _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16), factor, shift);
+	}
+#endif
+	for(; iii < length; ++iii)
+		result[iii] = values[iii] * scale + offset;
+}
+
+void scale(const int32_t *values, float *result, int64_t length, 
+	float scale, float offset)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128 factor = _mm_set1_ps(scale);
+	__m128 shift = _mm_set1_ps(offset);
+	for(; iii + 4 <= length; iii += 4)
+		storeScaled(result + iii, _mm_loadu_si128((const __m128i*) (values + iii)), factor, shift);
+#endif
+	for(; iii < length; ++iii)
+		result[iii] = values[iii] * scale + offset;
+}
+
+void scale(const float *values, float *result, int64_t length, 
+	float scale, float offset)
+{
+	int64_t iii = 0;
+#ifdef EMD_SIMD_SSE2
+	__m128 factor = _mm_set1_ps(scale);
+	__m128 shift = _mm_set1_ps(offset);
+	for(; iii + 4 <= length; iii += 4)
+	{
+		__m128 value = _mm_loadu_ps(values + iii);
+		_mm_storeu_ps(result + iii, _mm_add_ps(_mm_mul_ps(value, factor), shift));
+	}
+#endif
+	for(; iii < length; ++iii)
+		result[iii] = values[iii] * scale + offset;
+}
+
+} // namespace simd
+
+} // namespace emd
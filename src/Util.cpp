@@ -28,6 +28,11 @@
 namespace emd
 {
 
+#ifdef EMDLIB_FILTER_PLUGIN_PATH
+// Filter plugins installed alongside the library are always searched.
+static const bool s_pluginPathAdded = (H5PLappend(EMDLIB_FILTER_PLUGIN_PATH) >= 0);
+#endif
+
 DataType hdfToEmdType(const H5::DataType &h5Type)
 {
 	DataType emdType = DataTypeUnknown;
@@ -38,6 +43,18 @@ DataType hdfToEmdType(const H5::DataType &h5Type)
 	{
 		switch(depth)
 		{
+		case 2:
+			{
+				// Told apart by the mantissa size
+				size_t signPosition, exponentPosition, exponentSize, mantissaPosition, mantissaSize;
+				H5Tget_fields(h5Type.getId(), &signPosition, &exponentPosition, 
+					&exponentSize, &mantissaPosition, &mantissaSize);
+				if(exponentSize == 5 && mantissaSize == 10)
+					emdType = DataTypeFloat16;
+				else if(exponentSize == 8 && mantissaSize == 7)
+					emdType = DataTypeBFloat16;
+			}
+			break;
 		case 4:
 			emdType = DataTypeFloat32;
 			break;
@@ -88,6 +105,32 @@ DataType hdfToEmdType(const H5::DataType &h5Type)
 	}
 	else if(H5T_STRING == dataClass)
 		emdType = DataTypeString;
+	else if(H5T_COMPOUND == dataClass)
+	{
+		// Complex numbers: two floating point members of the same size
+		hid_t id = h5Type.getId();
+		if(H5Tget_nmembers(id) == 2)
+		{
+			hid_t real = H5Tget_member_type(id, 0);
+			hid_t imaginary = H5Tget_member_type(id, 1);
+			if(H5Tget_class(real) == H5T_FLOAT && H5Tget_class(imaginary) == H5T_FLOAT
+				&& H5Tget_size(real) == H5Tget_size(imaginary)
+				&& H5Tget_member_offset(id, 1) == H5Tget_size(real))
+			{
+				switch(depth)
+				{
+				case 8:
+					emdType = DataTypeComplex64;
+					break;
+				case 16:
+					emdType = DataTypeComplex128;
+					break;
+				}
+			}
+			H5Tclose(real);
+			H5Tclose(imaginary);
+		}
+	}
 
 	return emdType;
 }
@@ -109,6 +152,10 @@ DataType dataTypeFromHdfDataSet(const H5::DataSet &dataSet)
 	{
 		type = dataSet.getStrType();
 	}
+	else if(H5T_COMPOUND == dataClass)
+	{
+		type = dataSet.getCompType();
+	}
 
     return hdfToEmdType(type);
 }
@@ -148,6 +195,43 @@ H5::DataType emdToHdfType(const DataType &emdType)
 	case DataTypeFloat64:
 		hdfType = H5::PredType::NATIVE_DOUBLE;
 		break;
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
+		{
+			// There is no predefined 16 bit float type; both are derived
+			//	from the 32 bit type
+			H5::FloatType floatType(H5::PredType::IEEE_F32LE);
+			if(emdType == DataTypeFloat16)
+			{
+				floatType.setFields(15, 10, 5, 0, 10);
+				floatType.setOffset(0);
+				floatType.setPrecision(16);
+				floatType.setSize(2);
+				floatType.setEbias(15);
+			}
+			else
+			{
+				floatType.setFields(15, 7, 8, 0, 7);
+				floatType.setOffset(0);
+				floatType.setPrecision(16);
+				floatType.setSize(2);
+				floatType.setEbias(127);
+			}
+			hdfType = floatType;
+		}
+		break;
+	case DataTypeComplex64:
+	case DataTypeComplex128:
+		{
+			// Same layout as numpy / h5py complex numbers
+			H5::PredType part = (emdType == DataTypeComplex64 
+				? H5::PredType::NATIVE_FLOAT : H5::PredType::NATIVE_DOUBLE);
+			H5::CompType complexType(2 * part.getSize());
+			complexType.insertMember("r", 0, part);
+			complexType.insertMember("i", part.getSize(), part);
+			hdfType = complexType;
+		}
+		break;
 	case DataTypeString:
 		hdfType = H5::PredType::C_S1;
 		break;
@@ -168,6 +252,8 @@ int emdTypeDepth(const DataType &type)
 		break;
 	case DataTypeInt16:
 	case DataTypeUInt16:
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
 		depth = 2;
 		break;
 	case DataTypeInt32:
@@ -178,8 +264,12 @@ int emdTypeDepth(const DataType &type)
 	case DataTypeInt64:
 	case DataTypeUInt64:
 	case DataTypeFloat64:
+	case DataTypeComplex64:
 		depth = 8;
 		break;
+	case DataTypeComplex128:
+		depth = 16;
+		break;
 	case DataTypeString:
 		depth = 0;
 	default:
@@ -223,6 +313,18 @@ QString emdTypeString(const DataType &type)
 	case DataTypeFloat64:
 		string = "double";
 		break;
+	case DataTypeFloat16:
+		string = "float16";
+		break;
+	case DataTypeBFloat16:
+		string = "bfloat16";
+		break;
+	case DataTypeComplex64:
+		string = "complex64";
+		break;
+	case DataTypeComplex128:
+		string = "complex128";
+		break;
 	case DataTypeString:
 		string = "string";
 		break;
@@ -248,6 +350,8 @@ bool isFloatType(DataType type)
 	case DataTypeInt64:
 	case DataTypeUInt64:
 		return false;
+	case DataTypeFloat16:
+	case DataTypeBFloat16:
 	case DataTypeFloat32:
 	case DataTypeFloat64:
 		return true;
@@ -260,6 +364,17 @@ bool isFloatType(DataType type)
 	return false;
 }
 
+bool isComplexType(DataType type)
+{
+	return (type == DataTypeComplex64 || type == DataTypeComplex128);
+}
+
+bool addFilterPluginPath(const QString &path)
+{
+	QByteArray ba = path.toLocal8Bit();
+	return (H5PLappend(ba.constData()) >= 0);
+}
+
 QVariant emdTypeFromString(const QString &string, const DataType &type)
 {
 	bool ok;
@@ -0,0 +1,263 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "VirtualDetector.h"
+
+#include <cmath>
+#include <cstring>
+
+#include <H5Cpp.h>
+
+#include <QDebug>
+
+#include "Allocator.h"
+#include "Convert.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameStream.h"
+#include "Parallel.h"
+#include "Simd.h"
+
+namespace emd
+{
+
+// Frames handed to one thread at a time
+static const int64_t FRAME_GRAIN = 16;
+
+VirtualDetector::VirtualDetector(DataGroup *dataGroup)
+	: m_dataGroup(dataGroup),
+	m_frameRows(0),
+	m_frameColumns(0)
+{
+	const Dataset *data = m_dataGroup->data();
+	if(!data)
+		return;
+
+	data->frameShape(m_frameRows, m_frameColumns);
+	m_scanDims = data->scanDims();
+
+	// A single frame gives a single pixel
+	if(m_scanDims.empty())
+		m_scanDims.push_back(1);
+}
+
+int VirtualDetector::addMask(const std::vector<float> &mask)
+{
+	if((int64_t) mask.size() != (int64_t) m_frameRows * m_frameColumns)
+		return -1;
+
+	m_masks.push_back(mask);
+	return (int) m_masks.size() - 1;
+}
+
+int VirtualDetector::addAnnularMask(double centerRow, double centerColumn,
+	double innerRadius, double outerRadius)
+{
+	std::vector<float> mask((size_t) m_frameRows * m_frameColumns, 0.0f);
+	double inner2 = innerRadius * innerRadius;
+	double outer2 = outerRadius * outerRadius;
+	for(int row = 0; row < m_frameRows; ++row)
+	{
+		double dRow = row - centerRow;
+		for(int column = 0; column < m_frameColumns; ++column)
+		{
+			double dColumn = column - centerColumn;
+			double r2 = dRow * dRow + dColumn * dColumn;
+			if(r2 >= inner2 && r2 <= outer2)
+				mask[(size_t) row * m_frameColumns + column] = 1.0f;
+		}
+	}
+
+	return addMask(mask);
+}
+
+void VirtualDetector::clearMasks()
+{
+	m_masks.clear();
+	m_images.clear();
+}
+
+template <typename T>
+static void integrateFrames(const T *frames, int64_t firstFrame, int64_t frameCount,
+	int64_t frameSize, const std::vector<std::vector<float> > &masks, 
+	std::vector<std::vector<float> > &images)
+{
+	parallelFor(0, frameCount, FRAME_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		// Each frame is converted once and then stays in cache while it
+		//	is multiplied with all of the masks.
+		std::vector<float> scratch(frameSize);
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			simd::convert(frames + frame * frameSize, scratch.data(), frameSize);
+			for(size_t mask = 0; mask < masks.size(); ++mask)
+			{
+				images[mask][firstFrame + frame] = 
+					simd::dot(scratch.data(), masks[mask].data(), frameSize);
+			}
+		}
+	});
+}
+
+template <>
+void integrateFrames<float>(const float *frames, int64_t firstFrame, int64_t frameCount,
+	int64_t frameSize, const std::vector<std::vector<float> > &masks, 
+	std::vector<std::vector<float> > &images)
+{
+	parallelFor(0, frameCount, FRAME_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			for(size_t mask = 0; mask < masks.size(); ++mask)
+			{
+				images[mask][firstFrame + frame] = 
+					simd::dot(frames + frame * frameSize, masks[mask].data(), frameSize);
+			}
+		}
+	});
+}
+
+template <>
+void integrateFrames<double>(const double *frames, int64_t firstFrame, int64_t frameCount,
+	int64_t frameSize, const std::vector<std::vector<float> > &masks, 
+	std::vector<std::vector<float> > &images)
+{
+	parallelFor(0, frameCount, FRAME_GRAIN, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			for(size_t mask = 0; mask < masks.size(); ++mask)
+			{
+				images[mask][firstFrame + frame] = (float)
+					simd::dot(frames + frame * frameSize, masks[mask].data(), frameSize);
+			}
+		}
+	});
+}
+
+// Integrates the blocks of a FrameStream
+struct MaskIntegration
+{
+	int64_t frameSize;
+	const std::vector<std::vector<float> > *masks;
+	std::vector<std::vector<float> > *images;
+
+	template <typename T>
+	void operator()(const T *frames, int64_t firstFrame, int64_t frameCount)
+	{
+		integrateFrames(frames, firstFrame, frameCount, frameSize, *masks, *images);
+	}
+};
+
+bool VirtualDetector::run(H5::H5File *file)
+{
+	const Dataset *data = m_dataGroup->data();
+	if(!data || m_masks.empty())
+		return false;
+
+	if(data->isSparse())
+		return runSparse(file);
+
+	FrameStream stream(data);
+	if(!stream.isValid())
+		return false;
+
+	if(!isNumericType(stream.dataType()))
+	{
+		qWarning() << "Unsupported data type for virtual detector";
+		return false;
+	}
+
+	if(!data->isLoaded())
+	{
+		if(!file || !stream.open(file))
+			return false;
+	}
+
+	m_images.assign(m_masks.size(), std::vector<float>(stream.frameCount(), 0.0f));
+
+	MaskIntegration integration = {stream.frameSize(), &m_masks, &m_images};
+	if(!stream.forEachBlock(integration))
+	{
+		m_images.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool VirtualDetector::runSparse(H5::H5File *file)
+{
+	// Event lists are small enough to be loaded for the duration of the
+	//	integration.
+	bool wasLoaded = m_dataGroup->isLoaded();
+	if(!wasLoaded && (!file || !m_dataGroup->load(file)))
+		return false;
+
+	const Dataset *data = m_dataGroup->data();
+	int64_t frameCount = data->sparseFrameCount();
+	m_images.assign(m_masks.size(), std::vector<float>(frameCount, 0.0f));
+
+	// Summing the mask weights at the event positions is the dot
+	//	product with the densified frame.
+	parallelFor(0, frameCount, FRAME_GRAIN * 16, [&](int64_t begin, int64_t end)
+	{
+		for(int64_t frame = begin; frame < end; ++frame)
+		{
+			int64_t count;
+			const uint32_t *events = data->sparseEvents(frame, count);
+			for(size_t mask = 0; mask < m_masks.size(); ++mask)
+			{
+				const float *weights = m_masks[mask].data();
+				int64_t size = (int64_t) m_masks[mask].size();
+				float sum = 0;
+				for(int64_t iii = 0; iii < count; ++iii)
+				{
+					if(events[iii] < size)
+						sum += weights[events[iii]];
+				}
+				m_images[mask][frame] = sum;
+			}
+		}
+	});
+
+	if(!wasLoaded)
+		m_dataGroup->unload();
+
+	return true;
+}
+
+Dataset *VirtualDetector::createImage(int maskIndex) const
+{
+	if(maskIndex < 0 || maskIndex >= (int) m_images.size())
+		return 0;
+
+	const std::vector<float> &image = m_images[maskIndex];
+	char *data = (char*) allocateBuffer(image.size() * sizeof(float));
+	memcpy(data, image.data(), image.size() * sizeof(float));
+
+	Dataset *dataset = new Dataset((int) m_scanDims.size(), m_scanDims.data(), 
+		DataTypeFloat32, data, AllocatedBuffer, m_dataGroup->dataOrder());
+	dataset->setName("data");
+
+	return dataset;
+}
+
+} // namespace emd
@@ -0,0 +1,153 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Datasets adopting external buffers: the deleter runs once, after the
+//	last copy, frame and unload; a view never frees the caller's buffer,
+//	and a copy of it that is changed gets its own data; both save 
+//	straight from the caller's memory.
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Dataset.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int DIMS[2] = {8, 16};
+const int SIZE = 8 * 16;
+
+static Frame *frameOf(const Dataset &data)
+{
+	Dataset::Slice slice(2, 0);
+	slice[0] = Dataset::VerticalDimension;
+	slice[1] = Dataset::HorizontalDimension;
+	return data.frame(slice);
+}
+
+static uint16_t *makeValues(uint16_t first)
+{
+	uint16_t *values = new uint16_t[SIZE];
+	for(int iii = 0; iii < SIZE; ++iii)
+		values[iii] = (uint16_t) (first + iii);
+	return values;
+}
+
+static bool saved(Dataset &data, const std::string &path, 
+	const uint16_t *expected)
+{
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		data.save(QString(""), &file);
+	}
+
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+	Dataset loaded;
+	loaded.loadData(file.openDataSet("data"));
+	return loaded.isLoaded() && loaded.dataType() == DataTypeUInt16 
+		&& loaded.dimLength(0) == DIMS[0] && loaded.dimLength(1) == DIMS[1] 
+		&& memcmp(loaded.rawData(), expected, SIZE * sizeof(uint16_t)) == 0;
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_adoptbuffer.emd");
+
+	// Adopted: shared by copies and frames, freed once by the last
+	int deletes = 0;
+	uint16_t *values = makeValues(1);
+	Dataset::BufferDeleter deleter = [&deletes](char *data) 
+	{
+		++deletes;
+		delete[] (uint16_t*) data;
+	};
+	{
+		Dataset *adopted = new Dataset(2, DIMS, DataTypeUInt16, (char*) values, deleter);
+		adopted->setName("data");
+		CHECK(adopted->rawData() == (const char*) values);
+		CHECK(saved(*adopted, path, values));
+
+		Dataset *copy = new Dataset(*adopted);
+		Dataset moved(std::move(*copy));
+		delete copy;
+		std::unique_ptr<Frame> frame(frameOf(moved));
+		CHECK(moved.rawData() == (const char*) values);
+
+		adopted->unloadData();
+		delete adopted;
+		CHECK(deletes == 0);
+		moved.unloadData();
+		CHECK(deletes == 0);
+		CHECK(frame && frame->data<uint16_t>().real[0] == 1);
+	}
+	CHECK(deletes == 1);
+
+	// Changed while shared, the dataset gets a copy and the buffer goes
+	//	with the other copy
+	deletes = 0;
+	values = makeValues(1);
+	{
+		Dataset adopted(2, DIMS, DataTypeUInt16, (char*) values, deleter);
+		Dataset copy(adopted);
+		uint16_t *changed = (uint16_t*) adopted.mutableData();
+		CHECK(changed != values);
+		changed[0] = 500;
+		CHECK(values[0] == 1 && copy.rawData() == (const char*) values);
+		CHECK(deletes == 0);
+	}
+	CHECK(deletes == 1);
+
+	// A view: the caller's buffer is written while the view is its only
+	//	user, a changed copy gets its own data, and nothing is freed
+	uint16_t *external = makeValues(100);
+	{
+		Dataset view(2, DIMS, DataTypeUInt16, (char*) external, Dataset::BufferDeleter());
+		view.setName("data");
+		CHECK(view.rawData() == (const char*) external);
+		((uint16_t*) view.mutableData())[1] = 7;
+		CHECK(external[1] == 7);
+		CHECK(saved(view, path, external));
+
+		Dataset copy(view);
+		uint16_t *detached = (uint16_t*) copy.mutableData();
+		CHECK(detached != external);
+		detached[2] = 9;
+		CHECK(external[2] == 102 && detached[1] == 7);
+		CHECK(view.rawData() == (const char*) external);
+
+		std::unique_ptr<Frame> frame(frameOf(copy));
+		copy.unloadData();
+		CHECK(frame && frame->data<uint16_t>().real[2] == 9);
+	}
+	CHECK(external[0] == 100 && external[1] == 7 && external[2] == 102);
+	delete[] external;
+
+	remove(path.c_str());
+	return testResult();
+}
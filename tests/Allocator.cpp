@@ -0,0 +1,90 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Checks the pooled size classes: frame-sized blocks are reused, larger
+//	ones are not rounded up, and bytesInUse counts the bytes requested.
+//	Datasets and frames free new[] buffers with delete[] and only hand
+//	the ones tagged AllocatedBuffer back to the allocator.
+
+#include <cstring>
+
+#include "Allocator.h"
+#include "Dataset.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const size_t MB = 1024 * 1024;
+
+int main()
+{
+	setHugePageThreshold(0);
+	AllocatorStatistics before = allocatorStatistics();
+
+	// A 33MB dataset is not rounded up to 64MB
+	char *large = (char*) allocateBuffer(33 * MB);
+	memset(large, 1, 33 * MB);
+	CHECK(allocatorStatistics().bytesInUse - before.bytesInUse == (int64_t) (33 * MB));
+	freeBuffer(large);
+	CHECK(allocatorStatistics().bytesInUse == before.bytesInUse);
+	CHECK(allocatorStatistics().bytesPooled == before.bytesPooled);
+
+	// Frame-sized blocks go back to the pool, and a block of the same 
+	//	class is reused
+	char *frame = (char*) allocateBuffer(4 * MB + 1);
+	CHECK(allocatorStatistics().bytesInUse - before.bytesInUse == (int64_t) (4 * MB + 1));
+	freeBuffer(frame);
+	CHECK(allocatorStatistics().bytesPooled - before.bytesPooled == (int64_t) (5 * MB));
+	int64_t hits = allocatorStatistics().poolHits;
+	frame = (char*) allocateBuffer(5 * MB);
+	CHECK(allocatorStatistics().poolHits == hits + 1);
+	CHECK(allocatorStatistics().bytesInUse - before.bytesInUse == (int64_t) (5 * MB));
+	memset(frame, 2, 5 * MB);
+	freeBuffer(frame);
+
+	// A smaller class is not served from it
+	hits = allocatorStatistics().poolHits;
+	frame = (char*) allocateBuffer(3 * MB);
+	CHECK(allocatorStatistics().poolHits == hits);
+	freeBuffer(frame);
+
+	CHECK(allocatorStatistics().bytesInUse == before.bytesInUse);
+	trimBufferPool();
+	CHECK(allocatorStatistics().bytesPooled == 0);
+
+	int dims[2] = {64, 64};
+	int64_t frees = allocatorStatistics().frees;
+	{
+		Dataset dataset(2, dims, DataTypeUInt8, new char[64 * 64]);
+		Frame frame(new char[64 * 64], 0, 1, 64, 64, 64, DataTypeUInt8);
+	}
+	CHECK(allocatorStatistics().frees == frees);
+	{
+		Dataset dataset(2, dims, DataTypeUInt8, 
+			(char*) allocateBuffer(64 * 64), AllocatedBuffer);
+		Frame frame(allocateBuffer(64 * 64), 0, 1, 64, 64, 64, 
+			DataTypeUInt8, AllocatedBuffer);
+	}
+	CHECK(allocatorStatistics().frees == frees + 2);
+	CHECK(allocatorStatistics().bytesInUse == before.bytesInUse);
+
+	return testResult();
+}
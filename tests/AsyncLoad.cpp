@@ -0,0 +1,151 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Loads a group on the I/O thread, converted, and checks that a group
+//	with unsaved changes, in its data or in a dim, is refused rather than
+//	reloaded. A scalar is loaded converted and with progress. Float and
+//	complex groups do not count as integer data.
+
+#include <stdint.h>
+#include <string>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "AsyncLoad.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+int main()
+{
+	H5::Exception::dontPrint();
+	const int dims[2] = {16, 32};
+	const int values = dims[0] * dims[1];
+	uint16_t *data = (uint16_t*) allocateBuffer(values * sizeof(uint16_t));
+	for(int iii = 0; iii < values; ++iii)
+		data[iii] = (uint16_t) (iii * 7);
+
+	emd::Node root;
+	DataGroup group(&root);
+	group.setName("group");
+	Dataset *dataset = new Dataset(2, dims, DataTypeUInt16, (char*) data, AllocatedBuffer, true);
+	dataset->setName("data");
+	dataset->setParentNode(&group);
+	group.setData(dataset);
+	const char *dimNames[2] = {"dim1", "dim2"};
+	for(int dim = 0; dim < 2; ++dim)
+	{
+		int32_t *dimValues = (int32_t*) allocateBuffer(dims[dim] * sizeof(int32_t));
+		for(int iii = 0; iii < dims[dim]; ++iii)
+			dimValues[iii] = iii;
+		Dataset *dimData = new Dataset(1, &dims[dim], DataTypeInt32, 
+			(char*) dimValues, AllocatedBuffer, true);
+		dimData->setName(dimNames[dim]);
+		dimData->setParentNode(&group);
+		group.addDim(dimData);
+	}
+
+	std::string path = testPath("test_asyncload.emd");
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		H5::Group hdfGroup = file.createGroup("group");
+		dataset->save(QString(""), &hdfGroup);
+		for(int dim = 0; dim < 2; ++dim)
+			group.dimData(dim)->save(QString(""), &hdfGroup);
+	}
+	group.unload();
+	QString filePath(path.c_str());
+
+	Dataset::LoadOptions options;
+	options.type = DataTypeFloat32;
+	LoadHandle handle = LoadHandle::load(&group, filePath, options);
+	handle.wait();
+	CHECK(handle.succeeded());
+	CHECK(group.isLoaded() && group.data()->dataType() == DataTypeFloat32);
+	if(group.isLoaded() && group.data()->dataType() == DataTypeFloat32)
+	{
+		const float *loaded = (const float*) group.data()->rawData();
+		for(int iii = 0; iii < values; ++iii)
+			CHECK(loaded[iii] == (float) (uint16_t) (iii * 7));
+	}
+
+	// An edit is kept, and the load reports why it did not happen
+	dataset->setStatus(emd::Node::DIRTY);
+	((float*) dataset->mutableData())[0] = -1;
+	handle = LoadHandle::load(&group, filePath);
+	handle.wait();
+	CHECK(handle.error() == LoadErrorDirty);
+	CHECK(group.isLoaded() && group.data()->dataType() == DataTypeFloat32);
+	if(group.isLoaded())
+		CHECK(((const float*) group.data()->rawData())[0] == -1);
+
+	// Likewise for an edited calibration
+	dataset->removeStatus(emd::Node::DIRTY);
+	Dataset *dim = group.dimData(0);
+	dim->setStatus(emd::Node::DIRTY);
+	((int32_t*) dim->mutableData())[0] = -1;
+	handle = LoadHandle::load(&group, filePath);
+	handle.wait();
+	CHECK(handle.error() == LoadErrorDirty);
+	CHECK(dim->isLoaded() && ((const int32_t*) dim->rawData())[0] == -1);
+
+	// A scalar, read in one block
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_RDWR);
+		H5::DataSet scalar = file.createDataSet("scalar", H5::PredType::NATIVE_UINT16, 
+			H5::DataSpace(H5S_SCALAR));
+		uint16_t value = 21;
+		scalar.write(&value, H5::PredType::NATIVE_UINT16);
+
+		LoadProgress progress;
+		Dataset::LoadOptions scalarOptions;
+		scalarOptions.type = DataTypeFloat64;
+		scalarOptions.scale = 2;
+		scalarOptions.progress = &progress;
+		Dataset loaded;
+		loaded.loadData(scalar, scalarOptions);
+		CHECK(loaded.isLoaded() && loaded.dimCount() == 0);
+		CHECK(loaded.isLoaded() && ((const double*) loaded.rawData())[0] == 42.0);
+		CHECK(progress.bytesRead == (int64_t) sizeof(uint16_t));
+	}
+
+	LoadHandle invalid = LoadHandle::load(0, filePath);
+	CHECK(invalid.error() == LoadErrorInvalidGroup);
+
+	const DataType notInteger[5] = {DataTypeFloat16, DataTypeBFloat16, 
+		DataTypeFloat32, DataTypeComplex64, DataTypeComplex128};
+	for(DataType type : notInteger)
+	{
+		DataGroup typed(&root);
+		Dataset *typedData = new Dataset(4, type);
+		typedData->setParentNode(&typed);
+		typed.setData(typedData);
+		CHECK(!typed.isIntType());
+		typedData->setDataType(DataTypeInt16);
+		CHECK(typed.isIntType());
+	}
+
+	return testResult();
+}
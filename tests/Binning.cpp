@@ -0,0 +1,213 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Loads a group binned and strided along each dim and compares the data
+//	with bins summed by brute force, and the dim vectors with the mean
+//	over each bin (for full vectors) or a start and step rescaled to the
+//	bins (for truncated ones). A full load afterwards restores the sizes.
+
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "Model.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int RANK = 3;
+const int DIMS[RANK] = {9, 7, 10};
+// dim2 is stored as a start and a step
+const double START = 0.5;
+const double STEP = 0.25;
+
+static uint16_t value(int64_t index)
+{
+	return (uint16_t) (index % 251);
+}
+
+static double dimValue(int dim, int index)
+{
+	if(dim == 1)
+		return START + index * STEP;
+	return (dim + 1) * index * index;
+}
+
+static void writeGroup(const std::string &path)
+{
+	H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+	file.createGroup("/data");
+	H5::Group group = file.createGroup("/data/cube");
+	int32_t type = 1;
+	group.createAttribute("emd_group_type", H5::PredType::NATIVE_INT32, 
+		H5::DataSpace()).write(H5::PredType::NATIVE_INT32, &type);
+
+	hsize_t dims[RANK];
+	int64_t size = 1;
+	for(int iii = 0; iii < RANK; ++iii)
+	{
+		dims[iii] = DIMS[iii];
+		size *= DIMS[iii];
+	}
+	std::vector<uint16_t> values(size);
+	for(int64_t iii = 0; iii < size; ++iii)
+		values[iii] = value(iii);
+	group.createDataSet("data", H5::PredType::NATIVE_UINT16, H5::DataSpace(RANK, dims))
+		.write(values.data(), H5::PredType::NATIVE_UINT16);
+
+	for(int iii = 0; iii < RANK; ++iii)
+	{
+		hsize_t length = (iii == 1 ? 2 : DIMS[iii]);
+		std::vector<double> vector(length);
+		for(hsize_t jjj = 0; jjj < length; ++jjj)
+			vector[jjj] = dimValue(iii, (int) jjj);
+		QByteArray name = QString("dim%1").arg(iii + 1).toLocal8Bit();
+		group.createDataSet(name.constData(), H5::PredType::NATIVE_DOUBLE, 
+			H5::DataSpace(1, &length)).write(vector.data(), H5::PredType::NATIVE_DOUBLE);
+	}
+}
+
+// Bins that do not fit are dropped
+static int binnedLength(int length, int binning, int stride)
+{
+	binning = std::min(binning, length);
+	return (length - binning) / (binning * stride) + 1;
+}
+
+static void checkLoad(Model &model, const std::vector<int> &binning, 
+	const std::vector<int> &strides, DataType type, DataType expectedType)
+{
+	Dataset::LoadOptions options;
+	options.type = type;
+	options.binning = binning;
+	options.strides = strides;
+	CHECK(model.loadDataGroup(0, options));
+	DataGroup *group = model.dataGroupAtIndex(0);
+	const Dataset *data = group->data();
+	CHECK(group->isLoaded() && data->dataType() == expectedType);
+	if(!group->isLoaded() || data->dataType() != expectedType)
+		return;
+
+	int bins[RANK], steps[RANK], lengths[RANK];
+	for(int iii = 0; iii < RANK; ++iii)
+	{
+		bins[iii] = std::min(options.binningFactor(iii), DIMS[iii]);
+		steps[iii] = bins[iii] * options.strideFactor(iii);
+		lengths[iii] = binnedLength(DIMS[iii], options.binningFactor(iii), 
+			options.strideFactor(iii));
+		CHECK(data->dimLength(iii) == lengths[iii]);
+		CHECK(group->dimData(iii)->dimLength(0) == lengths[iii]);
+	}
+
+	// The data, with every bin summed
+	int64_t index = 0, wrong = 0;
+	for(int iii = 0; iii < lengths[0]; ++iii)
+		for(int jjj = 0; jjj < lengths[1]; ++jjj)
+			for(int kkk = 0; kkk < lengths[2]; ++kkk, ++index)
+			{
+				double sum = 0;
+				for(int aaa = 0; aaa < bins[0]; ++aaa)
+					for(int bbb = 0; bbb < bins[1]; ++bbb)
+						for(int ccc = 0; ccc < bins[2]; ++ccc)
+							sum += value(((int64_t) (iii * steps[0] + aaa) * DIMS[1] 
+								+ jjj * steps[1] + bbb) * DIMS[2] + kkk * steps[2] + ccc);
+
+				double actual = 0;
+				if(expectedType == DataTypeFloat32)
+					actual = ((const float*) data->rawData())[index];
+				else if(expectedType == DataTypeFloat64)
+					actual = ((const double*) data->rawData())[index];
+				else if(expectedType == DataTypeUInt16)
+					actual = ((const uint16_t*) data->rawData())[index];
+				if(actual != sum)
+					++wrong;
+			}
+	CHECK(wrong == 0);
+
+	// Full dims hold the mean over each bin
+	for(int dim = 0; dim < RANK; dim += 2)
+	{
+		const Dataset *vector = group->dimData(dim);
+		CHECK(vector->dataType() == DataTypeFloat64);
+		if(vector->dataType() != DataTypeFloat64)
+			continue;
+		const double *values = (const double*) vector->rawData();
+		for(int iii = 0; iii < lengths[dim]; ++iii)
+		{
+			double mean = 0;
+			for(int aaa = 0; aaa < bins[dim]; ++aaa)
+				mean += dimValue(dim, iii * steps[dim] + aaa);
+			mean /= bins[dim];
+			CHECK(std::fabs(values[iii] - mean) < 1e-9);
+		}
+	}
+
+	// The truncated dim starts at the centre of the first bin, stepping
+	//	from bin to bin
+	const Dataset *truncated = group->dimData(1);
+	CHECK(truncated->dataSpace().dimLength(0) == 2);
+	const double *startStep = (const double*) truncated->rawData();
+	double start = START + 0.5 * (bins[1] - 1) * STEP;
+	CHECK(std::fabs(startStep[0] - start) < 1e-12);
+	CHECK(std::fabs(startStep[1] - startStep[0] - STEP * steps[1]) < 1e-12);
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_binning.emd");
+	remove(path.c_str());
+	writeGroup(path);
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	CHECK(model.dataGroupCount() == 1);
+	if(model.dataGroupCount() != 1)
+		return testResult();
+	CHECK(model.loadDataGroup(0));
+	CHECK(model.dataGroupAtIndex(0)->dimData(1)->dimLength(0) == DIMS[1]);
+
+	std::vector<int> none;
+	checkLoad(model, {2, 3, 4}, {1, 2, 1}, DataTypeUnknown, DataTypeFloat32);
+	checkLoad(model, {3, 1, 2}, none, DataTypeUnknown, DataTypeFloat32);
+	checkLoad(model, {3, 2}, none, DataTypeFloat64, DataTypeFloat64);
+	checkLoad(model, none, {2, 3, 4}, DataTypeUnknown, DataTypeUInt16);
+	// A bin longer than the dim covers all of it
+	checkLoad(model, {20, 1, 3}, {1, 1, 2}, DataTypeUnknown, DataTypeFloat32);
+	checkLoad(model, {1, 7, 1}, {4}, DataTypeUnknown, DataTypeFloat32);
+
+	// A full load restores the sizes and the stored dims
+	checkLoad(model, none, none, DataTypeUnknown, DataTypeUInt16);
+	const DataGroup *group = model.dataGroupAtIndex(0);
+	for(int iii = 0; iii < RANK; ++iii)
+		CHECK(group->data()->dimLength(iii) == DIMS[iii]);
+	const double *dim1 = (const double*) group->dimData(0)->rawData();
+	CHECK(dim1[DIMS[0] - 1] == dimValue(0, DIMS[0] - 1));
+
+	remove(path.c_str());
+	return testResult();
+}
@@ -0,0 +1,122 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Loads and reads big-endian data, which must be converted from the
+//	swapped bytes on every path: kept as stored, converted, decimated and
+//	read into a buffer.
+
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include "Dataset.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+int main()
+{
+	H5::Exception::dontPrint();
+	const hsize_t dims[3] = {4, 8, 8};
+	const int values = 4 * 8 * 8;
+	std::vector<uint16_t> data(values);
+	for(int iii = 0; iii < values; ++iii)
+		data[iii] = (uint16_t) (iii * 3);
+
+	std::string path = testPath("test_byteorder.emd");
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		H5::DataSpace space(3, dims);
+		H5::DataSet dataSet = file.createDataSet("data", 
+			H5::PredType::STD_U16BE, space);
+		dataSet.write(data.data(), H5::PredType::NATIVE_UINT16);
+	}
+
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+	H5::DataSet dataSet = file.openDataSet("data");
+
+	// As stored
+	Dataset stored;
+	stored.loadData(dataSet);
+	CHECK(stored.isLoaded() && stored.dataType() == DataTypeUInt16);
+	if(stored.isLoaded())
+	{
+		const uint16_t *loaded = (const uint16_t*) stored.rawData();
+		for(int iii = 0; iii < values; ++iii)
+			CHECK(loaded[iii] == data[iii]);
+	}
+
+	// Converted block by block
+	Dataset::LoadOptions options;
+	options.type = DataTypeFloat32;
+	Dataset converted;
+	converted.loadData(dataSet, options);
+	CHECK(converted.isLoaded() && converted.dataType() == DataTypeFloat32);
+	if(converted.isLoaded())
+	{
+		const float *loaded = (const float*) converted.rawData();
+		for(int iii = 0; iii < values; ++iii)
+			CHECK(loaded[iii] == data[iii]);
+	}
+
+	// Every second value along the frame dims
+	options.type = DataTypeFloat64;
+	options.strides.push_back(1);
+	options.strides.push_back(2);
+	options.strides.push_back(2);
+	Dataset decimated;
+	decimated.loadData(dataSet, options);
+	CHECK(decimated.isLoaded() && decimated.dataType() == DataTypeFloat64);
+	if(decimated.isLoaded() && decimated.dataType() == DataTypeFloat64)
+	{
+		CHECK(decimated.dimLength(1) == 4 && decimated.dimLength(2) == 4);
+		const double *loaded = (const double*) decimated.rawData();
+		for(int iii = 0; iii < 4; ++iii)
+			for(int jjj = 0; jjj < 4; ++jjj)
+				for(int kkk = 0; kkk < 4; ++kkk)
+					CHECK(loaded[(iii * 4 + jjj) * 4 + kkk] 
+						== data[(iii * 8 + 2 * jjj) * 8 + 2 * kkk]);
+	}
+
+	// A selection read into a buffer, as stored and converted
+	Dataset::Selection selection(3);
+	selection[0].start = 1;
+	selection[0].end = 3;
+	selection[1].start = 0;
+	selection[1].end = 8;
+	selection[2].start = 2;
+	selection[2].end = 6;
+	std::vector<uint16_t> raw(2 * 8 * 4);
+	std::vector<float> buffer(2 * 8 * 4);
+	Dataset reader;
+	CHECK(reader.read(dataSet, selection, raw.data()));
+	CHECK(reader.read(dataSet, selection, buffer.data(), DataTypeFloat32));
+	for(int iii = 0; iii < 2; ++iii)
+		for(int jjj = 0; jjj < 8; ++jjj)
+			for(int kkk = 0; kkk < 4; ++kkk)
+			{
+				uint16_t expected = data[((iii + 1) * 8 + jjj) * 8 + kkk + 2];
+				CHECK(raw[(iii * 8 + jjj) * 4 + kkk] == expected);
+				CHECK(buffer[(iii * 8 + jjj) * 4 + kkk] == expected);
+			}
+
+	return testResult();
+}
@@ -0,0 +1,217 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Centers of mass of frames whose centers are known by hand (a single
+//	pixel, two weighted pixels, a peak over a background that the 
+//	threshold removes, a peak the mask removes), and of sparse events,
+//	checked along with a brute force moment of every frame.
+
+#include <cmath>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "CenterOfMass.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int ROWS = 7;
+const int COLUMNS = 9;
+const int FRAME_SIZE = ROWS * COLUMNS;
+const int SCAN[2] = {3, 4};
+const int FRAMES = SCAN[0] * SCAN[1];
+
+// The center is reported relative to the middle of the frame
+const double ORIGIN_ROW = 3;
+const double ORIGIN_COLUMN = 4;
+
+static bool near(float actual, double expected)
+{
+	return std::fabs(actual - expected) <= 1e-4 * std::max(1.0, std::fabs(expected));
+}
+
+static std::vector<float> image(CenterOfMass &com, CenterOfMass::Component component)
+{
+	std::unique_ptr<Dataset> data(com.createImage(component));
+	if(!data || data->dataType() != DataTypeFloat32)
+		return std::vector<float>();
+	const float *values = (const float*) data->rawData();
+	return std::vector<float>(values, values + FRAMES);
+}
+
+// Brute force: the weighted moments of the pixels at or above the 
+//	threshold, relative to the origin
+static void checkAll(CenterOfMass &com, const std::vector<float> &frames, 
+	const std::vector<float> &mask, float threshold)
+{
+	std::vector<float> rows = image(com, CenterOfMass::ComponentRow);
+	std::vector<float> columns = image(com, CenterOfMass::ComponentColumn);
+	std::vector<float> intensities = image(com, CenterOfMass::ComponentIntensity);
+	std::vector<float> magnitudes = image(com, CenterOfMass::ComponentMagnitude);
+	std::vector<float> angles = image(com, CenterOfMass::ComponentAngle);
+	CHECK(rows.size() == (size_t) FRAMES && angles.size() == (size_t) FRAMES);
+	if(rows.size() != (size_t) FRAMES || angles.size() != (size_t) FRAMES)
+		return;
+
+	int wrong = 0;
+	for(int frame = 0; frame < FRAMES; ++frame)
+	{
+		double sum = 0, rowMoment = 0, columnMoment = 0;
+		for(int pixel = 0; pixel < FRAME_SIZE; ++pixel)
+		{
+			float value = frames[frame * FRAME_SIZE + pixel];
+			if(value < threshold)
+				continue;
+			double weighted = value * mask[pixel];
+			sum += weighted;
+			rowMoment += weighted * (pixel / COLUMNS - ORIGIN_ROW);
+			columnMoment += weighted * (pixel % COLUMNS - ORIGIN_COLUMN);
+		}
+		double row = sum != 0 ? rowMoment / sum : 0;
+		double column = sum != 0 ? columnMoment / sum : 0;
+
+		wrong += !near(intensities[frame], sum) || !near(rows[frame], row) 
+			|| !near(columns[frame], column) 
+			|| !near(magnitudes[frame], std::sqrt(row * row + column * column)) 
+			|| !near(angles[frame], std::atan2(row, column));
+	}
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	// Descending: scan 3 x 4 of 7 x 9 frames. Frames from 4 on are a 
+	//	background of 1 with a peak of 100 at (5, 1).
+	std::vector<float> frames(FRAMES * FRAME_SIZE, 0.0f);
+	frames[0 * FRAME_SIZE + 2 * COLUMNS + 6] = 5;
+	frames[1 * FRAME_SIZE + 0 * COLUMNS + 0] = 1;
+	frames[1 * FRAME_SIZE + 4 * COLUMNS + 8] = 3;
+	for(int pixel = 0; pixel < FRAME_SIZE; ++pixel)
+		frames[3 * FRAME_SIZE + pixel] = (float) (pixel % 5);
+	for(int frame = 4; frame < FRAMES; ++frame)
+	{
+		for(int pixel = 0; pixel < FRAME_SIZE; ++pixel)
+			frames[frame * FRAME_SIZE + pixel] = 1;
+		frames[frame * FRAME_SIZE + 5 * COLUMNS + 1] = 100;
+	}
+
+	const int dims[4] = {SCAN[0], SCAN[1], ROWS, COLUMNS};
+	float *buffer = new float[frames.size()];
+	std::copy(frames.begin(), frames.end(), buffer);
+	DataGroup group;
+	group.setData(new Dataset(4, dims, DataTypeFloat32, (char*) buffer));
+
+	CenterOfMass com(&group);
+	CHECK(com.frameRows() == ROWS && com.frameColumns() == COLUMNS);
+	CHECK(com.run());
+	std::vector<float> rows = image(com, CenterOfMass::ComponentRow);
+	std::vector<float> columns = image(com, CenterOfMass::ComponentColumn);
+	std::vector<float> intensities = image(com, CenterOfMass::ComponentIntensity);
+	CHECK(rows.size() == (size_t) FRAMES);
+	if(rows.size() != (size_t) FRAMES)
+		return testResult();
+
+	// A single pixel at (2, 6)
+	CHECK(near(rows[0], -1) && near(columns[0], 2) && near(intensities[0], 5));
+	// 1 at (0, 0) and 3 at (4, 8): (3, 6)
+	CHECK(near(rows[1], 0) && near(columns[1], 2) && near(intensities[1], 4));
+	// An empty frame
+	CHECK(rows[2] == 0 && columns[2] == 0 && intensities[2] == 0);
+	std::vector<float> ones(FRAME_SIZE, 1.0f);
+	checkAll(com, frames, ones, -1e30f);
+
+	// The threshold leaves only the peak
+	com.setThreshold(2);
+	CHECK(com.run());
+	rows = image(com, CenterOfMass::ComponentRow);
+	columns = image(com, CenterOfMass::ComponentColumn);
+	intensities = image(com, CenterOfMass::ComponentIntensity);
+	for(int frame = 4; frame < FRAMES; ++frame)
+	{
+		CHECK(near(rows[frame], 2) && near(columns[frame], -3));
+		CHECK(near(intensities[frame], 100));
+	}
+	checkAll(com, frames, ones, 2);
+
+	// The mask removes the peak, and halves the left half of the frame
+	std::vector<float> mask(FRAME_SIZE, 1.0f);
+	for(int pixel = 0; pixel < FRAME_SIZE; ++pixel)
+	{
+		if(pixel % COLUMNS < COLUMNS / 2)
+			mask[pixel] = 0.5f;
+	}
+	mask[5 * COLUMNS + 1] = 0;
+	CHECK(com.setMask(mask));
+	CHECK(!com.setMask(std::vector<float>(3, 1.0f)));
+	CHECK(com.run());
+	intensities = image(com, CenterOfMass::ComponentIntensity);
+	for(int frame = 4; frame < FRAMES; ++frame)
+		CHECK(intensities[frame] == 0);
+	checkAll(com, frames, mask, 2);
+
+	com.setThreshold(-1e30f);
+	CHECK(com.run());
+	checkAll(com, frames, mask, -1e30f);
+
+	// Sparse: no threshold, the mask still applies. Frame 0 has events at
+	//	(1, 2) twice and (3, 4) once: (5/3, 8/3).
+	std::vector<uint64_t> offsets(1, 0);
+	std::vector<uint32_t> events;
+	std::vector<float> dense(FRAMES * FRAME_SIZE, 0.0f);
+	const uint32_t first[3] = {1 * COLUMNS + 2, 1 * COLUMNS + 2, 3 * COLUMNS + 4};
+	for(uint32_t pixel : first)
+	{
+		events.push_back(pixel);
+		dense[pixel] += 1;
+	}
+	offsets.push_back(events.size());
+	for(int frame = 1; frame < FRAMES; ++frame)
+	{
+		for(int event = 0; event < frame; ++event)
+		{
+			uint32_t pixel = (uint32_t) ((frame * 13 + event * 29) % FRAME_SIZE);
+			events.push_back(pixel);
+			dense[frame * FRAME_SIZE + pixel] += 1;
+		}
+		offsets.push_back(events.size());
+	}
+	const int frameDims[2] = {ROWS, COLUMNS};
+	DataGroup sparse;
+	sparse.setData(new Dataset(2, SCAN, frameDims, offsets, events));
+
+	CenterOfMass sparseCom(&sparse);
+	sparseCom.setThreshold(2);
+	CHECK(sparseCom.run());
+	rows = image(sparseCom, CenterOfMass::ComponentRow);
+	columns = image(sparseCom, CenterOfMass::ComponentColumn);
+	CHECK(rows.size() == (size_t) FRAMES);
+	if(rows.size() == (size_t) FRAMES)
+		CHECK(near(rows[0], 5.0 / 3 - ORIGIN_ROW) && near(columns[0], 8.0 / 3 - ORIGIN_COLUMN));
+	checkAll(sparseCom, dense, ones, -1e30f);
+
+	CHECK(sparseCom.setMask(mask));
+	CHECK(sparseCom.run());
+	checkAll(sparseCom, dense, mask, -1e30f);
+
+	return testResult();
+}
@@ -0,0 +1,158 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Native complex data: converting between a complex dim and interleaved
+//	values, saving and loading the HDF5 compound type, and Fourier 
+//	transforms of interleaved frames, which must match those of the same
+//	data with a complex dim.
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "Complex.h"
+#include "Dataset.h"
+#include "FourierTransform.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int H_SIZE = 4;
+const int V_SIZE = 8;
+const int SIZE = H_SIZE * V_SIZE;
+
+static bool isClose(float a, float b)
+{
+	return std::fabs(a - b) < 1e-4f * (1.0f + std::fabs(a));
+}
+
+// The frame spanning both dims of a 2D dataset, after a complex dim
+static Frame *frameOf(const Dataset &data, bool complexDim)
+{
+	int first = complexDim ? 1 : 0;
+	Dataset::Slice slice(first + 2, 0);
+	slice[first] = Dataset::HorizontalDimension;
+	slice[first + 1] = Dataset::VerticalDimension;
+	return data.frame(slice);
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+
+	// Real values followed by the imaginary values
+	const int dims[3] = {2, H_SIZE, V_SIZE};
+	float *values = (float*) allocateBuffer(2 * SIZE * sizeof(float));
+	for(int iii = 0; iii < SIZE; ++iii)
+	{
+		values[iii] = (float) (iii % 5) - 1.5f;
+		values[SIZE + iii] = (float) (iii % 3) * 0.25f;
+	}
+	Dataset split(3, dims, DataTypeFloat32, (char*) values, AllocatedBuffer);
+	split.setName("data");
+	split.setComplexIndex(0);
+
+	Dataset *interleaved = interleaveComplex(&split);
+	CHECK(interleaved && interleaved->dataType() == DataTypeComplex64);
+	CHECK(interleaved && interleaved->dimCount() == 2);
+	if(!interleaved)
+		return testResult();
+	const float *pairs = (const float*) interleaved->rawData();
+	for(int iii = 0; iii < SIZE; ++iii)
+	{
+		CHECK(pairs[2 * iii] == values[iii]);
+		CHECK(pairs[2 * iii + 1] == values[SIZE + iii]);
+	}
+
+	Dataset *splitAgain = splitComplex(interleaved, 0);
+	CHECK(splitAgain && splitAgain->dataType() == DataTypeFloat32);
+	CHECK(splitAgain && splitAgain->complexIndex() == 0);
+	CHECK(splitAgain && memcmp(splitAgain->rawData(), values, 
+		2 * SIZE * sizeof(float)) == 0);
+	delete splitAgain;
+
+	// The compound type round trip
+	std::string path = testPath("test_complex.emd");
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		interleaved->save(QString(""), &file);
+	}
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+		H5::DataSet dataSet = file.openDataSet("data");
+		Dataset loaded;
+		loaded.loadData(dataSet);
+		CHECK(loaded.isLoaded() && loaded.dataType() == DataTypeComplex64);
+		CHECK(loaded.isLoaded() && memcmp(loaded.rawData(), pairs, 
+			2 * SIZE * sizeof(float)) == 0);
+	}
+
+	// Interleaved and split frames of the same data transform alike
+	Frame *complexFrame = frameOf(*interleaved, false);
+	Frame *splitFrame = frameOf(split, true);
+	CHECK(complexFrame && complexFrame->isComplex());
+	CHECK(splitFrame && splitFrame->isComplex());
+	Frame *transformed = FourierTransform::transform(complexFrame);
+	Frame *reference = FourierTransform::transform(splitFrame);
+	CHECK(transformed && transformed->dataType() == DataTypeComplex64);
+	CHECK(reference && reference->dataType() == DataTypeComplex64);
+	if(transformed && reference)
+	{
+		const float *result = transformed->data<float>().real;
+		const float *expected = reference->data<float>().real;
+		for(int iii = 0; iii < 2 * SIZE; ++iii)
+			CHECK(isClose(result[iii], expected[iii]));
+	}
+
+	// The inverse gives back the data
+	Frame *restored = transformed ? FourierTransform::inverse(transformed) : 0;
+	CHECK(restored && restored->dataType() == DataTypeComplex64);
+	if(restored && complexFrame)
+	{
+		Frame::Data<const float> source = complexFrame->data<float>();
+		Frame::Data<const float> result = restored->data<float>();
+		CHECK(result.hSize == source.hSize && result.vSize == source.vSize);
+		for(int vvv = 0; vvv < source.vSize; ++vvv)
+		{
+			for(int hhh = 0; hhh < source.hSize; ++hhh)
+			{
+				int64_t from = 2 * (vvv * source.vStep + hhh * source.hStep);
+				int64_t to = 2 * (vvv * result.vStep + hhh * result.hStep);
+				CHECK(isClose(result.real[to], source.real[from]));
+				CHECK(isClose(result.real[to + 1], source.real[from + 1]));
+			}
+		}
+	}
+
+	delete restored;
+	delete transformed;
+	delete reference;
+	delete complexFrame;
+	delete splitFrame;
+	delete interleaved;
+
+	return testResult();
+}
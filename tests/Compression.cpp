@@ -0,0 +1,94 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Saves data with each compression and reads it back. Filters whose
+//	plugin is not installed fall back to deflate; when the bitshuffle
+//	plugin is there, the file must ask it for LZ4.
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "Dataset.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const H5Z_filter_t FILTER_BITSHUFFLE = 32008;
+
+int main()
+{
+	H5::Exception::dontPrint();
+	const int dims[3] = {4, 32, 32};
+	const int values = dims[0] * dims[1] * dims[2];
+	uint16_t *data = (uint16_t*) allocateBuffer(values * sizeof(uint16_t));
+	for(int iii = 0; iii < values; ++iii)
+		data[iii] = (iii % 97 == 0) ? iii : 0;
+	Dataset source(3, dims, DataTypeUInt16, (char*) data, AllocatedBuffer);
+	source.setName("data");
+
+	const Dataset::Compression compressions[4] = {Dataset::CompressionNone, 
+		Dataset::CompressionDeflate, Dataset::CompressionBitshuffleLZ4, 
+		Dataset::CompressionZstd};
+	for(Dataset::Compression compression : compressions)
+	{
+		std::string path = testPath("test_compression.emd");
+		path.insert(path.size() - 4, 1, (char) ('0' + compression));
+		source.setCompression(compression);
+		{
+			H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+			source.save(QString(""), &file);
+		}
+
+		H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+		H5::DataSet dataSet = file.openDataSet("data");
+		Dataset loaded;
+		loaded.loadData(dataSet);
+		CHECK(loaded.isLoaded());
+		CHECK(loaded.dataType() == DataTypeUInt16);
+		CHECK(loaded.isLoaded() && memcmp(loaded.rawData(), data, 
+			values * sizeof(uint16_t)) == 0);
+		if(compression == Dataset::CompressionNone)
+			CHECK(loaded.compression() == Dataset::CompressionNone);
+		else
+			CHECK(loaded.compression() != Dataset::CompressionNone);
+
+		if(loaded.compression() == Dataset::CompressionBitshuffleLZ4)
+		{
+			H5::DSetCreatPropList plist = dataSet.getCreatePlist();
+			unsigned int flags, config;
+			size_t count = 8;
+			unsigned int parameters[8] = {0};
+			H5Pget_filter_by_id2(plist.getId(), FILTER_BITSHUFFLE, &flags, 
+				&count, parameters, 0, NULL, &config);
+			// Block size chosen by the filter, LZ4 compressor
+			CHECK(count >= 5);
+			CHECK(parameters[3] == 0);
+			CHECK(parameters[4] == 2);
+		}
+	}
+
+	return testResult();
+}
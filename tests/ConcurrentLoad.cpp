@@ -0,0 +1,162 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Stress test of the memory budget: threads load groups synchronously,
+//	converted, while another changes the budget and loads asynchronously,
+//	which unloads groups to make room. A group must not be unloaded while
+//	it is read into: the read would go on into freed memory, which the
+//	pool may have handed out again. Best run built with -fsanitize=thread
+//	or address as well.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "AsyncLoad.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameWriter.h"
+#include "Model.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int GROUPS = 8;
+const int FRAMES = 128;
+const int ROWS = 64;
+const int COLUMNS = 64;
+const int64_t GROUP_BYTES = (int64_t) FRAMES * ROWS * COLUMNS * sizeof(float);
+const int LOADS = 40;
+
+static uint16_t value(int group, int64_t index)
+{
+	return (uint16_t) (group * 1009 + index);
+}
+
+static bool writeGroup(const std::string &path, int group)
+{
+	std::vector<uint16_t> frames((size_t) FRAMES * ROWS * COLUMNS);
+	for(size_t iii = 0; iii < frames.size(); ++iii)
+		frames[iii] = value(group, iii);
+
+	FrameWriter writer;
+	QString groupPath = QString("/data/group%1").arg(group);
+	if(!writer.open(QString(path.c_str()), groupPath, ROWS, COLUMNS, DataTypeUInt16))
+		return false;
+	bool written = writer.append(frames.data(), FRAMES);
+	return writer.close() && written;
+}
+
+// The group holds its values as Float32, if it is loaded
+static bool holdsValues(DataGroup *group, int index)
+{
+	if(!group->isLoaded())
+		return true;
+
+	const Dataset *data = group->data();
+	if(data->dataType() != DataTypeFloat32 || data->memoryFootprint() != GROUP_BYTES)
+		return false;
+
+	std::shared_ptr<const char> buffer = data->sharedData();
+	const float *values = (const float*) buffer.get();
+	for(int64_t iii = 0; iii < GROUP_BYTES / (int64_t) sizeof(float); ++iii)
+	{
+		if(values[iii] != (float) value(index, iii))
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_concurrentload.emd");
+	remove(path.c_str());
+	for(int group = 0; group < GROUPS; ++group)
+		CHECK(writeGroup(path, group));
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	CHECK(model.dataGroupCount() == GROUPS);
+	if(model.dataGroupCount() != GROUPS)
+		return testResult();
+	model.unloadDataGroups();
+
+	Dataset::LoadOptions options;
+	options.type = DataTypeFloat32;
+	model.setMemoryBudget(2 * GROUP_BYTES);
+
+	std::atomic<int> running(2);
+	std::vector<std::thread> loaders;
+	for(int thread = 0; thread < 2; ++thread)
+	{
+		loaders.push_back(std::thread([&model, &options, &running, thread]()
+		{
+			// Refused while the group is loaded asynchronously
+			for(int iii = 0; iii < LOADS; ++iii)
+				model.loadDataGroup((iii * 3 + thread) % GROUPS, options);
+			--running;
+		}));
+	}
+
+	// Shrinks and grows the budget while the loaders read, with an
+	//	asynchronous load now and then. A block the size of a group, 
+	//	taken from the pool once groups have been unloaded, must keep 
+	//	its contents.
+	int overwritten = 0;
+	for(int iii = 0; running.load() > 0; ++iii)
+	{
+		model.setMemoryBudget(iii % 2 ? GROUP_BYTES / 2 : 3 * GROUP_BYTES);
+		if(iii % 64 == 0)
+			model.loadDataGroupAsync((iii / 64) % GROUPS, options).wait();
+
+		char *block = (char*) allocateBuffer(GROUP_BYTES);
+		memset(block, 0x5a, GROUP_BYTES);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		for(int64_t jjj = 0; jjj < GROUP_BYTES; ++jjj)
+		{
+			if(block[jjj] != 0x5a)
+			{
+				++overwritten;
+				break;
+			}
+		}
+		freeBuffer(block);
+	}
+	CHECK(overwritten == 0);
+
+	for(std::thread &loader : loaders)
+		loader.join();
+
+	for(int group = 0; group < GROUPS; ++group)
+		CHECK(holdsValues(model.dataGroupAtIndex(group), group));
+
+	remove(path.c_str());
+	return testResult();
+}
@@ -0,0 +1,164 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Copies of a dataset and its frames share the data until one of them
+//	changes it through mutableData, which gives it a private copy; a frame
+//	keeps the data alive after the dataset unloads it. Only frames from
+//	mutableFrame write to the dataset.
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#include "Allocator.h"
+#include "Dataset.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int H_SIZE = 16;
+const int V_SIZE = 8;
+const int SIZE = H_SIZE * V_SIZE;
+
+static Frame *frameOf(const Dataset &data)
+{
+	Dataset::Slice slice(2, 0);
+	slice[0] = Dataset::HorizontalDimension;
+	slice[1] = Dataset::VerticalDimension;
+	return data.frame(slice);
+}
+
+// Whether the frame shows the values, whatever its steps
+static bool frameMatches(const Frame *frame, const std::vector<uint16_t> &values)
+{
+	Frame::Data<const uint16_t> data = frame->data<uint16_t>();
+	if(data.hSize * data.vSize != SIZE)
+		return false;
+
+	std::vector<uint16_t> seen;
+	for(int vvv = 0; vvv < data.vSize; ++vvv)
+	{
+		for(int hhh = 0; hhh < data.hSize; ++hhh)
+			seen.push_back(data.real[hhh * data.hStep + vvv * data.vStep]);
+	}
+	std::vector<uint16_t> sorted(values);
+	std::sort(seen.begin(), seen.end());
+	std::sort(sorted.begin(), sorted.end());
+	return seen == sorted;
+}
+
+int main()
+{
+	const int dims[2] = {H_SIZE, V_SIZE};
+	std::vector<uint16_t> values(SIZE);
+	uint16_t *buffer = (uint16_t*) allocateBuffer(SIZE * sizeof(uint16_t));
+	for(int iii = 0; iii < SIZE; ++iii)
+		buffer[iii] = values[iii] = (uint16_t) iii;
+
+	Dataset data(2, dims, DataTypeUInt16, (char*) buffer, AllocatedBuffer);
+	const char *original = data.rawData();
+
+	// A copy shares the buffer until it changes it
+	{
+		Dataset copy(data);
+		CHECK(copy.rawData() == original);
+		CHECK(data.isShared() && copy.isShared());
+
+		uint16_t *changed = (uint16_t*) copy.mutableData();
+		CHECK((const char*) changed != original);
+		changed[0] = 1000;
+		CHECK(((const uint16_t*) data.rawData())[0] == 0);
+		CHECK(!data.isShared() && !copy.isShared());
+	}
+
+	// A frame points into the shared buffer, and gets its own copy when
+	//	written to
+	Frame *frame = frameOf(data);
+	CHECK(frame != 0);
+	if(frame)
+	{
+		CHECK((const char*) frame->data<uint16_t>().real == original);
+		CHECK(data.isShared());
+		CHECK(frameMatches(frame, values));
+
+		Frame::Data<uint16_t> writable = frame->mutableData<uint16_t>();
+		CHECK((const char*) writable.real != original);
+		CHECK(frameMatches(frame, values));
+		writable.real[0] = 1000;
+		CHECK(((const uint16_t*) data.rawData())[0] == 0);
+		CHECK(!data.isShared());
+		delete frame;
+	}
+
+	// Changing the dataset leaves its frames as they were
+	frame = frameOf(data);
+	if(frame)
+	{
+		uint16_t *changed = (uint16_t*) data.mutableData();
+		CHECK((const char*) changed != original);
+		changed[1] = 1000;
+		CHECK(frameMatches(frame, values));
+		delete frame;
+	}
+
+	// A frame from mutableFrame writes to the dataset, after making its
+	//	data private
+	{
+		Dataset copy(data);
+		frame = data.mutableFrame(Dataset::Slice(2, 0));
+		CHECK(frame == 0);
+		Dataset::Slice slice(2, 0);
+		slice[0] = Dataset::HorizontalDimension;
+		slice[1] = Dataset::VerticalDimension;
+		frame = data.mutableFrame(slice);
+		CHECK(frame != 0);
+		if(frame)
+		{
+			CHECK(data.rawData() != copy.rawData());
+			Frame::Data<uint16_t> writable = frame->mutableData<uint16_t>();
+			CHECK((const char*) writable.real == data.rawData());
+			writable.real[0] = 2000;
+			CHECK(((const uint16_t*) data.rawData())[0] == 2000);
+			CHECK(((const uint16_t*) copy.rawData())[0] == 0);
+			writable.real[0] = 0;
+			delete frame;
+		}
+	}
+
+	// A frame outlives the unloaded data, and then writes it in place
+	frame = frameOf(data);
+	if(frame)
+	{
+		std::vector<uint16_t> current(values);
+		current[1] = 1000;
+		const uint16_t *shared = frame->data<uint16_t>().real;
+		int64_t inUse = allocatorStatistics().bytesInUse;
+		data.unloadData();
+		CHECK(!data.isLoaded());
+		CHECK(allocatorStatistics().bytesInUse == inUse);
+		CHECK(frameMatches(frame, current));
+		CHECK(frame->mutableData<uint16_t>().real == shared);
+		delete frame;
+		CHECK(allocatorStatistics().bytesInUse < inUse);
+	}
+
+	return testResult();
+}
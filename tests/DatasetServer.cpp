@@ -0,0 +1,206 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Serves a file to this process and to a forked one: the second client
+//	asks for it by another path and gets the same segment, its writes stay
+//	its own, and what it held is released when it exits. Also checks the
+//	memory cap, that a client stuck halfway through a request does not 
+//	hold up the others, and that a rewritten file is read again.
+
+#include <chrono>
+#include <cstring>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Dataset.h"
+#include "DatasetServer.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int FRAMES = 8;
+const int ROWS = 16;
+const int COLUMNS = 16;
+const int64_t VALUES = FRAMES * ROWS * COLUMNS;
+const int64_t ALL_BYTES = VALUES * 2;
+
+static uint16_t value(int64_t index, int offset)
+{
+	return (uint16_t) (index * 7 + offset);
+}
+
+static void writeFile(const std::string &path, int offset)
+{
+	std::vector<uint16_t> values(VALUES);
+	for(int64_t iii = 0; iii < VALUES; ++iii)
+		values[iii] = value(iii, offset);
+
+	H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+	hsize_t dims[3] = {FRAMES, ROWS, COLUMNS};
+	H5::DataSpace space(3, dims);
+	file.createDataSet("data", H5::PredType::NATIVE_UINT16, space)
+		.write(values.data(), H5::PredType::NATIVE_UINT16);
+}
+
+// Values [first, first + count) of the file, as attached
+static bool holds(const Dataset *data, int64_t first, int64_t count, 
+	int offset)
+{
+	if(!data || data->dataType() != DataTypeUInt16)
+		return false;
+
+	const uint16_t *values = (const uint16_t*) data->rawData();
+	for(int64_t iii = 0; iii < count; ++iii)
+	{
+		if(values[iii] != value(first + iii, offset))
+			return false;
+	}
+	return true;
+}
+
+static Dataset::Selection frames(int first, int end)
+{
+	Dataset::Selection selection(3);
+	selection[0].start = first;
+	selection[0].end = end;
+	selection[1].start = 0;
+	selection[1].end = ROWS;
+	selection[2].start = 0;
+	selection[2].end = COLUMNS;
+	return selection;
+}
+
+static bool waitForClients(DatasetServer &server, int count)
+{
+	for(int iii = 0; iii < 500 && server.clientCount() != count; ++iii)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return server.clientCount() == count;
+}
+
+// Run in the forked process; returns the exit code
+static int forkedClient(const QString &socketPath, const QString &otherPath)
+{
+	DatasetClient client;
+	if(!client.connect(socketPath))
+		return 1;
+
+	Dataset *same = client.attach(otherPath, "data");
+	if(!holds(same, 0, VALUES, 0))
+		return 2;
+
+	uint16_t *values = (uint16_t*) same->mutableData();
+	for(int64_t iii = 0; iii < VALUES; ++iii)
+		values[iii] = 0xffff;
+
+	// Held until the process exits
+	Dataset *half = client.attach(otherPath, "data", frames(0, FRAMES / 2));
+	if(!holds(half, 0, VALUES / 2, 0))
+		return 3;
+	return 0;
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string directory = testPath("");
+	std::string path = directory + "test_datasetserver.emd";
+	QString filePath = QString::fromStdString(path);
+	QString otherPath = QString::fromStdString(directory + "./test_datasetserver.emd");
+	QString socketPath = QString::fromStdString(testPath("test_datasetserver.socket"));
+	writeFile(path, 0);
+
+	// Room for all of the data and half of it
+	DatasetServer server(socketPath, ALL_BYTES + ALL_BYTES / 2);
+	CHECK(server.start());
+
+	DatasetClient client;
+	CHECK(client.connect(socketPath));
+	Dataset *all = client.attach(filePath, "data");
+	CHECK(holds(all, 0, VALUES, 0));
+	CHECK(all && all->dimCount() == 3 && all->dimLength(0) == FRAMES);
+	CHECK(server.segmentCount() == 1 && server.memoryUsage() == ALL_BYTES);
+	CHECK(!client.attach(filePath + ".missing", "data"));
+
+	pid_t pid = fork();
+	if(pid == 0)
+		_exit(forkedClient(socketPath, otherPath));
+	int status = -1;
+	CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// The same segment, unchanged by the other process's writes
+	CHECK(server.segmentCount() == 2);
+	CHECK(waitForClients(server, 1));
+	CHECK(holds(all, 0, VALUES, 0));
+	Dataset *again = client.attach(otherPath, "data");
+	CHECK(holds(again, 0, VALUES, 0));
+	CHECK(server.segmentCount() == 2);
+	delete again;
+
+	// The half the other process held is dropped to make room
+	Dataset *second = client.attach(filePath, "data", frames(FRAMES / 2, FRAMES));
+	CHECK(holds(second, VALUES / 2, VALUES / 2, 0));
+	CHECK(server.segmentCount() == 2);
+	CHECK(server.memoryUsage() == ALL_BYTES + ALL_BYTES / 2);
+
+	// Nothing more can be dropped while this process holds both
+	CHECK(!client.attach(filePath, "data", frames(0, FRAMES / 2), DataTypeFloat32));
+	CHECK(server.segmentCount() == 2);
+
+	// A client that sends part of a request
+	int stuck = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	QByteArray socketName = socketPath.toLocal8Bit();
+	strncpy(address.sun_path, socketName.constData(), sizeof(address.sun_path) - 1);
+	CHECK(connect(stuck, (sockaddr*) &address, sizeof(address)) == 0);
+	const char partial[12] = {1, 0, 0, 0};
+	CHECK(send(stuck, partial, sizeof(partial), 0) == (ssize_t) sizeof(partial));
+	CHECK(waitForClients(server, 2));
+	again = client.attach(filePath, "data");
+	CHECK(holds(again, 0, VALUES, 0));
+	delete again;
+	close(stuck);
+	CHECK(waitForClients(server, 1));
+
+	// Rewritten, the file is read again
+	delete all;
+	delete second;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	writeFile(path, 1000);
+	all = client.attach(filePath, "data");
+	CHECK(holds(all, 0, VALUES, 1000));
+	delete all;
+
+	client.disconnect();
+	server.stop();
+	return testResult();
+}
@@ -0,0 +1,208 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Compares forward and inverse transforms of frames of power of two and
+//	other sizes (radix-2 and Bluestein), shifted and unshifted, with a 
+//	brute force discrete Fourier transform, and checks that the inverse
+//	undoes the forward transform.
+
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "FourierTransform.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+typedef std::complex<double> Complex;
+
+const double PI = 3.14159265358979323846;
+
+// Rows x columns, with the columns varying fastest; the sign is -1 for
+//	the forward transform
+static std::vector<Complex> dft(const std::vector<Complex> &values, 
+	int rows, int columns, int sign)
+{
+	std::vector<Complex> result(values.size());
+	for(int kkk = 0; kkk < rows; ++kkk)
+		for(int lll = 0; lll < columns; ++lll)
+		{
+			Complex sum(0, 0);
+			for(int row = 0; row < rows; ++row)
+				for(int column = 0; column < columns; ++column)
+				{
+					double phase = sign * 2 * PI * ((double) kkk * row / rows 
+						+ (double) lll * column / columns);
+					sum += values[row * columns + column] 
+						* Complex(std::cos(phase), std::sin(phase));
+				}
+			result[kkk * columns + lll] = sum;
+		}
+	return result;
+}
+
+// Moves the zero frequency to (rows / 2, columns / 2)
+static std::vector<Complex> shifted(const std::vector<Complex> &values, 
+	int rows, int columns)
+{
+	std::vector<Complex> result(values.size());
+	for(int row = 0; row < rows; ++row)
+		for(int column = 0; column < columns; ++column)
+			result[((row + rows / 2) % rows) * columns + (column + columns / 2) % columns] 
+				= values[row * columns + column];
+	return result;
+}
+
+template <typename R>
+static std::vector<Complex> valuesOf(const Frame *frame, int rows, int columns)
+{
+	std::vector<Complex> values;
+	if(!frame || !frame->isComplex())
+		return values;
+
+	Frame::Data<const R> data = frame->data<R>();
+	if(data.hSize != columns || data.vSize != rows)
+		return values;
+
+	for(int row = 0; row < rows; ++row)
+		for(int column = 0; column < columns; ++column)
+		{
+			int64_t index = row * data.vStep + column * data.hStep;
+			values.push_back(Complex(data.real[2 * index], data.real[2 * index + 1]));
+		}
+	return values;
+}
+
+static bool matches(const std::vector<Complex> &actual, 
+	const std::vector<Complex> &expected, double tolerance)
+{
+	if(actual.size() != expected.size())
+		return false;
+
+	double norm = 1;
+	for(const Complex &value : expected)
+		norm = std::max(norm, std::abs(value));
+	for(size_t iii = 0; iii < actual.size(); ++iii)
+	{
+		if(std::abs(actual[iii] - expected[iii]) > tolerance * norm)
+			return false;
+	}
+	return true;
+}
+
+static void checkSize(int rows, int columns)
+{
+	int64_t size = (int64_t) rows * columns;
+	std::vector<Complex> input(size);
+	double *real = new double[size];
+	float *realFloat = new float[size];
+	float *imaginaryFloat = new float[size];
+	float *interleaved = new float[2 * size];
+	for(int64_t iii = 0; iii < size; ++iii)
+	{
+		real[iii] = std::sin(0.7 * iii) + 0.25 * (iii % 3);
+		realFloat[iii] = (float) real[iii];
+		imaginaryFloat[iii] = (float) std::cos(1.3 * iii);
+		interleaved[2 * iii] = realFloat[iii];
+		interleaved[2 * iii + 1] = imaginaryFloat[iii];
+		input[iii] = Complex(real[iii], 0);
+	}
+
+	std::vector<Complex> complexInput(size);
+	for(int64_t iii = 0; iii < size; ++iii)
+		complexInput[iii] = Complex(realFloat[iii], imaginaryFloat[iii]);
+
+	// Real Float64, transformed in double precision
+	Frame realFrame(real, NULL, 1, columns, columns, rows, DataTypeFloat64);
+	std::vector<Complex> expected = dft(input, rows, columns, -1);
+	const bool shifts[] = {false, true};
+	for(bool shift : shifts)
+	{
+		std::unique_ptr<Frame> spectrum(FourierTransform::transform(&realFrame, shift));
+		CHECK(spectrum && spectrum->dataType() == DataTypeComplex128);
+		CHECK(matches(valuesOf<double>(spectrum.get(), rows, columns), 
+			shift ? shifted(expected, rows, columns) : expected, 1e-9));
+
+		std::unique_ptr<Frame> back(FourierTransform::inverse(spectrum.get()));
+		CHECK(matches(valuesOf<double>(back.get(), rows, columns), input, 1e-9));
+	}
+
+	// Float32 with a separate imaginary part, and the same values 
+	//	interleaved, transformed in single precision
+	Frame splitFrame(realFloat, imaginaryFloat, 1, columns, columns, rows, 
+		DataTypeFloat32);
+	Frame complexFrame(interleaved, NULL, 1, columns, columns, rows, 
+		DataTypeComplex64);
+	expected = dft(complexInput, rows, columns, -1);
+	for(bool shift : shifts)
+	{
+		std::unique_ptr<Frame> split(FourierTransform::transform(&splitFrame, shift));
+		std::unique_ptr<Frame> complex(FourierTransform::transform(&complexFrame, shift));
+		CHECK(split && split->dataType() == DataTypeComplex64);
+		std::vector<Complex> reference = shift ? shifted(expected, rows, columns) 
+			: expected;
+		CHECK(matches(valuesOf<float>(split.get(), rows, columns), reference, 1e-5));
+		CHECK(matches(valuesOf<float>(complex.get(), rows, columns), reference, 1e-5));
+
+		std::unique_ptr<Frame> back(FourierTransform::inverse(complex.get()));
+		CHECK(matches(valuesOf<float>(back.get(), rows, columns), complexInput, 1e-5));
+	}
+
+	// The inverse of data that is not a transform
+	std::unique_ptr<Frame> inverse(FourierTransform::inverse(&complexFrame));
+	std::vector<Complex> inverseExpected = dft(complexInput, rows, columns, 1);
+	for(Complex &value : inverseExpected)
+		value /= (double) size;
+	CHECK(matches(valuesOf<float>(inverse.get(), rows, columns), inverseExpected, 1e-5));
+
+	// A stack, one frame per thread, as one at a time
+	FrameList frames;
+	frames.push_back(&realFrame);
+	frames.push_back(&complexFrame);
+	FrameList spectra = FourierTransform::transform(frames, true);
+	CHECK(spectra.size() == 2);
+	if(spectra.size() == 2)
+	{
+		std::unique_ptr<Frame> single(FourierTransform::transform(&complexFrame, true));
+		CHECK(matches(valuesOf<double>(spectra[0], rows, columns), 
+			shifted(dft(input, rows, columns, -1), rows, columns), 1e-9));
+		CHECK(matches(valuesOf<float>(spectra[1], rows, columns), 
+			valuesOf<float>(single.get(), rows, columns), 1e-6));
+	}
+	for(Frame *spectrum : spectra)
+		delete spectrum;
+}
+
+int main()
+{
+	const int sizes[][2] = {{8, 4}, {4, 8}, {6, 5}, {5, 6}, {7, 9}, {9, 7}, 
+		{1, 3}, {3, 1}, {1, 1}};
+	for(const int *size : sizes)
+		checkSize(size[0], size[1]);
+
+	FourierTransform::clearPlans();
+	checkSize(7, 9);
+
+	return testResult();
+}
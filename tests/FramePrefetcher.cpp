@@ -0,0 +1,271 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Scrubs through a 4D dataset that is not loaded, in both data orders
+//	and with a complex dim, and compares every prefetched frame with the
+//	frame of the same data in memory. Counts hits and misses while
+//	scrubbing one way, and checks that the lookahead stops at the ends
+//	of the dim rather than filling the cache beyond them.
+
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "AsyncLoad.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "Frame.h"
+#include "FramePrefetcher.h"
+#include "Model.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+// Slowest first in the file; dim 1 may be the complex dim
+const int RANK = 4;
+const int DIMS[RANK] = {12, 2, 5, 4};
+const int64_t VALUES = 12 * 2 * 5 * 4;
+
+static uint16_t value(int64_t index)
+{
+	return (uint16_t) (index * 7 + 3);
+}
+
+static void writeAttribute(H5::H5Object &object, const char *name, int32_t value)
+{
+	object.createAttribute(name, H5::PredType::NATIVE_INT32, H5::DataSpace())
+		.write(H5::PredType::NATIVE_INT32, &value);
+}
+
+// A data group as Model reads it, with default dim vectors
+static void writeGroup(H5::H5File &file, const char *name, bool descending, 
+	bool complex)
+{
+	QByteArray path = QString("/data/%1").arg(name).toLocal8Bit();
+	H5::Group group = file.createGroup(path.constData());
+	writeAttribute(group, "emd_group_type", 1);
+	writeAttribute(group, "data_order", descending ? 1 : 0);
+
+	hsize_t dims[RANK];
+	for(int iii = 0; iii < RANK; ++iii)
+		dims[iii] = DIMS[iii];
+	std::vector<uint16_t> values(VALUES);
+	for(int64_t iii = 0; iii < VALUES; ++iii)
+		values[iii] = value(iii);
+	group.createDataSet("data", H5::PredType::NATIVE_UINT16, H5::DataSpace(RANK, dims))
+		.write(values.data(), H5::PredType::NATIVE_UINT16);
+
+	for(int iii = 0; iii < RANK; ++iii)
+	{
+		std::vector<int32_t> vector(DIMS[iii]);
+		for(int jjj = 0; jjj < DIMS[iii]; ++jjj)
+			vector[jjj] = jjj + 1;
+		QByteArray dimName = QString("dim%1").arg(iii + 1).toLocal8Bit();
+		H5::DataSet dim = group.createDataSet(dimName.constData(), 
+			H5::PredType::NATIVE_INT32, H5::DataSpace(1, &dims[iii]));
+		dim.write(vector.data(), H5::PredType::NATIVE_INT32);
+		if(complex && iii == 1)
+		{
+			H5::StrType type(H5::PredType::C_S1, 7);
+			dim.createAttribute("name", type, H5::DataSpace()).write(type, "complex");
+		}
+	}
+}
+
+// Returns once the reads queued so far have been made
+static void waitForReads()
+{
+	std::shared_ptr<std::promise<void> > done = std::make_shared<std::promise<void> >();
+	std::future<void> result = done->get_future();
+	queueIoJob([done](bool) {done->set_value();});
+	result.wait();
+}
+
+static bool sameFrames(const emd::Frame *actual, const emd::Frame *expected)
+{
+	if(!actual || !expected)
+		return false;
+
+	emd::Frame::Data<const uint16_t> a = actual->data<uint16_t>();
+	emd::Frame::Data<const uint16_t> e = expected->data<uint16_t>();
+	if(a.hSize != e.hSize || a.vSize != e.vSize 
+		|| !a.imaginary != !e.imaginary)
+		return false;
+
+	for(int vvv = 0; vvv < e.vSize; ++vvv)
+		for(int hhh = 0; hhh < e.hSize; ++hhh)
+		{
+			if(a.real[hhh * a.hStep + vvv * a.vStep] 
+				!= e.real[hhh * e.hStep + vvv * e.vStep])
+				return false;
+			if(e.imaginary && a.imaginary[hhh * a.hStep + vvv * a.vStep] 
+				!= e.imaginary[hhh * e.hStep + vvv * e.vStep])
+				return false;
+		}
+	return true;
+}
+
+// The frames along dim 0 in descending order, where it is the slowest,
+//	or along dim 3 in ascending order, in both directions
+static void checkFrames(const DataGroup *group, const std::string &path, 
+	bool descending, bool complex)
+{
+	const Dataset *data = group->data();
+	CHECK(!data->isLoaded());
+	CHECK(data->dataOrder() == descending);
+	CHECK(data->complexIndex() == (complex ? 1 : -1));
+
+	char *values = new char[VALUES * sizeof(uint16_t)];
+	for(int64_t iii = 0; iii < VALUES; ++iii)
+		((uint16_t*) values)[iii] = value(iii);
+	Dataset reference(RANK, DIMS, DataTypeUInt16, values, descending);
+	reference.setComplexIndex(complex ? 1 : -1);
+
+	int axis = descending ? 0 : 3;
+	Dataset::Slice slice(RANK, 1);
+	slice[2] = Dataset::VerticalDimension;
+	slice[descending ? 3 : 0] = Dataset::HorizontalDimension;
+	int length = DIMS[axis];
+
+	FramePrefetcher prefetcher(data, QString(path.c_str()), 16, 4);
+	for(int step = 0; step < 2 * length; ++step)
+	{
+		slice[axis] = step < length ? step : 2 * length - 1 - step;
+		std::unique_ptr<emd::Frame> frame(prefetcher.frame(slice));
+		std::unique_ptr<emd::Frame> expected(reference.frame(slice));
+		CHECK(expected && expected->isComplex() == complex);
+		CHECK(sameFrames(frame.get(), expected.get()));
+	}
+	waitForReads();
+}
+
+static DataGroup *findGroup(Model &model, const QString &name)
+{
+	for(int iii = 0; iii < model.dataGroupCount(); ++iii)
+	{
+		if(model.dataGroupAtIndex(iii)->name() == name)
+			return model.dataGroupAtIndex(iii);
+	}
+	return 0;
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_frameprefetcher.emd");
+	remove(path.c_str());
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		file.createGroup("/data");
+		writeGroup(file, "descending", true, false);
+		writeGroup(file, "descending_complex", true, true);
+		writeGroup(file, "ascending", false, false);
+		writeGroup(file, "ascending_complex", false, true);
+	}
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	model.unloadDataGroups();
+	const char *names[] = {"descending", "descending_complex", "ascending", 
+		"ascending_complex"};
+	for(int iii = 0; iii < 4; ++iii)
+	{
+		DataGroup *group = findGroup(model, names[iii]);
+		CHECK(group != 0);
+		if(group)
+			checkFrames(group, path, iii < 2, iii % 2 == 1);
+	}
+
+	DataGroup *group = findGroup(model, "descending");
+	if(!group)
+		return testResult();
+	const Dataset *data = group->data();
+
+	// Scrubbing forward one frame at a time: the first two requests give
+	//	the velocity, and the rest have been read ahead
+	Dataset::Slice slice(RANK, 0);
+	slice[2] = Dataset::VerticalDimension;
+	slice[3] = Dataset::HorizontalDimension;
+	{
+		FramePrefetcher prefetcher(data, QString(path.c_str()), 16, 4);
+		for(int frame = 0; frame < DIMS[0]; ++frame)
+		{
+			slice[0] = frame;
+			std::unique_ptr<emd::Frame> read(prefetcher.frame(slice));
+			CHECK(read.get() != 0);
+			waitForReads();
+		}
+		CHECK(prefetcher.misses() == 2);
+		CHECK(prefetcher.hits() == DIMS[0] - 2);
+
+		// Going back again is a hit while the frames are cached, and 
+		//	clearing the cache makes it a miss
+		slice[0] = 5;
+		std::unique_ptr<emd::Frame> read(prefetcher.frame(slice));
+		CHECK(prefetcher.hits() == DIMS[0] - 1);
+		prefetcher.clear();
+		waitForReads();
+		slice[0] = 6;
+		read.reset(prefetcher.frame(slice));
+		CHECK(prefetcher.misses() == 3);
+		waitForReads();
+	}
+
+	// Backwards to the start of the dim, with room for four frames: the
+	//	lookahead from 2 reads 1 and 0 and stops, so 3 is still cached
+	//	when it is asked for again. Reads past 0 would have evicted it.
+	{
+		FramePrefetcher prefetcher(data, QString(path.c_str()), 4, 4);
+		const int frames[] = {3, 2, 1, 0, 3};
+		for(int frame : frames)
+		{
+			slice[0] = frame;
+			std::unique_ptr<emd::Frame> read(prefetcher.frame(slice));
+			CHECK(read.get() != 0);
+			waitForReads();
+		}
+		CHECK(prefetcher.misses() == 2);
+		CHECK(prefetcher.hits() == 3);
+	}
+
+	// And forwards to the end
+	{
+		FramePrefetcher prefetcher(data, QString(path.c_str()), 4, 4);
+		const int frames[] = {8, 9, 10, 11, 8};
+		for(int frame : frames)
+		{
+			slice[0] = frame;
+			std::unique_ptr<emd::Frame> read(prefetcher.frame(slice));
+			CHECK(read.get() != 0);
+			waitForReads();
+		}
+		CHECK(prefetcher.misses() == 2);
+		CHECK(prefetcher.hits() == 3);
+	}
+
+	remove(path.c_str());
+	return testResult();
+}
@@ -0,0 +1,102 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Pushes the same frame in several layouts: each must come out of the
+//	ring as hSize rows of vSize values.
+
+#include <stdint.h>
+#include <vector>
+
+#include "FrameRing.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int H_SIZE = 40;
+const int V_SIZE = 24;
+
+static uint32_t value(int hhh, int vvv)
+{
+	return (uint32_t) (hhh * 1000 + vvv);
+}
+
+static void checkFrame(FrameRing &ring, const Frame::Data<void> &frame)
+{
+	CHECK(ring.push(frame));
+	std::vector<uint32_t> popped(H_SIZE * V_SIZE);
+	CHECK(ring.pop(popped.data()));
+	for(int hhh = 0; hhh < H_SIZE; ++hhh)
+	{
+		for(int vvv = 0; vvv < V_SIZE; ++vvv)
+		{
+			if(popped[hhh * V_SIZE + vvv] != value(hhh, vvv))
+			{
+				CHECK(popped[hhh * V_SIZE + vvv] == value(hhh, vvv));
+				return;
+			}
+		}
+	}
+}
+
+int main()
+{
+	FrameRing ring(H_SIZE, V_SIZE, DataTypeUInt32, 4);
+	CHECK(ring.isValid());
+
+	// Packed, vertical fastest
+	std::vector<uint32_t> packed(H_SIZE * V_SIZE);
+	for(int hhh = 0; hhh < H_SIZE; ++hhh)
+		for(int vvv = 0; vvv < V_SIZE; ++vvv)
+			packed[hhh * V_SIZE + vvv] = value(hhh, vvv);
+	checkFrame(ring, Frame::Data<void>(0, V_SIZE, 1, H_SIZE, V_SIZE, 
+		packed.data(), 0));
+
+	// Padded rows
+	const int pitch = V_SIZE + 5;
+	std::vector<uint32_t> padded(H_SIZE * pitch, 0);
+	for(int hhh = 0; hhh < H_SIZE; ++hhh)
+		for(int vvv = 0; vvv < V_SIZE; ++vvv)
+			padded[hhh * pitch + vvv] = value(hhh, vvv);
+	checkFrame(ring, Frame::Data<void>(0, pitch, 1, H_SIZE, V_SIZE, 
+		padded.data(), 0));
+
+	// Horizontal fastest, as from the prefetcher's point selections
+	std::vector<uint32_t> transposed(H_SIZE * V_SIZE);
+	for(int hhh = 0; hhh < H_SIZE; ++hhh)
+		for(int vvv = 0; vvv < V_SIZE; ++vvv)
+			transposed[vvv * H_SIZE + hhh] = value(hhh, vvv);
+	checkFrame(ring, Frame::Data<void>(0, 1, H_SIZE, H_SIZE, V_SIZE, 
+		transposed.data(), 0));
+
+	// Every second value of a larger frame
+	std::vector<uint32_t> strided(H_SIZE * V_SIZE * 4, 0);
+	for(int hhh = 0; hhh < H_SIZE; ++hhh)
+		for(int vvv = 0; vvv < V_SIZE; ++vvv)
+			strided[hhh * 4 * V_SIZE + 2 * vvv] = value(hhh, vvv);
+	checkFrame(ring, Frame::Data<void>(0, 4 * V_SIZE, 2, H_SIZE, V_SIZE, 
+		strided.data(), 0));
+
+	// Frames of the wrong shape are refused
+	CHECK(!ring.push(Frame::Data<void>(0, 1, V_SIZE, V_SIZE, H_SIZE, 
+		transposed.data(), 0)));
+	CHECK(ring.framesPushed() == 4 && ring.framesPopped() == 4);
+
+	return testResult();
+}
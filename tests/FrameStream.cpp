@@ -0,0 +1,122 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Streams a group from the file in blocks of a few frames, in both data
+//	orders, and checks that each block holds whole frames within the 
+//	block size and that the blocks together are the loaded data.
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameStream.h"
+#include "FrameWriter.h"
+#include "Model.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int FRAMES = 6;
+const int ROWS = 5;
+const int COLUMNS = 40;
+const int64_t VALUES = FRAMES * ROWS * COLUMNS;
+
+static void checkStream(const Dataset *data, H5::H5File &file, 
+	const std::vector<uint16_t> &loaded, int64_t blockBytes)
+{
+	FrameStream stream(data, blockBytes);
+	CHECK(stream.isValid() && stream.open(&file));
+	int64_t frameBytes = stream.frameSize() * sizeof(uint16_t);
+	int64_t maxFrames = std::max<int64_t>(1, blockBytes / frameBytes);
+
+	std::vector<uint16_t> streamed;
+	const char *frames;
+	int64_t firstFrame, blockFrames;
+	int blocks = 0;
+	while(stream.next(frames, firstFrame, blockFrames))
+	{
+		CHECK(firstFrame * stream.frameSize() == (int64_t) streamed.size());
+		CHECK(blockFrames >= 1 && blockFrames <= maxFrames);
+		const uint16_t *values = (const uint16_t*) frames;
+		streamed.insert(streamed.end(), values, 
+			values + blockFrames * stream.frameSize());
+		++blocks;
+	}
+	CHECK(!stream.error());
+	CHECK(blocks == (stream.frameCount() + maxFrames - 1) / maxFrames);
+	CHECK(streamed == loaded);
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_framestream.emd");
+	remove(path.c_str());
+
+	std::vector<uint16_t> values(VALUES);
+	for(int64_t iii = 0; iii < VALUES; ++iii)
+		values[iii] = (uint16_t) (iii * 3 + 1);
+	{
+		FrameWriter writer;
+		CHECK(writer.open(QString(path.c_str()), "/data/frames", ROWS, 
+			COLUMNS, DataTypeUInt16));
+		CHECK(writer.append(values.data(), FRAMES));
+		CHECK(writer.close());
+	}
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	CHECK(model.dataGroupCount() == 1);
+	if(model.dataGroupCount() != 1)
+		return testResult();
+	DataGroup *group = model.dataGroupAtIndex(0);
+	CHECK(model.loadDataGroup(0) && group->isLoaded());
+	if(!group->isLoaded())
+		return testResult();
+	const char *raw = group->data()->rawData();
+	std::vector<uint16_t> loaded((const uint16_t*) raw, (const uint16_t*) raw + VALUES);
+	CHECK(loaded == values);
+	model.unloadDataGroups();
+	CHECK(!group->isLoaded());
+
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+
+	// Descending: 6 frames of 5 x 40, in rows of the slowest dim
+	checkStream(group->data(), file, loaded, ROWS * COLUMNS * 2 * 4);
+	checkStream(group->data(), file, loaded, 1);
+	checkStream(group->data(), file, loaded, VALUES * 2);
+
+	// Ascending: 40 frames of 5 x 6, in runs that do not line up with the
+	//	stored dims
+	group->setDataOrder(false);
+	checkStream(group->data(), file, loaded, FRAMES * ROWS * 2 * 7);
+	checkStream(group->data(), file, loaded, FRAMES * ROWS * 2 * 3 + 5);
+	checkStream(group->data(), file, loaded, 1);
+	checkStream(group->data(), file, loaded, VALUES * 2);
+
+	return testResult();
+}
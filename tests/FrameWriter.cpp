@@ -0,0 +1,103 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Opening a writer adds a group to an existing HDF5 file without 
+//	touching what is there, and fails on files of other formats, leaving
+//	them as they are.
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "FrameWriter.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int ROWS = 4;
+const int COLUMNS = 6;
+
+static bool writeFrames(const std::string &path, const char *group, uint16_t value)
+{
+	std::vector<uint16_t> frames(2 * ROWS * COLUMNS, value);
+	FrameWriter writer;
+	if(!writer.open(QString(path.c_str()), QString(group), ROWS, COLUMNS, 
+			DataTypeUInt16))
+		return false;
+	bool written = writer.append(frames.data(), 2);
+	return writer.close() && written;
+}
+
+static hsize_t frameCount(const std::string &path, const char *data)
+{
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+	hsize_t dims[3] = {0, 0, 0};
+	file.openDataSet(data).getSpace().getSimpleExtentDims(dims);
+	return dims[0];
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+
+	// A new file is created, and a second group added to it
+	std::string path = testPath("test_framewriter.emd");
+	remove(path.c_str());
+	CHECK(writeFrames(path, "/data/first", 1));
+	CHECK(writeFrames(path, "/data/second", 2));
+	try {
+		CHECK(frameCount(path, "/data/first/data") == 2);
+		CHECK(frameCount(path, "/data/second/data") == 2);
+	}
+	catch(H5::Exception &error) {
+		CHECK(!"the groups are in the file");
+	}
+	CHECK(!writeFrames(path, "/data/first", 3));
+	remove(path.c_str());
+
+	// Other files are not replaced
+	std::string textPath = testPath("test_framewriter.txt");
+	const char text[] = "not an HDF5 file";
+	FILE *file = fopen(textPath.c_str(), "wb");
+	CHECK(file != 0);
+	if(file)
+	{
+		fwrite(text, 1, sizeof(text), file);
+		fclose(file);
+	}
+	CHECK(!writeFrames(textPath, "/data/frames", 1));
+	char content[sizeof(text)] = {0};
+	file = fopen(textPath.c_str(), "rb");
+	CHECK(file != 0);
+	if(file)
+	{
+		CHECK(fread(content, 1, sizeof(text), file) == sizeof(text));
+		fclose(file);
+	}
+	CHECK(memcmp(content, text, sizeof(text)) == 0);
+	remove(textPath.c_str());
+
+	return testResult();
+}
@@ -0,0 +1,113 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// 16 bit float data through the kernels that dispatch on the data type:
+//	reductions, frame ranges, Fourier transforms and complex components
+//	must see the values, not their bits.
+
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include "Allocator.h"
+#include "Complex.h"
+#include "Dataset.h"
+#include "FourierTransform.h"
+#include "Frame.h"
+#include "Reduction.h"
+#include "Simd.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+int main()
+{
+	const int dims[2] = {8, 64};
+	const int count = dims[0] * dims[1];
+	const DataType types[2] = {DataTypeFloat16, DataTypeBFloat16};
+	for(DataType type : types)
+	{
+		uint16_t *values = (uint16_t*) allocateBuffer(count * sizeof(uint16_t));
+		for(int iii = 0; iii < count; ++iii)
+		{
+			float value = (float) (iii % dims[1]) - 10.0f;
+			values[iii] = (type == DataTypeFloat16) ? simd::floatToHalf(value) 
+				: simd::floatToBfloat16(value);
+		}
+		Dataset data(2, dims, type, (char*) values, AllocatedBuffer);
+
+		Dataset *sum = Reduction::reduce(&data, Reduction::OperationSum, 
+			std::vector<int>(1, 1));
+		CHECK(sum && sum->dataType() == DataTypeFloat64);
+		if(sum)
+		{
+			// Sum of -10 ... 53
+			const double *sums = (const double*) sum->rawData();
+			for(int row = 0; row < dims[0]; ++row)
+				CHECK(std::fabs(sums[row] - 1376.0) < 1e-6);
+		}
+		delete sum;
+
+		Dataset *minimum = Reduction::reduce(&data, Reduction::OperationMin, 
+			std::vector<int>(1, 1));
+		CHECK(minimum && minimum->dataType() == DataTypeFloat32);
+		if(minimum)
+			CHECK(((const float*) minimum->rawData())[0] == -10.0f);
+		delete minimum;
+
+		Frame frame(values, 0, 1, dims[1], dims[1], dims[0], type, false);
+		float low, high;
+		frame.getDataRange(low, high);
+		// The most extreme sampled values are left out
+		CHECK(low >= -10.0f && low < 0.0f);
+		CHECK(high > 40.0f && high <= 53.0f);
+
+		// Transformed as the same values in Float32
+		std::vector<float> floats(count);
+		for(int iii = 0; iii < count; ++iii)
+			floats[iii] = (float) (iii % dims[1]) - 10.0f;
+		Frame reference(floats.data(), 0, 1, dims[1], dims[1], dims[0], 
+			DataTypeFloat32, false);
+		Frame *transformed = FourierTransform::transform(&frame);
+		Frame *expected = FourierTransform::transform(&reference);
+		CHECK(transformed && transformed->dataType() == DataTypeComplex64);
+		if(transformed && expected)
+		{
+			const float *result = transformed->data<float>().real;
+			const float *values = expected->data<float>().real;
+			for(int iii = 0; iii < 2 * count; ++iii)
+				CHECK(std::fabs(result[iii] - values[iii]) < 1e-3f * (1.0f + std::fabs(values[iii])));
+		}
+		delete transformed;
+		delete expected;
+
+		Frame *magnitude = complexFrame(&frame, ComplexMagnitude);
+		CHECK(magnitude && magnitude->dataType() == DataTypeFloat32);
+		if(magnitude)
+		{
+			const float *result = magnitude->data<float>().real;
+			for(int iii = 0; iii < count; ++iii)
+				CHECK(result[iii] == std::fabs(floats[iii]));
+		}
+		delete magnitude;
+	}
+
+	return testResult();
+}
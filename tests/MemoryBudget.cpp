@@ -0,0 +1,160 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Checks the model's memory budget: the least recently used groups are
+//	unloaded first, groups with unsaved changes are kept, and memoryUsage
+//	adds up the groups that are loaded.
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "DataGroup.h"
+#include "FrameWriter.h"
+#include "Model.h"
+#include "Node.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int GROUPS = 4;
+const int FRAMES = 16;
+const int ROWS = 32;
+const int COLUMNS = 32;
+
+static bool writeGroup(const std::string &path, int group)
+{
+	std::vector<uint16_t> frames((size_t) FRAMES * ROWS * COLUMNS, 
+		(uint16_t) group);
+
+	FrameWriter writer;
+	QString groupPath = QString("/data/group%1").arg(group);
+	if(!writer.open(QString(path.c_str()), groupPath, ROWS, COLUMNS, DataTypeUInt16))
+		return false;
+	bool written = writer.append(frames.data(), FRAMES);
+	return writer.close() && written;
+}
+
+// Which groups are loaded, one bit per group
+static int loaded(Model &model)
+{
+	int mask = 0;
+	for(int group = 0; group < GROUPS; ++group)
+	{
+		if(model.dataGroupAtIndex(group)->isLoaded())
+			mask |= 1 << group;
+	}
+	return mask;
+}
+
+// The dim vectors stay when a group is unloaded
+static int64_t footprint(Model &model)
+{
+	int64_t bytes = 0;
+	for(int group = 0; group < GROUPS; ++group)
+		bytes += model.dataGroupAtIndex(group)->memoryFootprint();
+	return bytes;
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_memorybudget.emd");
+	remove(path.c_str());
+	for(int group = 0; group < GROUPS; ++group)
+		CHECK(writeGroup(path, group));
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	CHECK(model.dataGroupCount() == GROUPS);
+	if(model.dataGroupCount() != GROUPS)
+		return testResult();
+	model.unloadDataGroups();
+	CHECK(loaded(model) == 0);
+	CHECK(model.memoryUsage() == 0);
+
+	// No budget: everything stays
+	for(int group = 0; group < GROUPS; ++group)
+		CHECK(model.loadDataGroup(group));
+	CHECK(loaded(model) == 0xf);
+	CHECK(model.memoryUsage() == footprint(model));
+
+	// Unloading leaves the dim vectors
+	model.unloadDataGroups();
+	int64_t dimBytes = model.dataGroupAtIndex(0)->memoryFootprint();
+	for(int group = 0; group < GROUPS; ++group)
+		CHECK(model.loadDataGroup(group));
+	int64_t dataBytes = model.dataGroupAtIndex(0)->memoryFootprint() - dimBytes;
+	CHECK(dataBytes == (int64_t) FRAMES * ROWS * COLUMNS * 2);
+	auto usage = [=](int groups) {return GROUPS * dimBytes + groups * dataBytes;};
+	CHECK(model.memoryUsage() == usage(GROUPS));
+
+	// Room for two groups and a half; shrinking the budget unloads the 
+	//	least recently used groups, 0 and 1
+	model.setMemoryBudget(usage(2) + dataBytes / 2);
+	CHECK(loaded(model) == 0xc);
+	CHECK(model.memoryUsage() == usage(2));
+
+	// 2 is used after 3, so 3 makes room for 0
+	model.touchDataGroup(model.dataGroupAtIndex(2));
+	CHECK(model.loadDataGroup(0));
+	CHECK(loaded(model) == 0x5);
+	CHECK(model.memoryUsage() == footprint(model));
+
+	// Loading a loaded group only marks it used: 2 goes for 1
+	CHECK(model.loadDataGroup(0));
+	CHECK(loaded(model) == 0x5);
+	CHECK(model.loadDataGroup(1));
+	CHECK(loaded(model) == 0x3);
+
+	// 0 is the least recently used but has unsaved changes, so 1 goes
+	model.dataGroupAtIndex(0)->setStatus(emd::Node::DIRTY);
+	CHECK(model.dataGroupAtIndex(0)->isDirty());
+	CHECK(model.loadDataGroup(3));
+	CHECK(loaded(model) == 0x9);
+	CHECK(model.memoryUsage() == usage(2));
+
+	// With room for half a group, only the dirty group is left
+	model.setMemoryBudget(usage(1) - dataBytes / 2);
+	CHECK(loaded(model) == 0x1);
+	CHECK(model.memoryUsage() == usage(1));
+	CHECK(model.memoryUsage() == footprint(model));
+
+	// The group being loaded is kept even when it does not fit
+	CHECK(model.loadDataGroup(2));
+	CHECK(loaded(model) == 0x5);
+	CHECK(model.memoryUsage() == usage(2));
+
+	// Lifting the budget unloads nothing more
+	model.setMemoryBudget(0);
+	CHECK(model.memoryBudget() == 0);
+	CHECK(model.loadDataGroup(1));
+	CHECK(model.loadDataGroup(3));
+	CHECK(loaded(model) == 0xf);
+	CHECK(model.memoryUsage() == usage(GROUPS));
+
+	model.dataGroupAtIndex(0)->removeStatus(emd::Node::DIRTY);
+	remove(path.c_str());
+	return testResult();
+}
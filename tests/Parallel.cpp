@@ -0,0 +1,180 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Runs parallelFor alone, nested and from several threads at once, with
+//	different thread counts, and checks that every index is visited 
+//	exactly once and that exceptions reach the caller.
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "Parallel.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+// Sum of [0, count)
+static int64_t triangle(int64_t count)
+{
+	return count * (count - 1) / 2;
+}
+
+static void checkCovered(int64_t length, int64_t grain)
+{
+	std::vector<int> visits(length, 0);
+	parallelFor(0, length, grain, [&visits](int64_t begin, int64_t end)
+	{
+		for(int64_t iii = begin; iii < end; ++iii)
+			++visits[iii];
+	});
+
+	int wrong = 0;
+	for(int64_t iii = 0; iii < length; ++iii)
+		wrong += (visits[iii] != 1);
+	CHECK(wrong == 0);
+}
+
+// Outer ranges each run an inner parallelFor
+static int64_t nestedTotal(int64_t outer, int64_t inner)
+{
+	std::atomic<int64_t> total(0);
+	parallelFor(0, outer, 1, [&total, inner](int64_t begin, int64_t end)
+	{
+		for(int64_t iii = begin; iii < end; ++iii)
+		{
+			parallelFor(0, inner, 16, [&total](int64_t first, int64_t last)
+			{
+				int64_t sum = 0;
+				for(int64_t jjj = first; jjj < last; ++jjj)
+					sum += jjj;
+				total.fetch_add(sum);
+			});
+		}
+	});
+	return total.load();
+}
+
+int main()
+{
+	// Thread count
+	setThreadCount(3);
+	CHECK(threadCount() == 3);
+	setThreadCount(0);
+	CHECK(threadCount() >= 1);
+	setThreadCount(-2);
+	CHECK(threadCount() >= 1);
+
+	// Every index once, for counts that do and don't divide evenly, and
+	//	with more threads than the machine has
+	const int counts[] = {1, 2, 3, 8};
+	for(int count : counts)
+	{
+		setThreadCount(count);
+		checkCovered(1, 1);
+		checkCovered(7, 1);
+		checkCovered(1000, 1);
+		checkCovered(1001, 64);
+		checkCovered(100000, 1000);
+	}
+
+	// No more threads than the count, even though more workers were 
+	//	started above
+	setThreadCount(3);
+	{
+		std::mutex mutex;
+		std::set<std::thread::id> threads;
+		parallelFor(0, 3, 1, [&mutex, &threads](int64_t, int64_t)
+		{
+			parallelFor(0, 3, 1, [&mutex, &threads](int64_t, int64_t)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				std::lock_guard<std::mutex> lock(mutex);
+				threads.insert(std::this_thread::get_id());
+			});
+		});
+		CHECK(!threads.empty() && threads.size() <= 3);
+	}
+
+	// Nested
+	setThreadCount(4);
+	CHECK(nestedTotal(16, 1000) == 16 * triangle(1000));
+
+	// Nested, from several threads at once, with the count shrinking 
+	//	and growing in between
+	const int CALLERS = 4;
+	const int ROUNDS = 20;
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> callers;
+	for(int caller = 0; caller < CALLERS; ++caller)
+	{
+		callers.push_back(std::thread([&wrong, caller]()
+		{
+			for(int round = 0; round < ROUNDS; ++round)
+			{
+				int64_t inner = 500 + 37 * caller + round;
+				if(nestedTotal(8, inner) != 8 * triangle(inner))
+					++wrong;
+			}
+		}));
+	}
+	for(int round = 0; round < ROUNDS; ++round)
+	{
+		setThreadCount(round % 2 ? 2 : 8);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	for(std::thread &caller : callers)
+		caller.join();
+	CHECK(wrong.load() == 0);
+
+	// An exception from a queued range and from the caller's range: all
+	//	other ranges still run, and the caller gets it
+	setThreadCount(4);
+	const int64_t throwAt[] = {0, 999};
+	for(int64_t bad : throwAt)
+	{
+		std::atomic<int64_t> done(0);
+		bool caught = false;
+		try {
+			parallelFor(0, 1000, 1, [&done, bad](int64_t begin, int64_t end)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				done.fetch_add(end - begin);
+				if(begin <= bad && bad < end)
+					throw std::runtime_error("range failed");
+			});
+		}
+		catch(const std::runtime_error &) {
+			caught = true;
+		}
+		CHECK(caught);
+		CHECK(done.load() == 1000);
+	}
+
+	// The pool still works afterwards
+	checkCovered(100000, 100);
+
+	return testResult();
+}
@@ -0,0 +1,197 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Loads groups coarse first: checks how many passes are made when the
+//	stride reaches the longest dim, what every pass holds, that the 
+//	callback can stop the load, and that the load is refused while the
+//	group is loaded asynchronously.
+
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "AsyncLoad.h"
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameWriter.h"
+#include "Model.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int ROWS = 8;
+const int COLUMNS = 12;
+
+static uint16_t value(int64_t index)
+{
+	return (uint16_t) (index * 5 + 1);
+}
+
+static bool writeGroup(const std::string &path, const QString &name, int frames)
+{
+	std::vector<uint16_t> values((size_t) frames * ROWS * COLUMNS);
+	for(size_t iii = 0; iii < values.size(); ++iii)
+		values[iii] = value(iii);
+
+	FrameWriter writer;
+	if(!writer.open(QString(path.c_str()), "/data/" + name, ROWS, COLUMNS, DataTypeUInt16))
+		return false;
+	bool written = writer.append(values.data(), frames);
+	return writer.close() && written;
+}
+
+static int groupIndex(Model &model, const QString &name)
+{
+	for(int iii = 0; iii < model.dataGroupCount(); ++iii)
+	{
+		if(model.dataGroupAtIndex(iii)->name() == name)
+			return iii;
+	}
+	return -1;
+}
+
+// Every stride-th value along each dim, with the dim vectors to match
+static bool holdsStrided(const DataGroup *group, int frames, int stride)
+{
+	const int lengths[3] = {frames, ROWS, COLUMNS};
+	const Dataset *data = group->data();
+	if(!group->isLoaded() || data->dataType() != DataTypeUInt16 
+		|| data->dimCount() != 3)
+		return false;
+	for(int iii = 0; iii < 3; ++iii)
+	{
+		int length = (lengths[iii] + stride - 1) / stride;
+		if(data->dimLength(iii) != length || group->dimData(iii)->dimLength(0) != length)
+			return false;
+	}
+
+	const uint16_t *values = (const uint16_t*) data->rawData();
+	int64_t index = 0;
+	for(int frame = 0; frame < frames; frame += stride)
+		for(int row = 0; row < ROWS; row += stride)
+			for(int column = 0; column < COLUMNS; column += stride)
+			{
+				if(values[index++] != value(((int64_t) frame * ROWS + row) * COLUMNS + column))
+					return false;
+			}
+	return true;
+}
+
+struct Pass
+{
+	int pass;
+	int passCount;
+	bool holds;
+};
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_progressiveload.emd");
+	remove(path.c_str());
+	// The longest dims are 16, which a stride of 16 reaches, and 20
+	CHECK(writeGroup(path, "sixteen", 16));
+	CHECK(writeGroup(path, "twenty", 20));
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	int sixteen = groupIndex(model, "sixteen");
+	int twenty = groupIndex(model, "twenty");
+	CHECK(sixteen >= 0 && twenty >= 0);
+	if(sixteen < 0 || twenty < 0)
+		return testResult();
+	model.unloadDataGroups();
+
+	// Strides 16, 4 and 1; more passes are not useful
+	std::vector<Pass> passes;
+	auto record = [&passes](int frames)
+	{
+		return [&passes, frames](DataGroup *group, int pass, int passCount)
+		{
+			int stride = 1 << (2 * (passCount - 1 - pass));
+			Pass record = {pass, passCount, holdsStrided(group, frames, stride)};
+			passes.push_back(record);
+			return true;
+		};
+	};
+	CHECK(model.loadDataGroupProgressive(twenty, record(20), 5));
+	CHECK(passes.size() == 3);
+	for(size_t iii = 0; iii < passes.size(); ++iii)
+	{
+		CHECK(passes[iii].pass == (int) iii && passes[iii].passCount == 3);
+		CHECK(passes[iii].holds);
+	}
+	CHECK(holdsStrided(model.dataGroupAtIndex(twenty), 20, 1));
+
+	// A stride of 16 would leave one frame, row and column, so only 
+	//	strides 4 and 1 are read
+	passes.clear();
+	CHECK(model.loadDataGroupProgressive(sixteen, record(16), 3));
+	CHECK(passes.size() == 2);
+	for(size_t iii = 0; iii < passes.size(); ++iii)
+	{
+		CHECK(passes[iii].pass == (int) iii && passes[iii].passCount == 2);
+		CHECK(passes[iii].holds);
+	}
+
+	// Fewer passes than are useful
+	passes.clear();
+	CHECK(model.loadDataGroupProgressive(twenty, record(20), 2));
+	CHECK(passes.size() == 2 && passes[0].passCount == 2);
+	CHECK(passes.size() == 2 && passes[0].holds && passes[1].holds);
+	passes.clear();
+	CHECK(model.loadDataGroupProgressive(twenty, record(20), 0));
+	CHECK(passes.size() == 1 && passes[0].passCount == 1 && passes[0].holds);
+
+	// Stopped after the first pass, the coarse data stays
+	int calls = 0;
+	CHECK(model.loadDataGroupProgressive(twenty, 
+		[&calls](DataGroup *, int, int) {++calls; return false;}));
+	CHECK(calls == 1);
+	CHECK(holdsStrided(model.dataGroupAtIndex(twenty), 20, 16));
+
+	// Refused while the group waits on the I/O thread, which is held up
+	//	until then
+	std::shared_ptr<std::promise<void> > release = std::make_shared<std::promise<void> >();
+	std::shared_future<void> released = release->get_future().share();
+	queueIoJob([released](bool) {released.wait();});
+	LoadHandle handle = model.loadDataGroupAsync(sixteen);
+	calls = 0;
+	CHECK(!model.loadDataGroupProgressive(sixteen, 
+		[&calls](DataGroup *, int, int) {++calls; return true;}));
+	CHECK(calls == 0);
+	release->set_value();
+	handle.wait();
+	CHECK(holdsStrided(model.dataGroupAtIndex(sixteen), 16, 1));
+
+	// And allowed again once it has finished
+	passes.clear();
+	CHECK(model.loadDataGroupProgressive(sixteen, record(16)));
+	CHECK(passes.size() == 2);
+
+	remove(path.c_str());
+	return testResult();
+}
@@ -0,0 +1,167 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Reads a compressed cube through helper processes, in pieces small
+//	enough that every helper decodes several, and compares the values
+//	with the same reads made in this process (a pool that is not 
+//	started) and with the values written.
+
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Dataset.h"
+#include "ReaderPool.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const hsize_t FRAMES = 20;
+const hsize_t ROWS = 12;
+const hsize_t COLUMNS = 14;
+
+static uint16_t value(int64_t frame, int64_t row, int64_t column)
+{
+	return (uint16_t) ((frame * ROWS + row) * COLUMNS + column);
+}
+
+static Dataset::Selection select(int frames, int frameEnd, int rows, 
+	int rowEnd, int columns, int columnEnd)
+{
+	Dataset::Selection selection(3);
+	selection[0].start = frames;
+	selection[0].end = frameEnd;
+	selection[1].start = rows;
+	selection[1].end = rowEnd;
+	selection[2].start = columns;
+	selection[2].end = columnEnd;
+	return selection;
+}
+
+template <typename T>
+static void checkRead(ReaderPool &pool, ReaderPool &here, 
+	const Dataset::Selection &selection, DataType type, 
+	const std::vector<int64_t> &strides, size_t size)
+{
+	std::vector<T> pooled(size, (T) -1);
+	std::vector<T> reference(size, (T) -1);
+	CHECK(pool.read("data", selection, pooled.data(), type, strides));
+	CHECK(here.read("data", selection, reference.data(), type, strides));
+	CHECK(pooled == reference);
+
+	std::vector<int64_t> step(strides);
+	if(step.empty())
+	{
+		step.push_back((selection[1].end - selection[1].start) 
+			* (selection[2].end - selection[2].start));
+		step.push_back(selection[2].end - selection[2].start);
+		step.push_back(1);
+	}
+
+	int wrong = 0;
+	for(int iii = selection[0].start; iii < selection[0].end; ++iii)
+		for(int jjj = selection[1].start; jjj < selection[1].end; ++jjj)
+			for(int kkk = selection[2].start; kkk < selection[2].end; ++kkk)
+			{
+				int64_t offset = (iii - selection[0].start) * step[0] 
+					+ (jjj - selection[1].start) * step[1] 
+					+ (kkk - selection[2].start) * step[2];
+				wrong += (pooled[offset] != (T) value(iii, jjj, kkk));
+			}
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_readerpool.emd");
+	{
+		std::vector<uint16_t> cube(FRAMES * ROWS * COLUMNS);
+		for(hsize_t iii = 0; iii < FRAMES; ++iii)
+			for(hsize_t jjj = 0; jjj < ROWS; ++jjj)
+				for(hsize_t kkk = 0; kkk < COLUMNS; ++kkk)
+					cube[(iii * ROWS + jjj) * COLUMNS + kkk] = value(iii, jjj, kkk);
+
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		hsize_t dims[3] = {FRAMES, ROWS, COLUMNS};
+		hsize_t chunk[3] = {3, ROWS, COLUMNS};
+		H5::DSetCreatPropList plist;
+		plist.setChunk(3, chunk);
+		plist.setDeflate(4);
+		H5::DataSpace space(3, dims);
+		file.createDataSet("data", H5::PredType::NATIVE_UINT16, space, plist)
+			.write(cube.data(), H5::PredType::NATIVE_UINT16);
+	}
+
+	// The smallest shared memory holds a few slices of a piece
+	QString filePath = QString::fromStdString(path);
+	ReaderPool pool(filePath, 3, 4096);
+	ReaderPool here(filePath);
+	CHECK(pool.timeout() == 30000);
+	pool.setTimeout(10000);
+	CHECK(pool.timeout() == 10000);
+	CHECK(pool.start());
+	CHECK(pool.processCount() == 3);
+	CHECK(here.processCount() == 0);
+
+	// Everything, as stored and packed
+	checkRead<uint16_t>(pool, here, select(0, FRAMES, 0, ROWS, 0, COLUMNS), 
+		DataTypeUnknown, std::vector<int64_t>(), FRAMES * ROWS * COLUMNS);
+
+	// Part of each frame, converted, into padded rows of a larger buffer
+	std::vector<int64_t> padded(3);
+	padded[0] = 64;
+	padded[1] = 8;
+	padded[2] = 1;
+	checkRead<float>(pool, here, select(1, 18, 2, 9, 3, 10), 
+		DataTypeFloat32, padded, 17 * 64);
+
+	// Converted and transposed: the frame dim fastest
+	std::vector<int64_t> transposed(3);
+	transposed[0] = 1;
+	transposed[1] = 5 * 16;
+	transposed[2] = 16;
+	checkRead<double>(pool, here, select(4, 20, 0, 5, 2, 7), 
+		DataTypeFloat64, transposed, 5 * 5 * 16);
+
+	// A single frame
+	checkRead<int32_t>(pool, here, select(7, 8, 0, ROWS, 0, COLUMNS), 
+		DataTypeInt32, std::vector<int64_t>(), ROWS * COLUMNS);
+
+	// Bad selections are refused by both
+	std::vector<uint16_t> buffer(FRAMES * ROWS * COLUMNS);
+	CHECK(!pool.read("data", select(0, FRAMES + 1, 0, ROWS, 0, COLUMNS), 
+		buffer.data()));
+	CHECK(!here.read("data", select(0, FRAMES + 1, 0, ROWS, 0, COLUMNS), 
+		buffer.data()));
+	CHECK(!pool.read("missing", select(0, 1, 0, 1, 0, 1), buffer.data()));
+	CHECK(pool.processCount() == 3);
+
+	// Stopped, the pool reads in this process
+	pool.stop();
+	CHECK(pool.processCount() == 0);
+	checkRead<uint16_t>(pool, here, select(2, 5, 0, ROWS, 0, COLUMNS), 
+		DataTypeUnknown, std::vector<int64_t>(), 3 * ROWS * COLUMNS);
+
+	return testResult();
+}
@@ -0,0 +1,378 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Reduces dense data in both data orders along several combinations of
+//	dims, and sparse data, and compares every output with a brute force
+//	reduction. Also checks that long sums keep their precision.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "Dataset.h"
+#include "Parallel.h"
+#include "Reduction.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+// Offset of an index in data of the given dims, C order when descending
+static int64_t offsetOf(const std::vector<int> &index, 
+	const std::vector<int> &dims, bool descending)
+{
+	int64_t offset = 0;
+	int rank = dims.size();
+	for(int iii = 0; iii < rank; ++iii)
+	{
+		int dim = descending ? iii : rank - 1 - iii;
+		offset = offset * dims[dim] + index[dim];
+	}
+	return offset;
+}
+
+static bool next(std::vector<int> &index, const std::vector<int> &dims)
+{
+	for(int iii = (int) dims.size() - 1; iii >= 0; --iii)
+	{
+		if(++index[iii] < dims[iii])
+			return true;
+		index[iii] = 0;
+	}
+	return false;
+}
+
+// The operation over the values of each output, in double precision
+static std::vector<double> bruteForce(const std::vector<double> &values, 
+	const std::vector<int> &dims, bool descending, 
+	const std::vector<bool> &reduced, Reduction::Operation operation)
+{
+	std::vector<int> outDims;
+	for(size_t iii = 0; iii < dims.size(); ++iii)
+	{
+		if(!reduced[iii])
+			outDims.push_back(dims[iii]);
+	}
+	if(outDims.empty())
+		outDims.push_back(1);
+
+	int64_t outCount = 1;
+	for(int length : outDims)
+		outCount *= length;
+	std::vector<std::vector<double> > groups(outCount);
+
+	std::vector<int> index(dims.size(), 0);
+	do {
+		std::vector<int> outIndex;
+		for(size_t iii = 0; iii < dims.size(); ++iii)
+		{
+			if(!reduced[iii])
+				outIndex.push_back(index[iii]);
+		}
+		if(outIndex.empty())
+			outIndex.push_back(0);
+		groups[offsetOf(outIndex, outDims, descending)].push_back(
+			values[offsetOf(index, dims, descending)]);
+	} while(next(index, dims));
+
+	std::vector<double> result(outCount);
+	for(int64_t out = 0; out < outCount; ++out)
+	{
+		const std::vector<double> &group = groups[out];
+		double sum = 0;
+		for(double value : group)
+			sum += value;
+		double mean = sum / group.size();
+		double squares = 0;
+		for(double value : group)
+			squares += (value - mean) * (value - mean);
+
+		switch(operation)
+		{
+		case Reduction::OperationSum:
+			result[out] = sum;
+			break;
+		case Reduction::OperationMean:
+			result[out] = mean;
+			break;
+		case Reduction::OperationMin:
+			result[out] = *std::min_element(group.begin(), group.end());
+			break;
+		case Reduction::OperationMax:
+			result[out] = *std::max_element(group.begin(), group.end());
+			break;
+		case Reduction::OperationVariance:
+			result[out] = squares / group.size();
+			break;
+		}
+	}
+	return result;
+}
+
+template <typename T>
+static std::vector<double> valuesOf(const Dataset *data, int64_t count)
+{
+	const T *values = (const T*) data->rawData();
+	return std::vector<double>(values, values + count);
+}
+
+static void checkDense(const std::vector<int> &dims, bool descending, 
+	const std::vector<int> &reduceDims)
+{
+	int64_t count = 1;
+	for(int length : dims)
+		count *= length;
+
+	int32_t *buffer = new int32_t[count];
+	std::vector<double> values(count);
+	uint32_t random = 12345;
+	for(int64_t iii = 0; iii < count; ++iii)
+	{
+		random = random * 1664525u + 1013904223u;
+		buffer[iii] = (int32_t) (random >> 20) - 2048;
+		values[iii] = buffer[iii];
+	}
+	Dataset data((int) dims.size(), dims.data(), DataTypeInt32, 
+		(char*) buffer, descending);
+
+	std::vector<bool> reduced(dims.size(), false);
+	for(int dim : reduceDims)
+		reduced[dim] = true;
+
+	const Reduction::Operation operations[] = {Reduction::OperationSum, 
+		Reduction::OperationMean, Reduction::OperationMin, 
+		Reduction::OperationMax, Reduction::OperationVariance};
+	for(Reduction::Operation operation : operations)
+	{
+		std::vector<double> expected = bruteForce(values, dims, descending, 
+			reduced, operation);
+		std::unique_ptr<Dataset> result(Reduction::reduce(&data, operation, 
+			reduceDims));
+		CHECK(result && result->dataOrder() == descending);
+		if(!result)
+			continue;
+
+		int outCount = 1;
+		for(int iii = 0; iii < result->dimCount(); ++iii)
+			outCount *= result->dimLength(iii);
+		CHECK(outCount == (int) expected.size());
+		if(outCount != (int) expected.size())
+			continue;
+
+		std::vector<double> actual;
+		if(operation == Reduction::OperationMin || operation == Reduction::OperationMax)
+		{
+			CHECK(result->dataType() == DataTypeInt32);
+			actual = valuesOf<int32_t>(result.get(), outCount);
+		}
+		else
+		{
+			CHECK(result->dataType() == DataTypeFloat64);
+			actual = valuesOf<double>(result.get(), outCount);
+		}
+
+		int wrong = 0;
+		for(int out = 0; out < outCount; ++out)
+		{
+			double tolerance = 1e-9 * std::max(1.0, std::fabs(expected[out]));
+			wrong += !(std::fabs(actual[out] - expected[out]) <= tolerance);
+		}
+		CHECK(wrong == 0);
+	}
+}
+
+// Events of frame f (of FRAME_SIZE pixels) at pixels f % 7, f % 5 + 9 
+//	and every pixel above 20 whose index divides f + 1
+static void checkSparse()
+{
+	const int scan[2] = {3, 4};
+	const int frame[2] = {5, 6};
+	const int frameSize = 30;
+	std::vector<int> dims;
+	dims.push_back(scan[0]);
+	dims.push_back(scan[1]);
+	dims.push_back(frame[0]);
+	dims.push_back(frame[1]);
+
+	std::vector<uint64_t> offsets(1, 0);
+	std::vector<uint32_t> events;
+	std::vector<double> dense(scan[0] * scan[1] * frameSize, 0);
+	for(int fff = 0; fff < scan[0] * scan[1]; ++fff)
+	{
+		std::vector<uint32_t> pixels;
+		pixels.push_back(fff % 7);
+		pixels.push_back(fff % 5 + 9);
+		for(int pixel = 21; pixel < frameSize; ++pixel)
+		{
+			if((fff + 1) % pixel == 0)
+				pixels.push_back(pixel);
+		}
+
+		for(uint32_t pixel : pixels)
+		{
+			events.push_back(pixel);
+			dense[fff * frameSize + pixel] += 1;
+		}
+		offsets.push_back(events.size());
+	}
+	Dataset data(2, scan, frame, offsets, events);
+
+	std::vector<std::vector<int> > combinations(5);
+	combinations[0].push_back(0);
+	combinations[0].push_back(1);
+	combinations[1].push_back(2);
+	combinations[1].push_back(3);
+	combinations[2].push_back(0);
+	combinations[3].push_back(1);
+	combinations[3].push_back(3);
+	for(int dim = 0; dim < 4; ++dim)
+		combinations[4].push_back(dim);
+
+	const Reduction::Operation operations[] = {Reduction::OperationSum, 
+		Reduction::OperationMean};
+	for(const std::vector<int> &reduceDims : combinations)
+	{
+		std::vector<bool> reduced(4, false);
+		for(int dim : reduceDims)
+			reduced[dim] = true;
+
+		for(Reduction::Operation operation : operations)
+		{
+			std::vector<double> expected = bruteForce(dense, dims, true, 
+				reduced, operation);
+			std::unique_ptr<Dataset> result(Reduction::reduce(&data, 
+				operation, reduceDims));
+			CHECK(result && result->dataType() == DataTypeFloat64);
+			if(!result)
+				continue;
+
+			std::vector<double> actual = valuesOf<double>(result.get(), 
+				expected.size());
+			int wrong = 0;
+			for(size_t out = 0; out < expected.size(); ++out)
+				wrong += !(std::fabs(actual[out] - expected[out]) <= 1e-12);
+			CHECK(wrong == 0);
+		}
+	}
+
+	// Only sums and means
+	CHECK(!Reduction::reduce(&data, Reduction::OperationMax, combinations[0]));
+}
+
+// 0.1 is not exact, so each addition rounds; the reduced sums must stay
+//	within a few roundings of the exact sum, where adding in order drifts
+//	by thousands
+static void checkPrecision()
+{
+	const int ROWS = 1 << 21;
+	const int dims[2] = {ROWS, 2};
+	double *buffer = new double[2 * ROWS];
+	for(int iii = 0; iii < 2 * ROWS; ++iii)
+		buffer[iii] = 0.1;
+	Dataset data(2, dims, DataTypeFloat64, (char*) buffer);
+
+	// The exact sum of ROWS copies of the double nearest 0.1
+	long double exact = (long double) ROWS * (long double) 0.1;
+	double tolerance = 1e-9;
+
+	// Along the contiguous run (pairwise), and across runs, two 
+	//	outputs at a time (compensated)
+	std::vector<int> all;
+	all.push_back(0);
+	all.push_back(1);
+	std::unique_ptr<Dataset> total(Reduction::reduce(&data, 
+		Reduction::OperationSum, all));
+	CHECK(total && std::fabs(((const double*) total->rawData())[0] 
+		- (double) (2 * exact)) <= tolerance);
+
+	std::unique_ptr<Dataset> columns(Reduction::reduce(&data, 
+		Reduction::OperationSum, std::vector<int>(1, 0)));
+	CHECK(columns && columns->dimLength(0) == 2);
+	if(columns)
+	{
+		const double *sums = (const double*) columns->rawData();
+		CHECK(std::fabs(sums[0] - (double) exact) <= tolerance);
+		CHECK(std::fabs(sums[1] - (double) exact) <= tolerance);
+	}
+
+	// Adding in order is far off
+	double naive = 0;
+	for(int iii = 0; iii < ROWS; ++iii)
+		naive += 0.1;
+	CHECK(std::fabs(naive - (double) exact) > 1000 * tolerance);
+}
+
+int main()
+{
+	std::vector<int> dims;
+	dims.push_back(3);
+	dims.push_back(4);
+	dims.push_back(5);
+	dims.push_back(6);
+
+	std::vector<std::vector<int> > combinations;
+	combinations.push_back(std::vector<int>());
+	for(int dim = 0; dim < 4; ++dim)
+		combinations.push_back(std::vector<int>(1, dim));
+	const int pairs[][2] = {{0, 1}, {2, 3}, {0, 2}, {1, 3}, {0, 3}, {3, 0}};
+	for(const int *pair : pairs)
+		combinations.push_back(std::vector<int>(pair, pair + 2));
+	const int triples[][3] = {{0, 1, 2}, {1, 2, 3}, {0, 1, 3}};
+	for(const int *triple : triples)
+		combinations.push_back(std::vector<int>(triple, triple + 3));
+	std::vector<int> all;
+	for(int dim = 0; dim < 4; ++dim)
+		all.push_back(dim);
+	combinations.push_back(all);
+
+	// On one thread and on several, where partial results are merged
+	const int threads[] = {1, 4};
+	for(int count : threads)
+	{
+		setThreadCount(count);
+		for(const std::vector<int> &reduceDims : combinations)
+		{
+			checkDense(dims, true, reduceDims);
+			checkDense(dims, false, reduceDims);
+		}
+
+		// Long enough to be split along the merged fastest dim
+		std::vector<int> line(1, 300000);
+		checkDense(line, true, std::vector<int>(1, 0));
+		std::vector<int> wide;
+		wide.push_back(2);
+		wide.push_back(150000);
+		checkDense(wide, false, std::vector<int>(1, 1));
+		checkDense(wide, true, std::vector<int>(1, 0));
+
+		checkSparse();
+		checkPrecision();
+	}
+
+	// Bad dims
+	int32_t *buffer = new int32_t[12]();
+	const int small[2] = {3, 4};
+	Dataset data(2, small, DataTypeInt32, (char*) buffer);
+	CHECK(!Reduction::reduce(&data, Reduction::OperationSum, std::vector<int>(1, 2)));
+	CHECK(!Reduction::reduce(&data, Reduction::OperationSum, std::vector<int>(1, -1)));
+
+	return testResult();
+}
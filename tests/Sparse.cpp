@@ -0,0 +1,182 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Saves sparse event data, reads it back and densifies frames of it: a
+//	diffraction pattern of one scan position and the real space image
+//	of one detector pixel. Saving over stored data writes the changes,
+//	and data that cannot be written stays marked as unsaved.
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Allocator.h"
+#include "Dataset.h"
+#include "Frame.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int SCAN_DIMS[2] = {3, 2};
+const int FRAME_DIMS[2] = {4, 5};
+const uint32_t PIXEL = 16;
+
+int main()
+{
+	H5::Exception::dontPrint();
+
+	// Frame f has two events at pixel f and one at PIXEL; frame 2 is 
+	//	empty and frame 5 has a second event at PIXEL.
+	const int frameCount = SCAN_DIMS[0] * SCAN_DIMS[1];
+	std::vector<uint64_t> offsets(1, 0);
+	std::vector<uint32_t> events;
+	for(int frame = 0; frame < frameCount; ++frame)
+	{
+		if(frame != 2)
+		{
+			events.push_back(frame);
+			events.push_back(frame);
+			events.push_back(PIXEL);
+		}
+		if(frame == 5)
+			events.push_back(PIXEL);
+		offsets.push_back(events.size());
+	}
+
+	Dataset source(2, SCAN_DIMS, FRAME_DIMS, offsets, events);
+	source.setName("events");
+	std::string path = testPath("test_sparse.emd");
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		source.save(QString(""), &file);
+	}
+
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+	H5::DataSet dataSet = file.openDataSet("events");
+	Dataset loaded;
+	loaded.initSparse(dataSet);
+	loaded.loadData(dataSet);
+	CHECK(loaded.isSparse() && loaded.isLoaded());
+	CHECK(loaded.dimCount() == 4);
+	CHECK(loaded.sparseFrameCount() == frameCount);
+	CHECK(loaded.sparseFrameSize() == FRAME_DIMS[0] * FRAME_DIMS[1]);
+	for(int frame = 0; frame < loaded.sparseFrameCount(); ++frame)
+	{
+		int64_t count;
+		const uint32_t *frameEvents = loaded.sparseEvents(frame, count);
+		CHECK(count == (int64_t) (offsets[frame + 1] - offsets[frame]));
+		for(int64_t iii = 0; iii < count; ++iii)
+			CHECK(frameEvents[iii] == events[offsets[frame] + iii]);
+	}
+
+	// Diffraction pattern at scan position (2, 1), i.e. frame 5
+	Dataset::Slice slice(4);
+	slice[0] = 2;
+	slice[1] = 1;
+	slice[2] = Dataset::HorizontalDimension;
+	slice[3] = Dataset::VerticalDimension;
+	Frame *pattern = loaded.frame(slice);
+	CHECK(pattern != 0);
+	if(pattern)
+	{
+		Frame::Data<const uint32_t> data = pattern->data<uint32_t>();
+		CHECK(data.hSize == FRAME_DIMS[0] && data.vSize == FRAME_DIMS[1]);
+		for(int hhh = 0; hhh < data.hSize; ++hhh)
+		{
+			for(int vvv = 0; vvv < data.vSize; ++vvv)
+			{
+				uint32_t pixel = hhh * FRAME_DIMS[1] + vvv;
+				uint32_t expected = (pixel == 5) ? 2 : (pixel == PIXEL) ? 2 : 0;
+				CHECK(data.real[hhh * data.hStep + vvv * data.vStep] == expected);
+			}
+		}
+	}
+	delete pattern;
+
+	// Image of detector pixel PIXEL = (3, 1) over the scan
+	slice[0] = Dataset::HorizontalDimension;
+	slice[1] = Dataset::VerticalDimension;
+	slice[2] = PIXEL / FRAME_DIMS[1];
+	slice[3] = PIXEL % FRAME_DIMS[1];
+	Frame *image = loaded.frame(slice);
+	CHECK(image != 0);
+	if(image)
+	{
+		Frame::Data<const uint32_t> data = image->data<uint32_t>();
+		CHECK(data.hSize == SCAN_DIMS[0] && data.vSize == SCAN_DIMS[1]);
+		for(int hhh = 0; hhh < data.hSize; ++hhh)
+		{
+			for(int vvv = 0; vvv < data.vSize; ++vvv)
+			{
+				int frame = hhh * SCAN_DIMS[1] + vvv;
+				uint32_t expected = (frame == 2) ? 0 : (frame == 5) ? 2 : 1;
+				CHECK(data.real[hhh * data.hStep + vvv * data.vStep] == expected);
+			}
+		}
+	}
+	delete image;
+
+	std::string savePath = testPath("test_sparse_save.emd");
+	{
+		const int dims[2] = {4, 5};
+		uint16_t *values = (uint16_t*) allocateBuffer(20 * sizeof(uint16_t));
+		for(int iii = 0; iii < 20; ++iii)
+			values[iii] = (uint16_t) iii;
+		Dataset dense(2, dims, DataTypeUInt16, (char*) values, AllocatedBuffer);
+		dense.setName("dense");
+		H5::H5File saveFile(savePath.c_str(), H5F_ACC_TRUNC);
+		dense.save(QString(""), &saveFile);
+		source.save(QString(""), &saveFile);
+
+		((uint16_t*) dense.mutableData())[3] = 1000;
+		dense.setStatus(emd::Node::DIRTY);
+		dense.save(QString(""), &saveFile);
+		CHECK(!(dense.status() & emd::Node::DIRTY));
+		uint16_t stored[20] = {0};
+		saveFile.openDataSet("dense").read(stored, H5::PredType::NATIVE_UINT16);
+		CHECK(stored[3] == 1000);
+
+		// Another shape is not written over the stored data
+		const int otherDims[2] = {5, 4};
+		uint16_t *otherValues = (uint16_t*) allocateBuffer(20 * sizeof(uint16_t));
+		for(int iii = 0; iii < 20; ++iii)
+			otherValues[iii] = 7;
+		Dataset reshaped(2, otherDims, DataTypeUInt16, (char*) otherValues, 
+			AllocatedBuffer);
+		reshaped.setName("dense");
+		reshaped.setStatus(emd::Node::DIRTY);
+		reshaped.save(QString(""), &saveFile);
+		CHECK(reshaped.status() & emd::Node::DIRTY);
+		saveFile.openDataSet("dense").read(stored, H5::PredType::NATIVE_UINT16);
+		CHECK(stored[0] == 0 && stored[3] == 1000);
+
+		// Nor are changed events
+		source.setStatus(emd::Node::DIRTY);
+		source.save(QString(""), &saveFile);
+		CHECK(source.status() & emd::Node::DIRTY);
+	}
+	remove(savePath.c_str());
+
+	return testResult();
+}
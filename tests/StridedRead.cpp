@@ -0,0 +1,104 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Reads selections into strided buffers. The one dim case spans more
+//	than one conversion block, so each block must land after the last.
+
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include "Dataset.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_stridedread.emd");
+	const hsize_t length = 9 * 1024 * 1024;
+	const hsize_t dims[3] = {3, 4, 5};
+	{
+		H5::H5File file(path.c_str(), H5F_ACC_TRUNC);
+		std::vector<uint16_t> line(length);
+		for(hsize_t iii = 0; iii < length; ++iii)
+			line[iii] = (uint16_t) (iii % 65521);
+		H5::DataSpace lineSpace(1, &length);
+		file.createDataSet("line", H5::PredType::NATIVE_UINT16, lineSpace)
+			.write(line.data(), H5::PredType::NATIVE_UINT16);
+
+		std::vector<int32_t> cube(3 * 4 * 5);
+		for(size_t iii = 0; iii < cube.size(); ++iii)
+			cube[iii] = (int32_t) iii;
+		H5::DataSpace cubeSpace(3, dims);
+		file.createDataSet("cube", H5::PredType::NATIVE_INT32, cubeSpace)
+			.write(cube.data(), H5::PredType::NATIVE_INT32);
+	}
+
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+	Dataset reader;
+
+	// Every second value of the destination, as stored
+	Dataset::Selection lineSelection(1);
+	lineSelection[0].start = 10;
+	lineSelection[0].end = (int) length - 10;
+	hsize_t count = length - 20;
+	std::vector<uint16_t> line(2 * count, 0xffff);
+	CHECK(reader.read(file.openDataSet("line"), lineSelection, line.data(), 
+		DataTypeUnknown, std::vector<int64_t>(1, 2)));
+	for(hsize_t iii = 0; iii < count; ++iii)
+	{
+		if(line[2 * iii] != (uint16_t) ((iii + 10) % 65521) 
+			|| line[2 * iii + 1] != 0xffff)
+		{
+			CHECK(line[2 * iii] == (uint16_t) ((iii + 10) % 65521));
+			CHECK(line[2 * iii + 1] == 0xffff);
+			break;
+		}
+	}
+
+	// Frames padded in a larger buffer, converted
+	Dataset::Selection cubeSelection(3);
+	cubeSelection[0].start = 1;
+	cubeSelection[0].end = 3;
+	cubeSelection[1].start = 0;
+	cubeSelection[1].end = 4;
+	cubeSelection[2].start = 1;
+	cubeSelection[2].end = 4;
+	std::vector<int64_t> strides(3);
+	strides[0] = 48;
+	strides[1] = 12;
+	strides[2] = 2;
+	std::vector<float> cube(2 * 48, -1);
+	CHECK(reader.read(file.openDataSet("cube"), cubeSelection, cube.data(), 
+		DataTypeFloat32, strides));
+	for(int iii = 0; iii < 2; ++iii)
+		for(int jjj = 0; jjj < 4; ++jjj)
+			for(int kkk = 0; kkk < 3; ++kkk)
+			{
+				int64_t offset = iii * 48 + jjj * 12 + kkk * 2;
+				CHECK(cube[offset] == (float) (((iii + 1) * 4 + jjj) * 5 + kkk + 1));
+				CHECK(cube[offset + 1] == -1);
+			}
+
+	return testResult();
+}
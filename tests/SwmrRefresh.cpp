@@ -0,0 +1,188 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Two processes: a child writes frames in SWMR mode while the parent 
+//	polls refresh on data loaded with conversion and strides. Every 
+//	refresh must keep the load options and give the same values as a 
+//	full load would.
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "Dataset.h"
+#include "FrameWriter.h"
+#include "TestUtil.h"
+
+using namespace emd;
+
+const int ROWS = 16;
+const int COLUMNS = 16;
+const int FRAMES = 300;
+
+static uint16_t value(int frame, int index)
+{
+	return (uint16_t) (frame * 7 + index);
+}
+
+static int writeFrames(const std::string &path, int ready)
+{
+	FrameWriter writer;
+	if(!writer.open(QString(path.c_str()), QString("/data/live"), ROWS, COLUMNS, 
+		DataTypeUInt16, true))
+		return 2;
+	char signal = 1;
+	if(write(ready, &signal, 1) != 1)
+		return 2;
+
+	std::vector<uint16_t> frame(ROWS * COLUMNS);
+	for(int iii = 0; iii < FRAMES; ++iii)
+	{
+		for(int jjj = 0; jjj < ROWS * COLUMNS; ++jjj)
+			frame[jjj] = value(iii, jjj);
+		writer.append(frame.data());
+		if(iii % 25 == 24)
+		{
+			writer.flush();
+			usleep(20000);
+		}
+	}
+	return writer.close() ? 0 : 3;
+}
+
+// Scaled to Float32
+static void checkConverted(const Dataset &dataset)
+{
+	CHECK(dataset.dataType() == DataTypeFloat32);
+	CHECK(dataset.loadOptions().scale == 2);
+	if(dataset.dataType() != DataTypeFloat32)
+		return;
+
+	const float *values = (const float*) dataset.rawData();
+	for(int iii = 0; iii < dataset.dimLength(0); ++iii)
+	{
+		for(int jjj = 0; jjj < ROWS * COLUMNS; ++jjj)
+		{
+			if(values[iii * ROWS * COLUMNS + jjj] != 2.0f * value(iii, jjj))
+			{
+				CHECK(values[iii * ROWS * COLUMNS + jjj] == 2.0f * value(iii, jjj));
+				return;
+			}
+		}
+	}
+}
+
+// Every second frame and column, of at least the given frames (the
+//	writer may have flushed more since they were counted)
+static void checkDecimated(const Dataset &dataset, int frames)
+{
+	CHECK(dataset.dataType() == DataTypeUInt16);
+	CHECK(dataset.dimLength(0) >= (frames + 1) / 2);
+	CHECK(dataset.dimLength(1) == ROWS && dataset.dimLength(2) == COLUMNS / 2);
+	if(dataset.dataType() != DataTypeUInt16)
+		return;
+
+	const uint16_t *values = (const uint16_t*) dataset.rawData();
+	for(int iii = 0; iii < dataset.dimLength(0); ++iii)
+	{
+		for(int jjj = 0; jjj < ROWS * COLUMNS / 2; ++jjj)
+		{
+			uint16_t expected = value(2 * iii, 2 * jjj);
+			if(values[iii * ROWS * COLUMNS / 2 + jjj] != expected)
+			{
+				CHECK(values[iii * ROWS * COLUMNS / 2 + jjj] == expected);
+				return;
+			}
+		}
+	}
+}
+
+int main()
+{
+	std::string path = testPath("test_swmrrefresh.emd");
+	remove(path.c_str());
+	int ready[2];
+	if(pipe(ready) != 0)
+		return 1;
+
+	// Before HDF5 is used here, so that the writer starts clean
+	pid_t writer = fork();
+	if(writer == 0)
+	{
+		close(ready[0]);
+		_exit(writeFrames(path, ready[1]));
+	}
+	close(ready[1]);
+	char signal;
+	if(read(ready[0], &signal, 1) != 1)
+	{
+		fprintf(stderr, "writer failed to start\n");
+		waitpid(writer, 0, 0);
+		return 1;
+	}
+
+	H5::Exception::dontPrint();
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ);
+	H5::DataSet dataSet = file.openDataSet("/data/live/data");
+
+	Dataset::LoadOptions options;
+	options.type = DataTypeFloat32;
+	options.scale = 2;
+	Dataset converted;
+	converted.loadData(dataSet, options);
+
+	Dataset::LoadOptions strided;
+	strided.strides.push_back(2);
+	strided.strides.push_back(1);
+	strided.strides.push_back(2);
+	Dataset decimated;
+	decimated.loadData(dataSet, strided);
+
+	int refreshes = 0;
+	int status = 0;
+	while(true)
+	{
+		bool finished = (waitpid(writer, &status, WNOHANG) == writer);
+		if(converted.refresh(dataSet))
+		{
+			++refreshes;
+			checkConverted(converted);
+		}
+		if(decimated.refresh(dataSet))
+			checkDecimated(decimated, converted.dimLength(0));
+		if(finished)
+			break;
+		usleep(5000);
+	}
+
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	CHECK(refreshes > 0);
+	CHECK(converted.dimLength(0) == FRAMES);
+	checkConverted(converted);
+	CHECK(decimated.dimLength(0) == (FRAMES + 1) / 2);
+	checkDecimated(decimated, FRAMES);
+	remove(path.c_str());
+
+	return testResult();
+}
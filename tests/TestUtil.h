@@ -0,0 +1,57 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef EMD_TESTUTIL_H
+#define EMD_TESTUTIL_H
+
+// Minimal checks for the test programs: each failed check is printed
+//	and counted, and main returns testResult() so that ctest sees the
+//	failures.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static int s_testFailures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if(!(condition)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++s_testFailures; \
+		} \
+	} while(0)
+
+// A file name in the directory given by EMDLIB_TEST_DIR (or /tmp)
+inline std::string testPath(const char *name)
+{
+	const char *directory = getenv("EMDLIB_TEST_DIR");
+	return std::string(directory ? directory : "/tmp") + "/" + name;
+}
+
+inline int testResult()
+{
+	if(s_testFailures)
+		fprintf(stderr, "%d check(s) failed\n", s_testFailures);
+	return s_testFailures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * emdlib, a library for reading and writing electron microscopy dataset 
+ * (emd) files.
+ * Copyright (C) 2015  Phil Ophus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Integrates dense frames, loaded and streamed from the file in both data
+//	orders, and sparse event lists against two masks, and compares every
+//	pixel of the images with the dot product of its frame and the mask.
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "H5Cpp.h"
+
+#include <QString>
+
+#include "DataGroup.h"
+#include "Dataset.h"
+#include "FrameWriter.h"
+#include "Model.h"
+#include "TestUtil.h"
+#include "VirtualDetector.h"
+
+using namespace emd;
+
+const int FRAMES = 48;
+const int ROWS = 12;
+const int COLUMNS = 10;
+
+static std::vector<float> weights(int64_t size)
+{
+	std::vector<float> mask(size);
+	uint32_t random = 4321;
+	for(int64_t iii = 0; iii < size; ++iii)
+	{
+		random = random * 1664525u + 1013904223u;
+		mask[iii] = (float) (random >> 24) / 64.0f - 1.0f;
+	}
+	return mask;
+}
+
+static bool matches(float actual, double expected)
+{
+	return std::fabs(actual - expected) <= 1e-4 * std::max(1.0, std::fabs(expected));
+}
+
+// Frames are consecutive runs of the values in either data order
+static void checkImages(VirtualDetector &detector, 
+	const std::vector<uint16_t> &values, bool descending)
+{
+	int64_t frameSize = (int64_t) detector.frameRows() * detector.frameColumns();
+	int64_t frameCount = values.size() / frameSize;
+	for(int mask = 0; mask < detector.maskCount(); ++mask)
+	{
+		std::unique_ptr<Dataset> image(detector.createImage(mask));
+		CHECK(image && image->dataType() == DataTypeFloat32);
+		CHECK(image && image->dataOrder() == descending);
+		if(!image)
+			continue;
+
+		std::vector<float> weights = mask == 0 ? std::vector<float>() 
+			: ::weights(frameSize);
+		const float *pixels = (const float*) image->rawData();
+		int wrong = 0;
+		for(int64_t frame = 0; frame < frameCount; ++frame)
+		{
+			double expected = 0;
+			for(int64_t pixel = 0; pixel < frameSize; ++pixel)
+			{
+				int row = pixel / detector.frameColumns();
+				int column = pixel % detector.frameColumns();
+				double weight = mask == 0 
+					? ((row - 4) * (row - 4) + (column - 3) * (column - 3) <= 9 ? 1 : 0)
+					: weights[pixel];
+				expected += weight * values[frame * frameSize + pixel];
+			}
+			wrong += !matches(pixels[frame], expected);
+		}
+		CHECK(wrong == 0);
+	}
+}
+
+static void addMasks(VirtualDetector &detector)
+{
+	CHECK(detector.addAnnularMask(4, 3, 0, 3) == 0);
+	CHECK(detector.addMask(weights((int64_t) detector.frameRows() 
+		* detector.frameColumns())) == 1);
+	CHECK(detector.addMask(std::vector<float>(3, 1.0f)) == -1);
+}
+
+static void checkSparse()
+{
+	const int scan[2] = {6, 7};
+	const int frame[2] = {ROWS, COLUMNS};
+	const int frameSize = ROWS * COLUMNS;
+	std::vector<uint64_t> offsets(1, 0);
+	std::vector<uint32_t> events;
+	std::vector<uint16_t> dense((size_t) scan[0] * scan[1] * frameSize, 0);
+	for(int fff = 0; fff < scan[0] * scan[1]; ++fff)
+	{
+		for(int event = 0; event < fff % 9; ++event)
+		{
+			uint32_t pixel = (uint32_t) ((fff * 37 + event * 53) % frameSize);
+			events.push_back(pixel);
+			++dense[(size_t) fff * frameSize + pixel];
+		}
+		offsets.push_back(events.size());
+	}
+
+	DataGroup group;
+	group.setData(new Dataset(2, scan, frame, offsets, events));
+	VirtualDetector detector(&group);
+	CHECK(detector.frameRows() == ROWS && detector.frameColumns() == COLUMNS);
+	addMasks(detector);
+	CHECK(detector.run());
+	checkImages(detector, dense, true);
+}
+
+int main()
+{
+	H5::Exception::dontPrint();
+	std::string path = testPath("test_virtualdetector.emd");
+	remove(path.c_str());
+
+	std::vector<uint16_t> values((size_t) FRAMES * ROWS * COLUMNS);
+	for(size_t iii = 0; iii < values.size(); ++iii)
+		values[iii] = (uint16_t) ((iii * 7919) % 1000);
+	{
+		FrameWriter writer;
+		CHECK(writer.open(QString(path.c_str()), "/data/frames", ROWS, 
+			COLUMNS, DataTypeUInt16));
+		CHECK(writer.append(values.data(), FRAMES));
+		CHECK(writer.close());
+	}
+
+	Model model;
+	CHECK(model.open(QString(path.c_str())));
+	CHECK(model.dataGroupCount() == 1);
+	if(model.dataGroupCount() != 1)
+		return testResult();
+	DataGroup *group = model.dataGroupAtIndex(0);
+	H5::H5File file(path.c_str(), H5F_ACC_RDONLY);
+
+	// Descending: 48 frames of 12 x 10, loaded and then from the file
+	CHECK(model.loadDataGroup(0));
+	{
+		VirtualDetector detector(group);
+		CHECK(detector.frameRows() == ROWS && detector.frameColumns() == COLUMNS);
+		addMasks(detector);
+		CHECK(detector.run());
+		checkImages(detector, values, true);
+
+		model.unloadDataGroups();
+		CHECK(!detector.run());
+		CHECK(detector.run(&file));
+		checkImages(detector, values, true);
+	}
+
+	// Ascending: 10 frames of 12 x 48
+	group->setDataOrder(false);
+	{
+		VirtualDetector detector(group);
+		CHECK(detector.frameRows() == ROWS && detector.frameColumns() == FRAMES);
+		addMasks(detector);
+		CHECK(detector.run(&file));
+		checkImages(detector, values, false);
+
+		CHECK(model.loadDataGroup(0));
+		group->setDataOrder(false);
+		CHECK(detector.run());
+		checkImages(detector, values, false);
+	}
+
+	checkSparse();
+
+	return testResult();
+}